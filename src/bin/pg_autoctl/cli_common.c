@@ -34,6 +34,7 @@
 KeeperConfig keeperOptions;
 bool allowRemovingPgdata = false;
 bool createAndRun = false;
+bool fastInit = false;
 bool outputJSON = false;
 int ssl_flag = 0;
 
@@ -68,8 +69,10 @@ static void stop_postgres_and_remove_pgdata_and_config(
  *		{ "help", no_argument, NULL, 'h' },
  *		{ "candidate-priority", required_argument, NULL, 'P'},
  *		{ "replication-quorum", required_argument, NULL, 'r'},
+ *		{ "zone", required_argument, NULL, 'z'},
  *		{ "help", no_argument, NULL, 0 },
  *		{ "run", no_argument, NULL, 'x' },
+ *		{ "fast", no_argument, NULL, 'F' },
  *      { "ssl-self-signed", no_argument, NULL, 's' },
  *      { "no-ssl", no_argument, NULL, 'N' },
  *      { "ssl-ca-file", required_argument, &ssl_flag, SSL_CA_FILE_FLAG },
@@ -312,6 +315,14 @@ cli_create_node_getopts(int argc, char **argv,
 				break;
 			}
 
+			case 'z':
+			{
+				/* { "zone", required_argument, NULL, 'z'} */
+				strlcpy(LocalOptionConfig.zone, optarg, NAMEDATALEN);
+				log_trace("--zone %s", LocalOptionConfig.zone);
+				break;
+			}
+
 			case 'V':
 			{
 				/* keeper_cli_print_version prints version and exits. */
@@ -360,6 +371,14 @@ cli_create_node_getopts(int argc, char **argv,
 				break;
 			}
 
+			case 'F':
+			{
+				/* { "fast", no_argument, NULL, 'F' }, */
+				fastInit = true;
+				log_trace("--fast");
+				break;
+			}
+
 			case 's':
 			{
 				/* { "ssl-self-signed", no_argument, NULL, 's' }, */
@@ -22,6 +22,7 @@ extern MonitorConfig monitorOptions;
 extern KeeperConfig keeperOptions;
 extern bool allowRemovingPgdata;
 extern bool createAndRun;
+extern bool fastInit;
 extern bool outputJSON;
 
 #define SSL_CA_FILE_FLAG    1	/* root public certificate */
@@ -112,10 +113,14 @@ extern CommandLine perform_switchover_command;
 extern CommandLine *perform_subcommands[];
 extern CommandLine perform_commands;
 
+/* cli_proxy.c */
+extern CommandLine proxy_command;
+
 /* cli_service.c */
 extern CommandLine service_run_command;
 extern CommandLine service_stop_command;
 extern CommandLine service_reload_command;
+extern CommandLine service_control_command;
 
 /* cli_show.c */
 extern CommandLine show_uri_command;
@@ -94,6 +94,8 @@ CommandLine create_postgres_command =
 		"  --skip-pg-hba     skip editing pg_hba.conf rules\n"
 		"  --candidate-priority    priority of the node to be promoted to become primary\n"
 		"  --replication-quorum    true if node participates in write quorum\n"
+		"  --zone            zone or rack where the node is running\n"
+		"  --fast            skip restarting Postgres when settings are in place\n"
 		KEEPER_CLI_SSL_OPTIONS
 		KEEPER_CLI_ALLOW_RM_PGDATA_OPTION,
 		cli_create_postgres_getopts,
@@ -266,7 +268,9 @@ cli_create_postgres_getopts(int argc, char **argv)
  		{ "help", no_argument, NULL, 'h' },
 		{ "candidate-priority", required_argument, NULL, 'P'},
 		{ "replication-quorum", required_argument, NULL, 'r'},
+		{ "zone", required_argument, NULL, 'z'},
 		{ "run", no_argument, NULL, 'x' },
+		{ "fast", no_argument, NULL, 'F' },
 		{ "help", no_argument, NULL, 0 },
 		{ "no-ssl", no_argument, NULL, 'N' },
 		{ "ssl-self-signed", no_argument, NULL, 's' },
@@ -280,7 +284,7 @@ cli_create_postgres_getopts(int argc, char **argv)
 
 	int optind =
 		cli_create_node_getopts(argc, argv, long_options,
-								"C:D:H:p:l:U:A:Sd:n:f:m:MRVvqhP:r:xsN",
+								"C:D:H:p:l:U:A:Sd:n:f:m:MRVvqhP:r:z:xsNF",
 								&options);
 
 	/* publish our option parsing in the global variable */
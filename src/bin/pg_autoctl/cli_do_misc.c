@@ -156,8 +156,8 @@ keeper_cli_create_monitor_user(int argc, char **argv)
 	bool missingPgdataOk = false;
 	bool postgresNotRunningOk = false;
 	int urlLength = 0;
-	char monitorHostname[_POSIX_HOST_NAME_MAX];
-	int monitorPort = 0;
+	NodeAddressArray monitorHosts = { 0 };
+	int hostIndex = 0;
 
 	/*
 	 * Monitor does not use a password, we expect it to login and immediately
@@ -177,22 +177,25 @@ keeper_cli_create_monitor_user(int argc, char **argv)
 		exit(EXIT_CODE_BAD_ARGS);
 	}
 
-	if (!hostname_from_uri(config.monitor_pguri,
-						   monitorHostname, _POSIX_HOST_NAME_MAX,
-						   &monitorPort))
+	if (!hostnames_from_uri(config.monitor_pguri, &monitorHosts))
 	{
 		log_fatal("Failed to determine monitor hostname");
 		exit(EXIT_CODE_BAD_ARGS);
 	}
 
-	if (!primary_create_user_with_hba(&postgres,
-									  PG_AUTOCTL_HEALTH_USERNAME, password,
-									  monitorHostname,
-									  pg_setup_get_auth_method(&(config.pgSetup))))
+	for (hostIndex = 0; hostIndex < monitorHosts.count; hostIndex++)
 	{
-		log_fatal("Failed to create the database user that the pg_auto_failover "
-				  " monitor uses for health checks, see above for details");
-		exit(EXIT_CODE_PGSQL);
+		if (!primary_create_user_with_hba(&postgres,
+										  PG_AUTOCTL_HEALTH_USERNAME, password,
+										  monitorHosts.nodes[hostIndex].host,
+										  pg_setup_get_auth_method(
+											  &(config.pgSetup))))
+		{
+			log_fatal("Failed to create the database user that the "
+					  "pg_auto_failover monitor uses for health checks, "
+					  "see above for details");
+			exit(EXIT_CODE_PGSQL);
+		}
 	}
 }
 
@@ -487,6 +487,7 @@ cli_do_monitor_node_active(int argc, char **argv)
 							 keeper.postgres.pgIsRunning,
 							 keeper.postgres.currentLSN,
 							 keeper.postgres.pgsrSyncState,
+							 &(keeper.postgres.standbys),
 							 &assignedState))
 	{
 		log_fatal("Failed to get the goal state from the node with the monitor, "
@@ -8,6 +8,8 @@
  *
  */
 
+#include <unistd.h>
+
 #include "cli_common.h"
 #include "commandline.h"
 #include "defaults.h"
@@ -17,10 +19,13 @@
 #include "keeper.h"
 #include "monitor.h"
 #include "monitor_config.h"
+#include "signals.h"
 #include "string_utils.h"
 
 static int cli_perform_failover_getopts(int argc, char **argv);
 static void cli_perform_failover(int argc, char **argv);
+static void cli_perform_switchover(int argc, char **argv);
+static void cli_perform_rolling_restart(int argc, char **argv);
 
 CommandLine perform_failover_command =
 	make_command("failover",
@@ -40,11 +45,21 @@ CommandLine perform_switchover_command =
 				 "  --formation   formation to target, defaults to 'default' \n" \
 				 "  --group       group to target, defaults to 0 \n",
 				 cli_perform_failover_getopts,
-				 cli_perform_failover);
+				 cli_perform_switchover);
+
+CommandLine perform_rolling_restart_command =
+	make_command("rolling-restart",
+				 "Restart every node of a formation, one node per group at a time",
+				 " [ --pgdata --formation ] ",
+				 "  --pgdata      path to data directory	 \n"		\
+				 "  --formation   formation to target, defaults to 'default' \n",
+				 cli_perform_failover_getopts,
+				 cli_perform_rolling_restart);
 
 CommandLine *perform_subcommands[] = {
 	&perform_failover_command,
 	&perform_switchover_command,
+	&perform_rolling_restart_command,
 	NULL,
 };
 
@@ -205,3 +220,88 @@ cli_perform_failover(int argc, char **argv)
 		exit(EXIT_CODE_MONITOR);
 	}
 }
+
+
+/*
+ * cli_perform_switchover calls the SQL function
+ * pgautofailover.perform_switchover() on the monitor.
+ */
+static void
+cli_perform_switchover(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+
+	if (!monitor_init_from_pgsetup(&monitor, &config.pgSetup))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	if (!monitor_perform_switchover(&monitor, config.formation, config.groupId))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_MONITOR);
+	}
+}
+
+
+/*
+ * cli_perform_rolling_restart calls the SQL function
+ * pgautofailover.perform_rolling_restart() on the monitor in a loop, until
+ * every node of the formation has been restarted. The monitor keeps track of
+ * the progress, so the command can be interrupted and run again.
+ */
+static void
+cli_perform_rolling_restart(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	Monitor monitor = { 0 };
+	int previousCount = -1;
+
+	if (!monitor_init_from_pgsetup(&monitor, &config.pgSetup))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	(void) set_signal_handlers();
+
+	while (true)
+	{
+		int remainingCount = 0;
+
+		if (!monitor_perform_rolling_restart(&monitor,
+											 config.formation,
+											 &remainingCount))
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_MONITOR);
+		}
+
+		if (remainingCount == 0)
+		{
+			log_info("Rolling restart of formation \"%s\" is done",
+					 config.formation);
+			break;
+		}
+
+		if (remainingCount != previousCount)
+		{
+			log_info("Rolling restart of formation \"%s\" in progress, "
+					 "%d node(s) left to restart",
+					 config.formation, remainingCount);
+			previousCount = remainingCount;
+		}
+
+		if (asked_to_stop || asked_to_stop_fast)
+		{
+			log_warn("Rolling restart of formation \"%s\" interrupted, "
+					 "run this command again to resume it",
+					 config.formation);
+			exit(EXIT_CODE_QUIT);
+		}
+
+		sleep(PG_AUTOCTL_KEEPER_SLEEP_TIME);
+	}
+}
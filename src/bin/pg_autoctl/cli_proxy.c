@@ -0,0 +1,262 @@
+/*
+ * src/bin/pg_autoctl/cli_proxy.c
+ *     Implementation of the pg_autoctl proxy CLI, which routes client
+ *     connections to the current primary node of a group.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include "cli_common.h"
+#include "commandline.h"
+#include "defaults.h"
+#include "env_utils.h"
+#include "proxy.h"
+#include "signals.h"
+#include "string_utils.h"
+
+static ProxyConfig proxyOptions = { 0 };
+static char proxyPgdata[MAXPGPATH] = { 0 };
+
+static int cli_proxy_getopts(int argc, char **argv);
+static void cli_proxy(int argc, char **argv);
+
+CommandLine proxy_command =
+	make_command("proxy",
+				 "Route client connections to the current primary node",
+				 " [ --pgdata | --monitor ] --port [ --readonly-port --listen "
+				 "--formation --group ] ",
+				 "  --pgdata        path to data directory\n"
+				 "  --monitor       pg_auto_failover Monitor Postgres URL\n"
+				 "  --listen        address to listen on, defaults to localhost\n"
+				 "  --port          port to listen on for the primary node\n"
+				 "  --readonly-port port to listen on for secondary nodes\n"
+				 "  --formation     formation to target, defaults to 'default'\n"
+				 "  --group         group to target, defaults to 0\n",
+				 cli_proxy_getopts,
+				 cli_proxy);
+
+
+/*
+ * cli_proxy_getopts parses the command line options for the command
+ * `pg_autoctl proxy`.
+ */
+static int
+cli_proxy_getopts(int argc, char **argv)
+{
+	ProxyConfig options = { 0 };
+	int c, option_index = 0, errors = 0;
+	int verboseCount = 0;
+
+	static struct option long_options[] = {
+		{ "pgdata", required_argument, NULL, 'D' },
+		{ "monitor", required_argument, NULL, 'm' },
+		{ "listen", required_argument, NULL, 'l' },
+		{ "port", required_argument, NULL, 'p' },
+		{ "readonly-port", required_argument, NULL, 'r' },
+		{ "formation", required_argument, NULL, 'f' },
+		{ "group", required_argument, NULL, 'g' },
+		{ "version", no_argument, NULL, 'V' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	/* set default values for our options, when we have some */
+	options.groupId = 0;
+	strlcpy(options.formation, FORMATION_DEFAULT, NAMEDATALEN);
+	strlcpy(options.listen, PROXY_LISTEN_ADDRESS, _POSIX_HOST_NAME_MAX);
+
+	optind = 0;
+
+	while ((c = getopt_long(argc, argv, "D:m:l:p:r:f:g:Vvqh",
+							long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'D':
+			{
+				strlcpy(proxyPgdata, optarg, MAXPGPATH);
+				log_trace("--pgdata %s", proxyPgdata);
+				break;
+			}
+
+			case 'm':
+			{
+				if (!validate_connection_string(optarg))
+				{
+					log_fatal("Failed to parse --monitor connection string, "
+							  "see above for details.");
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				strlcpy(options.monitor_pguri, optarg, MAXCONNINFO);
+				log_trace("--monitor %s", options.monitor_pguri);
+				break;
+			}
+
+			case 'l':
+			{
+				strlcpy(options.listen, optarg, _POSIX_HOST_NAME_MAX);
+				log_trace("--listen %s", options.listen);
+				break;
+			}
+
+			case 'p':
+			{
+				if (!stringToInt(optarg, &options.port) || options.port <= 0)
+				{
+					log_fatal("--port argument is not a valid port: \"%s\"",
+							  optarg);
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				log_trace("--port %d", options.port);
+				break;
+			}
+
+			case 'r':
+			{
+				if (!stringToInt(optarg, &options.readOnlyPort) ||
+					options.readOnlyPort <= 0)
+				{
+					log_fatal("--readonly-port argument is not a valid port: "
+							  "\"%s\"", optarg);
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				log_trace("--readonly-port %d", options.readOnlyPort);
+				break;
+			}
+
+			case 'f':
+			{
+				strlcpy(options.formation, optarg, NAMEDATALEN);
+				log_trace("--formation %s", options.formation);
+				break;
+			}
+
+			case 'g':
+			{
+				if (!stringToInt(optarg, &options.groupId))
+				{
+					log_fatal("--group argument is not a valid group ID: \"%s\"",
+							  optarg);
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+				log_trace("--group %d", options.groupId);
+				break;
+			}
+
+			case 'V':
+			{
+				/* keeper_cli_print_version prints version and exits. */
+				keeper_cli_print_version(argc, argv);
+				break;
+			}
+
+			case 'v':
+			{
+				++verboseCount;
+				switch (verboseCount)
+				{
+					case 1:
+						log_set_level(LOG_INFO);
+						break;
+
+					case 2:
+						log_set_level(LOG_DEBUG);
+						break;
+
+					default:
+						log_set_level(LOG_TRACE);
+						break;
+				}
+				break;
+			}
+
+			case 'q':
+			{
+				log_set_level(LOG_ERROR);
+				break;
+			}
+
+			case 'h':
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_QUIT);
+				break;
+			}
+
+			default:
+			{
+				/* getopt_long already wrote an error message */
+				errors++;
+			}
+		}
+	}
+
+	if (options.port == 0)
+	{
+		log_error("Please provide the --port to listen on");
+		errors++;
+	}
+
+	if (options.port > 0 && options.port == options.readOnlyPort)
+	{
+		log_error("Please use different values for --port and --readonly-port");
+		errors++;
+	}
+
+	if (errors > 0)
+	{
+		commandline_help(stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	/* without --monitor, find it from the local pg_autoctl setup */
+	if (IS_EMPTY_STRING_BUFFER(options.monitor_pguri) &&
+		IS_EMPTY_STRING_BUFFER(proxyPgdata))
+	{
+		get_env_pgdata_or_exit(proxyPgdata);
+	}
+
+	proxyOptions = options;
+
+	return optind;
+}
+
+
+/*
+ * cli_proxy runs the proxy service in the foreground until it's asked to
+ * stop.
+ */
+static void
+cli_proxy(int argc, char **argv)
+{
+	ProxyConfig config = proxyOptions;
+
+	if (IS_EMPTY_STRING_BUFFER(config.monitor_pguri))
+	{
+		Monitor monitor = { 0 };
+		PostgresSetup pgSetup = { 0 };
+
+		strlcpy(pgSetup.pgdata, proxyPgdata, MAXPGPATH);
+
+		if (!monitor_init_from_pgsetup(&monitor, &pgSetup))
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_BAD_ARGS);
+		}
+
+		strlcpy(config.monitor_pguri,
+				monitor.pgsql.connectionString, MAXCONNINFO);
+	}
+
+	(void) set_signal_handlers();
+
+	if (!proxy_service_run(&config))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+}
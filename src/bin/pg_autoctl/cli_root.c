@@ -77,9 +77,11 @@ CommandLine *root_subcommands_with_debug[] = {
 	&set_commands,
 	&perform_commands,
 	&do_commands,
+	&proxy_command,
 	&service_run_command,
 	&service_stop_command,
 	&service_reload_command,
+	&service_control_command,
 	&help,
 	&version,
 	NULL
@@ -102,9 +104,11 @@ CommandLine *root_subcommands[] = {
 	&get_commands,
 	&set_commands,
 	&perform_commands,
+	&proxy_command,
 	&service_run_command,
 	&service_stop_command,
 	&service_reload_command,
+	&service_control_command,
 	&help,
 	&version,
 	NULL
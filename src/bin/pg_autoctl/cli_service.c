@@ -17,6 +17,7 @@
 
 #include "cli_common.h"
 #include "commandline.h"
+#include "control.h"
 #include "defaults.h"
 #include "fsm.h"
 #include "keeper_config.h"
@@ -27,21 +28,30 @@
 
 static int stop_signal = SIGTERM;
 
+/* pg_autoctl run may manage several local Postgres instances */
+static char runPgdataArray[PG_AUTOCTL_MAX_INSTANCES][MAXPGPATH] = { 0 };
+static int runPgdataCount = 0;
+
 static void cli_service_run(int argc, char **argv);
 static void cli_keeper_run(int argc, char **argv);
+static void cli_keeper_run_instances(int argc, char **argv);
+static void cli_keeper_init_instance(Keeper *keeper, pid_t *pid);
 static void cli_monitor_run(int argc, char **argv);
 
+static int cli_getopt_run(int argc, char **argv);
 static int cli_getopt_pgdata_and_mode(int argc, char **argv);
 
 static void cli_service_reload(int argc, char **argv);
 static void cli_service_stop(int argc, char **argv);
+static void cli_service_control(int argc, char **argv);
 
 CommandLine service_run_command =
 	make_command("run",
 				 "Run the pg_autoctl service (monitor or keeper)",
-				 CLI_PGDATA_USAGE,
-				 CLI_PGDATA_OPTION,
-				 cli_getopt_pgdata,
+				 " [ --pgdata ... ] ",
+				 "  --pgdata      path to data directory, "
+				 "repeat to run several keepers\n",
+				 cli_getopt_run,
 				 cli_service_run);
 
 CommandLine service_stop_command =
@@ -62,6 +72,14 @@ CommandLine service_reload_command =
 				 cli_getopt_pgdata,
 				 cli_service_reload);
 
+CommandLine service_control_command =
+	make_command("control",
+				 "send a command to the running pg_autoctl service",
+				 " [ --pgdata ] status | reload | heartbeat | step ",
+				 CLI_PGDATA_OPTION,
+				 cli_getopt_pgdata,
+				 cli_service_control);
+
 
 /*
  * cli_service_run starts the local pg_auto_failover service, either the
@@ -73,6 +91,12 @@ cli_service_run(int argc, char **argv)
 {
 	KeeperConfig config = keeperOptions;
 
+	if (runPgdataCount > 1)
+	{
+		(void) cli_keeper_run_instances(argc, argv);
+		return;
+	}
+
 	if (!keeper_config_set_pathnames_from_pgdata(&config.pathnames,
 												 config.pgSetup.pgdata))
 	{
@@ -110,12 +134,112 @@ cli_keeper_run(int argc, char **argv)
 	Keeper keeper = { 0 };
 	pid_t pid = 0;
 
+	keeper.config = keeperOptions;
+
+	(void) cli_keeper_init_instance(&keeper, &pid);
+
+	if (keeper.config.monitorDisabled)
+	{
+		/*
+		 * At the moment, we have nothing to do here. Later we might want to
+		 * open an HTTPd service and wait for API calls.
+		 */
+		(void) keeper_service_stop(&keeper);
+	}
+	else
+	{
+		/*
+		 * Start with a monitor, so check everything is in order, then start
+		 * the HTTPd service, and finally the main monitor node_active protocol
+		 * loop.
+		 */
+		if (!keeper_check_monitor_extension_version(&keeper))
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_MONITOR);
+		}
+
+		keeper_service_run(&keeper, &pid);
+	}
+}
+
+
+/*
+ * cli_keeper_run_instances runs the keeper for several local Postgres
+ * instances in the same process, as in `pg_autoctl run --pgdata a --pgdata
+ * b`. The instances share a single main loop, and report their state to the
+ * monitor in a single call per iteration.
+ */
+static void
+cli_keeper_run_instances(int argc, char **argv)
+{
+	Keeper *keepers = calloc(runPgdataCount, sizeof(Keeper));
+	pid_t pid = 0;
+	int index = 0;
+
+	if (keepers == NULL)
+	{
+		log_fatal("Failed to allocate memory for %d keepers", runPgdataCount);
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	for (index = 0; index < runPgdataCount; index++)
+	{
+		Keeper *keeper = &(keepers[index]);
+		KeeperConfig options = keeperOptions;
+
+		strlcpy(options.pgSetup.pgdata, runPgdataArray[index], MAXPGPATH);
+		(void) prepare_keeper_options(&options);
+
+		if (ProbeConfigurationFileRole(options.pathnames.config) !=
+			PG_AUTOCTL_ROLE_KEEPER)
+		{
+			log_fatal("Configuration file \"%s\" is not a keeper "
+					  "configuration, only keepers may run in the same "
+					  "pg_autoctl process", options.pathnames.config);
+			exit(EXIT_CODE_BAD_CONFIG);
+		}
+
+		keeper->config = options;
+
+		(void) cli_keeper_init_instance(keeper, &pid);
+
+		if (keeper->config.monitorDisabled)
+		{
+			log_fatal("Running several keepers in the same pg_autoctl "
+					  "process requires a monitor, which is disabled "
+					  "for \"%s\"", keeper->config.pgSetup.pgdata);
+			exit(EXIT_CODE_BAD_CONFIG);
+		}
+
+		if (!keeper_check_monitor_extension_version(keeper))
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_MONITOR);
+		}
+	}
+
+	if (!keeper_service_run_instances(keepers, runPgdataCount, pid))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_KEEPER);
+	}
+
+	free(keepers);
+}
+
+
+/*
+ * cli_keeper_init_instance reads the configuration of a keeper, creates its
+ * pidfile and initializes it, exiting in case of errors.
+ */
+static void
+cli_keeper_init_instance(Keeper *keeper, pid_t *pid)
+{
 	bool missingPgdataIsOk = true;
 	bool pgIsNotRunningIsOk = true;
 	bool monitorDisabledIsOk = true;
 
-	keeper.config = keeperOptions;
-
 	/*
 	 * keeper_config_read_file() calls into pg_setup_init() which uses
 	 * pg_setup_is_ready(), and this function might loop until Postgres is
@@ -125,21 +249,21 @@ cli_keeper_run(int argc, char **argv)
 	 * that loop, we need to install our signal handlers and pidfile prior to
 	 * getting there.
 	 */
-	if (!keeper_config_read_file_skip_pgsetup(&(keeper.config),
+	if (!keeper_config_read_file_skip_pgsetup(&(keeper->config),
 											  monitorDisabledIsOk))
 	{
 		/* errors have already been logged. */
 		exit(EXIT_CODE_BAD_CONFIG);
 	}
 
-	if (!keeper_service_init(&keeper, &pid))
+	if (!keeper_service_init(keeper, pid))
 	{
 		log_fatal("Failed to initialize pg_auto_failover service, "
 				  "see above for details");
 		exit(EXIT_CODE_KEEPER);
 	}
 
-	if (!keeper_config_pgsetup_init(&(keeper.config),
+	if (!keeper_config_pgsetup_init(&(keeper->config),
 									missingPgdataIsOk,
 									pgIsNotRunningIsOk))
 	{
@@ -147,35 +271,11 @@ cli_keeper_run(int argc, char **argv)
 		exit(EXIT_CODE_BAD_CONFIG);
 	}
 
-	if (!keeper_init(&keeper, &keeper.config))
+	if (!keeper_init(keeper, &(keeper->config)))
 	{
 		log_fatal("Failed to initialise keeper, see above for details");
 		exit(EXIT_CODE_PGCTL);
 	}
-
-	if (keeper.config.monitorDisabled)
-	{
-		/*
-		 * At the moment, we have nothing to do here. Later we might want to
-		 * open an HTTPd service and wait for API calls.
-		 */
-		(void) keeper_service_stop(&keeper);
-	}
-	else
-	{
-		/*
-		 * Start with a monitor, so check everything is in order, then start
-		 * the HTTPd service, and finally the main monitor node_active protocol
-		 * loop.
-		 */
-		if (!keeper_check_monitor_extension_version(&keeper))
-		{
-			/* errors have already been logged */
-			exit(EXIT_CODE_MONITOR);
-		}
-
-		keeper_service_run(&keeper, &pid);
-	}
 }
 
 
@@ -234,6 +334,177 @@ cli_service_reload(int argc, char **argv)
 }
 
 
+/*
+ * cli_service_control sends a command to the control socket of the running
+ * keeper, and prints its JSON reply:
+ *
+ *  - status prints the current status of the keeper,
+ *  - reload makes the keeper reload its configuration,
+ *  - heartbeat makes the keeper call node_active right away, without
+ *    running a state transition,
+ *  - step makes the keeper run an iteration of its main loop right away.
+ */
+static void
+cli_service_control(int argc, char **argv)
+{
+	KeeperConfig config = keeperOptions;
+	char reply[BUFSIZE * 4] = { 0 };
+	JSON_Value *js = NULL;
+	char *serialized_string = NULL;
+
+	if (argc != 1)
+	{
+		commandline_print_usage(&service_control_command, stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	if (ControlCommandFromString(argv[0]) == CONTROL_COMMAND_UNKNOWN)
+	{
+		log_error("Unknown control command \"%s\"", argv[0]);
+		commandline_print_usage(&service_control_command, stderr);
+		exit(EXIT_CODE_BAD_ARGS);
+	}
+
+	(void) exit_unless_role_is_keeper(&config);
+
+	if (!control_send_command(config.pathnames.control, argv[0],
+							  reply, sizeof(reply)))
+	{
+		/* errors have already been logged */
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	js = json_parse_string(reply);
+
+	if (js == NULL)
+	{
+		log_error("Failed to parse the reply to command \"%s\": %s",
+				  argv[0], reply);
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	serialized_string = json_serialize_to_string_pretty(js);
+	fformat(stdout, "%s\n", serialized_string);
+
+	json_free_serialized_string(serialized_string);
+
+	if (json_object_has_value(json_value_get_object(js), "error"))
+	{
+		json_value_free(js);
+		exit(EXIT_CODE_INTERNAL_ERROR);
+	}
+
+	json_value_free(js);
+}
+
+
+/*
+ * cli_getopt_run parses the command line options of `pg_autoctl run`, which
+ * accepts the --pgdata option several times to run the keepers of several
+ * local Postgres instances in the same process.
+ */
+static int
+cli_getopt_run(int argc, char **argv)
+{
+	KeeperConfig options = { 0 };
+	int c, option_index = 0;
+	int verboseCount = 0;
+
+	static struct option long_options[] = {
+		{ "pgdata", required_argument, NULL, 'D' },
+		{ "version", no_argument, NULL, 'V' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	optind = 0;
+
+	while ((c = getopt_long(argc, argv, "D:Vvqh",
+							long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'D':
+			{
+				if (runPgdataCount >= PG_AUTOCTL_MAX_INSTANCES)
+				{
+					log_fatal("pg_autoctl run supports at most %d "
+							  "--pgdata options",
+							  PG_AUTOCTL_MAX_INSTANCES);
+					exit(EXIT_CODE_BAD_ARGS);
+				}
+
+				strlcpy(runPgdataArray[runPgdataCount++], optarg, MAXPGPATH);
+				log_trace("--pgdata %s", optarg);
+				break;
+			}
+
+			case 'V':
+			{
+				/* keeper_cli_print_version prints version and exits. */
+				keeper_cli_print_version(argc, argv);
+				break;
+			}
+
+			case 'v':
+			{
+				++verboseCount;
+				switch (verboseCount)
+				{
+					case 1:
+						log_set_level(LOG_INFO);
+						break;
+
+					case 2:
+						log_set_level(LOG_DEBUG);
+						break;
+
+					default:
+						log_set_level(LOG_TRACE);
+						break;
+				}
+				break;
+			}
+
+			case 'q':
+			{
+				log_set_level(LOG_ERROR);
+				break;
+			}
+
+			case 'h':
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_QUIT);
+				break;
+			}
+
+			default:
+			{
+				commandline_help(stderr);
+				exit(EXIT_CODE_BAD_ARGS);
+				break;
+			}
+		}
+	}
+
+	/* the first --pgdata, or PGDATA, is used to probe the service role */
+	if (runPgdataCount > 0)
+	{
+		strlcpy(options.pgSetup.pgdata, runPgdataArray[0], MAXPGPATH);
+	}
+
+	/* now that we have the command line parameters, prepare the options */
+	(void) prepare_keeper_options(&options);
+
+	keeperOptions = options;
+
+	return optind;
+}
+
+
 /*
  * cli_getopt_pgdata_and_mode gets both the --pgdata and the stopping mode
  * options (either --fast or --immediate) from the command line.
@@ -31,6 +31,7 @@
 #include "string_utils.h"
 
 static int eventCount = 10;
+static bool showReadOnlyUri = false;
 
 static int cli_show_state_getopts(int argc, char **argv);
 static void cli_show_state(int argc, char **argv);
@@ -57,9 +58,11 @@ static void print_monitor_and_formation_uri(KeeperConfig *config,
 CommandLine show_uri_command =
 	make_command("uri",
 				 "Show the postgres uri to use to connect to pg_auto_failover nodes",
-				 " [ --pgdata --formation --json ] ",
+				 " [ --pgdata --formation --readonly --json ] ",
 				 "  --pgdata      path to data directory\n"
 				 "  --formation   show the coordinator uri of given formation\n"
+				 "  --readonly    show the uri of healthy secondary nodes, "
+				 "freshest first\n"
 				 "  --json        output data in the JSON format\n",
 				 cli_show_uri_getopts,
 				 cli_show_uri);
@@ -122,15 +125,18 @@ CommandLine show_standby_names_command =
 
 CommandLine show_file_command =
 	make_command("file",
-				 "List pg_autoctl internal files (config, state, pid)",
-				 " [ --pgdata --all --config | --state | --init | --pid --contents ]",
+				 "List pg_autoctl internal files (config, state, pid, status)",
+				 " [ --pgdata --all --config | --state | --init | --pid | --status "
+				 "--contents --json ]",
 				 "  --pgdata      path to data directory \n"
 				 "  --all         show all pg_autoctl files \n"
 				 "  --config      show pg_autoctl configuration file \n"
 				 "  --state       show pg_autoctl state file \n"
 				 "  --init        show pg_autoctl initialisation state file \n"
 				 "  --pid         show pg_autoctl PID file \n"
-				 "  --contents    show selected file contents \n",
+				 "  --status      show pg_autoctl status file \n"
+				 "  --contents    show selected file contents \n"
+				 "  --json        output data in the JSON format\n",
 				 cli_show_file_getopts,
 				 cli_show_file);
 
@@ -141,7 +147,8 @@ typedef enum
 	SHOW_FILE_CONFIG,
 	SHOW_FILE_STATE,
 	SHOW_FILE_INIT,
-	SHOW_FILE_PID
+	SHOW_FILE_PID,
+	SHOW_FILE_STATUS
 } ShowFileSelection;
 
 typedef struct ShowFileOptions
@@ -637,6 +644,7 @@ cli_show_uri_getopts(int argc, char **argv)
 	static struct option long_options[] = {
 		{ "pgdata", required_argument, NULL, 'D' },
 		{ "formation", required_argument, NULL, 'f' },
+		{ "readonly", no_argument, NULL, 'r' },
 		{ "json", no_argument, NULL, 'J' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "verbose", no_argument, NULL, 'v' },
@@ -655,7 +663,7 @@ cli_show_uri_getopts(int argc, char **argv)
 
 	optind = 0;
 
-	while ((c = getopt_long(argc, argv, "D:f:Vvqh",
+	while ((c = getopt_long(argc, argv, "D:f:rJVvqh",
 							long_options, &option_index)) != -1)
 	{
 		switch (c)
@@ -674,6 +682,13 @@ cli_show_uri_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'r':
+			{
+				showReadOnlyUri = true;
+				log_trace("--readonly");
+				break;
+			}
+
 			case 'V':
 			{
 				/* keeper_cli_print_version prints version and exits. */
@@ -757,7 +772,7 @@ cli_show_uri(int argc, char **argv)
 {
 	KeeperConfig config = keeperOptions;
 
-	if (!IS_EMPTY_STRING_BUFFER(config.formation))
+	if (!IS_EMPTY_STRING_BUFFER(config.formation) || showReadOnlyUri)
 	{
 		(void) cli_show_formation_uri(argc, argv);
 	}
@@ -787,6 +802,12 @@ cli_show_formation_uri(int argc, char **argv)
 			bool pgIsNotRunningIsOk = true;
 			char connInfo[MAXCONNINFO];
 
+			/* --readonly without --formation targets the default formation */
+			if (IS_EMPTY_STRING_BUFFER(kconfig.formation))
+			{
+				strlcpy(kconfig.formation, FORMATION_DEFAULT, NAMEDATALEN);
+			}
+
 			if (!monitor_config_init_from_pgsetup(&mconfig,
 												  &kconfig.pgSetup,
 												  missingPgdataIsOk,
@@ -943,7 +964,8 @@ cli_show_all_uri(int argc, char **argv)
 /*
  * print_monitor_and_formation_uri connects to given monitor to fetch the
  * keeper configuration formation's URI, and prints it out on given stream. It
- * is printed in JSON format when outputJSON is true (--json options).
+ * is printed in JSON format when outputJSON is true (--json options). With
+ * --readonly, the URI lists the formation's readable secondary nodes instead.
  */
 static void
 print_monitor_and_formation_uri(KeeperConfig *config,
@@ -952,11 +974,23 @@ print_monitor_and_formation_uri(KeeperConfig *config,
 {
 	char postgresUri[MAXCONNINFO];
 
-	if (!monitor_formation_uri(monitor,
-							   config->formation,
-							   config->pgSetup.ssl.sslModeStr,
-							   postgresUri,
-							   MAXCONNINFO))
+	if (showReadOnlyUri)
+	{
+		if (!monitor_formation_readonly_uri(monitor,
+											config->formation,
+											config->pgSetup.ssl.sslModeStr,
+											postgresUri,
+											MAXCONNINFO))
+		{
+			/* errors have already been logged */
+			exit(EXIT_CODE_MONITOR);
+		}
+	}
+	else if (!monitor_formation_uri(monitor,
+									config->formation,
+									config->pgSetup.ssl.sslModeStr,
+									postgresUri,
+									MAXCONNINFO))
 	{
 		/* errors have already been logged */
 		exit(EXIT_CODE_MONITOR);
@@ -1001,7 +1035,9 @@ cli_show_file_getopts(int argc, char **argv)
 		{ "state", no_argument, NULL, 's' },
 		{ "init", no_argument, NULL, 'i' },
 		{ "pid", no_argument, NULL, 'p' },
+		{ "status", no_argument, NULL, 'S' },
 		{ "contents", no_argument, NULL, 'C' },
+		{ "json", no_argument, NULL, 'J' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "verbose", no_argument, NULL, 'v' },
 		{ "quiet", no_argument, NULL, 'q' },
@@ -1011,7 +1047,7 @@ cli_show_file_getopts(int argc, char **argv)
 
 	optind = 0;
 
-	while ((c = getopt_long(argc, argv, "D:acsipCVvqh",
+	while ((c = getopt_long(argc, argv, "D:acsipSCJVvqh",
 							long_options, &option_index)) != -1)
 	{
 		switch (c)
@@ -1051,7 +1087,7 @@ cli_show_file_getopts(int argc, char **argv)
 					&& fileOptions.selection != SHOW_FILE_CONFIG)
 				{
 					log_error(
-						"Please use only one of --config --state --init --pid");
+						"Please use only one of --config --state --init --pid --status");
 					commandline_help(stderr);
 				}
 				fileOptions.selection = SHOW_FILE_CONFIG;
@@ -1065,7 +1101,7 @@ cli_show_file_getopts(int argc, char **argv)
 					&& fileOptions.selection != SHOW_FILE_STATE)
 				{
 					log_error(
-						"Please use only one of --config --state --init --pid");
+						"Please use only one of --config --state --init --pid --status");
 					commandline_help(stderr);
 				}
 				fileOptions.selection = SHOW_FILE_STATE;
@@ -1079,7 +1115,7 @@ cli_show_file_getopts(int argc, char **argv)
 					&& fileOptions.selection != SHOW_FILE_INIT)
 				{
 					log_error(
-						"Please use only one of --config --state --init --pid");
+						"Please use only one of --config --state --init --pid --status");
 					commandline_help(stderr);
 				}
 				fileOptions.selection = SHOW_FILE_INIT;
@@ -1093,7 +1129,7 @@ cli_show_file_getopts(int argc, char **argv)
 					&& fileOptions.selection != SHOW_FILE_PID)
 				{
 					log_error(
-						"Please use only one of --config --state --init --pid");
+						"Please use only one of --config --state --init --pid --status");
 					commandline_help(stderr);
 				}
 				fileOptions.selection = SHOW_FILE_PID;
@@ -1101,6 +1137,27 @@ cli_show_file_getopts(int argc, char **argv)
 				break;
 			}
 
+			case 'S':
+			{
+				if (fileOptions.selection != SHOW_FILE_UNKNOWN
+					&& fileOptions.selection != SHOW_FILE_STATUS)
+				{
+					log_error(
+						"Please use only one of --config --state --init --pid --status");
+					commandline_help(stderr);
+				}
+				fileOptions.selection = SHOW_FILE_STATUS;
+				log_trace("--status");
+				break;
+			}
+
+			case 'J':
+			{
+				outputJSON = true;
+				log_trace("--json");
+				break;
+			}
+
 			case 'V':
 			{
 				/* keeper_cli_print_version prints version and exits. */
@@ -1202,6 +1259,7 @@ cli_show_file(int argc, char **argv)
 				json_object_set_string(root, "state", config.pathnames.state);
 				json_object_set_string(root, "init", config.pathnames.init);
 				json_object_set_string(root, "pid", config.pathnames.pid);
+				json_object_set_string(root, "status", config.pathnames.status);
 			}
 
 			serialized_string = json_serialize_to_string_pretty(js);
@@ -1318,6 +1376,55 @@ cli_show_file(int argc, char **argv)
 			break;
 		}
 
+		case SHOW_FILE_STATUS:
+		{
+			if (role == PG_AUTOCTL_ROLE_MONITOR)
+			{
+				log_error("A monitor has no status file");
+				exit(EXIT_CODE_BAD_ARGS);
+			}
+
+			if (showFileOptions.showFileContents)
+			{
+				KeeperStatus status = { 0 };
+				KeeperStatusData data = { 0 };
+
+				if (!keeper_status_attach(&status, config.pathnames.status) ||
+					!keeper_status_snapshot(&status, &data))
+				{
+					/* errors have already been logged */
+					(void) keeper_status_detach(&status);
+					exit(EXIT_CODE_BAD_STATE);
+				}
+
+				(void) keeper_status_detach(&status);
+
+				if (outputJSON)
+				{
+					char *serialized_string = NULL;
+					JSON_Value *js = json_value_init_object();
+
+					(void) keeperStatusAsJSON(&data, js);
+
+					serialized_string = json_serialize_to_string_pretty(js);
+					fformat(stdout, "%s\n", serialized_string);
+
+					json_free_serialized_string(serialized_string);
+					json_value_free(js);
+				}
+				else
+				{
+					(void) print_keeper_status(&data, stdout);
+				}
+			}
+			else
+			{
+				fformat(stdout, "%s\n", config.pathnames.status);
+			}
+
+			break;
+		}
+
 		default:
 		{
 			log_fatal("Unrecognized configuration file \"%s\"",
@@ -0,0 +1,63 @@
+/*
+ * src/bin/pg_autoctl/clock_utils.c
+ *   Implementations of utility functions for measuring elapsed time with a
+ *   monotonic clock
+ *
+ * All our timeouts are computed using CLOCK_MONOTONIC in milliseconds, so
+ * that they are not impacted by the wall-clock being stepped (NTP, manual
+ * changes). Wall-clock time is only used for display, and for the timestamps
+ * that we persist in the keeper state file.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <time.h>
+
+#include "clock_utils.h"
+
+
+/*
+ * monotonic_clock_ms returns the current value of the monotonic clock in
+ * milliseconds. The value has no meaning on its own, only differences between
+ * two calls are meaningful.
+ */
+uint64_t
+monotonic_clock_ms()
+{
+	struct timespec ts = { 0 };
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * MSECS_PER_SEC
+		   + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * monotonic_clock_from_epoch converts a wall-clock timestamp from the past,
+ * such as one that we read from the keeper state file, to the monotonic
+ * clock, based on the time elapsed since then. We return 1 rather than 0 when
+ * the timestamp is older than the monotonic clock origin (system boot), so
+ * that callers may still use 0 as "never".
+ */
+uint64_t
+monotonic_clock_from_epoch(uint64_t epoch)
+{
+	uint64_t nowMs = monotonic_clock_ms();
+	uint64_t nowEpoch = time(NULL);
+	uint64_t elapsedMs = 0;
+
+	if (epoch == 0)
+	{
+		return 0;
+	}
+
+	if (epoch < nowEpoch)
+	{
+		elapsedMs = (nowEpoch - epoch) * MSECS_PER_SEC;
+	}
+
+	return elapsedMs < nowMs ? nowMs - elapsedMs : 1;
+}
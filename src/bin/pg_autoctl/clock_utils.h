@@ -0,0 +1,19 @@
+/*
+ * src/bin/pg_autoctl/clock_utils.h
+ *   Utility functions for measuring elapsed time with a monotonic clock
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+#ifndef CLOCK_UTILS_H
+#define CLOCK_UTILS_H
+
+#include <stdint.h>
+
+#define MSECS_PER_SEC 1000
+
+uint64_t monotonic_clock_ms(void);
+uint64_t monotonic_clock_from_epoch(uint64_t epoch);
+
+#endif /* CLOCK_UTILS_H */
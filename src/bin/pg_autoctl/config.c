@@ -233,6 +233,54 @@ SetPidFilePath(ConfigFilePaths *pathnames, const char *pgdata)
 
 	log_trace("SetPidFilePath: \"%s\"", pathnames->pid);
 
+	/* now the file where we publish the current primary of our group */
+	if (IS_EMPTY_STRING_BUFFER(pathnames->primary))
+	{
+		if (!build_xdg_path(pathnames->primary,
+							XDG_RUNTIME,
+							pgdata,
+							KEEPER_PRIMARY_FILENAME))
+		{
+			log_error("Failed to build pg_autoctl primary file pathname, "
+					  "see above.");
+			exit(EXIT_CODE_INTERNAL_ERROR);
+		}
+	}
+
+	log_trace("SetPidFilePath: \"%s\"", pathnames->primary);
+
+	/* and the status page that the running keeper keeps up to date */
+	if (IS_EMPTY_STRING_BUFFER(pathnames->status))
+	{
+		if (!build_xdg_path(pathnames->status,
+							XDG_RUNTIME,
+							pgdata,
+							KEEPER_STATUS_FILENAME))
+		{
+			log_error("Failed to build pg_autoctl status file pathname, "
+					  "see above.");
+			exit(EXIT_CODE_INTERNAL_ERROR);
+		}
+	}
+
+	log_trace("SetPidFilePath: \"%s\"", pathnames->status);
+
+	/* and the control socket of the running keeper */
+	if (IS_EMPTY_STRING_BUFFER(pathnames->control))
+	{
+		if (!build_xdg_path(pathnames->control,
+							XDG_RUNTIME,
+							pgdata,
+							KEEPER_CONTROL_FILENAME))
+		{
+			log_error("Failed to build pg_autoctl control socket pathname, "
+					  "see above.");
+			exit(EXIT_CODE_INTERNAL_ERROR);
+		}
+	}
+
+	log_trace("SetPidFilePath: \"%s\"", pathnames->control);
+
 	return true;
 }
 
@@ -37,6 +37,9 @@ typedef struct ConfigFilePaths
 	char state[MAXPGPATH];  /* ~/.local/share/pg_autoctl/${PGDATA}/pg_autoctl.state */
 	char pid[MAXPGPATH];	/* /tmp/${PGDATA}/pg_autoctl.pid */
 	char init[MAXPGPATH];	/* /tmp/${PGDATA}/pg_autoctl.init */
+	char primary[MAXPGPATH];	/* /tmp/${PGDATA}/pg_autoctl.primary */
+	char status[MAXPGPATH];		/* /tmp/${PGDATA}/pg_autoctl.status */
+	char control[MAXPGPATH];	/* /tmp/${PGDATA}/pg_autoctl.sock */
 	char systemd[MAXPGPATH];	/* ~/.config/systemd/user/pgautofailover.service */
 } ConfigFilePaths;
 
@@ -0,0 +1,549 @@
+/*
+ * src/bin/pg_autoctl/control.c
+ *     Control socket of the running pg_autoctl keeper.
+ *
+ * The keeper listens on a unix domain socket in its runtime directory, next
+ * to its pid file. A client connects, sends a single command on a line, and
+ * reads a single JSON object back before the keeper closes the connection.
+ * The main loop waits on the control socket instead of sleeping, so that
+ * commands that need a main loop iteration run right away, without waiting
+ * for PG_AUTOCTL_KEEPER_SLEEP_TIME.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+
+#include "parson.h"
+
+#include "clock_utils.h"
+#include "control.h"
+#include "defaults.h"
+#include "file_utils.h"
+#include "log.h"
+
+/* not every platform has MSG_NOSIGNAL, see control_socket_nosigpipe() */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static bool control_socket_address(const char *filename,
+								   struct sockaddr_un *addr);
+static void control_socket_nosigpipe(int fd);
+static bool control_socket_read(ControlSocket *control);
+
+
+/*
+ * control_socket_listen creates the control socket of a keeper instance.
+ */
+bool
+control_socket_listen(ControlSocket *control, const char *filename)
+{
+	struct sockaddr_un addr = { 0 };
+	mode_t previousUmask = 0;
+	int bindResult = 0;
+	int fd = -1;
+
+	control->listenFd = -1;
+	control->clientFd = -1;
+	control->reading = false;
+	control->pending = CONTROL_COMMAND_UNKNOWN;
+
+	if (!control_socket_address(filename, &addr))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* a previous keeper might have left its socket behind */
+	if (file_exists(filename) && !unlink_file(filename))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0)
+	{
+		log_error("Failed to create a unix socket: %m");
+		return false;
+	}
+
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 ||
+		fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+	{
+		log_error("Failed to set up the control socket: %m");
+		close(fd);
+		return false;
+	}
+
+	/*
+	 * Only our own user may control the keeper. The socket file is created
+	 * by bind() with the permissions of our umask, so restrict it there
+	 * rather than with a chmod() afterwards, when other users could already
+	 * have connected.
+	 */
+	previousUmask = umask(S_IRWXG | S_IRWXO);
+	bindResult = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+	(void) umask(previousUmask);
+
+	if (bindResult < 0 ||
+		listen(fd, SOMAXCONN) < 0)
+	{
+		log_error("Failed to listen on the control socket \"%s\": %m",
+				  filename);
+		close(fd);
+		return false;
+	}
+
+	log_debug("Listening for control commands on \"%s\"", filename);
+
+	control->listenFd = fd;
+
+	return true;
+}
+
+
+/*
+ * control_socket_pollfd returns the file descriptor that the main loop should
+ * wait on for the control socket to be ready: the client connection while we
+ * wait for its command, the listening socket when we can accept a new client,
+ * and -1 while a command is pending, which poll() ignores.
+ */
+int
+control_socket_pollfd(ControlSocket *control)
+{
+	if (control->clientFd >= 0)
+	{
+		return control->reading ? control->clientFd : -1;
+	}
+
+	return control->listenFd;
+}
+
+
+/*
+ * control_socket_accept is called when the file descriptor returned by
+ * control_socket_pollfd() is readable. It accepts a client connection, or
+ * reads the command of the client, without ever blocking the main loop: the
+ * client socket is non-blocking, and we come back to it once it's readable.
+ *
+ * When a command has been received, it is found in control->pending, the
+ * function returns true, and the client waits for control_socket_reply().
+ */
+bool
+control_socket_accept(ControlSocket *control)
+{
+	int fd = -1;
+
+	if (control->listenFd < 0)
+	{
+		return false;
+	}
+
+	if (control->clientFd >= 0)
+	{
+		/* one command at a time */
+		return control->reading && control_socket_read(control);
+	}
+
+	fd = accept(control->listenFd, NULL, NULL);
+
+	if (fd < 0)
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		{
+			log_warn("Failed to accept a control connection: %m");
+		}
+		return false;
+	}
+
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+	{
+		log_warn("Failed to set up a control connection: %m");
+		close(fd);
+		return false;
+	}
+
+	(void) control_socket_nosigpipe(fd);
+
+	control->clientFd = fd;
+	control->reading = true;
+	control->acceptMs = monotonic_clock_ms();
+
+	/* the client sends its command right after connecting */
+	return control_socket_read(control);
+}
+
+
+/*
+ * control_socket_read reads the command of the connected client, when it is
+ * available. It returns true when we received a command.
+ */
+static bool
+control_socket_read(ControlSocket *control)
+{
+	char buffer[BUFSIZE] = { 0 };
+	char *newline = NULL;
+	ssize_t bytes = recv(control->clientFd, buffer, sizeof(buffer) - 1, 0);
+
+	if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+					  errno == EINTR))
+	{
+		/* wait until the client socket is readable */
+		return false;
+	}
+
+	if (bytes <= 0)
+	{
+		log_warn("Failed to read a command from a control connection");
+		close(control->clientFd);
+		control->clientFd = -1;
+		control->reading = false;
+		return false;
+	}
+
+	buffer[bytes] = '\0';
+
+	if ((newline = strchr(buffer, '\n')) != NULL)
+	{
+		*newline = '\0';
+	}
+
+	control->reading = false;
+	control->pending = ControlCommandFromString(buffer);
+
+	if (control->pending == CONTROL_COMMAND_UNKNOWN)
+	{
+		JSON_Value *js = json_value_init_object();
+		JSON_Object *jsobj = json_value_get_object(js);
+
+		log_warn("Received unknown control command \"%s\"", buffer);
+
+		json_object_set_string(jsobj, "error", "unknown command");
+
+		(void) control_socket_reply(control, js);
+		json_value_free(js);
+
+		return false;
+	}
+
+	log_debug("Received control command \"%s\"", buffer);
+
+	return true;
+}
+
+
+/*
+ * control_socket_expire closes the client connection when the client did not
+ * send its command within PG_AUTOCTL_CONTROL_TIMEOUT_MS after connecting, so
+ * that other clients may connect.
+ */
+void
+control_socket_expire(ControlSocket *control)
+{
+	if (control->clientFd < 0 || !control->reading)
+	{
+		return;
+	}
+
+	if (monotonic_clock_ms() - control->acceptMs >=
+		PG_AUTOCTL_CONTROL_TIMEOUT_MS)
+	{
+		log_warn("Failed to read a command from a control connection "
+				 "in %dms", PG_AUTOCTL_CONTROL_TIMEOUT_MS);
+		close(control->clientFd);
+		control->clientFd = -1;
+		control->reading = false;
+	}
+}
+
+
+/*
+ * control_socket_reply sends the given JSON object to the client waiting for
+ * the answer to its command, and closes the connection.
+ */
+bool
+control_socket_reply(ControlSocket *control, JSON_Value *js)
+{
+	char *serialized_string = NULL;
+	size_t length = 0;
+	size_t written = 0;
+	bool success = true;
+
+	if (control->clientFd < 0)
+	{
+		return false;
+	}
+
+	serialized_string = json_serialize_to_string(js);
+
+	if (serialized_string != NULL)
+	{
+		length = strlen(serialized_string);
+
+		while (written < length)
+		{
+			ssize_t bytes = send(control->clientFd,
+								 serialized_string + written,
+								 length - written,
+								 MSG_NOSIGNAL);
+
+			if (bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			if (bytes <= 0)
+			{
+				log_warn("Failed to reply to a control command: %m");
+				success = false;
+				break;
+			}
+
+			written += bytes;
+		}
+
+		json_free_serialized_string(serialized_string);
+	}
+
+	close(control->clientFd);
+
+	control->clientFd = -1;
+	control->reading = false;
+	control->pending = CONTROL_COMMAND_UNKNOWN;
+
+	return success;
+}
+
+
+/*
+ * control_socket_close closes the control socket, and removes it.
+ */
+void
+control_socket_close(ControlSocket *control, const char *filename)
+{
+	if (control->clientFd >= 0)
+	{
+		close(control->clientFd);
+		control->clientFd = -1;
+		control->reading = false;
+	}
+
+	if (control->listenFd >= 0)
+	{
+		close(control->listenFd);
+		control->listenFd = -1;
+
+		(void) unlink_file(filename);
+	}
+}
+
+
+/*
+ * control_send_command connects to the control socket of a running keeper,
+ * sends the given command, and copies the reply to the given buffer.
+ */
+bool
+control_send_command(const char *filename, const char *command,
+					 char *reply, int size)
+{
+	struct sockaddr_un addr = { 0 };
+	struct timeval timeout = { PG_AUTOCTL_CONTROL_REPLY_TIMEOUT, 0 };
+	char buffer[BUFSIZE] = { 0 };
+	int length = 0;
+	int received = 0;
+	int fd = -1;
+
+	if (!control_socket_address(filename, &addr))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0)
+	{
+		log_error("Failed to create a unix socket: %m");
+		return false;
+	}
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+	{
+		log_error("Failed to connect to the control socket \"%s\": %m",
+				  filename);
+		log_info("Is the pg_autoctl service running?");
+		close(fd);
+		return false;
+	}
+
+	(void) control_socket_nosigpipe(fd);
+
+	/* don't wait forever for a keeper that is stuck */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO,
+				   &timeout, sizeof(timeout)) < 0)
+	{
+		log_error("Failed to set a timeout on the control socket: %m");
+		close(fd);
+		return false;
+	}
+
+	length = sformat(buffer, BUFSIZE, "%s\n", command);
+
+	if (send(fd, buffer, length, MSG_NOSIGNAL) != length)
+	{
+		log_error("Failed to send command \"%s\" to the control socket: %m",
+				  command);
+		close(fd);
+		return false;
+	}
+
+	/* the keeper closes the connection once it has replied */
+	while (received < size - 1)
+	{
+		ssize_t bytes = recv(fd, reply + received, size - 1 - received, 0);
+
+		if (bytes < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			log_error("The pg_autoctl service did not reply to command "
+					  "\"%s\" within %ds", command,
+					  PG_AUTOCTL_CONTROL_REPLY_TIMEOUT);
+			close(fd);
+			return false;
+		}
+
+		if (bytes < 0)
+		{
+			log_error("Failed to read the reply to command \"%s\": %m",
+					  command);
+			close(fd);
+			return false;
+		}
+
+		if (bytes == 0)
+		{
+			break;
+		}
+
+		received += bytes;
+	}
+
+	reply[received] = '\0';
+	close(fd);
+
+	if (received == 0)
+	{
+		log_error("The pg_autoctl service closed the control connection "
+				  "without replying to command \"%s\"", command);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * ControlCommandFromString parses a control command name.
+ */
+ControlCommand
+ControlCommandFromString(const char *str)
+{
+	if (strcmp(str, "status") == 0)
+	{
+		return CONTROL_COMMAND_STATUS;
+	}
+	else if (strcmp(str, "reload") == 0)
+	{
+		return CONTROL_COMMAND_RELOAD;
+	}
+	else if (strcmp(str, "heartbeat") == 0)
+	{
+		return CONTROL_COMMAND_HEARTBEAT;
+	}
+	else if (strcmp(str, "step") == 0)
+	{
+		return CONTROL_COMMAND_STEP;
+	}
+
+	return CONTROL_COMMAND_UNKNOWN;
+}
+
+
+/*
+ * ControlCommandToString returns the name of a control command.
+ */
+const char *
+ControlCommandToString(ControlCommand command)
+{
+	switch (command)
+	{
+		case CONTROL_COMMAND_STATUS:
+			return "status";
+
+		case CONTROL_COMMAND_RELOAD:
+			return "reload";
+
+		case CONTROL_COMMAND_HEARTBEAT:
+			return "heartbeat";
+
+		case CONTROL_COMMAND_STEP:
+			return "step";
+
+		default:
+			return "unknown";
+	}
+}
+
+
+/*
+ * control_socket_address fills in the unix socket address for the given
+ * filename, which must fit in sun_path.
+ */
+static bool
+control_socket_address(const char *filename, struct sockaddr_un *addr)
+{
+	addr->sun_family = AF_UNIX;
+
+	if (strlcpy(addr->sun_path, filename, sizeof(addr->sun_path)) >=
+		sizeof(addr->sun_path))
+	{
+		log_error("Control socket path \"%s\" is too long, the maximum "
+				  "length is %zu", filename, sizeof(addr->sun_path) - 1);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * control_socket_nosigpipe prevents writing to a closed connection from
+ * killing us with SIGPIPE on platforms that don't have MSG_NOSIGNAL.
+ */
+static void
+control_socket_nosigpipe(int fd)
+{
+#ifdef SO_NOSIGPIPE
+	int enable = 1;
+
+	(void) setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+}
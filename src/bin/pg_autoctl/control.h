@@ -0,0 +1,53 @@
+/*
+ * src/bin/pg_autoctl/control.h
+ *     Control socket of the running pg_autoctl keeper.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "parson.h"
+
+typedef enum
+{
+	CONTROL_COMMAND_UNKNOWN = 0,
+	CONTROL_COMMAND_STATUS,		/* report the status page right away */
+	CONTROL_COMMAND_RELOAD,		/* re-read the configuration right away */
+	CONTROL_COMMAND_HEARTBEAT,	/* call node_active now, without a transition */
+	CONTROL_COMMAND_STEP		/* run a main loop iteration now */
+} ControlCommand;
+
+/*
+ * ControlSocket is the listening socket of a keeper instance, and the client
+ * connection that either sends its command, or waits for the answer to it.
+ */
+typedef struct ControlSocket
+{
+	int listenFd;
+	int clientFd;
+	bool reading;				/* clientFd did not send its command yet */
+	uint64_t acceptMs;			/* monotonic clock, when clientFd connected */
+	ControlCommand pending;
+} ControlSocket;
+
+bool control_socket_listen(ControlSocket *control, const char *filename);
+int control_socket_pollfd(ControlSocket *control);
+bool control_socket_accept(ControlSocket *control);
+void control_socket_expire(ControlSocket *control);
+bool control_socket_reply(ControlSocket *control, JSON_Value *js);
+void control_socket_close(ControlSocket *control, const char *filename);
+
+bool control_send_command(const char *filename, const char *command,
+						  char *reply, int size);
+
+ControlCommand ControlCommandFromString(const char *str);
+const char * ControlCommandToString(ControlCommand command);
+
+#endif /* CONTROL_H */
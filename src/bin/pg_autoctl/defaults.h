@@ -17,7 +17,7 @@
 #define PG_AUTOCTL_VERSION "1.2"
 
 /* version of the extension that we requite to talk to on the monitor */
-#define PG_AUTOCTL_EXTENSION_VERSION "1.2"
+#define PG_AUTOCTL_EXTENSION_VERSION "1.3"
 
 /* environment variable to use to make DEBUG facilities available */
 #define PG_AUTOCTL_DEBUG "PG_AUTOCTL_DEBUG"
@@ -37,11 +37,16 @@
 #define FORMATION_DEFAULT "default"
 #define GROUP_ID_DEFAULT 0
 #define POSTGRES_CONNECT_TIMEOUT "5"
+#define MONITOR_HOST_CONNECT_TIMEOUT "2"
 #define MAXIMUM_BACKUP_RATE "100M"
 
 /* retry PQping for a maximum of 15 mins */
 #define POSTGRES_PING_RETRY_TIMEOUT 900
 
+/* non-blocking connections back off exponentially between attempts */
+#define POSTGRES_CONNECT_RETRY_BASE_DELAY_MS 1000
+#define POSTGRES_CONNECT_RETRY_MAX_DELAY_MS 30000
+
 #define PG_AUTOCTL_MONITOR_DISABLED "PG_AUTOCTL_DISABLED"
 
 #define NETWORK_PARTITION_TIMEOUT 20
@@ -49,19 +54,39 @@
 #define PREPARE_PROMOTION_WALRECEIVER_TIMEOUT 5
 
 #define PG_AUTOCTL_KEEPER_SLEEP_TIME 5
+#define FENCING_WATCHDOG_INTERVAL_MS 500
+#define PG_AUTOCTL_CONTROL_TIMEOUT_MS 1000
+#define PG_AUTOCTL_CONTROL_REPLY_TIMEOUT 30
 #define PG_AUTOCTL_MONITOR_SLEEP_TIME 1
 
 #define PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT 30
 
+/* pg_autoctl run --pgdata may be repeated to manage several instances */
+#define PG_AUTOCTL_MAX_INSTANCES 64
+
 #define COORDINATOR_IS_READY_TIMEOUT 300
 
 #define POSTGRESQL_FAILS_TO_START_TIMEOUT 20
 #define POSTGRESQL_FAILS_TO_START_RETRIES 3
 
+/* same as pg_ctl --timeout default, when supervising the postmaster */
+#define POSTGRES_START_TIMEOUT 60
+
+/* terminate idle sessions in batches when draining the primary */
+#define DRAIN_SESSIONS_BATCH_SIZE 50
+#define DRAIN_SESSIONS_BATCH_SLEEP_MS 100
+#define DRAIN_SESSIONS_MAX_BATCHES 20
+
 #define FAILOVER_FORMATION_NUMBER_SYNC_STANDBYS 1
 #define FAILOVER_NODE_CANDIDATE_PRIORITY 100
 #define FAILOVER_NODE_REPLICATION_QUORUM true
 
+/* pg_autoctl proxy */
+#define PROXY_LISTEN_ADDRESS "localhost"
+#define PROXY_MAX_CONNECTIONS 1024
+#define PROXY_MAX_EVENTS 64
+#define PROXY_PIPE_SIZE 65536
+
 /* internal default for allocating strings  */
 #define BUFSIZE 1024
 
@@ -83,6 +108,9 @@
 #define KEEPER_STATE_FILENAME "pg_autoctl.state"
 #define KEEPER_PID_FILENAME "pg_autoctl.pid"
 #define KEEPER_INIT_FILENAME "pg_autoctl.init"
+#define KEEPER_PRIMARY_FILENAME "pg_autoctl.primary"
+#define KEEPER_STATUS_FILENAME "pg_autoctl.status"
+#define KEEPER_CONTROL_FILENAME "pg_autoctl.sock"
 
 #define KEEPER_SYSTEMD_SERVICE "pgautofailover"
 #define KEEPER_SYSTEMD_FILENAME "pgautofailover.service"
@@ -92,8 +92,21 @@
 
 #define COMMENT_SECONDARY_TO_CATCHINGUP \
 	"Failed to report back to the monitor, " \
+	"or a new primary is available after a switchover, " \
 	"not eligible for promotion"
 
+#define COMMENT_DRAINING_TO_WAIT_PRIMARY \
+	"The switchover did not complete in time, " \
+	"resuming as the primary"
+
+#define COMMENT_DRAINING_TO_CATCHINGUP \
+	"A new primary is available after a switchover, " \
+	"follow it without pg_rewind."
+
+#define COMMENT_SECONDARY_TO_WAIT_PRIMARY \
+	"Received all the WAL from the primary during a switchover, " \
+	"promoting now."
+
 #define COMMENT_CATCHINGUP_TO_SECONDARY \
 	"Convinced the monitor that I'm up and running, " \
 	"and eligible for promotion again"
@@ -164,16 +177,16 @@ KeeperFSMTransition KeeperFSM[] = {
 	/*
 	 * failover occurred, primary -> draining/demoted
 	 */
-	{ PRIMARY_STATE, DRAINING_STATE, COMMENT_PRIMARY_TO_DRAINING, &fsm_stop_postgres },
+	{ PRIMARY_STATE, DRAINING_STATE, COMMENT_PRIMARY_TO_DRAINING, &fsm_drain_and_stop_postgres },
 	{ DRAINING_STATE, DEMOTED_STATE, COMMENT_DRAINING_TO_DEMOTED, &fsm_stop_postgres },
 	{ PRIMARY_STATE, DEMOTED_STATE, COMMENT_PRIMARY_TO_DEMOTED, &fsm_stop_postgres },
 	{ PRIMARY_STATE, DEMOTE_TIMEOUT_STATE, COMMENT_PRIMARY_TO_DEMOTED, &fsm_stop_postgres },
 
-	{ JOIN_PRIMARY_STATE, DRAINING_STATE, COMMENT_PRIMARY_TO_DRAINING, &fsm_stop_postgres },
+	{ JOIN_PRIMARY_STATE, DRAINING_STATE, COMMENT_PRIMARY_TO_DRAINING, &fsm_drain_and_stop_postgres },
 	{ JOIN_PRIMARY_STATE, DEMOTED_STATE, COMMENT_PRIMARY_TO_DEMOTED, &fsm_stop_postgres },
 	{ JOIN_PRIMARY_STATE, DEMOTE_TIMEOUT_STATE, COMMENT_PRIMARY_TO_DEMOTED, &fsm_stop_postgres },
 
-	{ APPLY_SETTINGS_STATE, DRAINING_STATE, COMMENT_PRIMARY_TO_DRAINING, &fsm_stop_postgres },
+	{ APPLY_SETTINGS_STATE, DRAINING_STATE, COMMENT_PRIMARY_TO_DRAINING, &fsm_drain_and_stop_postgres },
 	{ APPLY_SETTINGS_STATE, DEMOTED_STATE, COMMENT_PRIMARY_TO_DEMOTED, &fsm_stop_postgres },
 	{ APPLY_SETTINGS_STATE, DEMOTE_TIMEOUT_STATE, COMMENT_PRIMARY_TO_DEMOTED, &fsm_stop_postgres },	
 
@@ -189,6 +202,7 @@ KeeperFSMTransition KeeperFSM[] = {
 	{ DEMOTED_STATE, SINGLE_STATE, COMMENT_DEMOTED_TO_SINGLE, &fsm_resume_as_primary },
 	{ DEMOTE_TIMEOUT_STATE, SINGLE_STATE, COMMENT_DEMOTED_TO_SINGLE, &fsm_resume_as_primary },
 	{ DRAINING_STATE, SINGLE_STATE, COMMENT_DEMOTED_TO_SINGLE, &fsm_resume_as_primary },
+	{ DRAINING_STATE, WAIT_PRIMARY_STATE, COMMENT_DRAINING_TO_WAIT_PRIMARY, &fsm_resume_after_switchover },
 
 	/*
 	 * primary was forcibly removed
@@ -209,6 +223,7 @@ KeeperFSMTransition KeeperFSM[] = {
 	{ PRIMARY_STATE, JOIN_PRIMARY_STATE, COMMENT_PRIMARY_TO_JOIN_PRIMARY, &fsm_prepare_replication },
 	{ PRIMARY_STATE, WAIT_PRIMARY_STATE, COMMENT_PRIMARY_TO_WAIT_PRIMARY, &fsm_disable_sync_rep },
 	{ STOP_REPLICATION_STATE, WAIT_PRIMARY_STATE, COMMENT_STOP_REPLICATION_TO_WAIT_PRIMARY, &fsm_promote_standby_to_primary },
+	{ SECONDARY_STATE, WAIT_PRIMARY_STATE, COMMENT_SECONDARY_TO_WAIT_PRIMARY, &fsm_promote_standby_for_switchover },
 
 	/*
 	 * Situation is getting back to normal on the primary
@@ -222,7 +237,8 @@ KeeperFSMTransition KeeperFSM[] = {
 	 */
 	{ WAIT_STANDBY_STATE, CATCHINGUP_STATE, COMMENT_WAIT_STANDBY_TO_CATCHINGUP, &fsm_init_standby },
 	{ DEMOTED_STATE, CATCHINGUP_STATE, COMMENT_DEMOTED_TO_CATCHINGUP, &fsm_rewind_or_init },
-	{ SECONDARY_STATE, CATCHINGUP_STATE, COMMENT_SECONDARY_TO_CATCHINGUP, NULL },
+	{ SECONDARY_STATE, CATCHINGUP_STATE, COMMENT_SECONDARY_TO_CATCHINGUP, &fsm_follow_primary_if_changed },
+	{ DRAINING_STATE, CATCHINGUP_STATE, COMMENT_DRAINING_TO_CATCHINGUP, &fsm_follow_new_primary },
 
 	/*
 	 * We're asked to be a standby.
@@ -323,6 +339,7 @@ keeper_fsm_step(Keeper *keeper)
 							 postgres->pgIsRunning,
 							 postgres->currentLSN,
 							 postgres->pgsrSyncState,
+							 &(postgres->standbys),
 							 &assignedState))
 	{
 		log_fatal("Failed to get the goal state from the monitor, "
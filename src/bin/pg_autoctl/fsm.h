@@ -40,13 +40,17 @@ bool fsm_init_primary(Keeper *keeper);
 bool fsm_prepare_replication(Keeper *keeper);
 bool fsm_disable_replication(Keeper *keeper);
 bool fsm_resume_as_primary(Keeper *keeper);
+bool fsm_resume_after_switchover(Keeper *keeper);
 bool fsm_rewind_or_init(Keeper *keeper);
+bool fsm_follow_new_primary(Keeper *keeper);
+bool fsm_follow_primary_if_changed(Keeper *keeper);
 
 bool fsm_init_standby(Keeper *keeper);
 bool fsm_promote_standby(Keeper *keeper);
 bool fsm_prepare_standby_for_promotion(Keeper *keeper);
 bool fsm_promote_standby_to_primary(Keeper *keeper);
 bool fsm_promote_standby_to_single(Keeper *keeper);
+bool fsm_promote_standby_for_switchover(Keeper *keeper);
 bool fsm_stop_replication(Keeper *keeper);
 
 bool fsm_enable_sync_rep(Keeper *keeper);
@@ -55,6 +59,7 @@ bool fsm_apply_settings(Keeper *keeper);
 
 bool fsm_start_postgres(Keeper *keeper);
 bool fsm_stop_postgres(Keeper *keeper);
+bool fsm_drain_and_stop_postgres(Keeper *keeper);
 
 bool fsm_start_maintenance_on_standby(Keeper *keeper);
 bool fsm_restart_standby(Keeper *keeper);
@@ -40,6 +40,10 @@
 #include "state.h"
 
 static bool prepare_replication(Keeper *keeper, NodeState otherNodeState);
+static void publish_primary(Keeper *keeper, NodeAddress *primaryNode);
+static void publish_local_node_as_primary(Keeper *keeper);
+static bool fsm_postgres_needs_restart(Keeper *keeper, bool *needsRestart);
+static bool promote_standby(Keeper *keeper, bool resumeWrites);
 
 
 /*
@@ -216,14 +220,12 @@ fsm_init_primary(Keeper *keeper)
 	 */
 	if (!config->monitorDisabled)
 	{
-		char monitorHostname[_POSIX_HOST_NAME_MAX];
-		int monitorPort = 0;
+		NodeAddressArray monitorHosts = { 0 };
 		char *password = NULL;
 		char *authMethod = NULL;
+		int hostIndex = 0;
 
-		if (!hostname_from_uri(config->monitor_pguri,
-							   monitorHostname, _POSIX_HOST_NAME_MAX,
-							   &monitorPort))
+		if (!hostnames_from_uri(config->monitor_pguri, &monitorHosts))
 		{
 			/* developer error, this should never happen */
 			log_fatal("BUG: monitor_pguri should be validated before calling "
@@ -235,17 +237,24 @@ fsm_init_primary(Keeper *keeper)
 
 		/*
 		 * We need to add the monitor host:port in the HBA settings for the
-		 * node to enable the health checks.
+		 * node to enable the health checks. When the monitor has a standby,
+		 * health checks come from whichever of them is the primary.
 		 */
-		if (!primary_create_user_with_hba(postgres,
-										  PG_AUTOCTL_HEALTH_USERNAME, password,
-										  monitorHostname, authMethod))
+		for (hostIndex = 0; hostIndex < monitorHosts.count; hostIndex++)
 		{
-			log_error(
-				"Failed to initialise postgres as primary because "
-				"creating the database user that the pg_auto_failover monitor "
-				"uses for health checks failed, see above for details");
-			return false;
+			if (!primary_create_user_with_hba(postgres,
+											  PG_AUTOCTL_HEALTH_USERNAME,
+											  password,
+											  monitorHosts.nodes[hostIndex].host,
+											  authMethod))
+			{
+				log_error(
+					"Failed to initialise postgres as primary because "
+					"creating the database user that the pg_auto_failover "
+					"monitor uses for health checks failed, "
+					"see above for details");
+				return false;
+			}
 		}
 	}
 
@@ -362,29 +371,83 @@ fsm_disable_replication(Keeper *keeper)
  *
  *    start_postgres
  * && disable_synchronous_replication
+ * && resume writes
  * && drop_replication_slot
  *
- * So we reuse fsm_disable_replication() here, rather than copy/pasting the same
- * bits code in the fsm_resume_as_primary() function body. If the definition of
- * the fsm_resume_as_primary transition ever came to diverge from whatever
- * fsm_disable_replication() is doing, we'd have to copy/paste and maintain
- * separate code path.
+ * This is what fsm_disable_replication() does, and we also resume writes that
+ * might have been paused when draining. Both settings are changed with a
+ * single configuration reload.
  */
 bool
 fsm_resume_as_primary(Keeper *keeper)
 {
+	KeeperConfig *config = &(keeper->config);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	GUCBatch settings = { 0 };
+
+	if (!keeper_start_postgres(keeper))
+	{
+		return false;
+	}
+
+	log_info("Disabling synchronous replication and resuming writes");
+
+	if (!pgsql_guc_batch_add(&settings, "synchronous_standby_names", "''") ||
+		!pgsql_guc_batch_add(&settings, "default_transaction_read_only", "'off'") ||
+		!primary_apply_settings(postgres, &settings))
+	{
+		log_error("Failed to disable synchronous replication and set "
+				  "default_transaction_read_only to off in order to resume "
+				  "as a primary, see above for details");
+		return false;
+	}
+
+	if (!primary_drop_replication_slots(postgres))
+	{
+		log_error("Failed to disable replication because dropping the replication "
+				  "slot \"%s\" used by the standby failed, see above for details",
+				  config->replication_slot_name);
+		return false;
+	}
+
+	publish_local_node_as_primary(keeper);
+
+	return true;
+}
+
+
+/*
+ * fsm_resume_after_switchover is used when the monitor gave up on a planned
+ * switchover, because this node never reported a clean shutdown or no
+ * standby node could be promoted in time. The standby nodes still follow us,
+ * so we keep the replication slots, and resume writes with synchronous
+ * replication disabled until a standby node has caught up again.
+ */
+bool
+fsm_resume_after_switchover(Keeper *keeper)
+{
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	GUCBatch settings = { 0 };
+
 	if (!keeper_start_postgres(keeper))
 	{
 		return false;
 	}
 
-	if (!fsm_disable_replication(keeper))
+	log_info("Resuming writes after the switchover did not complete");
+
+	if (!pgsql_guc_batch_add(&settings, "synchronous_standby_names", "''") ||
+		!pgsql_guc_batch_add(&settings, "default_transaction_read_only", "'off'") ||
+		!primary_apply_settings(postgres, &settings))
 	{
-		log_error("Failed to disable synchronous replication in order to "
-				  "resume as a primary, see above for details");
+		log_error("Failed to disable synchronous replication and set "
+				  "default_transaction_read_only to off in order to resume "
+				  "as a primary, see above for details");
 		return false;
 	}
 
+	publish_local_node_as_primary(keeper);
+
 	return true;
 }
 
@@ -473,11 +536,24 @@ prepare_replication(Keeper *keeper, NodeState otherNodeState)
 	 * going to try and add HBA entries and create replication slots again.
 	 * Both operations succeed when their target entry already exists.
 	 *
+	 * The HBA entries for all the standby nodes are added in a single edit of
+	 * the pg_hba.conf file, followed by a single reload.
+	 *
 	 * Note that primary_create_replication_slot() is idempotent thanks to
 	 * first dropping the target replication slot, then creating it again. We
 	 * might want to avoid drop/create noise on those servers that we managed
 	 * to process in the previous loop.
 	 */
+	if (!primary_add_standbys_to_hba(postgres,
+									 &(keeper->otherNodes),
+									 config->replication_password))
+	{
+		log_error("Failed to grant access to the standby nodes "
+				  "by adding relevant lines to pg_hba.conf for the standby "
+				  "hostnames and user, see above for details");
+		return false;
+	}
+
 	for (nodeIndex = 0; nodeIndex < keeper->otherNodes.count; nodeIndex++)
 	{
 		NodeAddress *otherNode = &(keeper->otherNodes.nodes[nodeIndex]);
@@ -486,17 +562,6 @@ prepare_replication(Keeper *keeper, NodeState otherNodeState)
 		log_info("Preparing replication for standby node %d (%s:%d)",
 				 otherNode->nodeId, otherNode->host, otherNode->port);
 
-		if (!primary_add_standby_to_hba(postgres,
-										otherNode->host,
-										config->replication_password))
-		{
-			log_error("Failed to grant access to the standby %d (%s:%d) "
-					  "by adding relevant lines to pg_hba.conf for the standby "
-					  "hostname and user, see above for details",
-					  otherNode->nodeId, otherNode->host, otherNode->port);
-			return false;
-		}
-
 		if (!postgres_sprintf_replicationSlotName(otherNode->nodeId,
 												  replicationSlotName, BUFSIZE))
 		{
@@ -559,7 +624,8 @@ fsm_stop_replication(Keeper *keeper)
 		return false;
 	}
 
-	return fsm_promote_standby(keeper);
+	/* writes are resumed when reaching wait_primary */
+	return promote_standby(keeper, false);
 }
 
 
@@ -603,6 +669,63 @@ fsm_promote_standby_to_primary(Keeper *keeper)
 				  "target_session_attrs read-write");
 		return false;
 	}
+
+	publish_local_node_as_primary(keeper);
+
+	return true;
+}
+
+
+/*
+ * fsm_promote_standby_for_switchover is used when the monitor selected this
+ * standby to be the new primary in a planned switchover. The old primary has
+ * been shut down cleanly and we received all of its WAL already, so we can
+ * promote right away, skipping prepare_promotion and stop_replication.
+ */
+bool
+fsm_promote_standby_for_switchover(Keeper *keeper)
+{
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	GUCBatch settings = { 0 };
+
+	if (!ensure_local_postgres_is_running(postgres))
+	{
+		log_error("Failed to promote postgres because the server could not "
+				  "be started before promotion, see above for details");
+		return false;
+	}
+
+	if (!standby_promote(postgres))
+	{
+		log_error("Failed to promote the local postgres server from standby "
+				  "to wait_primary state, see above for details");
+		return false;
+	}
+
+	/*
+	 * We might have been drained as a primary in a previous switchover, and
+	 * the other nodes are going to follow us asynchronously at first: resume
+	 * writes and disable synchronous replication with a single reload.
+	 */
+	if (!pgsql_guc_batch_add(&settings, "default_transaction_read_only", "'off'") ||
+		!pgsql_guc_batch_add(&settings, "synchronous_standby_names", "''") ||
+		!primary_apply_settings(postgres, &settings))
+	{
+		log_error("Failed to set default_transaction_read_only to off "
+				  "and disable synchronous replication after promotion, "
+				  "see above for details");
+		return false;
+	}
+
+	/* the old primary and the other standby nodes are going to follow us */
+	if (!prepare_replication(keeper, ANY_STATE))
+	{
+		/* prepare_replication logs relevant errors */
+		return false;
+	}
+
+	publish_local_node_as_primary(keeper);
+
 	return true;
 }
 
@@ -691,6 +814,37 @@ fsm_stop_postgres(Keeper *keeper)
 }
 
 
+/*
+ * fsm_drain_and_stop_postgres is used when the primary is asked to step down.
+ * Before stopping Postgres we pause writes and terminate idle sessions in
+ * batches, and we stop publishing ourselves as the primary, so that clients
+ * and connection poolers can move to the new primary without all of them
+ * reconnecting at the same time.
+ *
+ * Draining is done on a best effort basis: failing to drain must not prevent
+ * us from stopping Postgres.
+ */
+bool
+fsm_drain_and_stop_postgres(Keeper *keeper)
+{
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+
+	publish_primary(keeper, NULL);
+
+	if (pg_setup_is_running(pgSetup))
+	{
+		if (!primary_drain_sessions(postgres))
+		{
+			log_warn("Failed to drain client sessions before stopping "
+					 "Postgres, see above for details");
+		}
+	}
+
+	return fsm_stop_postgres(keeper);
+}
+
+
 
 /*
  * fsm_init_standby is used when the primary is now ready to accept a standby,
@@ -747,6 +901,8 @@ fsm_init_standby(Keeper *keeper)
 		return false;
 	}
 
+	publish_primary(keeper, &(replicationSource.primaryNode));
+
 	/* now, in case we have an init state file around, remove it */
 	return unlink_file(config->pathnames.init);
 }
@@ -818,6 +974,8 @@ fsm_rewind_or_init(Keeper *keeper)
 		}
 	}
 
+	publish_primary(keeper, &(replicationSource.primaryNode));
+
 	/* prepare the standby's replication slot name */
 	if (!postgres_sprintf_replicationSlotName(
 			keeper->otherNodes.nodes[0].nodeId,
@@ -845,6 +1003,176 @@ fsm_rewind_or_init(Keeper *keeper)
 }
 
 
+/*
+ * fsm_follow_new_primary is used after a planned switchover, when the old
+ * primary has been shut down cleanly and the other standby nodes need to
+ * follow the newly promoted primary.
+ *
+ * Because the old primary was stopped with a shutdown checkpoint that the
+ * new primary received before being promoted, its timeline did not diverge
+ * and we only need to edit the replication setup and restart Postgres, with
+ * no pg_rewind or pg_basebackup involved. When that's not the case, we fall
+ * back to fsm_rewind_or_init.
+ */
+bool
+fsm_follow_new_primary(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	Monitor *monitor = &(keeper->monitor);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+
+	ReplicationSource replicationSource = { 0 };
+	int groupId = keeper->state.current_group;
+	bool fromDraining = keeper->state.current_role == DRAINING_STATE;
+
+	char applicationName[BUFSIZE] = { 0 };
+
+	if (fromDraining)
+	{
+		bool missing_ok = false;
+
+		if (!pg_controldata(pgSetup, missing_ok))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		if (!pgSetup->control.cluster_is_shut_down)
+		{
+			log_warn("Postgres was not shut down cleanly during switchover, "
+					 "using pg_rewind to follow the new primary");
+			return fsm_rewind_or_init(keeper);
+		}
+	}
+
+	/* get the primary node to follow */
+	if (!config->monitorDisabled)
+	{
+		if (!monitor_get_primary(monitor, config->formation, groupId,
+								 &replicationSource.primaryNode))
+		{
+			log_error("Failed to follow the new primary because get the "
+					  "primary node from the monitor failed, "
+					  "see above for details");
+			return false;
+		}
+	}
+	else
+	{
+		/* copy information from keeper->otherNodes into replicationSource */
+		strlcpy(replicationSource.primaryNode.host,
+				keeper->otherNodes.nodes[0].host, _POSIX_HOST_NAME_MAX);
+
+		replicationSource.primaryNode.port = keeper->otherNodes.nodes[0].port;
+	}
+
+	/* when we already stream from the new primary, there's nothing to do */
+	if (keeper->state.current_role == SECONDARY_STATE)
+	{
+		PGSQL *pgsql = &(postgres->sqlClient);
+		bool isStreaming = false;
+		bool success =
+			pgsql_is_streaming(pgsql,
+							   replicationSource.primaryNode.host,
+							   replicationSource.primaryNode.port,
+							   &isStreaming);
+
+		pgsql_finish(pgsql);
+
+		if (success && isStreaming)
+		{
+			publish_primary(keeper, &(replicationSource.primaryNode));
+			return true;
+		}
+	}
+
+	replicationSource.userName = PG_AUTOCTL_REPLICA_USERNAME;
+	replicationSource.password = config->replication_password;
+	replicationSource.slotName = config->replication_slot_name;
+	replicationSource.maximumBackupRate = config->maximum_backup_rate;
+	replicationSource.backupDir = config->backupDirectory;
+	replicationSource.sslOptions = config->pgSetup.ssl;
+
+	/* prepare our application_name */
+	sformat(applicationName, BUFSIZE,
+			"%s%d",
+			REPLICATION_APPLICATION_NAME_PREFIX,
+			keeper->state.current_node_id);
+	replicationSource.applicationName = applicationName;
+
+	if (!standby_follow_new_primary(postgres, &replicationSource))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	publish_primary(keeper, &(replicationSource.primaryNode));
+
+	/* the replication slots of the old primary are of no use anymore */
+	if (fromDraining && !primary_drop_replication_slots(postgres))
+	{
+		log_error("Failed to drop replication slots left over from the "
+				  "time this node was a primary");
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * fsm_follow_primary_if_changed is used when a secondary node is assigned
+ * catchingup. That happens when the monitor considers it unhealthy, and then
+ * there's nothing to do, or after a switchover, where the node needs to
+ * follow the new primary. We tell both cases apart by comparing the primary
+ * node that we published when we started following it with the current one.
+ */
+bool
+fsm_follow_primary_if_changed(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	Monitor *monitor = &(keeper->monitor);
+	NodeAddress primaryNode = { 0 };
+	char expected[BUFSIZE] = { 0 };
+	char *published = NULL;
+	long size = 0L;
+	bool samePrimary = false;
+
+	if (config->monitorDisabled)
+	{
+		return true;
+	}
+
+	if (!monitor_get_primary(monitor, config->formation,
+							 keeper->state.current_group, &primaryNode))
+	{
+		log_error("Failed to get the primary node from the monitor, "
+				  "see above for details");
+		return false;
+	}
+
+	sformat(expected, BUFSIZE, "host=%s port=%d\n",
+			primaryNode.host, primaryNode.port);
+
+	if (file_exists(config->pathnames.primary) &&
+		read_file(config->pathnames.primary, &published, &size))
+	{
+		samePrimary = strcmp(published, expected) == 0;
+		free(published);
+	}
+
+	if (samePrimary)
+	{
+		log_debug("Still following the primary node %s:%d",
+				  primaryNode.host, primaryNode.port);
+		return true;
+	}
+
+	return fsm_follow_new_primary(keeper);
+}
+
+
 /*
  * fsm_prepare_standby_for_promotion used when the standby is asked to prepare
  * its own promotion.
@@ -887,15 +1215,114 @@ fsm_start_maintenance_on_standby(Keeper *keeper)
 
 /*
  * fsm_restart_standby is used when restarting standby after manual maintenance
- * is done.
+ * is done. When Postgres is still running we restart it only when whatever
+ * was done during maintenance needs it: settings that are pending a restart,
+ * or a new minor version of Postgres installed. A rolling restart always
+ * restarts Postgres, that's what it was asked for.
  */
 bool
 fsm_restart_standby(Keeper *keeper)
 {
+	KeeperConfig *config = &(keeper->config);
+	PostgresSetup *pgSetup = &(keeper->postgres.postgresSetup);
+
+	if (pg_setup_is_running(pgSetup))
+	{
+		bool needsRestart = false;
+
+		if (!config->monitorDisabled &&
+			!monitor_is_restarting_node(&(keeper->monitor),
+										keeper->state.current_node_id,
+										&needsRestart))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		if (needsRestart)
+		{
+			log_info("Restarting Postgres as part of a rolling restart");
+
+			return keeper_restart_postgres(keeper);
+		}
+
+		if (!fsm_postgres_needs_restart(keeper, &needsRestart))
+		{
+			log_error("Failed to check whether Postgres needs a restart "
+					  "after maintenance, see above for details");
+			return false;
+		}
+
+		if (!needsRestart)
+		{
+			log_info("Postgres does not need a restart after maintenance");
+			return true;
+		}
+
+		log_info("Restarting Postgres after maintenance");
+
+		return keeper_restart_postgres(keeper);
+	}
+
 	return fsm_start_postgres(keeper);
 }
 
 
+/*
+ * fsm_postgres_needs_restart sets needsRestart to true when the running
+ * Postgres instance has settings pending a restart, or when the pg_ctl
+ * program we use now belongs to another version than the running server.
+ */
+static bool
+fsm_postgres_needs_restart(Keeper *keeper, bool *needsRestart)
+{
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+	PGSQL *pgsql = &(postgres->sqlClient);
+	char serverVersion[PG_VERSION_STRING_MAX] = { 0 };
+	char *installedVersion = NULL;
+	bool pendingRestart = false;
+	bool success =
+		pgsql_has_pending_restart(pgsql, &pendingRestart) &&
+		pgsql_get_server_version(pgsql, serverVersion, PG_VERSION_STRING_MAX);
+
+	pgsql_finish(pgsql);
+
+	if (!success)
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (pendingRestart)
+	{
+		log_info("Postgres has settings pending a restart");
+		*needsRestart = true;
+		return true;
+	}
+
+	installedVersion = pg_ctl_version(pgSetup->pg_ctl);
+
+	if (installedVersion == NULL)
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	*needsRestart = strcmp(installedVersion, serverVersion) != 0;
+
+	if (*needsRestart)
+	{
+		log_info("Postgres %s is running and %s is now installed at \"%s\"",
+				 serverVersion, installedVersion, pgSetup->pg_ctl);
+	}
+
+	free(installedVersion);
+
+	return true;
+}
+
+
 /*
  * The following actions are needed to promote a standby, and used in several
  * situations in the FSM transitions:
@@ -905,11 +1332,27 @@ fsm_restart_standby(Keeper *keeper)
  * && add_standby_to_hba
  * && create_replication_slot
  * && disable_synchronous_replication
+ * && resume_writes
  */
 bool
 fsm_promote_standby(Keeper *keeper)
+{
+	bool resumeWrites = true;
+
+	return promote_standby(keeper, resumeWrites);
+}
+
+
+/*
+ * promote_standby implements fsm_promote_standby. When resumeWrites is false,
+ * default_transaction_read_only is left as it is, which fsm_stop_replication
+ * needs until the monitor assigns the wait_primary state.
+ */
+static bool
+promote_standby(Keeper *keeper, bool resumeWrites)
 {
 	LocalPostgresServer *postgres = &(keeper->postgres);
+	GUCBatch settings = { 0 };
 
 	if (!ensure_local_postgres_is_running(postgres))
 	{
@@ -942,12 +1385,56 @@ fsm_promote_standby(Keeper *keeper)
 		return false;
 	}
 
-	if (!primary_disable_synchronous_replication(postgres))
+	/*
+	 * We might have been drained as a primary in a previous switchover, and
+	 * default_transaction_read_only then followed the data directory: resume
+	 * writes and disable synchronous replication with a single reload.
+	 */
+	if (!pgsql_guc_batch_add(&settings, "synchronous_standby_names", "''") ||
+		(resumeWrites &&
+		 !pgsql_guc_batch_add(&settings,
+							  "default_transaction_read_only", "'off'")) ||
+		!primary_apply_settings(postgres, &settings))
 	{
-		log_error("Failed to disable synchronous replication after promotion, "
-				  "see above for details");
+		log_error("Failed to disable synchronous replication "
+				  "after promotion, see above for details");
 		return false;
 	}
 
 	return true;
 }
+
+
+/*
+ * publish_primary writes the given primary node address to our local
+ * pg_autoctl.primary file, or removes the file when primaryNode is NULL.
+ * Failing to do so must not fail the transition, so we only log a warning.
+ */
+static void
+publish_primary(Keeper *keeper, NodeAddress *primaryNode)
+{
+	if (!keeper_publish_primary(keeper, primaryNode))
+	{
+		log_warn("Failed to publish the current primary node to \"%s\"",
+				 keeper->config.pathnames.primary);
+	}
+}
+
+
+/*
+ * publish_local_node_as_primary publishes the local node as the current
+ * primary node of the group.
+ */
+static void
+publish_local_node_as_primary(Keeper *keeper)
+{
+	KeeperConfig *config = &(keeper->config);
+	NodeAddress localNode = { 0 };
+
+	localNode.nodeId = keeper->state.current_node_id;
+	localNode.port = config->pgSetup.pgport;
+	localNode.isPrimary = true;
+	strlcpy(localNode.host, config->nodename, _POSIX_HOST_NAME_MAX);
+
+	publish_primary(keeper, &localNode);
+}
@@ -15,6 +15,7 @@
 
 #include "parson.h"
 
+#include "clock_utils.h"
 #include "file_utils.h"
 #include "keeper.h"
 #include "keeper_config.h"
@@ -64,7 +65,29 @@ keeper_load_state(Keeper *keeper)
 	KeeperStateData *keeperState = &(keeper->state);
 	KeeperConfig *config = &(keeper->config);
 
-	return keeper_state_read(keeperState, config->pathnames.state);
+	if (!keeper_state_read(keeperState, config->pathnames.state))
+	{
+		return false;
+	}
+
+	/*
+	 * When starting, initialize our monotonic clocks from the wall-clock
+	 * timestamps in the state file, so that network partition detection
+	 * survives a restart of pg_autoctl.
+	 */
+	if (keeper->lastMonitorContactMs == 0)
+	{
+		keeper->lastMonitorContactMs =
+			monotonic_clock_from_epoch(keeperState->last_monitor_contact);
+	}
+
+	if (keeper->lastSecondaryContactMs == 0)
+	{
+		keeper->lastSecondaryContactMs =
+			monotonic_clock_from_epoch(keeperState->last_secondary_contact);
+	}
+
+	return true;
 }
 
 
@@ -96,6 +119,7 @@ keeper_update_state(Keeper *keeper, int node_id, int group_id,
 	if (update_last_monitor_contact)
 	{
 		keeperState->last_monitor_contact = now;
+		keeper->lastMonitorContactMs = monotonic_clock_ms();
 	}
 	keeperState->current_node_id = node_id;
 	keeperState->current_group = group_id;
@@ -197,7 +221,7 @@ keeper_ensure_current_state(Keeper *keeper)
 			if (postgres->pgIsRunning)
 			{
 				/* reset PostgreSQL restart failures tracking */
-				postgres->pgFirstStartFailureTs = 0;
+				postgres->pgFirstStartFailureMs = 0;
 				postgres->pgStartRetries = 0;
 
 				return true;
@@ -290,8 +314,9 @@ ReportPgIsRunning(Keeper *keeper)
 	LocalPostgresServer *postgres = &(keeper->postgres);
 
 	int retries = config->postgresql_restart_failure_max_retries;
-	int timeout = config->postgresql_restart_failure_timeout;
-	uint64_t now = time(NULL);
+	uint64_t timeoutMs =
+		(uint64_t) config->postgresql_restart_failure_timeout * MSECS_PER_SEC;
+	uint64_t nowMs = monotonic_clock_ms();
 
 	if (keeperState->current_role != PRIMARY_STATE)
 	{
@@ -315,7 +340,7 @@ ReportPgIsRunning(Keeper *keeper)
 	{
 		return postgres->pgIsRunning;
 	}
-	else if (postgres->pgFirstStartFailureTs == 0)
+	else if (postgres->pgFirstStartFailureMs == 0)
 	{
 		/*
 		 * Oh, that's quite strange. It means we just fell in a code path where
@@ -327,7 +352,7 @@ ReportPgIsRunning(Keeper *keeper)
 
 		return postgres->pgIsRunning;
 	}
-	else if ((now - postgres->pgFirstStartFailureTs) > timeout
+	else if ((nowMs - postgres->pgFirstStartFailureMs) > timeoutMs
 		|| postgres->pgStartRetries >= retries)
 	{
 		/*
@@ -337,10 +362,10 @@ ReportPgIsRunning(Keeper *keeper)
 		 * reporting).
 		 */
 		log_error("Failed to restart PostgreSQL %d times in the "
-				  "last %" PRIu64 "s, reporting PostgreSQL not running to "
+				  "last %" PRIu64 "ms, reporting PostgreSQL not running to "
 				  "the pg_auto_failover monitor.",
 				  postgres->pgStartRetries,
-				  now - postgres->pgFirstStartFailureTs);
+				  nowMs - postgres->pgFirstStartFailureMs);
 
 		return false;
 	}
@@ -392,6 +417,7 @@ keeper_update_pg_state(Keeper *keeper)
 	postgres->pgIsRunning = false;
 	memset(postgres->pgsrSyncState, 0, PGSR_SYNC_STATE_MAXLENGTH);
 	strlcpy(postgres->currentLSN, "0/0", sizeof(postgres->currentLSN));
+	memset(&(postgres->standbys), 0, sizeof(StandbyTelemetry));
 
 	/*
 	 * In some states, it's ok to not have a PostgreSQL data directory at all.
@@ -535,14 +561,16 @@ keeper_update_pg_state(Keeper *keeper)
 		 *
 		 * Also update our view of pg_is_in_recovery, the replication sync
 		 * state when we are a primary with a standby currently using our
-		 * replication slot, and our current LSN position.
+		 * replication slot, our current LSN position, and what we see of
+		 * our standby nodes when we are a primary.
 		 *
 		 */
 		if (!pgsql_get_postgres_metadata(pgsql,
 										 config->replication_slot_name,
 										 &pgSetup->is_in_recovery,
 										 postgres->pgsrSyncState,
-										 postgres->currentLSN))
+										 postgres->currentLSN,
+										 &(postgres->standbys)))
 		{
 			log_error("Failed to update the local Postgres metadata");
 			return false;
@@ -552,6 +580,20 @@ keeper_update_pg_state(Keeper *keeper)
 	{
 		/* Postgres is not running. */
 		postgres->pgIsRunning = false;
+
+		/*
+		 * When draining, report the location of our shutdown checkpoint so
+		 * that the monitor can check that the standby node it promotes
+		 * received all of our WAL. Only a clean shut down allows for that.
+		 */
+		if (keeperState->current_role == DRAINING_STATE
+			&& pgSetup->control.cluster_is_shut_down
+			&& !IS_EMPTY_STRING_BUFFER(pgSetup->control.latest_checkpoint_lsn))
+		{
+			strlcpy(postgres->currentLSN,
+					pgSetup->control.latest_checkpoint_lsn,
+					sizeof(postgres->currentLSN));
+		}
 	}
 
 	/*
@@ -601,18 +643,32 @@ keeper_update_pg_state(Keeper *keeper)
 
 
 /*
- * keeper_start_postgres calls pg_ctl_start and then update our local
- * PostgreSQL instance setup and connection string to reflect the new reality.
+ * keeper_start_postgres calls pg_ctl_start, or starts the postmaster as our
+ * own child process when postgresql.supervise is set, and then update our
+ * local PostgreSQL instance setup and connection string to reflect the new
+ * reality.
  */
 bool
 keeper_start_postgres(Keeper *keeper)
 {
 	PostgresSetup *pgSetup = &(keeper->config.pgSetup);
+	bool started = false;
 
-	if (!pg_ctl_start(pgSetup->pg_ctl,
-					  pgSetup->pgdata,
-					  pgSetup->pgport,
-					  pgSetup->listen_addresses))
+	if (pgSetup->supervise)
+	{
+		PostgresSetup newPgSetup = *pgSetup;
+
+		started = pg_start_postmaster(&newPgSetup);
+	}
+	else
+	{
+		started = pg_ctl_start(pgSetup->pg_ctl,
+							   pgSetup->pgdata,
+							   pgSetup->pgport,
+							   pgSetup->listen_addresses);
+	}
+
+	if (!started)
 	{
 		log_error("Failed to start PostgreSQL at \"%s\" on port %d, "
 				  "see above for details.",
@@ -632,13 +688,34 @@ keeper_start_postgres(Keeper *keeper)
 /*
  * keeper_restart_postgres calls pg_ctl_restart and then update our local
  * PostgreSQL instance setup and connection string to reflect the new reality.
+ *
+ * When postgresql.supervise is set, pg_ctl restart would leave behind a
+ * postmaster that is not our child process anymore, so instead we stop
+ * Postgres and start the postmaster again ourselves.
  */
 bool
 keeper_restart_postgres(Keeper *keeper)
 {
 	PostgresSetup *pgSetup = &(keeper->postgres.postgresSetup);
+	bool restarted = false;
 
-	if (!pg_ctl_restart(pgSetup->pg_ctl, pgSetup->pgdata))
+	if (pgSetup->supervise)
+	{
+		PostgresSetup newPgSetup = *pgSetup;
+
+		restarted = pg_ctl_stop(pgSetup->pg_ctl, pgSetup->pgdata);
+
+		/* reap the postmaster before starting a new one */
+		(void) pg_reap_postmaster();
+
+		restarted = restarted && pg_start_postmaster(&newPgSetup);
+	}
+	else
+	{
+		restarted = pg_ctl_restart(pgSetup->pg_ctl, pgSetup->pgdata);
+	}
+
+	if (!restarted)
 	{
 		log_error("Failed to restart PostgreSQL instance at \"%s\", "
 				  "see above for details.", pgSetup->pgdata);
@@ -654,6 +731,35 @@ keeper_restart_postgres(Keeper *keeper)
 }
 
 
+/*
+ * keeper_publish_primary writes the address of the current primary node of
+ * our group to the pg_autoctl.primary runtime file, or removes the file when
+ * primaryNode is NULL, such as while a switchover is in progress. Connection
+ * poolers running on the same host can watch that file to redirect clients
+ * without having to query the monitor.
+ */
+bool
+keeper_publish_primary(Keeper *keeper, NodeAddress *primaryNode)
+{
+	KeeperConfig *config = &(keeper->config);
+	char contents[BUFSIZE] = { 0 };
+
+	if (primaryNode == NULL)
+	{
+		return unlink_file(config->pathnames.primary);
+	}
+
+	sformat(contents, BUFSIZE, "host=%s port=%d\n",
+			primaryNode->host, primaryNode->port);
+
+	log_debug("Publishing primary %s:%d to \"%s\"",
+			  primaryNode->host, primaryNode->port,
+			  config->pathnames.primary);
+
+	return write_file(contents, strlen(contents), config->pathnames.primary);
+}
+
+
 /*
  * keeper_check_monitor_extension_version checks that the monitor we connect to
  * has an extension version compatible with our expectations.
@@ -807,6 +913,7 @@ keeper_register_and_init(Keeper *keeper,
 							   config->pgSetup.pgKind,
 							   config->pgSetup.settings.candidatePriority,
 							   config->pgSetup.settings.replicationQuorum,
+							   config->zone,
 							   &assignedState))
 	{
 		/* errors have already been logged, remove state file */
@@ -11,11 +11,14 @@
 #define KEEPER_H
 
 #include "commandline.h"
+#include "control.h"
 #include "keeper_config.h"
 #include "log.h"
 #include "monitor.h"
 #include "primary_standby.h"
 #include "state.h"
+#include "status.h"
+#include "watchdog.h"
 
 /* the keeper manages a postgres server according to the given configuration */
 typedef struct Keeper
@@ -25,6 +28,24 @@ typedef struct Keeper
 	KeeperStateData state;
 	Monitor monitor;
 
+	/*
+	 * The state file keeps wall-clock timestamps of our last contacts with
+	 * the monitor and the standby, mostly for display purposes. Network
+	 * partition detection uses the same information on the monotonic clock,
+	 * in milliseconds, see clock_utils.h.
+	 */
+	uint64_t lastMonitorContactMs;
+	uint64_t lastSecondaryContactMs;
+
+	/* stops Postgres on a network partition while the main loop is busy */
+	FencingWatchdog watchdog;
+
+	/* status page for local readers, see status.c */
+	KeeperStatus status;
+
+	/* commands from local clients, see control.c */
+	ControlSocket control;
+
 	/*
 	 * When running without monitor, we need a place to stash the otherNodes
 	 * information. This is necessary in some transitions.
@@ -43,6 +64,7 @@ bool keeper_update_state(Keeper *keeper, int node_id, int group_id, NodeState st
 						 bool update_last_monitor_contact);
 bool keeper_start_postgres(Keeper *keeper);
 bool keeper_restart_postgres(Keeper *keeper);
+bool keeper_publish_primary(Keeper *keeper, NodeAddress *primaryNode);
 bool keeper_should_ensure_current_state_before_transition(Keeper *keeper);
 bool keeper_ensure_current_state(Keeper *keeper);
 bool keeper_update_pg_state(Keeper *keeper);
@@ -60,6 +82,7 @@ bool keeper_init_state_discover(Keeper *keeper, KeeperStateInit *initState);
 bool keeper_service_init(Keeper *keeper, pid_t *pid);
 bool keeper_service_stop(Keeper *keeper);
 bool keeper_service_run(Keeper *keeper, pid_t *start_pid);
+bool keeper_service_run_instances(Keeper *keepers, int count, pid_t pid);
 bool read_pidfile(const char *pidfile, pid_t *pid);
 
 #endif /* KEEPER_H */
@@ -44,6 +44,10 @@
 	make_strbuf_option("pg_autoctl", "nodekind", NULL, false, NAMEDATALEN, \
 					   config->nodeKind)
 
+#define OPTION_AUTOCTL_ZONE(config) \
+	make_strbuf_option("pg_autoctl", "zone", "zone", false, NAMEDATALEN, \
+					   config->zone)
+
 #define OPTION_POSTGRESQL_PGDATA(config) \
 	make_strbuf_option("postgresql", "pgdata", "pgdata", true, MAXPGPATH, \
 					   config->pgSetup.pgdata)
@@ -74,6 +78,10 @@
 	make_int_option("postgresql", "proxyport", "proxyport", \
 					false, &(config->pgSetup.proxyport))
 
+#define OPTION_POSTGRESQL_SUPERVISE(config)							\
+	make_int_option_default("postgresql", "supervise", NULL,		\
+							false, &(config->pgSetup.supervise), 0)
+
 #define OPTION_POSTGRESQL_LISTEN_ADDRESSES(config) \
 	make_strbuf_option("postgresql", "listen_addresses", "listen", \
 					   false, MAXPGPATH, config->pgSetup.listen_addresses)
@@ -167,6 +175,7 @@
 		OPTION_AUTOCTL_GROUPID(config), \
 		OPTION_AUTOCTL_NODENAME(config), \
 		OPTION_AUTOCTL_NODEKIND(config), \
+		OPTION_AUTOCTL_ZONE(config), \
 		OPTION_POSTGRESQL_PGDATA(config), \
 		OPTION_POSTGRESQL_PG_CTL(config), \
 		OPTION_POSTGRESQL_USERNAME(config), \
@@ -174,6 +183,7 @@
 		OPTION_POSTGRESQL_HOST(config), \
 		OPTION_POSTGRESQL_PORT(config), \
 		OPTION_POSTGRESQL_PROXY_PORT(config), \
+		OPTION_POSTGRESQL_SUPERVISE(config), \
 		OPTION_POSTGRESQL_LISTEN_ADDRESSES(config), \
 		OPTION_POSTGRESQL_AUTH_METHOD(config), \
 		OPTION_SSL_ACTIVE(config), \
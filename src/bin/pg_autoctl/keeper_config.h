@@ -32,6 +32,7 @@ typedef struct KeeperConfig
 	int groupId;
 	char nodename[_POSIX_HOST_NAME_MAX];
 	char nodeKind[NAMEDATALEN];
+	char zone[NAMEDATALEN];
 
 	/* PostgreSQL setup */
 	PostgresSetup pgSetup;
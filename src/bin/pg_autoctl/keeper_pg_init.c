@@ -7,13 +7,21 @@
  *
  */
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "cli_common.h"
+#include "clock_utils.h"
 #include "debian.h"
 #include "defaults.h"
 #include "env_utils.h"
+#include "file_utils.h"
 #include "fsm.h"
 #include "keeper.h"
 #include "keeper_config.h"
@@ -43,12 +51,34 @@ bool keeperInitWarnings = false;
 
 static KeeperStateInit initState = { 0 };
 
+/*
+ * When creating the first node of a group, initdb is the slowest step and it
+ * doesn't depend on the monitor: we run it in a child process while we
+ * register, in a directory next to PGDATA, and move it in place only when
+ * the monitor assigns us SINGLE_STATE. See keeper_pg_init_start_initdb().
+ */
+typedef struct InitdbProcess
+{
+	pid_t pid;
+	char pgdata[MAXPGPATH];		/* where initdb runs */
+	char target[MAXPGPATH];		/* PGDATA, with symbolic links resolved */
+} InitdbProcess;
+
 static bool keeper_pg_init_fsm(Keeper *keeper, KeeperConfig *config);
 static bool keeper_pg_init_and_register(Keeper *keeper, KeeperConfig *config);
 static bool reach_initial_state(Keeper *keeper);
 static bool wait_until_primary_is_ready(Keeper *config,
 										MonitorAssignedState *assignedState);
 static bool keeper_pg_init_node_active(Keeper *keeper);
+static bool keeper_pg_init_start_initdb(Keeper *keeper,
+										KeeperConfig *config,
+										InitdbProcess *initdb);
+static bool keeper_pg_init_initdb_target(const char *pgdata,
+										 InitdbProcess *initdb);
+static bool keeper_pg_init_finish_initdb(Keeper *keeper,
+										 InitdbProcess *initdb);
+static void keeper_pg_init_discard_initdb(InitdbProcess *initdb);
+
 /*
  * keeper_pg_init initializes a pg_autoctl keeper and its local PostgreSQL.
  *
@@ -252,8 +282,13 @@ keeper_pg_init_and_register(Keeper *keeper, KeeperConfig *config)
 		 * case other keeper are concurrently registering other nodes.
 		 *
 		 * So our strategy is to ask the monitor to pick a state for us and
-		 * then implement whatever was decided.
+		 * then implement whatever was decided. Meanwhile, we already run
+		 * initdb in case we are the first node.
 		 */
+		InitdbProcess initdb = { 0 };
+
+		(void) keeper_pg_init_start_initdb(keeper, config, &initdb);
+
 		if (!keeper_register_and_init(keeper, config, INIT_STATE))
 		{
 			log_error("Failed to register the existing local Postgres node "
@@ -262,12 +297,25 @@ keeper_pg_init_and_register(Keeper *keeper, KeeperConfig *config)
 					  "see above for details",
 					  config->nodename, config->pgSetup.pgport,
 					  config->pgSetup.pgdata, config->monitor_pguri);
+
+			(void) keeper_pg_init_discard_initdb(&initdb);
 			return false;
 		}
 
 		log_info("Successfully registered as \"%s\" to the monitor.",
 				 NodeStateToString(keeper->state.assigned_role));
 
+		if (keeper->state.assigned_role == SINGLE_STATE)
+		{
+			/* when it fails, the INIT ➜ SINGLE transition runs initdb */
+			(void) keeper_pg_init_finish_initdb(keeper, &initdb);
+		}
+		else
+		{
+			/* standby nodes get their PGDATA from pg_basebackup */
+			(void) keeper_pg_init_discard_initdb(&initdb);
+		}
+
 		return reach_initial_state(keeper);
 	}
 
@@ -468,10 +516,17 @@ reach_initial_state(Keeper *keeper)
 
 
 /*
- * wait_until_primary_is_ready calls monitor_node_active every second until the
- * monitor tells us that we can move from our current state
- * (WAIT_STANDBY_STATE) to CATCHINGUP_STATE, which only happens when the
- * primary successfully prepared for Streaming Replication.
+ * wait_until_primary_is_ready calls monitor_node_active until the monitor
+ * tells us that we can move from our current state (WAIT_STANDBY_STATE) to
+ * CATCHINGUP_STATE, which only happens when the primary successfully
+ * prepared for Streaming Replication.
+ *
+ * In between calls, we LISTEN to the monitor's "state" channel so that we
+ * call node_active again as soon as the primary reports that it's ready for
+ * us, in either the wait_primary or the join_primary state, rather than at
+ * the next PG_AUTOCTL_KEEPER_SLEEP_TIME tick: the monitor assigns us
+ * CATCHINGUP_STATE in that call. When the notifications are not available,
+ * we poll the monitor instead.
  */
 static bool
 wait_until_primary_is_ready(Keeper *keeper,
@@ -482,6 +537,22 @@ wait_until_primary_is_ready(Keeper *keeper,
 	char *pgsrSyncState = "";
 	int errors = 0, tries = 0;
 	bool firstLoop = true;
+	char *channels[] = { "state", NULL };
+	Monitor listener = { 0 };
+	bool listening = false;
+
+	/* LISTEN first, so that we don't miss a notification */
+	if (monitor_init(&listener, keeper->monitor.pgsql.connectionString))
+	{
+		listening = pgsql_listen(&(listener.pgsql), channels);
+	}
+
+	if (!listening)
+	{
+		log_warn("Failed to listen to state changes from the monitor, "
+				 "polling the monitor every %ds instead",
+				 PG_AUTOCTL_KEEPER_SLEEP_TIME);
+	}
 
 	/* wait until the primary is ready for us to pg_basebackup */
 	do {
@@ -489,6 +560,23 @@ wait_until_primary_is_ready(Keeper *keeper,
 		{
 			firstLoop = false;
 		}
+		else if (listening)
+		{
+			bool ready = false;
+
+			if (!monitor_wait_for_primary_ready(
+					&listener,
+					keeper->config.formation,
+					keeper->state.current_group,
+					PG_AUTOCTL_KEEPER_SLEEP_TIME * MSECS_PER_SEC,
+					&ready))
+			{
+				log_warn("Lost the monitor notifications, "
+						 "polling the monitor every %ds instead",
+						 PG_AUTOCTL_KEEPER_SLEEP_TIME);
+				listening = false;
+			}
+		}
 		else
 		{
 			sleep(PG_AUTOCTL_KEEPER_SLEEP_TIME);
@@ -504,6 +592,7 @@ wait_until_primary_is_ready(Keeper *keeper,
 								 pgIsRunning,
 								 currrentLSN,
 								 pgsrSyncState,
+								 NULL,
 								 assignedState))
 		{
 			++errors;
@@ -516,6 +605,7 @@ wait_until_primary_is_ready(Keeper *keeper,
 				log_error("Failed to contact the monitor 5 times in a row now, "
 						  "so we stop trying. You can do `pg_autoctl create` "
 						  "to retry and finish the local setup");
+				pgsql_finish(&(listener.pgsql));
 				return false;
 			}
 		}
@@ -533,6 +623,8 @@ wait_until_primary_is_ready(Keeper *keeper,
 				  NodeStateToString(assignedState->state));
 	} while (assignedState->state != CATCHINGUP_STATE);
 
+	pgsql_finish(&(listener.pgsql));
+
 	/*
 	 * Update our state with the result from the monitor now.
 	 */
@@ -553,14 +645,15 @@ wait_until_primary_is_ready(Keeper *keeper,
 /*
  * create_database_and_extension does the following:
  *
- *  - ensures PostgreSQL is running
+ *  - installs our default settings and ensures PostgreSQL is running
  *  - create the proper role with login
  *  - to be able to fetch pg_hba.conf location and edit it for pg_autoctl
  *  - then createdb pgSetup.dbname, which might not be postgres
- *  - and restart PostgreSQL with the new setup, to make it active/current
+ *  - and restart PostgreSQL with the new setup, to make it active/current,
+ *    unless --fast is used and the new setup is already active
  *  - finally when pgKind is Citus, create the citus extension
  *
- * When pgKind is Citus, the setup we install in step 2 contains the
+ * When pgKind is Citus, the setup we install in step 1 contains the
  * shared_preload_libraries = 'citus' entry, so we can proceed with create
  * extension citus after the restart.
  */
@@ -576,7 +669,9 @@ create_database_and_extension(Keeper *keeper)
 	PostgresSetup initPgSetup = { 0 };
 	bool missingPgdataIsOk = false;
 	bool pgIsNotRunningIsOk = true;
+	bool needsRestart = true;
 	char hbaFilePath[MAXPGPATH];
+	HBAEditBatch hbaBatch = { 0 };
 
 	log_trace("create_database_and_extension");
 
@@ -592,16 +687,24 @@ create_database_and_extension(Keeper *keeper)
 	 * We need to make it so that the user can actually use that connection
 	 * string with at least the --username used to create the database.
 	 */
-	if (!pghba_ensure_host_rule_exists(hbaFilePath,
-									   pgSetup->ssl.active,
-									   HBA_DATABASE_DBNAME,
-									   pgSetup->dbname,
-									   pg_setup_get_username(pgSetup),
-									   config->nodename,
-									   pg_setup_get_auth_method(pgSetup)))
+	if (!pghba_batch_init(&hbaBatch, hbaFilePath))
+	{
+		log_error("Failed to read \"%s\", see above for details",
+				  hbaFilePath);
+		return false;
+	}
+
+	if (!pghba_batch_add_host_rule(&hbaBatch,
+								   pgSetup->ssl.active,
+								   HBA_DATABASE_DBNAME,
+								   pgSetup->dbname,
+								   pg_setup_get_username(pgSetup),
+								   config->nodename,
+								   pg_setup_get_auth_method(pgSetup)))
 	{
 		log_error("Failed to edit \"%s\" to grant connections to \"%s\", "
 				  "see above for details", hbaFilePath, config->nodename);
+		pghba_batch_destroy(&hbaBatch);
 		return false;
 	}
 
@@ -615,20 +718,31 @@ create_database_and_extension(Keeper *keeper)
 				 pgSetup->pghost, hbaFilePath);
 
 		/* Intended use is restricted to unit testing, hard-code "trust" here */
-		if (!pghba_ensure_host_rule_exists(hbaFilePath,
-										   pgSetup->ssl.active,
-										   HBA_DATABASE_ALL,
-										   NULL, /* all: no database name */
-										   NULL, /* no username, "all" */
-										   pgSetup->pghost,
-										   "trust"))
+		if (!pghba_batch_add_host_rule(&hbaBatch,
+									   pgSetup->ssl.active,
+									   HBA_DATABASE_ALL,
+									   NULL, /* all: no database name */
+									   NULL, /* no username, "all" */
+									   pgSetup->pghost,
+									   "trust"))
 		{
 			log_error("Failed to edit \"%s\" to grant connections to \"%s\", "
 					  "see above for details", hbaFilePath, pgSetup->pghost);
+			pghba_batch_destroy(&hbaBatch);
 			return false;
 		}
 	}
 
+	if (!pghba_batch_write(&hbaBatch))
+	{
+		log_error("Failed to edit \"%s\", see above for details",
+				  hbaFilePath);
+		pghba_batch_destroy(&hbaBatch);
+		return false;
+	}
+
+	pghba_batch_destroy(&hbaBatch);
+
 	/*
 	 * Use the "template1" database in the next operations when connecting to
 	 * do the initial PostgreSQL configuration, and to create our database. We
@@ -645,6 +759,34 @@ create_database_and_extension(Keeper *keeper)
 	strlcpy(initPgSetup.dbname, "template1", NAMEDATALEN);
 	local_postgres_init(&initPostgres, &initPgSetup);
 
+	/*
+	 * When --ssl-self-signed has been used, now is the time to build a
+	 * self-signed certificate for the server. We place the certificate and
+	 * private key in $PGDATA/server.key and $PGDATA/server.crt
+	 */
+	if (pgSetup->ssl.createSelfSignedCert)
+	{
+		if (!pg_create_self_signed_cert(pgSetup, config->nodename))
+		{
+			log_error("Failed to create SSL self-signed certificate, "
+					  "see above for details");
+			return false;
+		}
+	}
+
+	/*
+	 * Add pg_autoctl PostgreSQL settings, including Citus extension in
+	 * shared_preload_libraries when dealing with a Citus worker or coordinator
+	 * node. We do that before starting Postgres for the first time, so that
+	 * a freshly initialized instance starts with the right settings.
+	 */
+	if (!postgres_add_default_settings(&initPostgres))
+	{
+		log_error("Failed to add default settings to newly initialized "
+				  "PostgreSQL instance, see above for details");
+		return false;
+	}
+
 	/*
 	 * Now start the database, we need to create our dbname and maybe the Citus
 	 * Extension too.
@@ -672,33 +814,6 @@ create_database_and_extension(Keeper *keeper)
 		}
 	}
 
-	/*
-	 * When --ssl-self-signed has been used, now is the time to build a
-	 * self-signed certificate for the server. We place the certificate and
-	 * private key in $PGDATA/server.key and $PGDATA/server.crt
-	 */
-	if (pgSetup->ssl.createSelfSignedCert)
-	{
-		if (!pg_create_self_signed_cert(pgSetup, config->nodename))
-		{
-			log_error("Failed to create SSL self-signed certificate, "
-					  "see above for details");
-			return false;
-		}
-	}
-
-	/*
-	 * Add pg_autoctl PostgreSQL settings, including Citus extension in
-	 * shared_preload_libraries when dealing with a Citus worker or coordinator
-	 * node.
-	 */
-	if (!postgres_add_default_settings(&initPostgres))
-	{
-		log_error("Failed to add default settings to newly initialized "
-				  "PostgreSQL instance, see above for details");
-		return false;
-	}
-
 	/*
 	 * Now allow nodes on the same network to connect to the coordinator, and
 	 * the coordinator to connect to its workers.
@@ -740,6 +855,21 @@ create_database_and_extension(Keeper *keeper)
 
 	}
 
+	/*
+	 * With --fast, skip the restart when the running instance already uses
+	 * the settings we installed, which is the case when we started it
+	 * ourselves in this function.
+	 */
+	if (fastInit)
+	{
+		if (!pgsql_has_pending_restart(&initPostgres.sqlClient, &needsRestart))
+		{
+			log_warn("Failed to check for settings pending a restart, "
+					 "restarting PostgreSQL");
+			needsRestart = true;
+		}
+	}
+
 	/* close the "template1" connection now */
 	pgsql_finish(&initPostgres.sqlClient);
 
@@ -748,12 +878,26 @@ create_database_and_extension(Keeper *keeper)
 	 * free to restart it to make sure that the defaults we just installed are
 	 * actually in place.
 	 */
-
-	if (!keeper_restart_postgres(keeper))
+	if (needsRestart)
 	{
-		log_fatal("Failed to restart PostgreSQL to enable pg_auto_failover "
-				  "configuration");
-		return false;
+		if (!keeper_restart_postgres(keeper))
+		{
+			log_fatal("Failed to restart PostgreSQL to enable pg_auto_failover "
+					  "configuration");
+			return false;
+		}
+	}
+	else
+	{
+		log_info("PostgreSQL settings are already in place, "
+				 "skipping restart");
+
+		if (!keeper_update_pg_state(keeper))
+		{
+			log_error("Failed to update the keeper's state from the local "
+					  "PostgreSQL instance, see above for details.");
+			return false;
+		}
 	}
 
 	/*
@@ -826,6 +970,7 @@ keeper_pg_init_node_active(Keeper *keeper)
 							 ReportPgIsRunning(keeper),
 							 keeper->postgres.currentLSN,
 							 keeper->postgres.pgsrSyncState,
+							 &(keeper->postgres.standbys),
 							 &assignedState))
 	{
 		log_error("Failed to contact the monitor to publish our "
@@ -860,3 +1005,244 @@ keeper_pg_init_node_active(Keeper *keeper)
 
 	return true;
 }
+
+
+/*
+ * keeper_pg_init_start_initdb starts a child process that runs initdb in a
+ * directory next to PGDATA. The monitor might assign us WAIT_STANDBY_STATE,
+ * in which case PGDATA must be left alone for pg_basebackup, so we don't use
+ * PGDATA itself yet. We only do that when the monitor has no other node in
+ * our group yet, so that standby nodes don't run initdb for nothing. Returns
+ * false when the child was not started, and then the INIT ➜ SINGLE
+ * transition runs initdb as usual.
+ */
+static bool
+keeper_pg_init_start_initdb(Keeper *keeper, KeeperConfig *config,
+							InitdbProcess *initdb)
+{
+	int nodeCount = 0;
+	pid_t pid = 0;
+
+	if (!monitor_count_group_nodes(&(keeper->monitor),
+								   config->formation,
+								   config->groupId,
+								   &nodeCount) ||
+		nodeCount > 0)
+	{
+		return false;
+	}
+
+	if (!keeper_pg_init_initdb_target(config->pgSetup.pgdata, initdb))
+	{
+		/* we run initdb in PGDATA later */
+		return false;
+	}
+
+	sformat(initdb->pgdata, MAXPGPATH, "%s.pg_autoctl.initdb", initdb->target);
+
+	/* a previous attempt might have been interrupted */
+	if (directory_exists(initdb->pgdata) && !rmtree(initdb->pgdata, true))
+	{
+		log_warn("Failed to remove directory \"%s\": %m", initdb->pgdata);
+		return false;
+	}
+
+	/* flush stdio buffers before forking, to avoid duplicate output */
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+
+	switch (pid)
+	{
+		case -1:
+		{
+			log_warn("Failed to fork the initdb process: %m");
+			return false;
+		}
+
+		case 0:
+		{
+			bool success = pg_ctl_initdb(config->pgSetup.pg_ctl,
+										 initdb->pgdata);
+
+			exit(success ? EXIT_CODE_QUIT : EXIT_CODE_PGCTL);
+		}
+
+		default:
+		{
+			log_debug("Running initdb in \"%s\" with pid %d while "
+					  "registering to the monitor", initdb->pgdata, pid);
+			initdb->pid = pid;
+			return true;
+		}
+	}
+}
+
+
+/*
+ * keeper_pg_init_initdb_target sets initdb->target to PGDATA with symbolic
+ * links resolved, so that the directory where initdb runs is next to it, on
+ * the same filesystem, and moving it in place replaces the target directory
+ * rather than a symbolic link. When PGDATA is a mount point, moving another
+ * directory over it is not possible, and we return false.
+ */
+static bool
+keeper_pg_init_initdb_target(const char *pgdata, InitdbProcess *initdb)
+{
+	char parent[MAXPGPATH] = { 0 };
+	char realParent[MAXPGPATH] = { 0 };
+	char *basename = NULL;
+	struct stat pgdataStat = { 0 };
+	struct stat parentStat = { 0 };
+	int length = 0;
+
+	if (directory_exists((char *) pgdata))
+	{
+		if (realpath(pgdata, initdb->target) == NULL)
+		{
+			log_debug("Failed to resolve \"%s\": %m", pgdata);
+			return false;
+		}
+
+		sformat(parent, MAXPGPATH, "%s/..", initdb->target);
+
+		if (stat(initdb->target, &pgdataStat) != 0 ||
+			stat(parent, &parentStat) != 0)
+		{
+			log_debug("Failed to stat \"%s\": %m", initdb->target);
+			return false;
+		}
+
+		if (pgdataStat.st_dev != parentStat.st_dev)
+		{
+			log_debug("PGDATA \"%s\" is a mount point, running initdb "
+					  "in place", initdb->target);
+			return false;
+		}
+
+		return true;
+	}
+
+	/* PGDATA does not exist yet, resolve its parent directory */
+	strlcpy(parent, pgdata, MAXPGPATH);
+
+	/* remove trailing slashes, so that we find the last path component */
+	length = strlen(parent);
+
+	while (length > 1 && parent[length - 1] == '/')
+	{
+		parent[--length] = '\0';
+	}
+
+	basename = strrchr(parent, '/');
+
+	if (basename == NULL)
+	{
+		basename = parent;
+		strlcpy(realParent, ".", MAXPGPATH);
+	}
+	else
+	{
+		*basename++ = '\0';
+
+		if (realpath(parent[0] == '\0' ? "/" : parent, realParent) == NULL)
+		{
+			log_debug("Failed to resolve \"%s\": %m", parent);
+			return false;
+		}
+	}
+
+	if (realParent[0] == '.' && realpath(".", realParent) == NULL)
+	{
+		log_debug("Failed to resolve the current directory: %m");
+		return false;
+	}
+
+	sformat(initdb->target, MAXPGPATH, "%s/%s",
+			strcmp(realParent, "/") == 0 ? "" : realParent, basename);
+
+	return true;
+}
+
+
+/*
+ * keeper_pg_init_finish_initdb waits until the initdb child process is done,
+ * and moves the new Postgres instance to PGDATA.
+ */
+static bool
+keeper_pg_init_finish_initdb(Keeper *keeper, InitdbProcess *initdb)
+{
+	KeeperConfig *config = &(keeper->config);
+	bool missingPgdataIsOk = false;
+	int status = 0;
+
+	if (initdb->pid <= 0)
+	{
+		return false;
+	}
+
+	if (waitpid(initdb->pid, &status, 0) != initdb->pid)
+	{
+		log_warn("Failed to wait for the initdb process %d: %m", initdb->pid);
+		initdb->pid = 0;
+		return false;
+	}
+
+	initdb->pid = 0;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_CODE_QUIT)
+	{
+		log_warn("Failed to initialise a PostgreSQL instance at \"%s\", "
+				 "trying again at \"%s\"",
+				 initdb->pgdata, config->pgSetup.pgdata);
+		(void) keeper_pg_init_discard_initdb(initdb);
+		return false;
+	}
+
+	/* rename(2) also replaces an empty PGDATA directory */
+	if (rename(initdb->pgdata, initdb->target) != 0)
+	{
+		log_warn("Failed to move \"%s\" to \"%s\": %m",
+				 initdb->pgdata, initdb->target);
+		(void) keeper_pg_init_discard_initdb(initdb);
+		return false;
+	}
+
+	log_info("Initialised a PostgreSQL cluster at \"%s\" "
+			 "while registering to the monitor", config->pgSetup.pgdata);
+
+	/* the INIT ➜ SINGLE transition now finds an existing instance */
+	if (!pg_controldata(&(config->pgSetup), missingPgdataIsOk))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* we might have been given a relative pathname */
+	return keeper_config_update_with_absolute_pgdata(config);
+}
+
+
+/*
+ * keeper_pg_init_discard_initdb waits until the initdb child process is done,
+ * if any, and removes the directory where it ran.
+ */
+static void
+keeper_pg_init_discard_initdb(InitdbProcess *initdb)
+{
+	int status = 0;
+
+	if (initdb->pid > 0)
+	{
+		(void) waitpid(initdb->pid, &status, 0);
+		initdb->pid = 0;
+	}
+
+	if (!IS_EMPTY_STRING_BUFFER(initdb->pgdata) &&
+		directory_exists(initdb->pgdata) &&
+		!rmtree(initdb->pgdata, true))
+	{
+		log_warn("Failed to remove directory \"%s\": %m", initdb->pgdata);
+	}
+}
@@ -7,13 +7,17 @@
  *
  */
 
+#include <errno.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "clock_utils.h"
 #include "defaults.h"
 #include "fsm.h"
 #include "keeper.h"
@@ -21,6 +25,7 @@
 #include "keeper_pg_init.h"
 #include "log.h"
 #include "monitor.h"
+#include "parson.h"
 #include "pgctl.h"
 #include "state.h"
 #include "signals.h"
@@ -29,10 +34,51 @@
 
 static bool keepRunning = true;
 
+/*
+ * KeeperLoop holds the per-instance state of the keeper main loop, so that
+ * a single pg_autoctl process may drive several local Postgres instances in
+ * the same loop, see keeper_service_run_instances().
+ */
+typedef struct KeeperLoop
+{
+	Keeper *keeper;
+	pid_t pid;
+	uint64_t now;
+	bool ready;					/* prepared for node_active in this round */
+	bool reportPgIsRunning;
+	bool firstLoop;
+	bool warnedOnCurrentIteration;
+	bool warnedOnPreviousIteration;
+	bool madeTransition;		/* in the last iteration */
+	bool contactedMonitor;		/* at least once since we started */
+	bool stopped;				/* lost its pidfile, not running anymore */
+} KeeperLoop;
+
+static bool keeper_loop_prepare(KeeperLoop *loop);
+static bool keeper_loop_apply(KeeperLoop *loop,
+							  bool couldContactMonitor,
+							  MonitorAssignedState *assignedState);
+static bool keeper_loop_node_active(KeeperLoop *loop,
+									MonitorAssignedState *assignedState);
+static void keeper_loop_node_active_all(KeeperLoop *loops, int count,
+										bool *couldContactMonitor,
+										MonitorAssignedState *assignedStates);
+static void keeper_loop_node_active_batch(KeeperLoop *loops, int count,
+										  bool *couldContactMonitor,
+										  MonitorAssignedState *assignedStates);
+static int keeper_loop_compare(const void *a, const void *b);
+static int keeper_loop_monitor_count(KeeperLoop *loops, int count);
+static Monitor * keeper_loop_monitor(KeeperLoop *loops, int count);
+static void keeper_loop_stop(KeeperLoop *loop);
+static void keeper_loop_connect(KeeperLoop *loops, int count);
+static bool keeper_loop_skip_connecting(KeeperLoop *loops, int count);
 static bool is_network_healthy(Keeper *keeper);
-static bool in_network_partition(KeeperStateData *keeperState, uint64_t now,
-								 int networkPartitionTimeout);
+static bool in_network_partition(Keeper *keeper, uint64_t nowMs,
+								 uint64_t networkPartitionTimeoutMs);
 static void reload_configuration(Keeper *keeper);
+static void keeper_loop_publish_status(KeeperLoop *loop);
+static void keeper_loop_wait(KeeperLoop *loops, int count, bool onlyConnect);
+static void keeper_loop_reply(KeeperLoop *loop, bool couldContactMonitor);
 
 /* pid file creation and reading */
 static bool create_pidfile(const char *pidfile, pid_t pid);
@@ -48,27 +94,107 @@ static bool remove_pidfile(const char *pidfile);
 bool
 keeper_service_run(Keeper *keeper, pid_t *start_pid)
 {
-	KeeperConfig *config = &(keeper->config);
-	KeeperStateData *keeperState = &(keeper->state);
-	Monitor *monitor = &(keeper->monitor);
-	LocalPostgresServer *postgres = &(keeper->postgres);
+	return keeper_service_run_instances(keeper, 1, *start_pid);
+}
+
+
+/*
+ * keeper_service_run_instances implements the main loop of the keeper for
+ * one or more local Postgres instances. All the instances share the same
+ * sleep timer, and when there is more than one of them, they report to the
+ * monitor in a single batched call to node_active per iteration, using a
+ * single monitor connection. Each instance still has its own configuration,
+ * state file, pidfile and FSM.
+ *
+ * The function keeper_service_init() must have been called for each instance
+ * before entering keeper_service_run_instances().
+ */
+bool
+keeper_service_run_instances(Keeper *keepers, int count, pid_t pid)
+{
+	KeeperLoop *loops = calloc(count, sizeof(KeeperLoop));
+	MonitorAssignedState *assignedStates =
+		calloc(count, sizeof(MonitorAssignedState));
+	bool *couldContactMonitor = calloc(count, sizeof(bool));
 	bool doSleep = false;
-	bool couldContactMonitor = false;
-	pid_t pid = *start_pid, checkpid = 0;
-	bool firstLoop = true;
-	bool warnedOnCurrentIteration = false;
-	bool warnedOnPreviousIteration = false;
+	bool waitForMonitor = false;
+	bool success = true;
+	uint64_t monitorStartMs = 0;
+	int runningCount = 0;
+	int index = 0;
+
+	if (loops == NULL || assignedStates == NULL || couldContactMonitor == NULL)
+	{
+		log_fatal("Failed to allocate memory for %d keeper instances", count);
+		free(loops);
+		free(assignedStates);
+		free(couldContactMonitor);
+		return false;
+	}
 
 	log_debug("pg_autoctl service is starting");
 
-	while (keepRunning)
+	for (index = 0; index < count; index++)
 	{
-		MonitorAssignedState assignedState = { 0 };
-		bool needStateChange = false;
-		bool transitionFailed = false;
-		bool reportPgIsRunning = false;
-		uint64_t now = time(NULL);
+		loops[index].keeper = &(keepers[index]);
+		loops[index].pid = pid;
+		loops[index].firstLoop = true;
+
+		/*
+		 * When supervising the postmaster, SIGCHLD interrupts our sleep as
+		 * soon as Postgres exits, so that we restart it right away.
+		 */
+		if (keepers[index].config.pgSetup.supervise)
+		{
+			signal(SIGCHLD, catch_child);
+		}
 
+		/*
+		 * Don't block the main loop when the monitor is unavailable: we
+		 * rather back off and keep watching the local Postgres instance.
+		 */
+		keepers[index].monitor.pgsql.nonBlocking = true;
+	}
+
+	/*
+	 * The fencing watchdog of each instance stops Postgres when the primary
+	 * is in a network partition, even while this loop is blocked on the
+	 * monitor. It only gets active once we know we're a primary.
+	 */
+	for (index = 0; index < count; index++)
+	{
+		Keeper *keeper = &(keepers[index]);
+
+		if (!fencing_watchdog_start(&(keeper->watchdog),
+									&(keeper->postgres.postgresSetup)))
+		{
+			log_warn("Failed to start the fencing watchdog for \"%s\", "
+					 "network partitions are only detected in the main loop",
+					 keeper->config.pgSetup.pgdata);
+		}
+
+		if (!keeper_status_create(&(keeper->status),
+								  keeper->config.pathnames.status))
+		{
+			log_warn("Failed to create the status file for \"%s\", "
+					 "the keeper status is only available from the monitor",
+					 keeper->config.pgSetup.pgdata);
+		}
+
+		if (!control_socket_listen(&(keeper->control),
+								   keeper->config.pathnames.control))
+		{
+			log_warn("Failed to create the control socket for \"%s\", "
+					 "use signals to control this pg_autoctl service",
+					 keeper->config.pgSetup.pgdata);
+		}
+	}
+
+	/* acquire monitor group locks in the same order in every process */
+	qsort(loops, count, sizeof(KeeperLoop), keeper_loop_compare);
+
+	while (keepRunning)
+	{
 		/*
 		 * Handle signals.
 		 *
@@ -82,7 +208,16 @@ keeper_service_run(Keeper *keeper, pid_t *start_pid)
 		 */
 		if (asked_to_reload)
 		{
-			(void) reload_configuration(keeper);
+			for (index = 0; index < count; index++)
+			{
+				if (!loops[index].stopped)
+				{
+					(void) reload_configuration(loops[index].keeper);
+				}
+			}
+
+			/* we're done reloading now. */
+			asked_to_reload = 0;
 		}
 
 		if (asked_to_stop)
@@ -90,275 +225,1047 @@ keeper_service_run(Keeper *keeper, pid_t *start_pid)
 			break;
 		}
 
-		if (doSleep)
+		if (doSleep || waitForMonitor)
 		{
-			sleep(PG_AUTOCTL_KEEPER_SLEEP_TIME);
+			(void) keeper_loop_wait(loops, count, !doSleep);
 		}
 
 		doSleep = true;
+		waitForMonitor = false;
 
 		/*
-		 * Before loading the current state from disk, make sure it's still our
-		 * state file. It might happen that the PID file got removed from disk,
-		 * then allowing another keeper to run.
-		 *
-		 * We should then quit in an emergency if our PID file either doesn't
-		 * exist anymore, or has been overwritten with another PID, so that we
-		 * don't enter a keeper state file war in between several services.
+		 * Reap the postmaster if it exited, so that its pid is not found
+		 * running anymore when updating our Postgres state.
 		 */
-		if (read_pidfile(config->pathnames.pid, &checkpid))
+		if (asked_to_reap)
 		{
-			if (checkpid != pid)
+			asked_to_reap = 0;
+			(void) pg_reap_postmaster();
+		}
+
+		/*
+		 * Start connecting to the monitors now, unless we did while waiting,
+		 * so that the connections are established while we update our view
+		 * of the local instances.
+		 */
+		(void) keeper_loop_connect(loops, count);
+
+		runningCount = 0;
+
+		for (index = 0; index < count; index++)
+		{
+			Keeper *keeper = loops[index].keeper;
+			uint64_t startMs = monotonic_clock_ms();
+
+			if (loops[index].stopped)
 			{
-				log_fatal("Our PID file \"%s\" now contains PID %d, "
-						  "instead of expected pid %d. Quitting.",
-						  config->pathnames.pid, checkpid, pid);
+				loops[index].ready = false;
+				continue;
+			}
+
+			loops[index].ready = keeper_loop_prepare(&(loops[index]));
 
-				exit(EXIT_CODE_QUIT);
+			keeper->status.data.prepareDurationMs =
+				monotonic_clock_ms() - startMs;
+
+			if (!loops[index].stopped)
+			{
+				++runningCount;
 			}
+
+			CHECK_FOR_FAST_SHUTDOWN;
 		}
-		else
+
+		/* we keep running as long as one of our instances is running */
+		if (runningCount == 0)
 		{
-			/*
-			 * Surrendering seems the less risky option for us now.
-			 *
-			 * Any other strategy would need to be careful about race
-			 * conditions happening when several processes (keeper or others) are
-			 * trying to create or remove the pidfile at the same time, possibly in
-			 * different orders. Yeah, let's quit.
-			 */
-			log_fatal("Our PID file disappeared from \"%s\", quitting.",
-					  config->pathnames.pid);
+			log_fatal("No keeper instance is running anymore. Quitting.");
 			exit(EXIT_CODE_QUIT);
 		}
 
 		CHECK_FOR_FAST_SHUTDOWN;
 
 		/*
-		 * Read the current state. While we could preserve the state in memory,
-		 * re-reading the file simplifies recovery from failures. For example,
-		 * if we fail to write the state file after making a transition, then
-		 * we should not tell the monitor that the transition succeeded, because
-		 * a subsequent crash of the keeper would cause the states to become
-		 * inconsistent. By re-reading the file, we make sure the state on disk
-		 * on the keeper is consistent with the state on the monitor
+		 * Don't block on a monitor connection that is still being
+		 * established: we rather wait for it in keeper_loop_wait(), along
+		 * with our control sockets, and then iterate again.
 		 */
-		if (!keeper_load_state(keeper))
+		if (keeper_loop_skip_connecting(loops, count))
 		{
-			log_error("Failed to read keeper state file, retrying...");
-			CHECK_FOR_FAST_SHUTDOWN;
-			continue;
+			waitForMonitor = true;
+			doSleep = false;
 		}
 
-		if (firstLoop)
-		{
-			log_info("pg_autoctl service is running, "
-					 "current state is \"%s\"",
-					 NodeStateToString(keeperState->current_role));
-		}
+		monitorStartMs = monotonic_clock_ms();
 
 		/*
-		 * Check for any changes in the local PostgreSQL instance, and update
-		 * our in-memory values for the replication WAL lag and sync_state.
+		 * Report the current state to the monitor and get the assigned state.
 		 */
-		if (!keeper_update_pg_state(keeper))
+		if (count == 1)
 		{
-			warnedOnCurrentIteration = true;
-			log_warn("Failed to update the keeper's state from the local "
-					 "PostgreSQL instance.");
+			if (loops[0].ready)
+			{
+				couldContactMonitor[0] =
+					keeper_loop_node_active(&(loops[0]), &(assignedStates[0]));
+			}
 		}
-		else if (warnedOnPreviousIteration)
+		else
 		{
-			log_info("Updated the keeper's state from the local "
-					 "PostgreSQL instance, which is %s",
-					 postgres->pgIsRunning ? "running" : "not running");
+			(void) keeper_loop_node_active_all(loops, count,
+											   couldContactMonitor,
+											   assignedStates);
 		}
 
-		CHECK_FOR_FAST_SHUTDOWN;
+		for (index = 0; index < count; index++)
+		{
+			loops[index].keeper->status.data.monitorDurationMs =
+				monotonic_clock_ms() - monitorStartMs;
+		}
 
-		reportPgIsRunning = ReportPgIsRunning(keeper);
-
-		/* We used to output that in INFO every 5s, which is too much chatter */
-		log_debug("Calling node_active for node %s/%d/%d with current state: "
-				  "%s, "
-				  "PostgreSQL %s running, "
-				  "sync_state is \"%s\", "
-				  "current lsn is \"%s\".",
-				  config->formation,
-				  keeperState->current_node_id,
-				  keeperState->current_group,
-				  NodeStateToString(keeperState->current_role),
-				  reportPgIsRunning ? "is" : "is not",
-				  postgres->pgsrSyncState,
-				  postgres->currentLSN);
+		CHECK_FOR_FAST_SHUTDOWN;
 
-		/*
-		 * Report the current state to the monitor and get the assigned state.
-		 */
-		couldContactMonitor =
-			monitor_node_active(monitor,
-								config->formation,
-								config->nodename,
-								config->pgSetup.pgport,
-								keeperState->current_node_id,
-								keeperState->current_group,
-								keeperState->current_role,
-								reportPgIsRunning,
-								postgres->currentLSN,
-								postgres->pgsrSyncState,
-								&assignedState);
-
-		if (couldContactMonitor)
-		{
-			keeperState->last_monitor_contact = now;
-			keeperState->assigned_role = assignedState.state;
-
-			if (keeperState->assigned_role != keeperState->current_role)
+		for (index = 0; index < count; index++)
+		{
+			if (!loops[index].ready)
 			{
-				needStateChange = true;
+				continue;
+			}
 
-				log_info("Monitor assigned new state \"%s\"",
-						 NodeStateToString(keeperState->assigned_role));
+			loops[index].madeTransition =
+				keeper_loop_apply(&(loops[index]),
+								  couldContactMonitor[index],
+								  &(assignedStates[index]));
+
+			/* cycle faster if we made a state transition */
+			if (loops[index].madeTransition)
+			{
+				doSleep = false;
 			}
+
+			CHECK_FOR_FAST_SHUTDOWN;
 		}
-		else
+
+		/* answer the control commands that asked for this iteration */
+		for (index = 0; index < count; index++)
 		{
-			log_error("Failed to get the goal state from the monitor");
+			ControlCommand pending = loops[index].keeper->control.pending;
 
-			/*
-			 * Check whether we're likely to be in a network partition.
-			 * That will cause the assigned_role to become demoted.
-			 */
-			if (keeperState->current_role == PRIMARY_STATE)
+			if (pending == CONTROL_COMMAND_STEP)
 			{
-				log_warn("Checking for network partitions...");
+				(void) keeper_loop_reply(&(loops[index]),
+										 loops[index].ready &&
+										 couldContactMonitor[index]);
+			}
 
-				if (!is_network_healthy(keeper))
-				{
-					keeperState->assigned_role = DEMOTE_TIMEOUT_STATE;
+			loops[index].madeTransition = false;
+		}
 
-					log_info("Network in not healthy, switching to state %s",
-							 NodeStateToString(keeperState->assigned_role));
-				}
-				else
-				{
-					log_info("Network is healthy");
-				}
+		if (asked_to_stop || asked_to_stop_fast)
+		{
+			keepRunning = false;
+		}
+	}
+
+	for (index = 0; index < count; index++)
+	{
+		if (loops[index].stopped)
+		{
+			continue;
+		}
+
+		(void) keeper_loop_stop(&(loops[index]));
+
+		if (!keeper_service_stop(loops[index].keeper))
+		{
+			success = false;
+		}
+	}
+
+	free(loops);
+	free(assignedStates);
+	free(couldContactMonitor);
+
+	return success;
+}
+
+
+/*
+ * keeper_loop_compare sorts keeper instances by monitor, so that instances
+ * that report to the same monitor are next to each other, and then by
+ * formation and group, which is the order in which the monitor locks groups
+ * in a batched node_active call.
+ */
+static int
+keeper_loop_compare(const void *a, const void *b)
+{
+	Keeper *keeperA = ((KeeperLoop *) a)->keeper;
+	Keeper *keeperB = ((KeeperLoop *) b)->keeper;
+	int cmp = strcmp(keeperA->config.monitor_pguri,
+					 keeperB->config.monitor_pguri);
+
+	if (cmp != 0)
+	{
+		return cmp;
+	}
+
+	cmp = strcmp(keeperA->config.formation, keeperB->config.formation);
+
+	if (cmp != 0)
+	{
+		return cmp;
+	}
+
+	return keeperA->config.groupId - keeperB->config.groupId;
+}
+
+
+/*
+ * keeper_loop_monitor_count returns how many instances, starting with the
+ * first one of the given array, report to the same monitor. The array is
+ * sorted with keeper_loop_compare.
+ */
+static int
+keeper_loop_monitor_count(KeeperLoop *loops, int count)
+{
+	int index = 1;
+
+	while (index < count &&
+		   strcmp(loops[0].keeper->config.monitor_pguri,
+				  loops[index].keeper->config.monitor_pguri) == 0)
+	{
+		++index;
+	}
+
+	return index;
+}
+
+
+/*
+ * keeper_loop_monitor returns the monitor connection that we use for the
+ * given instances, which all report to the same monitor: the connection of
+ * the first instance that is still running, or NULL when there's none.
+ */
+static Monitor *
+keeper_loop_monitor(KeeperLoop *loops, int count)
+{
+	for (int index = 0; index < count; index++)
+	{
+		if (!loops[index].stopped)
+		{
+			return &(loops[index].keeper->monitor);
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * keeper_loop_connect starts connecting to the monitor of each group of
+ * instances, unless a connection is established or in progress already.
+ */
+static void
+keeper_loop_connect(KeeperLoop *loops, int count)
+{
+	int index = 0;
+
+	while (index < count)
+	{
+		int monitorCount = keeper_loop_monitor_count(loops + index,
+													 count - index);
+		Monitor *monitor = keeper_loop_monitor(loops + index, monitorCount);
+
+		if (monitor != NULL)
+		{
+			(void) pgsql_start_connection(&(monitor->pgsql));
+		}
+
+		index += monitorCount;
+	}
+}
+
+
+/*
+ * keeper_loop_skip_connecting advances the monitor connections that are still
+ * being established, without waiting, and marks the instances that report to
+ * a monitor we're still connecting to as not ready for this iteration. It
+ * returns true when it skipped an instance.
+ */
+static bool
+keeper_loop_skip_connecting(KeeperLoop *loops, int count)
+{
+	bool skipped = false;
+	int index = 0;
+
+	while (index < count)
+	{
+		int monitorCount = keeper_loop_monitor_count(loops + index,
+													 count - index);
+		Monitor *monitor = keeper_loop_monitor(loops + index, monitorCount);
+		PGSQL *pgsql = monitor ? &(monitor->pgsql) : NULL;
+
+		if (pgsql != NULL && pgsql->connecting)
+		{
+			struct pollfd pfd = { 0 };
+
+			pfd.fd = PQsocket(pgsql->connection);
+			pfd.events =
+				pgsql->connectStatus == PGRES_POLLING_READING ? POLLIN : POLLOUT;
+
+			(void) pgsql_poll_connection(pgsql, poll(&pfd, 1, 0) > 0);
+		}
+
+		if (pgsql != NULL && pgsql->connecting)
+		{
+			log_debug("Still connecting to the monitor, "
+					  "skipping node_active for this iteration");
+
+			for (int i = index; i < index + monitorCount; i++)
+			{
+				skipped = skipped || loops[i].ready;
+				loops[i].ready = false;
 			}
 		}
 
-		CHECK_FOR_FAST_SHUTDOWN;
+		index += monitorCount;
+	}
+
+	return skipped;
+}
+
+
+/*
+ * keeper_loop_stop releases what an instance uses in the main loop: its
+ * fencing watchdog, status file and control socket. It does not remove the
+ * pidfile, see keeper_service_stop().
+ */
+static void
+keeper_loop_stop(KeeperLoop *loop)
+{
+	Keeper *keeper = loop->keeper;
+
+	(void) fencing_watchdog_stop(&(keeper->watchdog));
+	(void) keeper_status_remove(&(keeper->status),
+								keeper->config.pathnames.status);
+	(void) control_socket_close(&(keeper->control),
+								keeper->config.pathnames.control);
+}
+
+
+/*
+ * keeper_loop_prepare runs the first part of an iteration of the keeper main
+ * loop for an instance: check our pidfile, read the current state, and
+ * update our view of the local Postgres instance. It returns false when we
+ * should skip the instance for this iteration.
+ */
+static bool
+keeper_loop_prepare(KeeperLoop *loop)
+{
+	Keeper *keeper = loop->keeper;
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *keeperState = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	pid_t checkpid = 0;
+
+	loop->now = time(NULL);
+
+	/*
+	 * Before loading the current state from disk, make sure it's still our
+	 * state file. It might happen that the PID file got removed from disk,
+	 * then allowing another keeper to run.
+	 *
+	 * We should then stop this instance in an emergency if our PID file
+	 * either doesn't exist anymore, or has been overwritten with another PID,
+	 * so that we don't enter a keeper state file war in between several
+	 * services. The other instances of this process keep running, and we
+	 * quit when none is left.
+	 */
+	if (read_pidfile(config->pathnames.pid, &checkpid))
+	{
+		if (checkpid != loop->pid)
+		{
+			log_fatal("Our PID file \"%s\" now contains PID %d, "
+					  "instead of expected pid %d. Stopping.",
+					  config->pathnames.pid, checkpid, loop->pid);
+
+			(void) keeper_loop_stop(loop);
+			loop->stopped = true;
 
+			return false;
+		}
+	}
+	else
+	{
 		/*
-		 * If we see that PostgreSQL is not running when we know it should be,
-		 * the least we can do is start PostgreSQL again. Same if PostgreSQL is
-		 * running and we are DEMOTED, or in another one of those states where
-		 * the monitor asked us to stop serving queries, in order to ensure
-		 * consistency.
-		 *
-		 * Only enfore current state when we have a recent enough version of
-		 * it, meaning that we could contact the monitor.
+		 * Surrendering seems the less risky option for us now.
 		 *
-		 * We need to prevent the keeper from restarting PostgreSQL at boot
-		 * time when meanwhile the Monitor did set our goal_state to DEMOTED
-		 * because the other node has been promoted, which could happen if this
-		 * node was rebooting for a long enough time.
+		 * Any other strategy would need to be careful about race
+		 * conditions happening when several processes (keeper or others) are
+		 * trying to create or remove the pidfile at the same time, possibly in
+		 * different orders. Yeah, let's stop.
 		 */
-		if (needStateChange)
+		log_fatal("Our PID file disappeared from \"%s\", stopping.",
+				  config->pathnames.pid);
+
+		(void) keeper_loop_stop(loop);
+		loop->stopped = true;
+
+		return false;
+	}
+
+	if (asked_to_stop_fast)
+	{
+		return false;
+	}
+
+	/*
+	 * Read the current state. While we could preserve the state in memory,
+	 * re-reading the file simplifies recovery from failures. For example,
+	 * if we fail to write the state file after making a transition, then
+	 * we should not tell the monitor that the transition succeeded, because
+	 * a subsequent crash of the keeper would cause the states to become
+	 * inconsistent. By re-reading the file, we make sure the state on disk
+	 * on the keeper is consistent with the state on the monitor
+	 */
+	if (!keeper_load_state(keeper))
+	{
+		log_error("Failed to read keeper state file, retrying...");
+		return false;
+	}
+
+	if (loop->firstLoop)
+	{
+		log_info("pg_autoctl service is running, "
+				 "current state is \"%s\"",
+				 NodeStateToString(keeperState->current_role));
+	}
+
+	/*
+	 * Check for any changes in the local PostgreSQL instance, and update
+	 * our in-memory values for the replication WAL lag and sync_state.
+	 */
+	if (!keeper_update_pg_state(keeper))
+	{
+		loop->warnedOnCurrentIteration = true;
+		log_warn("Failed to update the keeper's state from the local "
+				 "PostgreSQL instance.");
+	}
+	else if (loop->warnedOnPreviousIteration)
+	{
+		log_info("Updated the keeper's state from the local "
+				 "PostgreSQL instance, which is %s",
+				 postgres->pgIsRunning ? "running" : "not running");
+	}
+
+	if (asked_to_stop_fast)
+	{
+		return false;
+	}
+
+	loop->reportPgIsRunning = ReportPgIsRunning(keeper);
+
+	/* We used to output that in INFO every 5s, which is too much chatter */
+	log_debug("Calling node_active for node %s/%d/%d with current state: "
+			  "%s, "
+			  "PostgreSQL %s running, "
+			  "sync_state is \"%s\", "
+			  "current lsn is \"%s\".",
+			  config->formation,
+			  keeperState->current_node_id,
+			  keeperState->current_group,
+			  NodeStateToString(keeperState->current_role),
+			  loop->reportPgIsRunning ? "is" : "is not",
+			  postgres->pgsrSyncState,
+			  postgres->currentLSN);
+
+	return true;
+}
+
+
+/*
+ * keeper_loop_node_active reports the current state of a single instance to
+ * the monitor and gets its assigned state.
+ */
+static bool
+keeper_loop_node_active(KeeperLoop *loop, MonitorAssignedState *assignedState)
+{
+	Keeper *keeper = loop->keeper;
+	KeeperConfig *config = &(keeper->config);
+	KeeperStateData *keeperState = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+
+	return monitor_node_active(&(keeper->monitor),
+							   config->formation,
+							   config->nodename,
+							   config->pgSetup.pgport,
+							   keeperState->current_node_id,
+							   keeperState->current_group,
+							   keeperState->current_role,
+							   loop->reportPgIsRunning,
+							   postgres->currentLSN,
+							   postgres->pgsrSyncState,
+							   &(postgres->standbys),
+							   assignedState);
+}
+
+
+/*
+ * keeper_loop_node_active_all reports the current state of all the instances
+ * that are ready, with a batched node_active call per monitor.
+ */
+static void
+keeper_loop_node_active_all(KeeperLoop *loops, int count,
+							bool *couldContactMonitor,
+							MonitorAssignedState *assignedStates)
+{
+	int index = 0;
+
+	while (index < count)
+	{
+		int monitorCount = keeper_loop_monitor_count(loops + index,
+													 count - index);
+
+		(void) keeper_loop_node_active_batch(loops + index,
+											 monitorCount,
+											 couldContactMonitor + index,
+											 assignedStates + index);
+
+		index += monitorCount;
+	}
+}
+
+
+/*
+ * keeper_loop_node_active_batch reports the current state of the given
+ * instances that are ready, which all report to the same monitor, in a single
+ * call using the monitor connection returned by keeper_loop_monitor(). When
+ * the batch fails, for
+ * instance because node_active raised an error for one of the nodes, we fall
+ * back to a node_active call per instance so that the other instances are
+ * not impacted.
+ */
+static void
+keeper_loop_node_active_batch(KeeperLoop *loops, int count,
+							  bool *couldContactMonitor,
+							  MonitorAssignedState *assignedStates)
+{
+	MonitorNodeActive *nodes = calloc(count, sizeof(MonitorNodeActive));
+	Monitor *monitor = keeper_loop_monitor(loops, count);
+	int nodeCount = 0;
+	int index = 0;
+
+	for (index = 0; index < count; index++)
+	{
+		Keeper *keeper = loops[index].keeper;
+		MonitorNodeActive *node = NULL;
+
+		couldContactMonitor[index] = false;
+
+		if (!loops[index].ready || nodes == NULL)
 		{
-			/*
-			 * First, ensure the current state (make sure Postgres is running
-			 * if it should, or Postgres is stopped if it should not run).
-			 *
-			 * The transition function we call next might depend on our
-			 * assumption that Postgres is running in the current state.
-			 */
-			if (keeper_should_ensure_current_state_before_transition(keeper))
+			continue;
+		}
+
+		node = &(nodes[nodeCount++]);
+
+		node->formation = keeper->config.formation;
+		node->host = keeper->config.nodename;
+		node->port = keeper->config.pgSetup.pgport;
+		node->nodeId = keeper->state.current_node_id;
+		node->groupId = keeper->state.current_group;
+		node->currentState = keeper->state.current_role;
+		node->pgIsRunning = loops[index].reportPgIsRunning;
+		node->currentLSN = keeper->postgres.currentLSN;
+		node->pgsrSyncState = keeper->postgres.pgsrSyncState;
+		node->standbys = &(keeper->postgres.standbys);
+	}
+
+	if (nodeCount > 0 && monitor_node_active_batch(monitor, nodes, nodeCount))
+	{
+		int nodeIndex = 0;
+
+		for (index = 0; index < count; index++)
+		{
+			if (loops[index].ready)
 			{
-				if (!keeper_ensure_current_state(keeper))
-				{
-					/*
-					 * We don't take care of the warnedOnCurrentIteration here
-					 * because the real thing that should happen is the
-					 * transition to the next state. That's what we keep track
-					 * of with "transitionFailed".
-					 */
-					log_warn(
-						"pg_autoctl failed to ensure current state \"%s\": "
-						"PostgreSQL %s running",
-						NodeStateToString(keeperState->current_role),
-						postgres->pgIsRunning ? "is" : "is not");
-				}
+				assignedStates[index] = nodes[nodeIndex++].assignedState;
+				couldContactMonitor[index] = true;
 			}
+		}
+	}
+	else
+	{
+		if (nodeCount > 0)
+		{
+			log_warn("Failed to report the state of %d local nodes "
+					 "in a single call, reporting each node in turn",
+					 nodeCount);
+		}
 
-			if (!keeper_fsm_reach_assigned_state(keeper))
+		for (index = 0; index < count; index++)
+		{
+			if (loops[index].ready)
 			{
-				log_error("Failed to transition to state \"%s\", retrying... ",
-						  NodeStateToString(keeperState->assigned_role));
-
-				transitionFailed = true;
+				couldContactMonitor[index] =
+					keeper_loop_node_active(&(loops[index]),
+											&(assignedStates[index]));
 			}
 		}
-		else if (couldContactMonitor)
+	}
+
+	free(nodes);
+}
+
+
+/*
+ * keeper_loop_apply runs the second part of an iteration of the keeper main
+ * loop for an instance: given the assigned state from the monitor, ensure
+ * the current state or transition to the assigned state, and store the state
+ * file. It returns true when a state transition has been made.
+ */
+static bool
+keeper_loop_apply(KeeperLoop *loop,
+				  bool couldContactMonitor,
+				  MonitorAssignedState *assignedState)
+{
+	Keeper *keeper = loop->keeper;
+	KeeperStateData *keeperState = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	bool needStateChange = false;
+	bool transitionFailed = false;
+	uint64_t transitionStartMs = 0;
+
+	if (couldContactMonitor)
+	{
+		loop->contactedMonitor = true;
+		keeperState->last_monitor_contact = loop->now;
+		keeper->lastMonitorContactMs = monotonic_clock_ms();
+		keeperState->assigned_role = assignedState->state;
+
+		if (fencing_watchdog_fenced(&(keeper->watchdog)))
+		{
+			log_info("The monitor is reachable again after the fencing "
+					 "watchdog stopped PostgreSQL");
+		}
+
+		if (keeperState->assigned_role != keeperState->current_role)
 		{
-			if (!keeper_ensure_current_state(keeper))
+			needStateChange = true;
+
+			log_info("Monitor assigned new state \"%s\"",
+					 NodeStateToString(keeperState->assigned_role));
+		}
+	}
+	else
+	{
+		log_error("Failed to get the goal state from the monitor");
+
+		/*
+		 * Check whether we're likely to be in a network partition.
+		 * That will cause the assigned_role to become demoted.
+		 *
+		 * When the fencing watchdog already stopped Postgres while we were
+		 * trying to reach the monitor, we record the demotion right away.
+		 */
+		if (fencing_watchdog_fenced(&(keeper->watchdog)) &&
+			keeperState->current_role == PRIMARY_STATE)
+		{
+			keeperState->assigned_role = DEMOTE_TIMEOUT_STATE;
+			needStateChange = true;
+
+			log_info("The fencing watchdog stopped PostgreSQL, "
+					 "switching to state %s",
+					 NodeStateToString(keeperState->assigned_role));
+		}
+		else if (keeperState->current_role == PRIMARY_STATE)
+		{
+			log_warn("Checking for network partitions...");
+
+			if (!is_network_healthy(keeper))
 			{
-				warnedOnCurrentIteration = true;
-				log_warn("pg_autoctl failed to ensure current state \"%s\": "
-						 "PostgreSQL %s running",
-						 NodeStateToString(keeperState->current_role),
-						 postgres->pgIsRunning ? "is" : "is not");
+				keeperState->assigned_role = DEMOTE_TIMEOUT_STATE;
+
+				log_info("Network in not healthy, switching to state %s",
+						 NodeStateToString(keeperState->assigned_role));
 			}
-			else if (warnedOnPreviousIteration)
+			else
 			{
-				log_info("pg_autoctl managed to ensure current state \"%s\": "
-						 "PostgreSQL %s running",
-						 NodeStateToString(keeperState->current_role),
-						 postgres->pgIsRunning ? "is" : "is not");
+				log_info("Network is healthy");
 			}
 		}
+	}
 
-		CHECK_FOR_FAST_SHUTDOWN;
+	if (asked_to_stop_fast)
+	{
+		return false;
+	}
 
+	/*
+	 * If we see that PostgreSQL is not running when we know it should be,
+	 * the least we can do is start PostgreSQL again. Same if PostgreSQL is
+	 * running and we are DEMOTED, or in another one of those states where
+	 * the monitor asked us to stop serving queries, in order to ensure
+	 * consistency.
+	 *
+	 * Only enfore current state when we have a recent enough version of
+	 * it, meaning that we could contact the monitor.
+	 *
+	 * We need to prevent the keeper from restarting PostgreSQL at boot
+	 * time when meanwhile the Monitor did set our goal_state to DEMOTED
+	 * because the other node has been promoted, which could happen if this
+	 * node was rebooting for a long enough time.
+	 */
+	if (needStateChange)
+	{
 		/*
-		 * Even if a transition failed, we still write the state file to update
-		 * timestamps used for the network partition checks.
+		 * First, ensure the current state (make sure Postgres is running
+		 * if it should, or Postgres is stopped if it should not run).
+		 *
+		 * The transition function we call next might depend on our
+		 * assumption that Postgres is running in the current state.
 		 */
-		if (!keeper_store_state(keeper))
+		if (keeper_should_ensure_current_state_before_transition(keeper))
 		{
+			if (!keeper_ensure_current_state(keeper))
+			{
+				/*
+				 * We don't take care of the warnedOnCurrentIteration here
+				 * because the real thing that should happen is the
+				 * transition to the next state. That's what we keep track
+				 * of with "transitionFailed".
+				 */
+				log_warn(
+					"pg_autoctl failed to ensure current state \"%s\": "
+					"PostgreSQL %s running",
+					NodeStateToString(keeperState->current_role),
+					postgres->pgIsRunning ? "is" : "is not");
+			}
+		}
+
+		keeper->status.data.transitionInProgress = true;
+		keeper->status.data.transitionStartTime = time(NULL);
+		(void) keeper_loop_publish_status(loop);
+
+		transitionStartMs = monotonic_clock_ms();
+
+		if (!keeper_fsm_reach_assigned_state(keeper))
+		{
+			log_error("Failed to transition to state \"%s\", retrying... ",
+					  NodeStateToString(keeperState->assigned_role));
+
 			transitionFailed = true;
 		}
 
-		if (needStateChange && !transitionFailed)
+		keeper->status.data.transitionInProgress = false;
+		keeper->status.data.transitionDurationMs =
+			monotonic_clock_ms() - transitionStartMs;
+	}
+	else if (couldContactMonitor ||
+			 (loop->contactedMonitor &&
+			  keeperState->assigned_role == keeperState->current_role &&
+			  !fencing_watchdog_fenced(&(keeper->watchdog))))
+	{
+		/*
+		 * We keep the local Postgres instance in its current state while the
+		 * monitor is unavailable, as long as that state is stable: the
+		 * monitor assigned it since we started, and neither the network
+		 * partition checks nor the fencing watchdog decided otherwise.
+		 */
+		if (!keeper_ensure_current_state(keeper))
+		{
+			loop->warnedOnCurrentIteration = true;
+			log_warn("pg_autoctl failed to ensure current state \"%s\": "
+					 "PostgreSQL %s running",
+					 NodeStateToString(keeperState->current_role),
+					 postgres->pgIsRunning ? "is" : "is not");
+		}
+		else if (loop->warnedOnPreviousIteration)
+		{
+			log_info("pg_autoctl managed to ensure current state \"%s\": "
+					 "PostgreSQL %s running",
+					 NodeStateToString(keeperState->current_role),
+					 postgres->pgIsRunning ? "is" : "is not");
+		}
+	}
+
+	if (asked_to_stop_fast)
+	{
+		return false;
+	}
+
+	/*
+	 * Even if a transition failed, we still write the state file to update
+	 * timestamps used for the network partition checks.
+	 */
+	if (!keeper_store_state(keeper))
+	{
+		transitionFailed = true;
+	}
+
+	(void) fencing_watchdog_update(&(keeper->watchdog),
+								   keeper->lastMonitorContactMs,
+								   keeper->lastSecondaryContactMs,
+								   keeper->config.network_partition_timeout,
+								   keeperState->current_role == PRIMARY_STATE);
+
+	if (!needStateChange)
+	{
+		keeper->status.data.transitionDurationMs = 0;
+	}
+	keeper->status.data.iterations++;
+	(void) keeper_loop_publish_status(loop);
+
+	if (loop->firstLoop)
+	{
+		loop->firstLoop = false;
+	}
+
+	/* advance the warnings "counters" */
+	if (loop->warnedOnPreviousIteration)
+	{
+		loop->warnedOnPreviousIteration = false;
+	}
+
+	if (loop->warnedOnCurrentIteration)
+	{
+		loop->warnedOnPreviousIteration = true;
+		loop->warnedOnCurrentIteration = false;
+	}
+
+	return needStateChange && !transitionFailed;
+}
+
+
+/*
+ * keeper_loop_publish_status updates the status page of an instance from
+ * what we know about it in the main loop.
+ */
+static void
+keeper_loop_publish_status(KeeperLoop *loop)
+{
+	Keeper *keeper = loop->keeper;
+	KeeperStateData *keeperState = &(keeper->state);
+	LocalPostgresServer *postgres = &(keeper->postgres);
+	KeeperStatusData *data = &(keeper->status.data);
+
+	data->pid = loop->pid;
+	data->nodeId = keeperState->current_node_id;
+	data->groupId = keeperState->current_group;
+	data->currentRole = keeperState->current_role;
+	data->assignedRole = keeperState->assigned_role;
+	data->lastUpdate = time(NULL);
+	data->lastMonitorContact = keeperState->last_monitor_contact;
+	data->lastSecondaryContact = keeperState->last_secondary_contact;
+	data->pgIsRunning = postgres->pgIsRunning;
+	data->xlogLag = keeperState->xlog_lag;
+
+	strlcpy(data->currentLSN, postgres->currentLSN, PG_LSN_MAXLENGTH);
+	strlcpy(data->pgsrSyncState, postgres->pgsrSyncState,
+			PGSR_SYNC_STATE_MAXLENGTH);
+
+	(void) keeper_status_publish(&(keeper->status));
+}
+
+
+/*
+ * keeper_loop_wait waits for PG_AUTOCTL_KEEPER_SLEEP_TIME before the next
+ * iteration of the main loop. A signal interrupts the wait, as well as the
+ * step control command, that needs a main loop iteration. The other control
+ * commands are answered right away: heartbeat only calls node_active.
+ *
+ * Meanwhile we establish the monitor connections, polling their sockets along
+ * with the control sockets. With onlyConnect, the wait is over as soon as no
+ * monitor connection is in progress anymore.
+ */
+static void
+keeper_loop_wait(KeeperLoop *loops, int count, bool onlyConnect)
+{
+	struct pollfd *pfds = calloc(2 * count, sizeof(struct pollfd));
+	uint64_t deadlineMs =
+		monotonic_clock_ms() + PG_AUTOCTL_KEEPER_SLEEP_TIME * MSECS_PER_SEC;
+	bool wakeUp = false;
+	int index = 0;
+
+	if (pfds == NULL)
+	{
+		sleep(PG_AUTOCTL_KEEPER_SLEEP_TIME);
+		return;
+	}
+
+	(void) keeper_loop_connect(loops, count);
+
+	while (!wakeUp)
+	{
+		uint64_t nowMs = monotonic_clock_ms();
+		int timeoutMs = (int) (deadlineMs - nowMs);
+		bool connecting = false;
+		int ready = 0;
+
+		if (nowMs >= deadlineMs)
 		{
-			/* cycle faster if we made a state transition */
-			doSleep = false;
+			break;
 		}
 
-		if (asked_to_stop || asked_to_stop_fast)
+		/* the monitor sockets follow the control sockets in pfds */
+		for (index = 0; index < count; index++)
 		{
-			keepRunning = false;
+			PGSQL *pgsql = &(loops[index].keeper->monitor.pgsql);
+
+			pfds[count + index].fd = -1;
+			pfds[count + index].revents = 0;
+
+			if (pgsql->connecting)
+			{
+				connecting = true;
+
+				pfds[count + index].fd = PQsocket(pgsql->connection);
+				pfds[count + index].events =
+					pgsql->connectStatus == PGRES_POLLING_READING
+					? POLLIN : POLLOUT;
+			}
+		}
+
+		if (onlyConnect && !connecting)
+		{
+			break;
+		}
+
+		/* wake up to check the connection timeouts */
+		if (connecting && timeoutMs > MSECS_PER_SEC)
+		{
+			timeoutMs = MSECS_PER_SEC;
+		}
+
+		/* poll() ignores negative file descriptors */
+		for (index = 0; index < count; index++)
+		{
+			ControlSocket *control = &(loops[index].keeper->control);
+
+			(void) control_socket_expire(control);
+
+			pfds[index].fd = control_socket_pollfd(control);
+			pfds[index].events = POLLIN;
+			pfds[index].revents = 0;
+
+			/* wake up to drop clients that don't send their command */
+			if (control->reading && timeoutMs > PG_AUTOCTL_CONTROL_TIMEOUT_MS)
+			{
+				timeoutMs = PG_AUTOCTL_CONTROL_TIMEOUT_MS;
+			}
 		}
 
-		if (firstLoop)
+		ready = poll(pfds, 2 * count, timeoutMs);
+
+		if (ready < 0)
 		{
-			firstLoop = false;
+			/* when interrupted by a signal, handle it right away */
+			if (errno != EINTR)
+			{
+				log_warn("Failed to wait for control commands: %m");
+			}
+			break;
 		}
 
-		/* advance the warnings "counters" */
-		if (warnedOnPreviousIteration)
+		for (index = 0; index < count; index++)
 		{
-			warnedOnPreviousIteration = false;
+			PGSQL *pgsql = &(loops[index].keeper->monitor.pgsql);
+
+			if (pgsql->connecting)
+			{
+				(void) pgsql_poll_connection(pgsql,
+											 pfds[count + index].revents != 0);
+			}
 		}
 
-		if (warnedOnCurrentIteration)
+		for (index = 0; ready > 0 && index < count; index++)
 		{
-			warnedOnPreviousIteration = true;
-			warnedOnCurrentIteration = false;
+			Keeper *keeper = loops[index].keeper;
+
+			if (!(pfds[index].revents & POLLIN) ||
+				!control_socket_accept(&(keeper->control)))
+			{
+				continue;
+			}
+
+			switch (keeper->control.pending)
+			{
+				case CONTROL_COMMAND_STATUS:
+				{
+					(void) keeper_loop_reply(&(loops[index]), false);
+					break;
+				}
+
+				case CONTROL_COMMAND_RELOAD:
+				{
+					(void) reload_configuration(keeper);
+					(void) keeper_loop_reply(&(loops[index]), false);
+					break;
+				}
+
+				case CONTROL_COMMAND_HEARTBEAT:
+				{
+					/*
+					 * Report our current state to the monitor, the assigned
+					 * state is then reached in the next iteration.
+					 */
+					MonitorAssignedState assignedState = { 0 };
+					bool couldContactMonitor =
+						keeper_loop_prepare(&(loops[index])) &&
+						keeper_loop_node_active(&(loops[index]),
+												&assignedState);
+
+					(void) keeper_loop_reply(&(loops[index]),
+											 couldContactMonitor);
+					break;
+				}
+
+				default:
+				{
+					/* answered at the end of the next iteration */
+					wakeUp = true;
+					break;
+				}
+			}
 		}
 	}
 
-	return keeper_service_stop(keeper);
+	free(pfds);
+}
+
+
+/*
+ * keeper_loop_reply answers the pending control command of an instance with
+ * a JSON object that contains the current status of the instance.
+ */
+static void
+keeper_loop_reply(KeeperLoop *loop, bool couldContactMonitor)
+{
+	Keeper *keeper = loop->keeper;
+	ControlSocket *control = &(keeper->control);
+	JSON_Value *js = json_value_init_object();
+	JSON_Object *jsobj = json_value_get_object(js);
+	JSON_Value *jsStatus = json_value_init_object();
+
+	json_object_set_string(jsobj, "command",
+						   ControlCommandToString(control->pending));
+
+	if (control->pending == CONTROL_COMMAND_HEARTBEAT ||
+		control->pending == CONTROL_COMMAND_STEP)
+	{
+		json_object_set_boolean(jsobj, "monitor", couldContactMonitor);
+	}
+
+	if (control->pending == CONTROL_COMMAND_STEP)
+	{
+		json_object_set_boolean(jsobj, "transition", loop->madeTransition);
+	}
+
+	(void) keeperStatusAsJSON(&(keeper->status.data), jsStatus);
+	json_object_set_value(jsobj, "status", jsStatus);
+
+	(void) control_socket_reply(control, js);
+
+	json_value_free(js);
 }
 
 
@@ -455,8 +1362,9 @@ is_network_healthy(Keeper *keeper)
 	KeeperConfig *config = &(keeper->config);
 	KeeperStateData *keeperState = &(keeper->state);
 	LocalPostgresServer *postgres = &(keeper->postgres);
-	int networkPartitionTimeout = config->network_partition_timeout;
-	uint64_t now = time(NULL);
+	uint64_t networkPartitionTimeoutMs =
+		(uint64_t) config->network_partition_timeout * MSECS_PER_SEC;
+	uint64_t nowMs = monotonic_clock_ms();
 	bool hasReplica = false;
 
 	if (keeperState->current_role != PRIMARY_STATE)
@@ -471,21 +1379,23 @@ is_network_healthy(Keeper *keeper)
 	if (primary_has_replica(postgres, PG_AUTOCTL_REPLICA_USERNAME, &hasReplica) &&
 		hasReplica)
 	{
-		keeperState->last_secondary_contact = now;
+		keeperState->last_secondary_contact = time(NULL);
+		keeper->lastSecondaryContactMs = nowMs;
 		log_warn("We lost the monitor, but still have a standby: "
 				 "we're not in a network partition, continuing.");
 		return true;
 	}
 
-	if (!in_network_partition(keeperState, now, networkPartitionTimeout))
+	if (!in_network_partition(keeper, nowMs, networkPartitionTimeoutMs))
 	{
 		/* still had recent contact with monitor and/or secondary */
 		return true;
 	}
 
-	log_info("Failed to contact the monitor or standby in %" PRIu64 " seconds, "
-			 "at %d seconds we shut down PostgreSQL to prevent split brain issues",
-			 keeperState->last_monitor_contact - now, networkPartitionTimeout);
+	log_info("Failed to contact the monitor or standby in %" PRIu64 "ms, "
+			 "at %" PRIu64 "ms we shut down PostgreSQL to prevent split brain "
+			 "issues",
+			 nowMs - keeper->lastMonitorContactMs, networkPartitionTimeoutMs);
 
 	return false;
 }
@@ -497,16 +1407,16 @@ is_network_healthy(Keeper *keeper)
  * the state before calling this function is advised.
  */
 static bool
-in_network_partition(KeeperStateData *keeperState, uint64_t now,
-					 int networkPartitionTimeout)
+in_network_partition(Keeper *keeper, uint64_t nowMs,
+					 uint64_t networkPartitionTimeoutMs)
 {
-	uint64_t monitor_contact_lag = (now - keeperState->last_monitor_contact);
-	uint64_t secondary_contact_lag = (now - keeperState->last_secondary_contact);
+	uint64_t monitor_contact_lag = (nowMs - keeper->lastMonitorContactMs);
+	uint64_t secondary_contact_lag = (nowMs - keeper->lastSecondaryContactMs);
 
-	return keeperState->last_monitor_contact > 0 &&
-		   keeperState->last_secondary_contact > 0 &&
-		   networkPartitionTimeout < monitor_contact_lag &&
-		   networkPartitionTimeout < secondary_contact_lag;
+	return keeper->lastMonitorContactMs > 0 &&
+		   keeper->lastSecondaryContactMs > 0 &&
+		   networkPartitionTimeoutMs < monitor_contact_lag &&
+		   networkPartitionTimeoutMs < secondary_contact_lag;
 }
 
 
@@ -563,9 +1473,6 @@ reload_configuration(Keeper *keeper)
 				 "continuing with the same configuration.",
 				 config->pathnames.config);
 	}
-
-	/* we're done reloading now. */
-	asked_to_reload = 0;
 }
 
 
@@ -6,12 +6,14 @@
  * Licensed under the PostgreSQL License.
  *
  */
+#include <errno.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <sys/select.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "clock_utils.h"
 #include "defaults.h"
 #include "env_utils.h"
 #include "log.h"
@@ -19,6 +21,7 @@
 #include "monitor_config.h"
 #include "parsing.h"
 #include "pgsql.h"
+#include "pqexpbuffer.h"
 #include "string_utils.h"
 
 #define STR_ERRCODE_OBJECT_IN_USE "55006"
@@ -44,6 +47,14 @@ typedef struct MonitorAssignedStateParseContext
 	bool parsedOK;
 } MonitorAssignedStateParseContext;
 
+typedef struct NodeActiveBatchParseContext
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	MonitorNodeActive *nodes;
+	int count;
+	bool parsedOK;
+} NodeActiveBatchParseContext;
+
 typedef struct NodeReplicationSettingsParseContext
 {
 	char sqlstate[SQLSTATE_LENGTH];
@@ -75,15 +86,23 @@ static bool parseNode(PGresult *result, int rowNumber, NodeAddress *node);
 static void parseNodeResult(void *ctx, PGresult *result);
 static void parseNodeArray(void *ctx, PGresult *result);
 static void parseNodeState(void *ctx, PGresult *result);
+static bool parseNodeStateRow(PGresult *result, int rowNumber, int firstColumn,
+							  MonitorAssignedState *assignedState);
+static void parseNodeStateBatch(void *ctx, PGresult *result);
 static void parseNodeReplicationSettings(void *ctx, PGresult *result);
 static void printCurrentState(void *ctx, PGresult *result);
 static void printLastEvents(void *ctx, PGresult *result);
 static void printFormationURI(void *ctx, PGresult *result);
 static void parseCoordinatorNode(void *ctx, PGresult *result);
 static void parseExtensionVersion(void *ctx, PGresult *result);
+static void setStandbyTelemetryParams(StandbyTelemetry *standbys,
+									  Oid *paramTypes,
+									  const char **paramValues);
 
 static bool prepare_connection_to_current_system_user(Monitor *source,
 													  Monitor *target);
+static bool monitor_add_conninfo_defaults(const char *url,
+										  char *connInfo, int size);
 
 /*
  * monitor_init initialises a Monitor struct to connect to the given
@@ -92,7 +111,15 @@ static bool prepare_connection_to_current_system_user(Monitor *source,
 bool
 monitor_init(Monitor *monitor, char *url)
 {
-	if (!pgsql_init(&monitor->pgsql, url, PGSQL_CONN_MONITOR))
+	char connInfo[MAXCONNINFO] = { 0 };
+
+	if (!monitor_add_conninfo_defaults(url, connInfo, MAXCONNINFO))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!pgsql_init(&monitor->pgsql, connInfo, PGSQL_CONN_MONITOR))
 	{
 		/* URL must be invalid, pgsql_init logged an error */
 		return false;
@@ -102,6 +129,95 @@ monitor_init(Monitor *monitor, char *url)
 }
 
 
+/*
+ * monitor_add_conninfo_defaults copies the monitor URL to connInfo. When the
+ * URL lists several hosts, such as a monitor and its standby monitor, we want
+ * to connect to the one that accepts writes, and to quickly skip a host that
+ * is down, so we add target_session_attrs and connect_timeout unless the URL
+ * already has them.
+ */
+static bool
+monitor_add_conninfo_defaults(const char *url, char *connInfo, int size)
+{
+	NodeAddressArray hosts = { 0 };
+	PQconninfoOption *conninfo = NULL;
+	PQconninfoOption *option = NULL;
+	char *errmsg = NULL;
+	bool hasTargetSessionAttrs = false;
+	bool hasConnectTimeout = false;
+	bool isURI = strncmp(url, "postgres://", 11) == 0 ||
+				 strncmp(url, "postgresql://", 13) == 0;
+	PQExpBuffer buffer = NULL;
+	bool success = true;
+
+	if (!hostnames_from_uri(url, &hosts) || hosts.count <= 1)
+	{
+		/* errors, if any, are logged again in pgsql_init */
+		strlcpy(connInfo, url, size);
+		return true;
+	}
+
+	conninfo = PQconninfoParse(url, &errmsg);
+	if (conninfo == NULL)
+	{
+		log_error("Failed to parse pguri \"%s\": %s", url, errmsg);
+		PQfreemem(errmsg);
+		return false;
+	}
+
+	for (option = conninfo; option->keyword != NULL; option++)
+	{
+		if (option->val == NULL)
+		{
+			continue;
+		}
+
+		if (strcmp(option->keyword, "target_session_attrs") == 0)
+		{
+			hasTargetSessionAttrs = true;
+		}
+		else if (strcmp(option->keyword, "connect_timeout") == 0)
+		{
+			hasConnectTimeout = true;
+		}
+	}
+	PQconninfoFree(conninfo);
+
+	buffer = createPQExpBuffer();
+	appendPQExpBufferStr(buffer, url);
+
+	if (!hasTargetSessionAttrs)
+	{
+		appendPQExpBuffer(buffer, "%s%s",
+						  isURI ? (strchr(buffer->data, '?') ? "&" : "?") : " ",
+						  "target_session_attrs=read-write");
+	}
+
+	if (!hasConnectTimeout)
+	{
+		appendPQExpBuffer(buffer, "%s%s%s",
+						  isURI ? (strchr(buffer->data, '?') ? "&" : "?") : " ",
+						  "connect_timeout=",
+						  MONITOR_HOST_CONNECT_TIMEOUT);
+	}
+
+	if (PQExpBufferBroken(buffer) || buffer->len >= size)
+	{
+		log_error("Failed to add connection parameters to monitor URL \"%s\"",
+				  url);
+		success = false;
+	}
+	else
+	{
+		strlcpy(connInfo, buffer->data, size);
+	}
+
+	destroyPQExpBuffer(buffer);
+
+	return success;
+}
+
+
 /*
  * monitor_get_nodes gets the hostname and port of all the nodes in the given
  * group.
@@ -512,16 +628,16 @@ bool
 monitor_register_node(Monitor *monitor, char *formation, char *host, int port,
 					  char *dbname, int desiredGroupId, NodeState initialState,
 					  PgInstanceKind kind, int candidatePriority, bool quorum,
-					  MonitorAssignedState *assignedState)
+					  char *zone, MonitorAssignedState *assignedState)
 {
 	PGSQL *pgsql = &monitor->pgsql;
 	const char *sql =
 		"SELECT * FROM pgautofailover.register_node($1, $2, $3, $4, $5, "
-		"$6::pgautofailover.replication_state, $7, $8, $9)";
-	int paramCount = 9;
-	Oid paramTypes[9] = { TEXTOID, TEXTOID, INT4OID, NAMEOID, INT4OID,
-						  TEXTOID, TEXTOID, INT4OID, BOOLOID };
-	const char *paramValues[9];
+		"$6::pgautofailover.replication_state, $7, $8, $9, $10)";
+	int paramCount = 10;
+	Oid paramTypes[10] = { TEXTOID, TEXTOID, INT4OID, NAMEOID, INT4OID,
+						   TEXTOID, TEXTOID, INT4OID, BOOLOID, TEXTOID };
+	const char *paramValues[10];
 	MonitorAssignedStateParseContext parseContext =
 		{ { 0 }, assignedState, false };
 	const char *nodeStateString = NodeStateToString(initialState);
@@ -535,6 +651,7 @@ monitor_register_node(Monitor *monitor, char *formation, char *host, int port,
 	paramValues[6] = nodeKindToString(kind);
 	paramValues[7] = intToString(candidatePriority).strValue;
 	paramValues[8] = quorum ? "true" : "false";
+	paramValues[9] = zone;
 
 
 	if (!pgsql_execute_with_params(pgsql, sql,
@@ -557,7 +674,7 @@ monitor_register_node(Monitor *monitor, char *formation, char *host, int port,
 			return monitor_register_node(monitor, formation, host, port,
 										 dbname, desiredGroupId, initialState,
 										 kind, candidatePriority, quorum,
-										 assignedState);
+										 zone, assignedState);
 		}
 
 		log_error("Failed to register node %s:%d in group %d of formation \"%s\" "
@@ -591,7 +708,8 @@ monitor_register_node(Monitor *monitor, char *formation, char *host, int port,
 /*
  * monitor_node_active communicates the current state of the node to the
  * monitor and puts the new goal state to assignedState, which must not
- * be NULL.
+ * be NULL. When standbys is not NULL, the replication telemetry of our
+ * standby nodes is also sent to the monitor.
  */
 bool
 monitor_node_active(Monitor *monitor,
@@ -599,16 +717,19 @@ monitor_node_active(Monitor *monitor,
 					int groupId, NodeState currentState,
 					bool pgIsRunning,
 					char *currentLSN, char *pgsrSyncState,
+					StandbyTelemetry *standbys,
 					MonitorAssignedState *assignedState)
 {
 	PGSQL *pgsql = &monitor->pgsql;
 	const char *sql =
 		"SELECT * FROM pgautofailover.node_active($1, $2, $3, $4, $5, "
-		"$6::pgautofailover.replication_state, $7, $8, $9)";
-	int paramCount = 9;
-	Oid paramTypes[9] = { TEXTOID, TEXTOID, INT4OID, INT4OID,
-						  INT4OID, TEXTOID, BOOLOID, LSNOID, TEXTOID };
-	const char *paramValues[9];
+		"$6::pgautofailover.replication_state, $7, $8, $9, "
+		"$10::int[], $11::pg_lsn[], $12::pg_lsn[], $13::pg_lsn[], "
+		"$14::interval[], $15::interval[], $16::interval[])";
+	int paramCount = 16;
+	Oid paramTypes[16] = { TEXTOID, TEXTOID, INT4OID, INT4OID,
+						   INT4OID, TEXTOID, BOOLOID, LSNOID, TEXTOID };
+	const char *paramValues[16];
 	MonitorAssignedStateParseContext parseContext =
 		{ { 0 }, assignedState, false };
 	const char *nodeStateString = NodeStateToString(currentState);
@@ -623,6 +744,8 @@ monitor_node_active(Monitor *monitor,
 	paramValues[7] = currentLSN;
 	paramValues[8] = pgsrSyncState;
 
+	setStandbyTelemetryParams(standbys, paramTypes + 9, paramValues + 9);
+
 	if (!pgsql_execute_with_params(pgsql, sql,
 								   paramCount, paramTypes, paramValues,
 								   &parseContext, parseNodeState))
@@ -656,6 +779,155 @@ monitor_node_active(Monitor *monitor,
 }
 
 
+/*
+ * monitor_node_active_batch reports the current state of several nodes
+ * managed by the same pg_autoctl process, and gets their assigned states
+ * back, in a single round-trip to the monitor: we send a UNION ALL of as many
+ * calls to pgautofailover.node_active() as we have nodes.
+ *
+ * The query runs in a single transaction on the monitor, so the nodes must
+ * be given in (formation, group) order to always acquire the group locks in
+ * the same order. When any of the node_active calls fails, the whole batch
+ * fails and the caller should then fall back to monitor_node_active() for
+ * each node.
+ */
+bool
+monitor_node_active_batch(Monitor *monitor, MonitorNodeActive *nodes, int count)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	PQExpBuffer query = createPQExpBuffer();
+	int paramCount = count * 16;
+	Oid *paramTypes = calloc(paramCount, sizeof(Oid));
+	const char **paramValues = calloc(paramCount, sizeof(char *));
+	IntString *intValues = calloc(count * 3, sizeof(IntString));
+	NodeActiveBatchParseContext parseContext = { { 0 }, nodes, count, false };
+	bool success = true;
+	int index = 0;
+
+	if (query == NULL || paramTypes == NULL ||
+		paramValues == NULL || intValues == NULL)
+	{
+		log_error("Failed to allocate memory for %d node_active calls", count);
+		destroyPQExpBuffer(query);
+		free(paramTypes);
+		free(paramValues);
+		free(intValues);
+		return false;
+	}
+
+	for (index = 0; index < count; index++)
+	{
+		MonitorNodeActive *node = &(nodes[index]);
+		int p = index * 16;
+
+		appendPQExpBuffer(query,
+						  "%sSELECT %d, * FROM pgautofailover.node_active("
+						  "$%d, $%d, $%d, $%d, $%d, "
+						  "$%d::pgautofailover.replication_state, "
+						  "$%d, $%d, $%d, "
+						  "$%d::int[], $%d::pg_lsn[], $%d::pg_lsn[], "
+						  "$%d::pg_lsn[], $%d::interval[], $%d::interval[], "
+						  "$%d::interval[])",
+						  index == 0 ? "" : " UNION ALL ",
+						  index,
+						  p + 1, p + 2, p + 3, p + 4, p + 5,
+						  p + 6, p + 7, p + 8, p + 9,
+						  p + 10, p + 11, p + 12, p + 13,
+						  p + 14, p + 15, p + 16);
+
+		intValues[index * 3] = intToString(node->port);
+		intValues[index * 3 + 1] = intToString(node->nodeId);
+		intValues[index * 3 + 2] = intToString(node->groupId);
+
+		paramTypes[p] = TEXTOID;
+		paramTypes[p + 1] = TEXTOID;
+		paramTypes[p + 2] = INT4OID;
+		paramTypes[p + 3] = INT4OID;
+		paramTypes[p + 4] = INT4OID;
+		paramTypes[p + 5] = TEXTOID;
+		paramTypes[p + 6] = BOOLOID;
+		paramTypes[p + 7] = LSNOID;
+		paramTypes[p + 8] = TEXTOID;
+
+		paramValues[p] = node->formation;
+		paramValues[p + 1] = node->host;
+		paramValues[p + 2] = intValues[index * 3].strValue;
+		paramValues[p + 3] = intValues[index * 3 + 1].strValue;
+		paramValues[p + 4] = intValues[index * 3 + 2].strValue;
+		paramValues[p + 5] = NodeStateToString(node->currentState);
+		paramValues[p + 6] = node->pgIsRunning ? "true" : "false";
+		paramValues[p + 7] = node->currentLSN;
+		paramValues[p + 8] = node->pgsrSyncState;
+
+		setStandbyTelemetryParams(node->standbys,
+								  paramTypes + p + 9, paramValues + p + 9);
+	}
+
+	/* memory allocation could have failed while building string */
+	if (PQExpBufferBroken(query))
+	{
+		log_error("Failed to allocate memory for %d node_active calls", count);
+		success = false;
+	}
+	else if (!pgsql_execute_with_params(pgsql, query->data,
+										paramCount, paramTypes, paramValues,
+										&parseContext, parseNodeStateBatch))
+	{
+		log_error("Failed to get node states for %d nodes from the monitor, "
+				  "see previous lines for details", count);
+		success = false;
+	}
+	else if (!parseContext.parsedOK)
+	{
+		log_error("Failed to get node states for %d nodes "
+				  "because the monitor returned an unexpected result, "
+				  "see previous lines for details", count);
+		success = false;
+	}
+
+	/* disconnect from PostgreSQL now */
+	pgsql_finish(&monitor->pgsql);
+
+	destroyPQExpBuffer(query);
+	free(paramTypes);
+	free(paramValues);
+	free(intValues);
+
+	return success;
+}
+
+
+/*
+ * setStandbyTelemetryParams sets the 7 node_active parameters that carry the
+ * replication telemetry of our standby nodes. The values are Postgres array
+ * literals sent as text, and casted on the monitor side. Without telemetry
+ * to report, such as when Postgres is not running, we send empty arrays.
+ */
+static void
+setStandbyTelemetryParams(StandbyTelemetry *standbys,
+						  Oid *paramTypes, const char **paramValues)
+{
+	for (int i = 0; i < 7; i++)
+	{
+		paramTypes[i] = TEXTOID;
+		paramValues[i] = "{}";
+	}
+
+	if (standbys == NULL || IS_EMPTY_STRING_BUFFER(standbys->nodeIds))
+	{
+		return;
+	}
+
+	paramValues[0] = standbys->nodeIds;
+	paramValues[1] = standbys->writeLSNs;
+	paramValues[2] = standbys->flushLSNs;
+	paramValues[3] = standbys->replayLSNs;
+	paramValues[4] = standbys->writeLags;
+	paramValues[5] = standbys->flushLags;
+	paramValues[6] = standbys->replayLags;
+}
+
+
 /*
  * monitor_set_node_candidate_priority updates the monitor on the changes
  * in the node candidate priority.
@@ -1002,6 +1274,174 @@ monitor_perform_failover(Monitor *monitor, char *formation, int group)
 }
 
 
+/*
+ * monitor_perform_switchover calls the pgautofailover.perform_switchover
+ * function on the monitor.
+ */
+bool
+monitor_perform_switchover(Monitor *monitor, char *formation, int group)
+{
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql = "SELECT pgautofailover.perform_switchover($1, $2)";
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, INT4OID };
+	const char *paramValues[2];
+
+	paramValues[0] = formation;
+	paramValues[1] = intToString(group).strValue;
+
+	/*
+	 * pgautofailover.perform_switchover() returns VOID.
+	 */
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   NULL, NULL))
+	{
+		log_error("Failed to perform switchover for formation %s and group %d",
+				  formation, group);
+		return false;
+	}
+
+	/* disconnect from PostgreSQL now */
+	pgsql_finish(&monitor->pgsql);
+
+	return true;
+}
+
+
+/*
+ * monitor_perform_rolling_restart calls the
+ * pgautofailover.perform_rolling_restart function on the monitor, which
+ * advances the rolling restart of the formation by one step, and sets
+ * remainingCount to how many nodes are still to be restarted.
+ */
+bool
+monitor_perform_rolling_restart(Monitor *monitor, char *formation,
+								int *remainingCount)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql = "SELECT pgautofailover.perform_rolling_restart($1)";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1];
+
+	paramValues[0] = formation;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
+	{
+		log_error("Failed to perform rolling restart for formation %s",
+				  formation);
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to parse the result of "
+				  "pgautofailover.perform_rolling_restart");
+		return false;
+	}
+
+	*remainingCount = context.intVal;
+
+	/* disconnect from PostgreSQL now */
+	pgsql_finish(&monitor->pgsql);
+
+	return true;
+}
+
+
+/*
+ * monitor_is_restarting_node sets restarting to true when the current rolling
+ * restart of the formation has asked the given node to restart.
+ */
+bool
+monitor_is_restarting_node(Monitor *monitor, int nodeId, bool *restarting)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT EXISTS(SELECT 1 FROM pgautofailover.rolling_restart "
+		"WHERE nodeid = $1 AND restarttime IS NOT NULL)";
+	int paramCount = 1;
+	Oid paramTypes[1] = { INT8OID };
+	const char *paramValues[1];
+
+	paramValues[0] = intToString(nodeId).strValue;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
+	{
+		log_error("Failed to check whether node %d is part of a rolling "
+				  "restart", nodeId);
+		return false;
+	}
+
+	/* disconnect from PostgreSQL now */
+	pgsql_finish(&monitor->pgsql);
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to check whether node %d is part of a rolling "
+				  "restart: could not parse monitor's result.", nodeId);
+		return false;
+	}
+
+	*restarting = context.boolVal;
+
+	return true;
+}
+
+
+/*
+ * monitor_count_group_nodes sets nodeCount to how many nodes are registered
+ * in the given group of the formation, or in the whole formation when the
+ * group is not known yet (groupId is -1).
+ */
+bool
+monitor_count_group_nodes(Monitor *monitor, char *formation, int groupId,
+						  int *nodeCount)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT count(*) FROM pgautofailover.node "
+		"WHERE formationid = $1 AND ($2 < 0 OR groupid = $2)";
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, INT4OID };
+	const char *paramValues[2];
+
+	paramValues[0] = formation;
+	paramValues[1] = intToString(groupId).strValue;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
+	{
+		log_error("Failed to count the nodes in group %d of formation \"%s\"",
+				  groupId, formation);
+		return false;
+	}
+
+	/* disconnect from PostgreSQL now */
+	pgsql_finish(&monitor->pgsql);
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to count the nodes in group %d of formation \"%s\": "
+				  "could not parse monitor's result.", groupId, formation);
+		return false;
+	}
+
+	*nodeCount = context.intVal;
+
+	return true;
+}
+
+
 /*
  * parseNode parses a hostname and a port from the libpq result and writes
  * it to the NodeAddressParseContext pointed to by ctx.
@@ -1224,8 +1664,6 @@ parseNodeState(void *ctx, PGresult *result)
 {
 	MonitorAssignedStateParseContext *context =
 		(MonitorAssignedStateParseContext *) ctx;
-	char *value = NULL;
-	int errors = 0;
 
 	if (PQntuples(result) != 1)
 	{
@@ -1241,39 +1679,56 @@ parseNodeState(void *ctx, PGresult *result)
 		return;
 	}
 
-	value = PQgetvalue(result, 0, 0);
+	context->parsedOK =
+		parseNodeStateRow(result, 0, 0, context->assignedState);
+}
+
+
+/*
+ * parseNodeStateRow parses the 5 columns of an assigned node state starting
+ * at the given column of the given row, as returned by register_node or
+ * node_active.
+ */
+static bool
+parseNodeStateRow(PGresult *result, int rowNumber, int firstColumn,
+				  MonitorAssignedState *assignedState)
+{
+	char *value = NULL;
+	int errors = 0;
 
-	if (!stringToInt(value, &context->assignedState->nodeId))
+	value = PQgetvalue(result, rowNumber, firstColumn);
+
+	if (!stringToInt(value, &assignedState->nodeId))
 	{
 		log_error("Invalid node ID \"%s\" returned by monitor", value);
 		++errors;
 	}
 
-	value = PQgetvalue(result, 0, 1);
+	value = PQgetvalue(result, rowNumber, firstColumn + 1);
 
-	if (!stringToInt(value, &context->assignedState->groupId))
+	if (!stringToInt(value, &assignedState->groupId))
 	{
 		log_error("Invalid group ID \"%s\" returned by monitor", value);
 		++errors;
 	}
 
-	value = PQgetvalue(result, 0, 2);
-	context->assignedState->state = NodeStateFromString(value);
-	if (context->assignedState->state == NO_STATE)
+	value = PQgetvalue(result, rowNumber, firstColumn + 2);
+	assignedState->state = NodeStateFromString(value);
+	if (assignedState->state == NO_STATE)
 	{
 		log_error("Invalid node state \"%s\" returned by monitor", value);
 		++errors;
 	}
 
-	value = PQgetvalue(result, 0, 3);
-	if (sscanf(value, "%d", &context->assignedState->candidatePriority) != 1)
+	value = PQgetvalue(result, rowNumber, firstColumn + 3);
+	if (sscanf(value, "%d", &assignedState->candidatePriority) != 1)
 	{
 		log_error("Invalid failover candidate priority \"%s\" "
 				  "returned by monitor", value);
 		++errors;
 	}
 
-	value = PQgetvalue(result, 0, 4);
+	value = PQgetvalue(result, rowNumber, firstColumn + 4);
 	if (value == NULL || ( (*value != 't') && (*value != 'f')))
 	{
 		log_error("Invalid replication quorum \"%s\" "
@@ -1282,16 +1737,60 @@ parseNodeState(void *ctx, PGresult *result)
 	}
 	else
 	{
-		context->assignedState->replicationQuorum = (*value) =='t';
+		assignedState->replicationQuorum = (*value) =='t';
 	}
 
+	/* if we have no errors, then we're good. */
+	return errors == 0;
+}
+
 
-	if (errors > 0)
+/*
+ * parseNodeStateBatch parses the node states returned by the query built in
+ * monitor_node_active_batch, where the first column is the index of the node
+ * in the batch.
+ */
+static void
+parseNodeStateBatch(void *ctx, PGresult *result)
+{
+	NodeActiveBatchParseContext *context = (NodeActiveBatchParseContext *) ctx;
+	int rowNumber = 0;
+
+	if (PQntuples(result) != context->count)
 	{
+		log_error("Query returned %d rows, expected %d",
+				  PQntuples(result), context->count);
 		context->parsedOK = false;
 		return;
 	}
 
+	if (PQnfields(result) != 6)
+	{
+		log_error("Query returned %d columns, expected 6", PQnfields(result));
+		context->parsedOK = false;
+		return;
+	}
+
+	for (rowNumber = 0; rowNumber < context->count; rowNumber++)
+	{
+		char *value = PQgetvalue(result, rowNumber, 0);
+		int index = -1;
+
+		if (!stringToInt(value, &index) || index < 0 || index >= context->count)
+		{
+			log_error("Invalid batch index \"%s\" returned by monitor", value);
+			context->parsedOK = false;
+			return;
+		}
+
+		if (!parseNodeStateRow(result, rowNumber, 1,
+							   &(context->nodes[index].assignedState)))
+		{
+			context->parsedOK = false;
+			return;
+		}
+	}
+
 	/* if we reach this line, then we're good. */
 	context->parsedOK = true;
 }
@@ -1943,6 +2442,64 @@ monitor_formation_uri(Monitor *monitor,
 }
 
 
+/*
+ * monitor_formation_readonly_uri calls the SQL API on the monitor that lists
+ * the readable secondary nodes of a formation, and builds a multi-host
+ * connection string from them, freshest node first.
+ */
+bool
+monitor_formation_readonly_uri(Monitor *monitor,
+							   const char *formation,
+							   const char *sslMode,
+							   char *connectionString,
+							   size_t size)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
+	PGSQL *pgsql = &monitor->pgsql;
+	const char *sql =
+		"SELECT format('postgres://%s/%s?sslmode=%s', "
+		"              string_agg(format('%s:%s', node_name, node_port), ',' "
+		"                         ORDER BY node_lsn DESC), "
+		"              (SELECT dbname "
+		"                 FROM pgautofailover.formation "
+		"                WHERE formationid = $1), "
+		"              $2) "
+		"  FROM pgautofailover.readable_nodes($1) "
+		"HAVING count(*) > 0";
+	int paramCount = 2;
+	Oid paramTypes[2] = { TEXTOID, TEXTOID };
+	const char *paramValues[2];
+
+	paramValues[0] = formation;
+	paramValues[1] = sslMode;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
+	{
+		log_error("Failed to list the readonly uri for formation \"%s\", "
+				  "see previous lines for details.",
+				  formation);
+		return false;
+	}
+
+	if (!context.parsedOk || context.strVal == NULL ||
+		strcmp(context.strVal, "") == 0)
+	{
+		log_error("Formation \"%s\" currently has no readable secondary nodes",
+				  formation);
+		return false;
+	}
+
+	strlcpy(connectionString, context.strVal, size);
+
+	/* disconnect from PostgreSQL now */
+	pgsql_finish(&monitor->pgsql);
+
+	return true;
+}
+
+
 /*
  * monitor_print_every_formation_uri prints a table of all our connection
  * strings: first the monitor URI itself, and then one line per formation.
@@ -2460,7 +3017,7 @@ monitor_wait_until_primary_applied_settings(Monitor *monitor,
 	bool applySettingsTransitionInProgress = false;
 	bool applySettingsTransitionDone = false;
 
-	uint64_t start = time(NULL);
+	uint64_t start = monotonic_clock_ms();
 
 	if (connection == NULL)
 	{
@@ -2478,9 +3035,10 @@ monitor_wait_until_primary_applied_settings(Monitor *monitor,
 		fd_set      input_mask;
 		PGnotify   *notify;
 
-		uint64_t now = time(NULL);
+		uint64_t now = monotonic_clock_ms();
 
-		if ((now - start) > PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT)
+		if ((now - start) >
+			PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT * MSECS_PER_SEC)
 		{
 			log_error("Failed to receive monitor's notifications that the "
 					  "settings have been applied");
@@ -2513,9 +3071,10 @@ monitor_wait_until_primary_applied_settings(Monitor *monitor,
 		{
 			StateNotification notification = { 0 };
 
-			uint64_t now = time(NULL);
+			uint64_t now = monotonic_clock_ms();
 
-			if ((now - start) > PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT)
+			if ((now - start) >
+				PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT * MSECS_PER_SEC)
 			{
 				/* errors are handled in the main loop */
 				break;
@@ -2605,6 +3164,117 @@ monitor_wait_until_primary_applied_settings(Monitor *monitor,
 }
 
 
+/*
+ * monitor_wait_for_primary_ready waits for at most timeoutMs until a
+ * notification on the "state" channel tells us that the primary node of the
+ * given group reported either the wait_primary or the join_primary state,
+ * which means it's ready for a new standby node, and sets ready accordingly.
+ * The caller must have issued a LISTEN on the channel already.
+ *
+ * The function returns false when the monitor connection is lost, and then
+ * the caller is expected to poll the monitor instead.
+ */
+bool
+monitor_wait_for_primary_ready(Monitor *monitor,
+							   char *formation,
+							   int groupId,
+							   int timeoutMs,
+							   bool *ready)
+{
+	PGconn *connection = monitor->pgsql.connection;
+	uint64_t start = monotonic_clock_ms();
+
+	*ready = false;
+
+	if (connection == NULL)
+	{
+		log_warn("Lost connection.");
+		return false;
+	}
+
+	while (!*ready)
+	{
+		int sock = PQsocket(connection);
+		fd_set input_mask;
+		struct timeval timeout = { 0 };
+		PGnotify *notify = NULL;
+		uint64_t elapsed = monotonic_clock_ms() - start;
+		uint64_t remaining = 0;
+		int ret = 0;
+
+		if (elapsed >= (uint64_t) timeoutMs)
+		{
+			break;
+		}
+
+		if (sock < 0)
+		{
+			return false;	/* shouldn't happen */
+		}
+
+		remaining = (uint64_t) timeoutMs - elapsed;
+		timeout.tv_sec = remaining / MSECS_PER_SEC;
+		timeout.tv_usec = (remaining % MSECS_PER_SEC) * 1000;
+
+		FD_ZERO(&input_mask);
+		FD_SET(sock, &input_mask);
+
+		ret = select(sock + 1, &input_mask, NULL, NULL, &timeout);
+
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			log_warn("select() failed: %m");
+			return false;
+		}
+
+		if (ret == 0)
+		{
+			break;
+		}
+
+		if (PQconsumeInput(connection) == 0)
+		{
+			log_warn("Lost connection to the monitor: %s",
+					 PQerrorMessage(connection));
+			pgsql_finish(&monitor->pgsql);
+			return false;
+		}
+
+		while ((notify = PQnotifies(connection)) != NULL)
+		{
+			StateNotification notification = { 0 };
+
+			if (strcmp(notify->relname, "state") == 0)
+			{
+				log_debug("received \"%s\"", notify->extra);
+
+				/* the parsing scribbles on the message, make a copy now */
+				strlcpy(notification.message, notify->extra, BUFSIZE);
+
+				/* errors are logged by parse_state_notification_message */
+				if (parse_state_notification_message(&notification) &&
+					notification.groupId == groupId &&
+					strcmp(notification.formationId, formation) == 0 &&
+					(notification.reportedState == WAIT_PRIMARY_STATE ||
+					 notification.reportedState == JOIN_PRIMARY_STATE))
+				{
+					*ready = true;
+				}
+			}
+
+			PQfreemem(notify);
+		}
+	}
+
+	return true;
+}
+
+
 /*
  * monitor_wait_until_node_reported_maintenance receives notifications and
  * watches for the given node to have goalState and reportedState set to given
@@ -2622,7 +3292,7 @@ monitor_wait_until_node_reported_state(Monitor *monitor,
 	PGconn *connection = monitor->pgsql.connection;
 	bool reachedMaintenance = false;
 
-	uint64_t start = time(NULL);
+	uint64_t start = monotonic_clock_ms();
 
 	if (connection == NULL)
 	{
@@ -2637,9 +3307,10 @@ monitor_wait_until_node_reported_state(Monitor *monitor,
 		fd_set      input_mask;
 		PGnotify   *notify;
 
-		uint64_t now = time(NULL);
+		uint64_t now = monotonic_clock_ms();
 
-		if ((now - start) > PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT)
+		if ((now - start) >
+			PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT * MSECS_PER_SEC)
 		{
 			log_error("Failed to receive monitor's notifications that the "
 					  "settings have been applied");
@@ -2672,9 +3343,10 @@ monitor_wait_until_node_reported_state(Monitor *monitor,
 		{
 			StateNotification notification = { 0 };
 
-			uint64_t now = time(NULL);
+			uint64_t now = monotonic_clock_ms();
 
-			if ((now - start) > PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT)
+			if ((now - start) >
+				PG_AUTOCTL_LISTEN_NOTIFICATIONS_TIMEOUT * MSECS_PER_SEC)
 			{
 				/* errors are handled in the main loop */
 				break;
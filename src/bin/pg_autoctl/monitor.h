@@ -32,6 +32,25 @@ typedef struct MonitorAssignedState
 	bool replicationQuorum;
 } MonitorAssignedState;
 
+/*
+ * A node_active call, as sent in a batch by a pg_autoctl process that
+ * manages several local Postgres instances.
+ */
+typedef struct MonitorNodeActive
+{
+	char *formation;
+	char *host;
+	int port;
+	int nodeId;
+	int groupId;
+	NodeState currentState;
+	bool pgIsRunning;
+	char *currentLSN;
+	char *pgsrSyncState;
+	StandbyTelemetry *standbys;
+	MonitorAssignedState assignedState;
+} MonitorNodeActive;
+
 typedef struct StateNotification
 {
 	char        message[BUFSIZE];
@@ -77,13 +96,16 @@ bool monitor_get_coordinator(Monitor *monitor, char *formation,
 bool monitor_register_node(Monitor *monitor, char *formation, char *host, int port,
 						   char *dbname, int desiredGroupId, NodeState initialSate,
 						   PgInstanceKind kind, int candidatePriority, bool quorum,
-						   MonitorAssignedState *assignedState);
+						   char *zone, MonitorAssignedState *assignedState);
 bool monitor_node_active(Monitor *monitor,
 						 char *formation, char *host, int port, int nodeId,
 						 int groupId, NodeState currentState,
 						 bool pgIsRunning,
 						 char *currentLSN, char *pgsrSyncState,
+						 StandbyTelemetry *standbys,
 						 MonitorAssignedState *assignedState);
+bool monitor_node_active_batch(Monitor *monitor,
+							   MonitorNodeActive *nodes, int count);
 bool monitor_get_node_replication_settings(Monitor *monitor, int nodeid,
 										   NodeReplicationSettings *settings);
 bool monitor_set_node_candidate_priority(Monitor *monitor, int nodeid,
@@ -99,6 +121,13 @@ bool monitor_set_formation_number_sync_standbys(Monitor *monitor, char *formatio
 
 bool monitor_remove(Monitor *monitor, char *host, int port);
 bool monitor_perform_failover(Monitor *monitor, char *formation, int group);
+bool monitor_perform_switchover(Monitor *monitor, char *formation, int group);
+bool monitor_perform_rolling_restart(Monitor *monitor, char *formation,
+									 int *remainingCount);
+bool monitor_is_restarting_node(Monitor *monitor, int nodeId,
+								bool *restarting);
+bool monitor_count_group_nodes(Monitor *monitor, char *formation, int groupId,
+							   int *nodeCount);
 
 bool monitor_print_state(Monitor *monitor, char *formation, int group);
 bool monitor_print_last_events(Monitor *monitor,
@@ -128,6 +157,11 @@ bool monitor_formation_uri(Monitor *monitor,
 						   const char *sslMode,
 						   char *connectionString,
 						   size_t size);
+bool monitor_formation_readonly_uri(Monitor *monitor,
+									const char *formation,
+									const char *sslMode,
+									char *connectionString,
+									size_t size);
 
 bool monitor_synchronous_standby_names(Monitor *monitor,
 									   char *formation, int groupId,
@@ -145,6 +179,11 @@ bool monitor_wait_until_primary_applied_settings(Monitor *monitor,
 bool monitor_wait_until_node_reported_state(Monitor *monitor,
 											int nodeId,
 											NodeState state);
+bool monitor_wait_for_primary_ready(Monitor *monitor,
+									char *formation,
+									int groupId,
+									int timeoutMs,
+									bool *ready);
 
 bool monitor_get_extension_version(Monitor *monitor,
 								   MonitorExtensionVersion *version);
@@ -125,11 +125,20 @@ parse_version_number(const char *version_string)
  *    Catalog version number:               201707211
  *    Database system identifier:           6534312872085436521
  *
+ * We also parse the following lines, that allow to know if the PostgreSQL
+ * instance has been shut down cleanly, and where:
+ *
+ *    Database cluster state:               shut down
+ *    Latest checkpoint location:           0/3000060
+ *
  */
 bool
 parse_controldata(PostgresControlData *pgControlData,
 				  const char *control_data_string)
 {
+	char *clusterState = NULL;
+	char *checkpointLSN = NULL;
+
 	if (!parse_controldata_field_uint32(control_data_string,
 										"pg_control version number",
 										&(pgControlData->pg_control_version)) ||
@@ -145,6 +154,30 @@ parse_controldata(PostgresControlData *pgControlData,
 		log_error("Failed to parse pg_controldata output");
 		return false;
 	}
+
+	clusterState = regexp_first_match(control_data_string,
+									  "^Database cluster state: *(.*)$");
+
+	pgControlData->cluster_is_shut_down =
+		clusterState != NULL && strcmp(clusterState, "shut down") == 0;
+
+	checkpointLSN =
+		regexp_first_match(control_data_string,
+						   "^Latest checkpoint location: *([0-9A-F]+/[0-9A-F]+)$");
+
+	if (checkpointLSN != NULL)
+	{
+		strlcpy(pgControlData->latest_checkpoint_lsn,
+				checkpointLSN, PG_LSN_MAXLENGTH);
+	}
+	else
+	{
+		pgControlData->latest_checkpoint_lsn[0] = '\0';
+	}
+
+	free(clusterState);
+	free(checkpointLSN);
+
 	return true;
 }
 
@@ -8,16 +8,26 @@
  *
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
 #include "postgres_fe.h"
 #include "pqexpbuffer.h"
 
+#include "clock_utils.h"
 #include "defaults.h"
 #include "env_utils.h"
 #include "file_utils.h"
@@ -26,6 +36,7 @@
 #include "pgctl.h"
 #include "pgsql.h"
 #include "pgsetup.h"
+#include "signals.h"
 #include "string_utils.h"
 
 #define RUN_PROGRAM_IMPLEMENTATION
@@ -42,6 +53,12 @@
 
 #define PROGRAM_NOT_RUNNING 3
 
+/*
+ * pids of the postmasters that we started ourselves, see pg_start_postmaster,
+ * one per local instance when pg_autoctl run manages several of them.
+ */
+static pid_t postmasterPids[PG_AUTOCTL_MAX_INSTANCES] = { 0 };
+
 
 static bool pg_include_config(const char *configFilePath,
 							  const char *configIncludeLine,
@@ -54,6 +71,11 @@ static bool prepare_guc_settings_from_pgsetup(const char *configFilePath,
 											  GUC *settings,
 											  PostgresSetup *pgSetup);
 static void log_program_output(Program prog, int outLogLevel, int errorLogLevel);
+static bool pg_wait_postmaster_ready(PostgresSetup *pgSetup, pid_t pid,
+									 int timeout);
+static bool postmaster_has_exited(pid_t pid);
+static bool reap_postmaster_pid(int slot);
+static bool postmaster_pidfile_has_status(const char *pidfile, pid_t pid);
 static bool escape_recovery_conf_string(char *destination,
 										int destinationSize,
 										const char *recoveryConfString);
@@ -910,6 +932,383 @@ pg_ctl_start(const char *pg_ctl,
 	return success;
 }
 
+/*
+ * pg_start_postmaster starts the Postgres server as a child process of
+ * pg_autoctl, without going through pg_ctl. This allows the keeper to learn
+ * about the postmaster termination as soon as it happens, thanks to SIGCHLD,
+ * rather than polling for it with "pg_ctl status".
+ *
+ * The function returns when the postmaster is ready to accept connections, as
+ * per the status line of its postmaster.pid file, or when it failed to start.
+ */
+bool
+pg_start_postmaster(PostgresSetup *pgSetup)
+{
+	char postgres[MAXPGPATH];
+	char logfile[MAXPGPATH];
+	char pgport[20];
+	char env_pg_regress_sock_dir[MAXPGPATH];
+
+	char *args[10];
+	int argsIndex = 0;
+	int logFd = -1;
+	int slot = 0;
+	pid_t pid;
+
+	path_in_same_directory(pgSetup->pg_ctl, "postgres", postgres);
+	join_path_components(logfile, pgSetup->pgdata, "startup.log");
+	sformat(pgport, sizeof(pgport), "%d", pgSetup->pgport);
+
+	args[argsIndex++] = postgres;
+	args[argsIndex++] = "-D";
+	args[argsIndex++] = pgSetup->pgdata;
+	args[argsIndex++] = "-p";
+	args[argsIndex++] = pgport;
+
+	if (!IS_EMPTY_STRING_BUFFER(pgSetup->listen_addresses))
+	{
+		args[argsIndex++] = "-h";
+		args[argsIndex++] = pgSetup->listen_addresses;
+	}
+
+	if (env_exists("PG_REGRESS_SOCK_DIR"))
+	{
+		if (!get_env_copy("PG_REGRESS_SOCK_DIR", env_pg_regress_sock_dir,
+						  MAXPGPATH))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+
+		args[argsIndex++] = "-k";
+		args[argsIndex++] = env_pg_regress_sock_dir;
+	}
+
+	args[argsIndex] = NULL;
+
+	/* as with pg_ctl start, Postgres already running is a success */
+	if (pg_setup_is_alive(pgSetup))
+	{
+		log_info("Postgres is already running with pid %ld",
+				 pgSetup->pidFile.pid);
+
+		return pg_wait_postmaster_ready(pgSetup, 0, POSTGRES_START_TIMEOUT);
+	}
+
+	/* we need a slot to signal and reap the postmaster later */
+	for (slot = 0; slot < PG_AUTOCTL_MAX_INSTANCES; slot++)
+	{
+		if (postmasterPids[slot] == 0)
+		{
+			break;
+		}
+	}
+
+	if (slot == PG_AUTOCTL_MAX_INSTANCES)
+	{
+		log_error("Failed to start Postgres at \"%s\": this pg_autoctl "
+				  "process already manages %d postmasters",
+				  pgSetup->pgdata, PG_AUTOCTL_MAX_INSTANCES);
+		return false;
+	}
+
+	logFd = open(logfile, O_WRONLY | O_CREAT | O_APPEND, 0600);
+
+	if (logFd < 0)
+	{
+		log_error("Failed to open \"%s\": %m", logfile);
+		return false;
+	}
+
+	log_info("%s -D %s -p %s", postgres, pgSetup->pgdata, pgport);
+
+	/* flush stdio buffers before forking, to avoid duplicate output */
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+
+	switch (pid)
+	{
+		case -1:
+		{
+			log_error("Failed to fork the postmaster process: %m");
+			close(logFd);
+			return false;
+		}
+
+		case 0:
+		{
+			/* child process: detach from our terminal and session */
+			int devNull = open("/dev/null", O_RDONLY);
+
+			(void) setsid();
+
+			if (devNull >= 0)
+			{
+				dup2(devNull, STDIN_FILENO);
+				close(devNull);
+			}
+
+			dup2(logFd, STDOUT_FILENO);
+			dup2(logFd, STDERR_FILENO);
+			close(logFd);
+
+			(void) execv(postgres, args);
+
+			/* execv only returns in case of errors */
+			fformat(stderr, "Failed to exec \"%s\": %s\n",
+					postgres, strerror(errno));
+			_exit(EXIT_CODE_PGCTL);
+		}
+
+		default:
+		{
+			close(logFd);
+
+			postmasterPids[slot] = pid;
+
+			log_debug("Started the postmaster with pid %d", pid);
+
+			return pg_wait_postmaster_ready(pgSetup, pid, POSTGRES_START_TIMEOUT);
+		}
+	}
+}
+
+
+/*
+ * pg_reap_postmaster checks whether the postmasters we started have exited,
+ * without blocking, and collects their exit status when that's the case.
+ * Until a child process is reaped its pid is still valid, and kill(pid, 0)
+ * keeps reporting the postmaster as running.
+ *
+ * Returns true when at least one postmaster has exited.
+ */
+bool
+pg_reap_postmaster()
+{
+	bool reaped = false;
+	int slot = 0;
+
+	for (slot = 0; slot < PG_AUTOCTL_MAX_INSTANCES; slot++)
+	{
+		if (postmasterPids[slot] > 0 && reap_postmaster_pid(slot))
+		{
+			reaped = true;
+		}
+	}
+
+	return reaped;
+}
+
+
+/*
+ * postmaster_has_exited returns true when the given postmaster that we
+ * started has exited, reaping it.
+ */
+static bool
+postmaster_has_exited(pid_t pid)
+{
+	int slot = 0;
+
+	for (slot = 0; slot < PG_AUTOCTL_MAX_INSTANCES; slot++)
+	{
+		if (postmasterPids[slot] == pid)
+		{
+			return reap_postmaster_pid(slot);
+		}
+	}
+
+	/* we already reaped it */
+	return true;
+}
+
+
+/*
+ * reap_postmaster_pid reaps the postmaster registered at the given slot when
+ * it has exited, logging its exit status, and returns true in that case.
+ */
+static bool
+reap_postmaster_pid(int slot)
+{
+	pid_t postmasterPid = postmasterPids[slot];
+	int status = 0;
+	pid_t pid = waitpid(postmasterPid, &status, WNOHANG);
+
+	if (pid == 0)
+	{
+		/* the postmaster is still running */
+		return false;
+	}
+
+	if (pid < 0)
+	{
+		log_debug("Failed to wait for the postmaster with pid %d: %m",
+				  postmasterPid);
+	}
+	else if (WIFEXITED(status))
+	{
+		log_warn("Postgres with pid %d exited with code %d",
+				 postmasterPid, WEXITSTATUS(status));
+	}
+	else if (WIFSIGNALED(status))
+	{
+		log_warn("Postgres with pid %d was terminated by signal %s",
+				 postmasterPid, strsignal(WTERMSIG(status)));
+	}
+
+	postmasterPids[slot] = 0;
+
+	return true;
+}
+
+
+/*
+ * pg_wait_postmaster_ready waits until the postmaster.pid status line says
+ * that the postmaster is ready to accept connections. On Linux we use inotify
+ * to be woken up when Postgres updates its pid file, elsewhere we poll for it
+ * every 100ms.
+ *
+ * We stop waiting early when the postmaster that we started, if any, exits.
+ */
+static bool
+pg_wait_postmaster_ready(PostgresSetup *pgSetup, pid_t pid, int timeout)
+{
+	char pidfile[MAXPGPATH];
+	uint64_t start = monotonic_clock_ms();
+	bool pg_is_not_running_is_ok = true;
+	int notifyFd = -1;
+
+	join_path_components(pidfile, pgSetup->pgdata, "postmaster.pid");
+
+	/* don't trust a status that we read before starting Postgres */
+	pgSetup->pm_status = POSTMASTER_STATUS_UNKNOWN;
+
+#ifdef __linux__
+	notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (notifyFd < 0 ||
+		inotify_add_watch(notifyFd, pgSetup->pgdata,
+						  IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE) < 0)
+	{
+		log_debug("Failed to watch \"%s\" with inotify, polling instead: %m",
+				  pgSetup->pgdata);
+
+		if (notifyFd >= 0)
+		{
+			close(notifyFd);
+			notifyFd = -1;
+		}
+	}
+#endif
+
+	for (;;)
+	{
+		uint64_t now = monotonic_clock_ms();
+
+		/*
+		 * Only parse the pid file when it has the status line already, so
+		 * that we don't log errors about a file that Postgres is still
+		 * writing.
+		 */
+		if (postmaster_pidfile_has_status(pidfile, pid) &&
+			read_pg_pidfile(pgSetup, pg_is_not_running_is_ok) &&
+			pgSetup->pm_status == POSTMASTER_STATUS_READY)
+		{
+			break;
+		}
+
+		if (pid > 0 && postmaster_has_exited(pid))
+		{
+			log_error("Postgres failed to start, see \"%s/startup.log\" "
+					  "for details", pgSetup->pgdata);
+			break;
+		}
+
+		if ((now - start) >= (uint64_t) timeout * MSECS_PER_SEC)
+		{
+			log_error("Postgres is not ready after %ds, "
+					  "see \"%s/startup.log\" for details",
+					  timeout, pgSetup->pgdata);
+			break;
+		}
+
+		if (asked_to_stop_fast)
+		{
+			break;
+		}
+
+		if (notifyFd >= 0)
+		{
+#ifdef __linux__
+			char buffer[BUFSIZE];
+			struct pollfd pfd = { .fd = notifyFd, .events = POLLIN };
+
+			/* wake-up at least every 100ms to check on the child process */
+			if (poll(&pfd, 1, 100) > 0)
+			{
+				/* drain the events, we re-read the pid file anyway */
+				while (read(notifyFd, buffer, sizeof(buffer)) > 0)
+				{
+				}
+			}
+#endif
+		}
+		else
+		{
+			pg_usleep(100 * 1000);
+		}
+	}
+
+	if (notifyFd >= 0)
+	{
+		close(notifyFd);
+	}
+
+	return pgSetup->pm_status == POSTMASTER_STATUS_READY;
+}
+
+
+/*
+ * postmaster_pidfile_has_status returns true when the given postmaster.pid
+ * file has been written up to its postmaster status line. When we started the
+ * postmaster ourselves, the pid file must also be the one of our child
+ * process (postmasterPid), not a stale one left behind by a previous crash.
+ */
+static bool
+postmaster_pidfile_has_status(const char *pidfile, pid_t postmasterPid)
+{
+	char *contents = NULL;
+	long fileSize = 0;
+	int lineCount = 0;
+	int pid = 0;
+
+	if (!file_exists(pidfile) || !read_file(pidfile, &contents, &fileSize))
+	{
+		return false;
+	}
+
+	if (postmasterPid > 0 &&
+		(sscanf(contents, "%d", &pid) != 1 || pid != postmasterPid))
+	{
+		free(contents);
+		return false;
+	}
+
+	for (long i = 0; i < fileSize; i++)
+	{
+		if (contents[i] == '\n')
+		{
+			++lineCount;
+		}
+	}
+
+	free(contents);
+
+	return lineCount >= LOCK_FILE_LINE_PM_STATUS;
+}
+
+
 
 /*
  * pg_ctl_stop tries to stop a PostgreSQL server by running a "pg_ctl stop"
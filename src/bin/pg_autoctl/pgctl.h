@@ -45,6 +45,9 @@ int pg_ctl_status(const char *pg_ctl, const char *pgdata, bool log_output);
 bool pg_ctl_restart(const char *pg_ctl, const char *pgdata);
 bool pg_ctl_promote(const char *pg_ctl, const char *pgdata);
 
+bool pg_start_postmaster(PostgresSetup *pgSetup);
+bool pg_reap_postmaster(void);
+
 bool pg_setup_standby_mode(uint32_t pg_control_version,
 						   const char *configFilePath,
 						   const char *pgdata,
@@ -11,6 +11,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
 
 #include "postgres_fe.h"
 #include "pqexpbuffer.h"
@@ -33,12 +34,16 @@ static void append_database_field(PQExpBuffer destination,
 static void append_hostname_or_cidr(PQExpBuffer destination,
 									const char *host);
 static int escape_hba_string(char *destination, const char *hbaString);
+static int compare_hba_lines(const void *a, const void *b);
+static int compare_hba_rule_to_line(const void *key, const void *elem);
+static bool hba_contents_has_rule(const char *contents, const char *rule);
 
 
 /*
  * pghba_ensure_host_rule_exists ensures that a host rule exists in the
  * pg_hba file with the given database, username, host and authentication
- * scheme.
+ * scheme. Callers that need to ensure several rules should rather use an
+ * HBAEditBatch, so that the file is read and written only once.
  */
 bool
 pghba_ensure_host_rule_exists(const char *hbaFilePath,
@@ -49,11 +54,112 @@ pghba_ensure_host_rule_exists(const char *hbaFilePath,
 							  const char *host,
 							  const char *authenticationScheme)
 {
-	char *currentHbaContents = NULL;
-	long currentHbaSize = 0L;
-	char *includeLine = NULL;
+	HBAEditBatch batch = { 0 };
+	bool success = false;
+
+	if (!pghba_batch_init(&batch, hbaFilePath))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	success = pghba_batch_add_host_rule(&batch, ssl, databaseType, database,
+										username, host, authenticationScheme)
+			  && pghba_batch_write(&batch);
+
+	pghba_batch_destroy(&batch);
+
+	return success;
+}
+
+
+/*
+ * pghba_batch_init reads the given HBA file and indexes its lines, so that
+ * checking whether a rule already exists is a binary search rather than a
+ * scan of the whole file contents.
+ */
+bool
+pghba_batch_init(HBAEditBatch *batch, const char *hbaFilePath)
+{
+	char *line = NULL;
+	int lineIndex = 0;
+
+	strlcpy(batch->hbaFilePath, hbaFilePath, MAXPGPATH);
+
+	if (!read_file(hbaFilePath, &(batch->contents), &(batch->size)))
+	{
+		/* read_file logs an error */
+		return false;
+	}
+
+	batch->linesBuffer = strdup(batch->contents);
+	batch->newRules = createPQExpBuffer();
+
+	if (batch->linesBuffer == NULL || batch->newRules == NULL)
+	{
+		log_error("Failed to allocate memory");
+		pghba_batch_destroy(batch);
+		return false;
+	}
+
+	/* count the lines to allocate our index, the last one may lack a \n */
+	batch->lineCount = 1;
+	for (line = batch->linesBuffer; *line != '\0'; line++)
+	{
+		if (*line == '\n')
+		{
+			batch->lineCount++;
+		}
+	}
+
+	batch->lines = (char **) malloc(batch->lineCount * sizeof(char *));
+
+	if (batch->lines == NULL)
+	{
+		log_error("Failed to allocate memory");
+		pghba_batch_destroy(batch);
+		return false;
+	}
+
+	/* split the buffer in lines, in-place */
+	line = batch->linesBuffer;
+
+	while (line != NULL)
+	{
+		char *newline = strchr(line, '\n');
+
+		if (newline != NULL)
+		{
+			*newline = '\0';
+		}
+
+		batch->lines[lineIndex++] = line;
+		line = newline == NULL ? NULL : newline + 1;
+	}
+
+	batch->lineCount = lineIndex;
+
+	qsort(batch->lines, batch->lineCount, sizeof(char *), compare_hba_lines);
+
+	return true;
+}
+
+
+/*
+ * pghba_batch_add_host_rule adds a host rule with the given database,
+ * username, host and authentication scheme to the batch, unless the HBA
+ * file or the batch already contain it.
+ */
+bool
+pghba_batch_add_host_rule(HBAEditBatch *batch,
+						  bool ssl,
+						  HBADatabaseType databaseType,
+						  const char *database,
+						  const char *username,
+						  const char *host,
+						  const char *authenticationScheme)
+{
 	PQExpBuffer hbaLineBuffer = createPQExpBuffer();
-	PQExpBuffer newHbaContents = NULL;
 
 	if (hbaLineBuffer == NULL)
 	{
@@ -105,47 +211,100 @@ pghba_ensure_host_rule_exists(const char *hbaFilePath,
 	{
 		log_warn("Skipping HBA edits (per --skip-pg-hba) for rule: %s",
 				 hbaLineBuffer->data);
+		destroyPQExpBuffer(hbaLineBuffer);
 		return true;
 	}
 
 	log_debug("Ensuring the HBA file \"%s\" contains the line: %s",
-			  hbaFilePath, hbaLineBuffer->data);
+			  batch->hbaFilePath, hbaLineBuffer->data);
 
-	if (!read_file(hbaFilePath, &currentHbaContents, &currentHbaSize))
+	/*
+	 * If the rule was found at the start of a line, either in the file or in
+	 * the rules we are about to add, we can skip adding it.
+	 */
+	if (bsearch(hbaLineBuffer->data,
+				batch->lines, batch->lineCount, sizeof(char *),
+				compare_hba_rule_to_line) != NULL ||
+		hba_contents_has_rule(batch->newRules->data, hbaLineBuffer->data))
 	{
-		/* read_file logs an error */
+		log_debug("Line already exists in %s, skipping", batch->hbaFilePath);
+		destroyPQExpBuffer(hbaLineBuffer);
+		return true;
+	}
+
+	appendPQExpBufferStr(batch->newRules, hbaLineBuffer->data);
+	appendPQExpBufferStr(batch->newRules, HBA_LINE_COMMENT "\n");
+	++batch->newRuleCount;
+
+	destroyPQExpBuffer(hbaLineBuffer);
+
+	/* memory allocation could have failed while building string */
+	if (PQExpBufferBroken(batch->newRules))
+	{
+		log_error("Failed to allocate memory");
 		return false;
 	}
 
-	includeLine = strstr(currentHbaContents, hbaLineBuffer->data);
+	return true;
+}
 
-	/*
-	 * If the rule was found and it starts on a new line. We can
-	 * skip adding it.
-	 */
-	if (includeLine != NULL && (includeLine == currentHbaContents ||
-								includeLine[-1] == '\n'))
+
+/*
+ * pghba_batch_write writes the HBA file with the rules collected in the
+ * batch appended, when there are any. The new contents are first written to
+ * a temporary file that is then renamed, so that Postgres never reads a
+ * partially written HBA file.
+ *
+ * When pg_hba.conf is a symbolic link, we replace the file it points to
+ * rather than the link itself, and the temporary file is given the same
+ * permissions as the file it replaces, which is often 0600.
+ *
+ * Callers may use batch->newRuleCount to decide whether they need to reload
+ * the Postgres configuration.
+ */
+bool
+pghba_batch_write(HBAEditBatch *batch)
+{
+	char hbaFilePath[PATH_MAX];
+	char tempFilePath[PATH_MAX];
+	struct stat hbaFileStat;
+	PQExpBuffer newHbaContents = NULL;
+
+	if (batch->newRuleCount == 0)
 	{
-		log_debug("Line already exists in %s, skipping", hbaFilePath);
-		free(currentHbaContents);
+		log_debug("HBA file \"%s\" is already up to date", batch->hbaFilePath);
 		return true;
 	}
 
-	/* build the new postgresql.conf contents */
+	if (realpath(batch->hbaFilePath, hbaFilePath) == NULL)
+	{
+		log_error("Failed to resolve the path of HBA file \"%s\": %m",
+				  batch->hbaFilePath);
+		return false;
+	}
+
+	if (stat(hbaFilePath, &hbaFileStat) != 0)
+	{
+		log_error("Failed to stat HBA file \"%s\": %m", hbaFilePath);
+		return false;
+	}
+
+	/* build the new pg_hba.conf contents */
 	newHbaContents = createPQExpBuffer();
 	if (newHbaContents == NULL)
 	{
 		log_error("Failed to allocate memory");
-		free(currentHbaContents);
 		return false;
 	}
 
-	appendPQExpBufferStr(newHbaContents, currentHbaContents);
-	appendPQExpBufferStr(newHbaContents, hbaLineBuffer->data);
-	appendPQExpBufferStr(newHbaContents, HBA_LINE_COMMENT "\n");
+	appendPQExpBufferStr(newHbaContents, batch->contents);
 
-	/* done with the old postgresql.conf contents */
-	free(currentHbaContents);
+	if (batch->size > 0 && batch->contents[batch->size - 1] != '\n')
+	{
+		appendPQExpBufferStr(newHbaContents, "\n");
+	}
+
+	appendPQExpBufferStr(newHbaContents, batch->newRules->data);
 
 	/* memory allocation could have failed while building string */
 	if (PQExpBufferBroken(newHbaContents))
@@ -155,23 +314,110 @@ pghba_ensure_host_rule_exists(const char *hbaFilePath,
 		return false;
 	}
 
-	/* write the new postgresql.conf */
-	if (!write_file(newHbaContents->data, newHbaContents->len, hbaFilePath))
+	sformat(tempFilePath, PATH_MAX, "%s.pg_autoctl.tmp", hbaFilePath);
+
+	if (!write_file(newHbaContents->data, newHbaContents->len, tempFilePath))
 	{
 		/* write_file logs an error */
 		destroyPQExpBuffer(newHbaContents);
 		return false;
 	}
 
-	destroyPQExpBuffer(hbaLineBuffer);
 	destroyPQExpBuffer(newHbaContents);
 
-	log_debug("Wrote new %s", hbaFilePath);
+	if (chmod(tempFilePath, hbaFileStat.st_mode & 07777) != 0)
+	{
+		log_error("Failed to set permissions of \"%s\": %m", tempFilePath);
+		(void) unlink_file(tempFilePath);
+		return false;
+	}
+
+	if (rename(tempFilePath, hbaFilePath) != 0)
+	{
+		log_error("Failed to rename \"%s\" to \"%s\": %m",
+				  tempFilePath, hbaFilePath);
+		(void) unlink_file(tempFilePath);
+		return false;
+	}
+
+	log_debug("Wrote new %s with %d new rule(s)",
+			  batch->hbaFilePath, batch->newRuleCount);
 
 	return true;
 }
 
 
+/*
+ * pghba_batch_destroy releases the memory allocated for the batch.
+ */
+void
+pghba_batch_destroy(HBAEditBatch *batch)
+{
+	free(batch->contents);
+	free(batch->linesBuffer);
+	free(batch->lines);
+
+	if (batch->newRules != NULL)
+	{
+		destroyPQExpBuffer(batch->newRules);
+	}
+
+	batch->contents = NULL;
+	batch->linesBuffer = NULL;
+	batch->lines = NULL;
+	batch->newRules = NULL;
+}
+
+
+/*
+ * compare_hba_lines is a qsort comparator for our index of HBA lines.
+ */
+static int
+compare_hba_lines(const void *a, const void *b)
+{
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+
+/*
+ * compare_hba_rule_to_line is a bsearch comparator that matches an HBA line
+ * that starts with the given rule. Lines that start with the same rule sort
+ * together in our index, so a prefix comparison is consistent with the
+ * ordering of compare_hba_lines.
+ */
+static int
+compare_hba_rule_to_line(const void *key, const void *elem)
+{
+	const char *rule = (const char *) key;
+	const char *line = *(char *const *) elem;
+
+	return strncmp(rule, line, strlen(rule));
+}
+
+
+/*
+ * hba_contents_has_rule returns true when the given rule is found at the
+ * start of a line in contents.
+ */
+static bool
+hba_contents_has_rule(const char *contents, const char *rule)
+{
+	const char *includeLine = strstr(contents, rule);
+
+	while (includeLine != NULL)
+	{
+		if (includeLine == contents || includeLine[-1] == '\n')
+		{
+			return true;
+		}
+
+		includeLine = strstr(includeLine + 1, rule);
+	}
+
+	return false;
+}
+
+
 /*
  * append_database_field writes the database field to destination according to
  * the databaseType. If the type is HBA_DATABASE_DBNAME then the databaseName
@@ -307,6 +553,7 @@ pghba_enable_lan_cidr(PGSQL *pgsql,
 	char hbaFilePath[MAXPGPATH];
 	char ipAddr[BUFSIZE];
 	char cidr[BUFSIZE];
+	HBAEditBatch batch = { 0 };
 
 	/* Compute the CIDR notation for our hostname */
 	if (!findHostnameLocalAddress(hostname, ipAddr, BUFSIZE))
@@ -345,18 +592,29 @@ pghba_enable_lan_cidr(PGSQL *pgsql,
 		sformat(hbaFilePath, MAXPGPATH, "%s/pg_hba.conf", pgdata);
 	}
 
-	if (!pghba_ensure_host_rule_exists(hbaFilePath, ssl, databaseType, database,
-									   username, cidr, authenticationScheme))
+	if (!pghba_batch_init(&batch, hbaFilePath))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!pghba_batch_add_host_rule(&batch, ssl, databaseType, database,
+								   username, cidr, authenticationScheme) ||
+		!pghba_batch_write(&batch))
 	{
 		log_error("Failed to add the local network to PostgreSQL HBA file: "
 				  "couldn't modify the pg_hba file");
+		pghba_batch_destroy(&batch);
 		return false;
 	}
 
+	pghba_batch_destroy(&batch);
+
 	/*
-	 * pgdata is given when PostgreSQL is not yet running, don't reload then...
+	 * pgdata is given when PostgreSQL is not yet running, don't reload then,
+	 * and there's no need to reload when the file did not change either.
 	 */
-	if (pgdata == NULL && !pgsql_reload_conf(pgsql))
+	if (pgdata == NULL && batch.newRuleCount > 0 && !pgsql_reload_conf(pgsql))
 	{
 		log_error("Failed to reload PostgreSQL configuration for new HBA rule");
 		return false;
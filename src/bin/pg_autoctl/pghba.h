@@ -10,6 +10,8 @@
 #ifndef PGHBA_H
 #define PGHBA_H
 
+#include "pqexpbuffer.h"
+
 #include "pgsql.h"
 
 /* supported HBA database values */
@@ -20,6 +22,35 @@ typedef enum HBADatabaseType
 	HBA_DATABASE_DBNAME
 } HBADatabaseType;
 
+/*
+ * An HBAEditBatch reads the pg_hba.conf file once, indexes its lines, and
+ * then collects the rules that are missing so that we can write the file
+ * only once, no matter how many rules we need to ensure.
+ */
+typedef struct HBAEditBatch
+{
+	char hbaFilePath[MAXPGPATH];
+	char *contents;             /* file contents, as read at init time */
+	long size;
+
+	char *linesBuffer;          /* copy of contents, split in lines */
+	char **lines;               /* sorted array of pointers into linesBuffer */
+	int lineCount;
+
+	PQExpBuffer newRules;       /* rules to append to the file */
+	int newRuleCount;
+} HBAEditBatch;
+
+bool pghba_batch_init(HBAEditBatch *batch, const char *hbaFilePath);
+bool pghba_batch_add_host_rule(HBAEditBatch *batch,
+							   bool ssl,
+							   HBADatabaseType databaseType,
+							   const char *database,
+							   const char *username,
+							   const char *host,
+							   const char *authenticationScheme);
+bool pghba_batch_write(HBAEditBatch *batch);
+void pghba_batch_destroy(HBAEditBatch *batch);
 
 bool pghba_ensure_host_rule_exists(const char *hbaFilePath,
 								   bool ssl,
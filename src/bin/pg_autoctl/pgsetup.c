@@ -285,6 +285,9 @@ pg_setup_init(PostgresSetup *pgSetup,
 		pgSetup->proxyport = options->proxyport;
 	}
 
+	/* Run the postmaster as our own child process, or use pg_ctl start */
+	pgSetup->supervise = options->supervise;
+
 
 	/*
 	 * If --listen is given, then set our listen_addresses to this value
@@ -755,6 +758,22 @@ pg_setup_is_running(PostgresSetup *pgSetup)
 }
 
 
+/*
+ * pg_setup_is_alive reads the postmaster.pid file again and checks that the
+ * postmaster process still exists, which is what "pg_ctl status" does,
+ * without having to fork and exec pg_ctl.
+ */
+bool
+pg_setup_is_alive(PostgresSetup *pgSetup)
+{
+	bool pg_is_not_running_is_ok = true;
+
+	pgSetup->pidFile.pid = 0;
+
+	return get_pgpid(pgSetup, pg_is_not_running_is_ok);
+}
+
+
 /*
  * pg_setup_is_ready returns true when the postmaster.pid file has a "ready"
  * status in it, which we parse in pgSetup->pm_status.
@@ -18,6 +18,15 @@
 
 #include "parson.h"
 
+/*
+ * Maximum length of serialized pg_lsn value
+ * It is taken from postgres file pg_lsn.c.
+ * It defines MAXPG_LSNLEN to be 17 and
+ * allocates a buffer 1 byte larger. We
+ * went for 18 to make buffer allocation simpler.
+ */
+#define PG_LSN_MAXLENGTH 18
+
 /*
  * To be able to check if a minor upgrade should be scheduled, and to check for
  * system WAL compatiblity, we use some parts of the pg_controldata output.
@@ -30,6 +39,8 @@ typedef struct pg_control_data
 	uint32_t pg_control_version;        /* PG_CONTROL_VERSION */
 	uint32_t catalog_version_no;        /* see catversion.h */
 	uint64_t system_identifier;
+	bool cluster_is_shut_down;          /* Database cluster state: shut down */
+	char latest_checkpoint_lsn[PG_LSN_MAXLENGTH]; /* Latest checkpoint location */
 } PostgresControlData;
 
 /*
@@ -145,6 +156,7 @@ typedef struct pg_setup
 	int pgport;                             /* PGPORT */
 	char listen_addresses[MAXPGPATH];       /* listen_addresses */
 	int proxyport;                          /* Proxy port */
+	int supervise;                          /* postmaster is our child */
 	char authMethod[NAMEDATALEN];           /* auth method, defaults to trust */
 	PostmasterStatus pm_status;				/* Postmaster status */
 	bool is_in_recovery;                    /* select pg_is_in_recovery() */
@@ -171,6 +183,7 @@ bool pg_setup_get_local_connection_string(PostgresSetup *pgSetup,
 										  char *connectionString);
 bool pg_setup_pgdata_exists(PostgresSetup *pgSetup);
 bool pg_setup_is_running(PostgresSetup *pgSetup);
+bool pg_setup_is_alive(PostgresSetup *pgSetup);
 bool pg_setup_is_primary(PostgresSetup *pgSetup);
 bool pg_setup_is_ready(PostgresSetup *pgSetup, bool pg_is_not_running_is_ok);
 char *pg_setup_get_username(PostgresSetup *pgSetup);
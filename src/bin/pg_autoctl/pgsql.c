@@ -6,6 +6,10 @@
  * Licensed under the PostgreSQL License.
  *
  */
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -13,6 +17,7 @@
 #include "libpq-fe.h"
 #include "pqexpbuffer.h"
 
+#include "clock_utils.h"
 #include "defaults.h"
 #include "log.h"
 #include "parsing.h"
@@ -29,12 +34,20 @@ static void pgAutoCtlDefaultNoticeProcessor(void *arg, const char *message);
 static void pgAutoCtlDebugNoticeProcessor(void *arg, const char *message);
 static PGconn * pgsql_open_connection(PGSQL *pgsql);
 static PGconn * pgsql_retry_open_connection(PGSQL *pgsql);
+static bool pgsql_start_host_connection(PGSQL *pgsql);
+static int connect_timeout_from_uri(const char *pguri);
+static bool pgsql_connect_next_host(PGSQL *pgsql);
+static uint64_t pgsql_connect_timeout_ms(PGSQL *pgsql);
+static void pgsql_connection_failed(PGSQL *pgsql);
+static void pgsql_connection_succeeded(PGSQL *pgsql);
 static bool is_response_ok(PGresult *result);
 static bool clear_results(PGconn *connection);
 static bool pgsql_alter_system_set(PGSQL *pgsql, GUC setting);
 static bool pgsql_get_current_setting(PGSQL *pgsql, char *settingName,
 									  char **currentValue);
 static void parsePgMetadata(void *ctx, PGresult *result);
+static void parseGUCBatchSettings(void *ctx, PGresult *result);
+static void unquote_guc_value(const char *value, char *unquoted, int size);
 
 
 /*
@@ -102,11 +115,22 @@ pgsql_init(PGSQL *pgsql, char *url, ConnectionType connectionType)
 {
 	pgsql->connectionType = connectionType;
 	pgsql->connection = NULL;
+	pgsql->nonBlocking = false;
+	pgsql->multipleHosts = false;
+	pgsql->connecting = false;
+	pgsql->failedAttempts = 0;
+	pgsql->nextAttemptMs = 0;
 
 	if (validate_connection_string(url))
 	{
+		NodeAddressArray hosts = { 0 };
+
 		/* size of url has already been validated. */
 		strlcpy(pgsql->connectionString, url, MAXCONNINFO);
+
+		pgsql->multipleHosts = hostnames_from_uri(url, &hosts) &&
+							   hosts.count > 1;
+		pgsql->hostTimeoutMs = connect_timeout_from_uri(url) * MSECS_PER_SEC;
 	}
 	else
 	{
@@ -128,6 +152,7 @@ pgsql_finish(PGSQL *pgsql)
 		PQfinish(pgsql->connection);
 		pgsql->connection = NULL;
 	}
+	pgsql->connecting = false;
 }
 
 /*
@@ -141,11 +166,22 @@ pgsql_open_connection(PGSQL *pgsql)
 	PGconn *connection = NULL;
 
 	/* we might be connected already */
-	if (pgsql->connection != NULL)
+	if (pgsql->connection != NULL && !pgsql->connecting)
 	{
 		return pgsql->connection;
 	}
 
+	if (pgsql->nonBlocking)
+	{
+		if (!pgsql_start_connection(pgsql) ||
+			!pgsql_complete_connection(pgsql))
+		{
+			/* errors have already been logged */
+			return NULL;
+		}
+		return pgsql->connection;
+	}
+
 	log_debug("Connecting to \"%s\"", pgsql->connectionString);
 
 	/* Make a connection to the database */
@@ -203,6 +239,407 @@ pgsql_open_connection(PGSQL *pgsql)
 }
 
 
+/*
+ * pgsql_start_connection starts establishing a connection without waiting
+ * for it, so that the caller can do something else while the network round
+ * trips happen, and then call pgsql_complete_connection(). It returns false
+ * when the connection attempt failed right away, or when the previous
+ * attempt failed and the next one is not due yet.
+ */
+bool
+pgsql_start_connection(PGSQL *pgsql)
+{
+	if (pgsql->connection != NULL)
+	{
+		return true;
+	}
+
+	if (pgsql->nextAttemptMs > 0 && monotonic_clock_ms() < pgsql->nextAttemptMs)
+	{
+		log_debug("Not connecting to \"%s\" before %" PRIu64 "ms",
+				  pgsql->connectionString,
+				  pgsql->nextAttemptMs - monotonic_clock_ms());
+		return false;
+	}
+
+	pgsql->hostIndex = 0;
+	pgsql->connectStatus = PGRES_POLLING_FAILED;
+
+	if (!pgsql_start_host_connection(pgsql) &&
+		!pgsql_connect_next_host(pgsql))
+	{
+		pgsql_connection_failed(pgsql);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * pgsql_start_host_connection starts establishing a connection to the current
+ * host of the connection string. With a single host, libpq knows which one
+ * to connect to. With several hosts we override the host and port of the
+ * connection string with the hostIndex one, so that the other parameters
+ * such as target_session_attrs still apply.
+ */
+static bool
+pgsql_start_host_connection(PGSQL *pgsql)
+{
+	PGconn *connection = NULL;
+
+	if (pgsql->multipleHosts)
+	{
+		NodeAddressArray hosts = { 0 };
+		NodeAddress *host = NULL;
+		IntString port = { 0 };
+		const char *keywords[] = { "dbname", "host", "port", NULL };
+		const char *values[] = { pgsql->connectionString, NULL, NULL, NULL };
+
+		if (!hostnames_from_uri(pgsql->connectionString, &hosts) ||
+			pgsql->hostIndex >= hosts.count)
+		{
+			log_error("Failed to parse the hosts of \"%s\"",
+					  pgsql->connectionString);
+			return false;
+		}
+
+		host = &(hosts.nodes[pgsql->hostIndex]);
+		port = intToString(host->port);
+
+		values[1] = host->host;
+		values[2] = port.strValue;
+
+		log_debug("Connecting to \"%s\" on host \"%s\" port %d",
+				  pgsql->connectionString, host->host, host->port);
+
+		connection = PQconnectStartParams(keywords, values, 1);
+	}
+	else
+	{
+		log_debug("Connecting to \"%s\"", pgsql->connectionString);
+
+		connection = PQconnectStart(pgsql->connectionString);
+	}
+
+	if (connection == NULL || PQstatus(connection) == CONNECTION_BAD)
+	{
+		log_error("Connection to database failed: %s",
+				  connection ? PQerrorMessage(connection) : "out of memory");
+
+		PQfinish(connection);
+		return false;
+	}
+
+	pgsql->connection = connection;
+	pgsql->connecting = true;
+	pgsql->connectStatus = PGRES_POLLING_WRITING;
+	pgsql->connectStartMs = monotonic_clock_ms();
+
+	return true;
+}
+
+
+/*
+ * connect_timeout_from_uri returns the connect_timeout parameter of the given
+ * connection string, in seconds, or POSTGRES_CONNECT_TIMEOUT when it's not
+ * set.
+ */
+static int
+connect_timeout_from_uri(const char *pguri)
+{
+	int timeout = 0;
+	char *errmsg = NULL;
+	PQconninfoOption *conninfo = PQconninfoParse(pguri, &errmsg);
+	PQconninfoOption *option = NULL;
+
+	if (conninfo == NULL)
+	{
+		PQfreemem(errmsg);
+		return atoi(POSTGRES_CONNECT_TIMEOUT);
+	}
+
+	for (option = conninfo; option->keyword != NULL; option++)
+	{
+		if (strcmp(option->keyword, "connect_timeout") == 0 &&
+			option->val != NULL)
+		{
+			timeout = atoi(option->val);
+		}
+	}
+
+	PQconninfoFree(conninfo);
+
+	return timeout > 0 ? timeout : atoi(POSTGRES_CONNECT_TIMEOUT);
+}
+
+
+/*
+ * pgsql_complete_connection waits for a connection started with
+ * pgsql_start_connection() to be established, for at most
+ * PG_AUTOCTL_KEEPER_SLEEP_TIME seconds, or connect_timeout for each host when
+ * the connection string lists several hosts, and returns true when the
+ * connection is ready to use.
+ */
+bool
+pgsql_complete_connection(PGSQL *pgsql)
+{
+	PostgresPollingStatusType status = pgsql->connectStatus;
+
+	if (pgsql->connection == NULL)
+	{
+		return false;
+	}
+
+	if (!pgsql->connecting)
+	{
+		return true;
+	}
+
+	while (status != PGRES_POLLING_OK && status != PGRES_POLLING_FAILED)
+	{
+		struct pollfd pfd = { 0 };
+		uint64_t timeoutMs = pgsql_connect_timeout_ms(pgsql);
+		uint64_t elapsedMs = monotonic_clock_ms() - pgsql->connectStartMs;
+		int ret = 0;
+
+		if (asked_to_stop || asked_to_stop_fast)
+		{
+			pgsql_finish(pgsql);
+			return false;
+		}
+
+		pfd.fd = PQsocket(pgsql->connection);
+		pfd.events = status == PGRES_POLLING_READING ? POLLIN : POLLOUT;
+
+		ret = poll(&pfd, 1,
+				   elapsedMs < timeoutMs ? (int) (timeoutMs - elapsedMs) : 0);
+
+		if (ret < 0 && errno != EINTR)
+		{
+			log_error("Failed to wait for the connection to \"%s\": %m",
+					  pgsql->connectionString);
+			pgsql_finish(pgsql);
+			pgsql_connection_failed(pgsql);
+			return false;
+		}
+
+		status = pgsql_poll_connection(pgsql, ret > 0);
+	}
+
+	return status == PGRES_POLLING_OK;
+}
+
+
+/*
+ * pgsql_poll_connection advances a connection started with
+ * pgsql_start_connection(), for callers that wait on PQsocket() in their own
+ * event loop. It calls PQconnectPoll when the socket is ready, and otherwise
+ * only checks the timeout. When the connection string lists several hosts and
+ * the current one fails or times out, it moves on to the next one. The
+ * returned status tells whether to wait for the socket to be readable or
+ * writable next. As libpq may switch to another socket in between, callers
+ * should fetch PQsocket() again each time.
+ */
+PostgresPollingStatusType
+pgsql_poll_connection(PGSQL *pgsql, bool socketReady)
+{
+	uint64_t timeoutMs = pgsql_connect_timeout_ms(pgsql);
+	uint64_t elapsedMs = 0;
+
+	if (pgsql->connection == NULL)
+	{
+		return PGRES_POLLING_FAILED;
+	}
+
+	if (!pgsql->connecting)
+	{
+		return PGRES_POLLING_OK;
+	}
+
+	if (socketReady)
+	{
+		pgsql->connectStatus = PQconnectPoll(pgsql->connection);
+	}
+
+	switch (pgsql->connectStatus)
+	{
+		case PGRES_POLLING_OK:
+		{
+			pgsql->connecting = false;
+			pgsql_connection_succeeded(pgsql);
+
+			/* integrate notifications as warnings */
+			PQsetNoticeProcessor(pgsql->connection,
+								 &pgAutoCtlDefaultNoticeProcessor, NULL);
+			break;
+		}
+
+		case PGRES_POLLING_FAILED:
+		{
+			if (pgsql_connect_next_host(pgsql))
+			{
+				break;
+			}
+
+			if (pgsql->connection != NULL)
+			{
+				log_error("Connection to database failed: %s",
+						  PQerrorMessage(pgsql->connection));
+			}
+			pgsql_finish(pgsql);
+			pgsql_connection_failed(pgsql);
+			break;
+		}
+
+		default:
+		{
+			elapsedMs = monotonic_clock_ms() - pgsql->connectStartMs;
+
+			if (elapsedMs < timeoutMs || pgsql_connect_next_host(pgsql))
+			{
+				break;
+			}
+
+			log_error("Failed to connect to \"%s\" in %" PRIu64 "ms",
+					  pgsql->connectionString, elapsedMs);
+			pgsql_finish(pgsql);
+			pgsql_connection_failed(pgsql);
+			pgsql->connectStatus = PGRES_POLLING_FAILED;
+			break;
+		}
+	}
+
+	return pgsql->connectStatus;
+}
+
+
+/*
+ * pgsql_connect_next_host abandons the connection attempt to the current host
+ * and starts connecting to the next host of the connection string, skipping
+ * the hosts that fail right away. It returns false when there's no host left
+ * to try, and then the current connection attempt is left untouched.
+ */
+static bool
+pgsql_connect_next_host(PGSQL *pgsql)
+{
+	NodeAddressArray hosts = { 0 };
+
+	if (!pgsql->multipleHosts ||
+		!hostnames_from_uri(pgsql->connectionString, &hosts))
+	{
+		return false;
+	}
+
+	if (pgsql->hostIndex + 1 >= hosts.count)
+	{
+		return false;
+	}
+
+	log_warn("Failed to connect to \"%s\" on host \"%s\" port %d: %s",
+			 pgsql->connectionString,
+			 hosts.nodes[pgsql->hostIndex].host,
+			 hosts.nodes[pgsql->hostIndex].port,
+			 pgsql->connectStatus == PGRES_POLLING_FAILED
+			 ? PQerrorMessage(pgsql->connection)
+			 : "timeout expired");
+
+	PQfinish(pgsql->connection);
+	pgsql->connection = NULL;
+
+	while (++pgsql->hostIndex < hosts.count)
+	{
+		if (pgsql_start_host_connection(pgsql))
+		{
+			return true;
+		}
+	}
+
+	/* we're out of hosts, and the caller reports the failure */
+	pgsql->connecting = false;
+	pgsql->connectStatus = PGRES_POLLING_FAILED;
+
+	return false;
+}
+
+
+/*
+ * pgsql_connect_timeout_ms returns how long we wait for a connection attempt
+ * to the current host: connect_timeout when the connection string lists
+ * several hosts, and PG_AUTOCTL_KEEPER_SLEEP_TIME otherwise.
+ */
+static uint64_t
+pgsql_connect_timeout_ms(PGSQL *pgsql)
+{
+	if (pgsql->multipleHosts)
+	{
+		return (uint64_t) pgsql->hostTimeoutMs;
+	}
+
+	return PG_AUTOCTL_KEEPER_SLEEP_TIME * MSECS_PER_SEC;
+}
+
+
+/*
+ * pgsql_connection_failed schedules the next connection attempt of a
+ * non-blocking client, using an exponential backoff with jitter, so that
+ * keepers that lost the monitor at the same time don't all come back at the
+ * same time.
+ */
+static void
+pgsql_connection_failed(PGSQL *pgsql)
+{
+	static bool seeded = false;
+	uint64_t delayMs = POSTGRES_CONNECT_RETRY_MAX_DELAY_MS;
+	uint64_t jitterMs = 0;
+
+	if (!seeded)
+	{
+		srandom((unsigned int) (getpid() ^ monotonic_clock_ms()));
+		seeded = true;
+	}
+
+	if (pgsql->failedAttempts < 16)
+	{
+		delayMs = (uint64_t) POSTGRES_CONNECT_RETRY_BASE_DELAY_MS
+				  << pgsql->failedAttempts;
+
+		if (delayMs > POSTGRES_CONNECT_RETRY_MAX_DELAY_MS)
+		{
+			delayMs = POSTGRES_CONNECT_RETRY_MAX_DELAY_MS;
+		}
+	}
+
+	/* wait between half the delay and the whole delay */
+	jitterMs = (uint64_t) random() % (delayMs / 2 + 1);
+	delayMs = delayMs / 2 + jitterMs;
+
+	++pgsql->failedAttempts;
+	pgsql->nextAttemptMs = monotonic_clock_ms() + delayMs;
+
+	log_warn("Failed to connect to \"%s\" %d time(s), "
+			 "next attempt in %" PRIu64 "ms",
+			 pgsql->connectionString, pgsql->failedAttempts, delayMs);
+}
+
+
+/*
+ * pgsql_connection_succeeded resets the backoff of a non-blocking client.
+ */
+static void
+pgsql_connection_succeeded(PGSQL *pgsql)
+{
+	if (pgsql->failedAttempts > 0)
+	{
+		log_info("Successfully connected to \"%s\" after %d failed attempts",
+				 pgsql->connectionString, pgsql->failedAttempts);
+	}
+
+	pgsql->failedAttempts = 0;
+	pgsql->nextAttemptMs = 0;
+}
+
+
 /*
  * pgsql_retry_open_connection loops over a PQping call until the remote server
  * is ready to accept connections, and then connects to it and returns true
@@ -215,16 +652,16 @@ pgsql_retry_open_connection(PGSQL *pgsql)
 	int attempts = 0;
 	bool retry = true;
 	bool connectionOk = false;
-	uint64_t startTime = time(NULL);
+	uint64_t startTime = monotonic_clock_ms();
 
 	log_warn("Failed to connect to \"%s\", retrying until "
 			 "the server is ready", pgsql->connectionString);
 
 	while (retry)
 	{
-		uint64_t now = time(NULL);
+		uint64_t now = monotonic_clock_ms();
 
-		if ((now - startTime) >= POSTGRES_PING_RETRY_TIMEOUT)
+		if ((now - startTime) >= POSTGRES_PING_RETRY_TIMEOUT * MSECS_PER_SEC)
 		{
 			log_warn("Failed to connect to \"%s\" after %d attempts, "
 					 "stopping now", pgsql->connectionString, attempts);
@@ -559,6 +996,71 @@ pgsql_check_postgresql_settings(PGSQL *pgsql, bool isCitusInstanceKind,
 }
 
 
+/*
+ * pgsql_has_pending_restart sets pendingRestart to true when the Postgres
+ * configuration files contain settings that can only be applied with a
+ * restart of the instance. The pg_file_settings view reads the configuration
+ * files at query time, so that we don't have to wait for a reload to be
+ * processed by our backend.
+ */
+bool
+pgsql_has_pending_restart(PGSQL *pgsql, bool *pendingRestart)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+	const char *sql =
+		"select exists(select 1 from pg_file_settings "
+		"where not applied and error is not null)";
+
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have been logged already */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to check for settings pending a restart");
+		return false;
+	}
+
+	*pendingRestart = context.boolVal;
+
+	return true;
+}
+
+
+/*
+ * pgsql_get_server_version copies the version number of the running Postgres
+ * server, such as "12.4", to the given buffer. Distributions often append
+ * their own details to server_version, we only keep the version number.
+ */
+bool
+pgsql_get_server_version(PGSQL *pgsql, char *serverVersion, size_t size)
+{
+	char *currentValue = NULL;
+	char *space = NULL;
+
+	if (!pgsql_get_current_setting(pgsql, "server_version", &currentValue))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	space = strchr(currentValue, ' ');
+
+	if (space != NULL)
+	{
+		*space = '\0';
+	}
+
+	strlcpy(serverVersion, currentValue, size);
+	free(currentValue);
+
+	return true;
+}
+
+
 /*
  * pgsql_check_monitor_settings connects to the given pgsql instance to check
  * that pgautofailover is part of shared_preload_libraries.
@@ -703,33 +1205,234 @@ pgsql_enable_synchronous_replication(PGSQL *pgsql)
 {
 	GUC setting = { "synchronous_standby_names", "'*'" };
 
-	log_info("Enabling synchronous replication");
+	log_info("Enabling synchronous replication");
+
+	return pgsql_alter_system_set(pgsql, setting);
+}
+
+
+/*
+ * pgsql_disable_synchronous_replication disables synchronous replication
+ * in Postgres such that writes do not block if there is no replica.
+ */
+bool
+pgsql_disable_synchronous_replication(PGSQL *pgsql)
+{
+	GUC setting = { "synchronous_standby_names", "''" };
+	char *cancelBlockedStatementsCommand =
+		"SELECT pg_cancel_backend(pid) FROM pg_stat_activity WHERE wait_event = 'SyncRep'";
+
+	log_info("Disabling synchronous replication");
+
+	if (!pgsql_alter_system_set(pgsql, setting))
+	{
+		return false;
+	}
+
+	log_debug("Unblocking commands waiting for synchronous replication");
+
+	if (!pgsql_execute(pgsql, cancelBlockedStatementsCommand))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * pgsql_set_default_transaction_mode_read_only makes it so that the server
+ * won't be a target of a connection string requiring target_session_attrs
+ * read-write by issuing ALTER SYSTEM SET transaction_mode_read_only TO on;
+ *
+ */
+bool
+pgsql_set_default_transaction_mode_read_only(PGSQL *pgsql)
+{
+	GUC setting = { "default_transaction_read_only", "'on'" };
+
+	log_info("Setting default_transaction_read_only to on");
+
+	return pgsql_alter_system_set(pgsql, setting);
+}
+
+
+/*
+ * pgsql_set_default_transaction_mode_read_write makes it so that the server
+ * can be a target of a connection string requiring target_session_attrs
+ * read-write by issuing ALTER SYSTEM SET transaction_mode_read_only TO off;
+ *
+ */
+bool
+pgsql_set_default_transaction_mode_read_write(PGSQL *pgsql)
+{
+	GUC setting = { "default_transaction_read_only", "'off'" };
+
+	log_info("Setting default_transaction_read_only to off");
+
+	return pgsql_alter_system_set(pgsql, setting);
+}
+
+
+/*
+ * pgsql_checkpoint runs a CHECKPOINT command on postgres to trigger a checkpoint.
+ */
+bool
+pgsql_checkpoint(PGSQL *pgsql)
+{
+	return pgsql_execute(pgsql, "CHECKPOINT");
+}
+
+
+/*
+ * pgsql_alter_system_set runs an ALTER SYSTEM SET ... command on Postgres
+ * to globally set a GUC and then runs pg_reload_conf() to make existing
+ * sessions reload it. Nothing is done when the setting already has the
+ * expected value.
+ */
+static bool
+pgsql_alter_system_set(PGSQL *pgsql, GUC setting)
+{
+	GUCBatch batch = { 0 };
+
+	if (!pgsql_guc_batch_add(&batch, setting.name, setting.value))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	return pgsql_guc_batch_apply(pgsql, &batch);
+}
+
+
+/*
+ * pgsql_guc_batch_add adds a setting to the batch. The value is an SQL
+ * literal, as in ALTER SYSTEM SET name TO value.
+ */
+bool
+pgsql_guc_batch_add(GUCBatch *batch, const char *name, const char *value)
+{
+	GUCBatchEntry *entry = NULL;
+
+	if (batch->count >= GUC_BATCH_MAX_COUNT)
+	{
+		log_error("Failed to add setting \"%s\" to a batch of settings: "
+				  "pg_autoctl supports batches of up to %d settings",
+				  name, GUC_BATCH_MAX_COUNT);
+		return false;
+	}
+
+	entry = &(batch->settings[batch->count]);
+
+	if (strlcpy(entry->name, name, NAMEDATALEN) >= NAMEDATALEN ||
+		strlcpy(entry->value, value, GUC_VALUE_MAXLENGTH) >= GUC_VALUE_MAXLENGTH)
+	{
+		log_error("Failed to add setting \"%s\" to a batch of settings: "
+				  "pg_autoctl supports values up to %d bytes",
+				  name, GUC_VALUE_MAXLENGTH);
+		return false;
+	}
+
+	entry->upToDate = false;
+	++batch->count;
+
+	return true;
+}
+
+
+/*
+ * pgsql_guc_batch_apply fetches the value of all the settings in the batch
+ * from postgresql.auto.conf in a single query, runs ALTER SYSTEM SET for the
+ * settings that need to change, and then reloads the configuration once when
+ * anything changed or a previous change has not been reloaded yet.
+ *
+ * We compare with pg_file_settings rather than pg_settings, because the
+ * values of our session can differ from the file that ALTER SYSTEM edits,
+ * such as with per-role settings or a pending reload. A reload is pending
+ * when the value in effect does not come from the applied line of
+ * postgresql.auto.conf, or differs from it, whatever its current source:
+ * ALTER SYSTEM might have edited the file over a default value and then
+ * failed to reload. Values with units are shown normalized in pg_settings,
+ * so we only compare those by source location.
+ *
+ * ALTER SYSTEM can't run in a transaction block, and a multi-statement query
+ * string runs in an implicit one, so we still send one command per setting
+ * that actually needs to change.
+ */
+bool
+pgsql_guc_batch_apply(PGSQL *pgsql, GUCBatch *batch)
+{
+	const char *sql =
+		"SELECT f.name, f.setting, "
+		"       s.sourcefile IS DISTINCT FROM f.sourcefile "
+		"    OR s.sourceline IS DISTINCT FROM f.sourceline "
+		"    OR (s.unit IS NULL AND s.setting IS DISTINCT FROM f.setting) "
+		"  FROM pg_catalog.pg_file_settings f "
+		"  JOIN pg_catalog.pg_settings s ON s.name = f.name "
+		" WHERE f.name = ANY(string_to_array($1, ',')) "
+		"   AND f.applied "
+		"   AND f.sourcefile = "
+		"       current_setting('data_directory') || '/postgresql.auto.conf'";
+	int paramCount = 1;
+	Oid paramTypes[1] = { TEXTOID };
+	const char *paramValues[1];
+	char names[BUFSIZE] = { 0 };
+	int settingIndex = 0;
+	int changedCount = 0;
+	bool pendingReload = false;
+
+	if (batch->count == 0)
+	{
+		return true;
+	}
+
+	for (settingIndex = 0; settingIndex < batch->count; settingIndex++)
+	{
+		if (settingIndex > 0)
+		{
+			strlcat(names, ",", BUFSIZE);
+		}
+		strlcat(names, batch->settings[settingIndex].name, BUFSIZE);
+	}
+
+	paramValues[0] = names;
+
+	/*
+	 * Failing to fetch the current values is not a problem: we then apply
+	 * every setting of the batch.
+	 */
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   batch, &parseGUCBatchSettings))
+	{
+		log_warn("Failed to fetch current values of settings \"%s\"", names);
+	}
+
+	for (settingIndex = 0; settingIndex < batch->count; settingIndex++)
+	{
+		GUCBatchEntry *entry = &(batch->settings[settingIndex]);
+		char command[BUFSIZE + GUC_VALUE_MAXLENGTH];
 
-	return pgsql_alter_system_set(pgsql, setting);
-}
+		if (entry->upToDate)
+		{
+			log_debug("Setting %s is already set to %s", entry->name, entry->value);
 
+			pendingReload = pendingReload || entry->pendingReload;
+			continue;
+		}
 
-/*
- * pgsql_disable_synchronous_replication disables synchronous replication
- * in Postgres such that writes do not block if there is no replica.
- */
-bool
-pgsql_disable_synchronous_replication(PGSQL *pgsql)
-{
-	GUC setting = { "synchronous_standby_names", "''" };
-	char *cancelBlockedStatementsCommand =
-		"SELECT pg_cancel_backend(pid) FROM pg_stat_activity WHERE wait_event = 'SyncRep'";
+		sformat(command, sizeof(command),
+				"ALTER SYSTEM SET %s TO %s", entry->name, entry->value);
 
-	log_info("Disabling synchronous replication");
+		if (!pgsql_execute(pgsql, command))
+		{
+			return false;
+		}
 
-	if (!pgsql_alter_system_set(pgsql, setting))
-	{
-		return false;
+		++changedCount;
 	}
 
-	log_debug("Unblocking commands waiting for synchronous replication");
-
-	if (!pgsql_execute(pgsql, cancelBlockedStatementsCommand))
+	if ((changedCount > 0 || pendingReload) && !pgsql_reload_conf(pgsql))
 	{
 		return false;
 	}
@@ -739,73 +1442,79 @@ pgsql_disable_synchronous_replication(PGSQL *pgsql)
 
 
 /*
- * pgsql_set_default_transaction_mode_read_only makes it so that the server
- * won't be a target of a connection string requiring target_session_attrs
- * read-write by issuing ALTER SYSTEM SET transaction_mode_read_only TO on;
- *
+ * parseGUCBatchSettings marks the settings of a GUCBatch that already have
+ * the expected value in postgresql.auto.conf, given a result set of (name,
+ * setting, pending reload) rows.
  */
-bool
-pgsql_set_default_transaction_mode_read_only(PGSQL *pgsql)
+static void
+parseGUCBatchSettings(void *ctx, PGresult *result)
 {
-	GUC setting = { "default_transaction_read_only", "'on'" };
-
-	log_info("Setting default_transaction_read_only to on");
-
-	return pgsql_alter_system_set(pgsql, setting);
-}
+	GUCBatch *batch = (GUCBatch *) ctx;
+	int rowNumber = 0;
 
+	if (PQnfields(result) != 3)
+	{
+		log_error("Query returned %d columns, expected 3", PQnfields(result));
+		return;
+	}
 
-/*
- * pgsql_set_default_transaction_mode_read_write makes it so that the server
- * can be a target of a connection string requiring target_session_attrs
- * read-write by issuing ALTER SYSTEM SET transaction_mode_read_only TO off;
- *
- */
-bool
-pgsql_set_default_transaction_mode_read_write(PGSQL *pgsql)
-{
-	GUC setting = { "default_transaction_read_only", "'off'" };
+	for (rowNumber = 0; rowNumber < PQntuples(result); rowNumber++)
+	{
+		char *name = PQgetvalue(result, rowNumber, 0);
+		char *setting = PQgetvalue(result, rowNumber, 1);
+		char *pendingReload = PQgetvalue(result, rowNumber, 2);
+		int settingIndex = 0;
 
-	log_info("Setting default_transaction_read_only to off");
+		for (settingIndex = 0; settingIndex < batch->count; settingIndex++)
+		{
+			GUCBatchEntry *entry = &(batch->settings[settingIndex]);
+			char value[GUC_VALUE_MAXLENGTH] = { 0 };
 
-	return pgsql_alter_system_set(pgsql, setting);
-}
+			if (strcmp(entry->name, name) != 0)
+			{
+				continue;
+			}
 
+			(void) unquote_guc_value(entry->value, value, GUC_VALUE_MAXLENGTH);
 
-/*
- * pgsql_checkpoint runs a CHECKPOINT command on postgres to trigger a checkpoint.
- */
-bool
-pgsql_checkpoint(PGSQL *pgsql)
-{
-	return pgsql_execute(pgsql, "CHECKPOINT");
+			entry->upToDate = strcmp(value, setting) == 0;
+			entry->pendingReload = strcmp(pendingReload, "t") == 0;
+		}
+	}
 }
 
 
 /*
- * pgsql_alter_system_set runs an ALTER SYSTEM SET ... command on Postgres
- * to globally set a GUC and then runs pg_reload_conf() to make existing
- * sessions reload it.
+ * unquote_guc_value removes the quotes from an SQL string literal, so that we
+ * can compare it to the value shown in pg_file_settings. Values that are not
+ * quoted are copied as-is.
  */
-static bool
-pgsql_alter_system_set(PGSQL *pgsql, GUC setting)
+static void
+unquote_guc_value(const char *value, char *unquoted, int size)
 {
-	char command[1024];
+	int length = strlen(value);
+	int charIndex = 0;
+	int unquotedLength = 0;
 
-	sformat(command, 1024,
-			"ALTER SYSTEM SET %s TO %s", setting.name, setting.value);
-
-	if (!pgsql_execute(pgsql, command))
+	if (length < 2 || value[0] != '\'' || value[length - 1] != '\'')
 	{
-		return false;
+		strlcpy(unquoted, value, size);
+		return;
 	}
 
-	if (!pgsql_reload_conf(pgsql))
+	for (charIndex = 1; charIndex < length - 1 && unquotedLength < size - 1;
+		 charIndex++)
 	{
-		return false;
+		/* two single quotes are a literal single quote */
+		if (value[charIndex] == '\'' && value[charIndex + 1] == '\'')
+		{
+			charIndex++;
+		}
+
+		unquoted[unquotedLength++] = value[charIndex];
 	}
 
-	return true;
+	unquoted[unquotedLength] = '\0';
 }
 
 
@@ -1253,16 +1962,194 @@ pgsql_has_replica(PGSQL *pgsql, char *userName, bool *hasReplica)
 }
 
 
+/*
+ * pgsql_has_live_replica returns whether a replica with the given username
+ * sent a reply to the local walsender in the last timeoutMs milliseconds.
+ *
+ * The reply_time column of pg_stat_replication only exists in Postgres 12
+ * and later, so when hasReplyTime is false we only check for the walsender
+ * entry, as pgsql_has_replica does. The walsender still goes away after
+ * wal_sender_timeout when the replica does not answer anymore.
+ */
+bool
+pgsql_has_live_replica(PGSQL *pgsql, char *userName, bool hasReplyTime,
+					   int timeoutMs, bool *hasReplica)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_BOOL, false };
+	IntString timeoutString = intToString(timeoutMs);
+
+	char *sql =
+		hasReplyTime
+		? "SELECT EXISTS (SELECT 1 FROM pg_stat_replication "
+		  " WHERE usename = $1 "
+		  "   AND reply_time > clock_timestamp() "
+		  "     - make_interval(secs => $2::float8 / 1000))"
+		: "SELECT EXISTS (SELECT 1 FROM pg_stat_replication WHERE usename = $1)";
+
+	const Oid paramTypes[2] = { TEXTOID, INT4OID };
+	const char *paramValues[2] = { userName, timeoutString.strValue };
+	int paramCount = hasReplyTime ? 2 : 1;
+
+	if (!pgsql_execute_with_params(pgsql, sql, paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to find pg_stat_replication");
+		return false;
+	}
+
+	*hasReplica = context.boolVal;
+
+	return true;
+}
+
+
+/*
+ * pgsql_is_streaming returns whether the local standby server currently has a
+ * WAL receiver process that is streaming from the given upstream server.
+ */
+bool
+pgsql_is_streaming(PGSQL *pgsql, const char *host, int port, bool *isStreaming)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_STRING, false };
+	NodeAddressArray upstream = { 0 };
+	char *sql =
+		"SELECT coalesce("
+		"(SELECT conninfo FROM pg_stat_wal_receiver WHERE status = 'streaming'),"
+		" '')";
+
+	*isStreaming = false;
+
+	if (!pgsql_execute_with_params(pgsql, sql, 0, NULL, NULL,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to get result from pg_stat_wal_receiver");
+		return false;
+	}
+
+	/* not streaming, or we're not allowed to see the conninfo */
+	if (IS_EMPTY_STRING_BUFFER(context.strVal))
+	{
+		free(context.strVal);
+		return true;
+	}
+
+	if (!hostnames_from_uri(context.strVal, &upstream))
+	{
+		/* errors have already been logged */
+		free(context.strVal);
+		return false;
+	}
+
+	free(context.strVal);
+
+	*isStreaming = upstream.count == 1
+				   && strcmp(upstream.nodes[0].host, host) == 0
+				   && upstream.nodes[0].port == port;
+
+	return true;
+}
+
+
+/*
+ * pgsql_terminate_idle_sessions terminates at most batchSize client sessions
+ * that are currently idle, and sets terminatedCount to how many were
+ * terminated. Sessions that are in a transaction are left alone.
+ */
+bool
+pgsql_terminate_idle_sessions(PGSQL *pgsql, int batchSize, int *terminatedCount)
+{
+	SingleValueResultContext context = { { 0 }, PGSQL_RESULT_INT, false };
+	char *sql =
+		"SELECT count(pg_terminate_backend(pid)) "
+		"  FROM (SELECT pid FROM pg_stat_activity "
+		"         WHERE pid <> pg_backend_pid() "
+		"           AND backend_type = 'client backend' "
+		"           AND state = 'idle' "
+		"         LIMIT $1) AS idle";
+	int paramCount = 1;
+	Oid paramTypes[1] = { INT4OID };
+	const char *paramValues[1];
+
+	paramValues[0] = intToString(batchSize).strValue;
+
+	if (!pgsql_execute_with_params(pgsql, sql,
+								   paramCount, paramTypes, paramValues,
+								   &context, &parseSingleValueResult))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (!context.parsedOk)
+	{
+		log_error("Failed to terminate idle sessions");
+		return false;
+	}
+
+	*terminatedCount = context.intVal;
+
+	return true;
+}
+
+
 /*
  * hostname_from_uri parses a PostgreSQL connection string URI and returns
- * whether the URL was successfully parsed.
+ * whether the URL was successfully parsed. When the URI lists several hosts,
+ * such as a monitor and its standby, the first one is returned.
  */
 bool
 hostname_from_uri(const char *pguri,
 				  char *hostname, int maxHostLength, int *port)
 {
-	int found = 0;
-	char *errmsg;
+	NodeAddressArray hosts = { 0 };
+
+	if (!hostnames_from_uri(pguri, &hosts))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (strlcpy(hostname, hosts.nodes[0].host, maxHostLength) >= maxHostLength)
+	{
+		log_error("The URL \"%s\" contains a hostname of %d characters, "
+				  "the maximum supported by pg_autoctl is %d characters",
+				  pguri, (int) strlen(hosts.nodes[0].host), maxHostLength);
+		return false;
+	}
+
+	*port = hosts.nodes[0].port;
+
+	return true;
+}
+
+
+/*
+ * hostnames_from_uri parses a PostgreSQL connection string URI and fills in
+ * the given array with the host and port of each of the hosts it contains,
+ * following the libpq rules for multiple hosts: the port list either has a
+ * single entry that applies to all hosts, or one entry per host.
+ */
+bool
+hostnames_from_uri(const char *pguri, NodeAddressArray *hosts)
+{
+	char *errmsg = NULL;
+	char *hostList = NULL;
+	char *portList = NULL;
+	char *ptr = NULL;
+	char *portPtr = NULL;
+	int portCount = 0;
 	PQconninfoOption *conninfo, *option;
 
 	conninfo = PQconninfoParse(pguri, &errmsg);
@@ -1275,54 +2162,102 @@ hostname_from_uri(const char *pguri,
 
 	for (option = conninfo; option->keyword != NULL; option++)
 	{
+		if (option->val == NULL || option->val[0] == '\0')
+		{
+			continue;
+		}
+
 		if (strcmp(option->keyword, "host") == 0 ||
-			strcmp(option->keyword, "hostaddr") == 0)
+			(strcmp(option->keyword, "hostaddr") == 0 && hostList == NULL))
 		{
-			if (option->val)
-			{
-				int hostNameLength = strlcpy(hostname, option->val, maxHostLength);
+			hostList = option->val;
+		}
+		else if (strcmp(option->keyword, "port") == 0)
+		{
+			portList = option->val;
+		}
+	}
 
-				if (hostNameLength >= maxHostLength)
-				{
-					log_error(
-						"The URL \"%s\" contains a hostname of %d characters, "
-						"the maximum supported by pg_autoctl is %d characters",
-						option->val, hostNameLength, maxHostLength);
-					PQconninfoFree(conninfo);
-					return false;
-				}
+	hosts->count = 0;
 
-				++found;
-			}
+	/* without a host, libpq uses its default host */
+	if (hostList == NULL)
+	{
+		hostList = "";
+	}
+
+	for (ptr = portList; ptr != NULL; ptr = strchr(ptr, ','))
+	{
+		++portCount;
+		++ptr;
+	}
+
+	ptr = hostList;
+	portPtr = portList;
+
+	while (ptr != NULL)
+	{
+		NodeAddress *node = NULL;
+		char *next = strchr(ptr, ',');
+		int length = next ? next - ptr : (int) strlen(ptr);
+
+		if (hosts->count >= NODE_ARRAY_MAX_COUNT)
+		{
+			log_error("The URL \"%s\" contains more than %d hosts",
+					  pguri, NODE_ARRAY_MAX_COUNT);
+			PQconninfoFree(conninfo);
+			return false;
 		}
 
-		if (strcmp(option->keyword, "port") == 0)
+		if (length >= _POSIX_HOST_NAME_MAX)
 		{
-			if (option->val)
-			{
-				/* we expect a single port number in a monitor's URI */
-				if (!stringToInt(option->val, port))
-				{
-					log_error("Failed to parse port number : %s", option->val);
+			log_error("The URL \"%s\" contains a hostname of %d characters, "
+					  "the maximum supported by pg_autoctl is %d characters",
+					  pguri, length, _POSIX_HOST_NAME_MAX - 1);
+			PQconninfoFree(conninfo);
+			return false;
+		}
 
-					PQconninfoFree(conninfo);
-					return false;
-				}
-				++found;
+		node = &(hosts->nodes[hosts->count++]);
+		strlcpy(node->host, ptr, length + 1);
+		node->port = POSTGRES_PORT;
+
+		if (portPtr != NULL)
+		{
+			char portString[NAMEDATALEN] = { 0 };
+			char *portNext = strchr(portPtr, ',');
+			int portLength =
+				portNext ? portNext - portPtr : (int) strlen(portPtr);
+
+			strlcpy(portString, portPtr,
+					Min(portLength + 1, NAMEDATALEN));
+
+			if (portLength > 0 && !stringToInt(portString, &(node->port)))
+			{
+				log_error("Failed to parse port number : %s", portString);
+				PQconninfoFree(conninfo);
+				return false;
 			}
-			else
+
+			/* a single port applies to all the hosts */
+			if (portCount > 1)
 			{
-				*port = POSTGRES_PORT;
+				portPtr = portNext ? portNext + 1 : NULL;
 			}
 		}
 
-		if (found == 2)
-		{
-			break;
-		}
+		ptr = next ? next + 1 : NULL;
 	}
+
 	PQconninfoFree(conninfo);
 
+	if (portCount > 1 && portCount != hosts->count)
+	{
+		log_error("The URL \"%s\" contains %d hosts and %d ports",
+				  pguri, hosts->count, portCount);
+		return false;
+	}
+
 	return true;
 }
 
@@ -1370,6 +2305,7 @@ validate_connection_string(const char *connectionString)
  *  - pg_is_in_recovery (primary or standby, as expected?)
  *  - sync_state from pg_stat_replication when a primary
  *  - current_lsn from the server
+ *  - write, flush and replay LSN and lag of each standby node when a primary
  *
  * With those metadata we can then check our expectations and take decisions in
  * some cases. We can obtain all the metadata that we need easily enough in a
@@ -1382,13 +2318,15 @@ typedef struct PgMetadata
 	bool	pg_is_in_recovery;
 	char	syncState[PGSR_SYNC_STATE_MAXLENGTH];
 	char	currentLSN[PG_LSN_MAXLENGTH];
+	StandbyTelemetry standbys;
 } PgMetadata;
 
 
 bool
 pgsql_get_postgres_metadata(PGSQL *pgsql, const char *slotName,
 							bool *pg_is_in_recovery,
-							char *pgsrSyncState, char *currentLSN)
+							char *pgsrSyncState, char *currentLSN,
+							StandbyTelemetry *standbys)
 {
 	PgMetadata context = { 0 };
 	char *sql =
@@ -1400,13 +2338,21 @@ pgsql_get_postgres_metadata(PGSQL *pgsql, const char *slotName,
 		 * We're good when at least one of them is either 'sync' or 'quorum'.
 		 * We don't check individual replication slots, we take the "best" one
 		 * and report that.
+		 *
+		 * We also report the LSNs and lags of each standby node as seen from
+		 * here, in the same snapshot as our current LSN, so that the monitor
+		 * can compare them. The standby node id is the suffix of the name of
+		 * its replication slot.
 		 */
 		"select pg_is_in_recovery(),"
 		" coalesce(rep.sync_state, '') as sync_state,"
 		" case when pg_is_in_recovery()"
 		" then pg_last_wal_receive_lsn()"
 		" else pg_current_wal_lsn()"
-        " end as current_lsn"
+        " end as current_lsn,"
+		" standbys.node_ids, standbys.write_lsns, standbys.flush_lsns,"
+		" standbys.replay_lsns, standbys.write_lags, standbys.flush_lags,"
+		" standbys.replay_lags"
 		" from (values(1)) as dummy"
 		" full outer join"
 		" ("
@@ -1423,7 +2369,29 @@ pgsql_get_postgres_metadata(PGSQL *pgsql, const char *slotName,
 		"         else 0 end "
 		"    desc limit 1"
 		" ) "
-		"as rep on true";
+		"as rep on true"
+		" cross join"
+		" ("
+		"   select coalesce(array_agg(substring(slot_name from '_([0-9]+)$')::int"
+		"                             order by slot_name), '{}') as node_ids,"
+		"          coalesce(array_agg(write_lsn order by slot_name), '{}')"
+		"            as write_lsns,"
+		"          coalesce(array_agg(flush_lsn order by slot_name), '{}')"
+		"            as flush_lsns,"
+		"          coalesce(array_agg(replay_lsn order by slot_name), '{}')"
+		"            as replay_lsns,"
+		"          coalesce(array_agg(write_lag order by slot_name), '{}')"
+		"            as write_lags,"
+		"          coalesce(array_agg(flush_lag order by slot_name), '{}')"
+		"            as flush_lags,"
+		"          coalesce(array_agg(replay_lag order by slot_name), '{}')"
+		"            as replay_lags"
+		"     from pg_replication_slots slot"
+		"     join pg_stat_replication rep"
+		"       on rep.pid = slot.active_pid"
+		"   where slot_name ~ '" REPLICATION_SLOT_NAME_PATTERN "[0-9]+$'"
+		" ) "
+		"as standbys";
 
 	const Oid paramTypes[1] = { TEXTOID };
 	const char *paramValues[1] = { slotName };
@@ -1455,6 +2423,11 @@ pgsql_get_postgres_metadata(PGSQL *pgsql, const char *slotName,
 		strlcpy(currentLSN, context.currentLSN, PG_LSN_MAXLENGTH);
 	}
 
+	if (standbys != NULL)
+	{
+		*standbys = context.standbys;
+	}
+
 	pgsql_finish(pgsql);
 
 	return true;
@@ -1462,17 +2435,33 @@ pgsql_get_postgres_metadata(PGSQL *pgsql, const char *slotName,
 
 
 /*
- * parsePgsrSyncStateAndWAL parses the result from a PostgreSQL query fetching
- * two columns from pg_stat_replication: sync_state and currentLSN.
+ * parsePgMetadata parses the result from the pgsql_get_postgres_metadata
+ * query: pg_is_in_recovery, sync_state, currentLSN and the standby arrays.
  */
 static void
 parsePgMetadata(void *ctx, PGresult *result)
 {
 	PgMetadata *context = (PgMetadata *) ctx;
-
-	if (PQnfields(result) != 3)
-	{
-		log_error("Query returned %d columns, expected 3", PQnfields(result));
+	StandbyTelemetry *standbys = &(context->standbys);
+	struct
+	{
+		char *target;
+		int column;
+	} standbyArrays[] = {
+		{ standbys->nodeIds, 3 },
+		{ standbys->writeLSNs, 4 },
+		{ standbys->flushLSNs, 5 },
+		{ standbys->replayLSNs, 6 },
+		{ standbys->writeLags, 7 },
+		{ standbys->flushLags, 8 },
+		{ standbys->replayLags, 9 }
+	};
+	int arrayCount = sizeof(standbyArrays) / sizeof(standbyArrays[0]);
+	bool overflow = false;
+
+	if (PQnfields(result) != 10)
+	{
+		log_error("Query returned %d columns, expected 10", PQnfields(result));
 		context->parsedOk = false;
 		return;
 	}
@@ -1508,6 +2497,30 @@ parsePgMetadata(void *ctx, PGresult *result)
 		context->currentLSN[0] = '\0';
 	}
 
+	for (int i = 0; i < arrayCount; i++)
+	{
+		char *value = PQgetvalue(result, 0, standbyArrays[i].column);
+
+		if (PQgetisnull(result, 0, standbyArrays[i].column) ||
+			strlcpy(standbyArrays[i].target, value,
+					STANDBY_TELEMETRY_MAXLENGTH) >= STANDBY_TELEMETRY_MAXLENGTH)
+		{
+			overflow = true;
+		}
+	}
+
+	/* the arrays must have as many entries each, report all or nothing */
+	if (overflow)
+	{
+		log_warn("Failed to parse the replication telemetry of the standby "
+				 "nodes, skipping it");
+
+		for (int i = 0; i < arrayCount; i++)
+		{
+			strlcpy(standbyArrays[i].target, "{}", STANDBY_TELEMETRY_MAXLENGTH);
+		}
+	}
+
 	context->parsedOk = true;
 }
 
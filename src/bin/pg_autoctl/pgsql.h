@@ -12,6 +12,7 @@
 
 
 #include <limits.h>
+#include <stdint.h>
 
 #include "libpq-fe.h"
 
@@ -33,15 +34,6 @@
 #define MAXCONNINFO 1024
 
 
-/*
- * Maximum length of serialized pg_lsn value
- * It is taken from postgres file pg_lsn.c.
- * It defines MAXPG_LSNLEN to be 17 and
- * allocates a buffer 1 byte larger. We
- * went for 18 to make buffer allocation simpler.
- */
-#define PG_LSN_MAXLENGTH 18
-
 /*
  * pg_stat_replication.sync_state is one if:
  *   sync, async, quorum, potential
@@ -69,6 +61,29 @@ typedef struct PGSQL
 	ConnectionType	connectionType;
 	char			connectionString[MAXCONNINFO];
 	PGconn		   *connection;
+
+	/*
+	 * By default, failing to connect to the monitor or a coordinator enters
+	 * a retry loop that blocks until POSTGRES_PING_RETRY_TIMEOUT. Services
+	 * that have other work to do set nonBlocking: connections are then
+	 * established with PQconnectStart/PQconnectPoll, and after a failure we
+	 * fail fast until the next attempt is due, see pgsql_start_connection().
+	 */
+	bool			nonBlocking;
+	bool			multipleHosts;	/* connectionString lists several hosts */
+	bool			connecting;		/* connection is still being established */
+
+	/*
+	 * libpq only implements connect_timeout in its blocking API, so with
+	 * several hosts we connect to one host at a time, and move on to the next
+	 * one when hostTimeoutMs has elapsed, see pgsql_poll_connection().
+	 */
+	int				hostIndex;		/* host we're connecting to */
+	int				hostTimeoutMs;	/* connect_timeout of each host */
+	PostgresPollingStatusType connectStatus;	/* what PQconnectPoll needs */
+	uint64_t		connectStartMs;	/* monotonic clock, when we started */
+	int				failedAttempts;
+	uint64_t		nextAttemptMs;	/* monotonic clock, 0 when not backing off */
 } PGSQL;
 
 /* PostgreSQL ("Grand Unified Configuration") setting */
@@ -94,6 +109,25 @@ typedef struct NodeAddressArray
 	NodeAddress nodes[NODE_ARRAY_MAX_COUNT];
 } NodeAddressArray;
 
+/*
+ * A primary node reports what pg_stat_replication knows about each of its
+ * standby nodes to the monitor. We keep the values as Postgres array literals,
+ * such as '{2,3}' or '{0/3000060,0/3000060}', with one entry per standby node
+ * in each array, and send them as-is.
+ */
+#define STANDBY_TELEMETRY_MAXLENGTH 1024
+
+typedef struct StandbyTelemetry
+{
+	char nodeIds[STANDBY_TELEMETRY_MAXLENGTH];
+	char writeLSNs[STANDBY_TELEMETRY_MAXLENGTH];
+	char flushLSNs[STANDBY_TELEMETRY_MAXLENGTH];
+	char replayLSNs[STANDBY_TELEMETRY_MAXLENGTH];
+	char writeLags[STANDBY_TELEMETRY_MAXLENGTH];
+	char flushLags[STANDBY_TELEMETRY_MAXLENGTH];
+	char replayLags[STANDBY_TELEMETRY_MAXLENGTH];
+} StandbyTelemetry;
+
 typedef struct ReplicationSource
 {
 	NodeAddress primaryNode;
@@ -148,6 +182,29 @@ typedef struct SingleValueResultContext
 	char *strVal;
 } SingleValueResultContext;
 
+/*
+ * A GUCBatch collects the settings that an FSM transition needs to change, so
+ * that we can skip those that already have the expected value and reload the
+ * Postgres configuration only once.
+ */
+#define GUC_BATCH_MAX_COUNT 16
+#define GUC_VALUE_MAXLENGTH 1024
+
+typedef struct GUCBatchEntry
+{
+	char name[NAMEDATALEN];
+	char value[GUC_VALUE_MAXLENGTH];    /* SQL literal, such as 'on' */
+	bool upToDate;                      /* as in postgresql.auto.conf */
+	bool pendingReload;                 /* file not reloaded yet */
+} GUCBatchEntry;
+
+typedef struct GUCBatch
+{
+	char sqlstate[SQLSTATE_LENGTH];
+	int count;
+	GUCBatchEntry settings[GUC_BATCH_MAX_COUNT];
+} GUCBatch;
+
 
 #define CHECK__SETTINGS_SQL											\
 	"select bool_and(ok) "											\
@@ -176,6 +233,9 @@ typedef struct SingleValueResultContext
 
 bool pgsql_init(PGSQL *pgsql, char *url, ConnectionType connectionType);
 void pgsql_finish(PGSQL *pgsql);
+bool pgsql_start_connection(PGSQL *pgsql);
+bool pgsql_complete_connection(PGSQL *pgsql);
+PostgresPollingStatusType pgsql_poll_connection(PGSQL *pgsql, bool socketReady);
 void parseSingleValueResult(void *ctx, PGresult *result);
 bool pgsql_execute_with_params(PGSQL *pgsql, const char *sql, int paramCount,
 							   const Oid *paramTypes, const char **paramValues,
@@ -184,6 +244,8 @@ bool pgsql_check_postgresql_settings(PGSQL *pgsql, bool isCitusInstanceKind,
 									 bool *settings_are_ok);
 bool pgsql_check_monitor_settings(PGSQL *pgsql, bool *settings_are_ok);
 bool pgsql_is_in_recovery(PGSQL *pgsql, bool *is_in_recovery);
+bool pgsql_has_pending_restart(PGSQL *pgsql, bool *pendingRestart);
+bool pgsql_get_server_version(PGSQL *pgsql, char *serverVersion, size_t size);
 bool pgsql_reload_conf(PGSQL *pgsql);
 bool pgsql_create_replication_slot(PGSQL *pgsql, const char *slotName);
 bool pgsql_drop_replication_slot(PGSQL *pgsql, const char *slotName, bool verbose);
@@ -196,20 +258,30 @@ bool pgsql_disable_synchronous_replication(PGSQL *pgsql);
 bool pgsql_set_default_transaction_mode_read_only(PGSQL *pgsql);
 bool pgsql_set_default_transaction_mode_read_write(PGSQL *pgsql);
 bool pgsql_checkpoint(PGSQL *pgsql);
+bool pgsql_guc_batch_add(GUCBatch *batch, const char *name, const char *value);
+bool pgsql_guc_batch_apply(PGSQL *pgsql, GUCBatch *batch);
 bool pgsql_get_hba_file_path(PGSQL *pgsql, char *hbaFilePath, int maxPathLength);
 bool pgsql_create_database(PGSQL *pgsql, const char *dbname, const char *owner);
 bool pgsql_create_extension(PGSQL *pgsql, const char *name);
 bool pgsql_create_user(PGSQL *pgsql, const char *userName, const char *password,
 					   bool login, bool superuser, bool replication);
 bool pgsql_has_replica(PGSQL *pgsql, char *userName, bool *hasReplica);
+bool pgsql_has_live_replica(PGSQL *pgsql, char *userName, bool hasReplyTime,
+							int timeoutMs, bool *hasReplica);
+bool pgsql_is_streaming(PGSQL *pgsql, const char *host, int port,
+						bool *isStreaming);
+bool pgsql_terminate_idle_sessions(PGSQL *pgsql, int batchSize,
+								   int *terminatedCount);
 bool hostname_from_uri(const char *pguri,
 					   char *hostname, int maxHostLength, int *port);
+bool hostnames_from_uri(const char *pguri, NodeAddressArray *hosts);
 bool validate_connection_string(const char *connectionString);
 bool pgsql_reset_primary_conninfo(PGSQL *pgsql);
 
 bool pgsql_get_postgres_metadata(PGSQL *pgsql, const char *slotName,
 								 bool *pg_is_in_recovery,
-								 char *pgsrSyncState, char *currentLSN);
+								 char *pgsrSyncState, char *currentLSN,
+								 StandbyTelemetry *standbys);
 
 bool pgsql_listen(PGSQL *pgsql, char *channels[]);
 
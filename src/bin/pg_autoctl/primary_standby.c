@@ -10,6 +10,7 @@
 
 #include "postgres_fe.h"
 
+#include "clock_utils.h"
 #include "file_utils.h"
 #include "log.h"
 #include "pgctl.h"
@@ -84,7 +85,7 @@ local_postgres_init(LocalPostgresServer *postgres, PostgresSetup *pgSetup)
 	postgres->postgresSetup = *pgSetup;
 
 	/* reset PostgreSQL restart failures tracking */
-	postgres->pgFirstStartFailureTs = 0;
+	postgres->pgFirstStartFailureMs = 0;
 	postgres->pgStartRetries = 0;
 
 	/* set the local instance kind from the configuration. */
@@ -104,18 +105,16 @@ local_postgres_update_pg_failures_tracking(LocalPostgresServer *postgres,
 	if (pgIsRunning)
 	{
 		/* reset PostgreSQL restart failures tracking */
-		postgres->pgFirstStartFailureTs = 0;
+		postgres->pgFirstStartFailureMs = 0;
 		postgres->pgStartRetries = 0;
 		postgres->pgIsRunning = true;
 	}
 	else
 	{
-		uint64_t now = time(NULL);
-
 		/* update PostgreSQL restart failure tracking */
-		if (postgres->pgFirstStartFailureTs == 0)
+		if (postgres->pgFirstStartFailureMs == 0)
 		{
-			postgres->pgFirstStartFailureTs = now;
+			postgres->pgFirstStartFailureMs = monotonic_clock_ms();
 		}
 		++postgres->pgStartRetries;
 	}
@@ -143,71 +142,99 @@ ensure_local_postgres_is_running(LocalPostgresServer *postgres)
 
 	log_trace("ensure_local_postgres_is_running");
 
-	if (!pg_is_running(pgSetup->pg_ctl, pgSetup->pgdata))
+	/*
+	 * When we supervise the postmaster, reap it first if it exited: a zombie
+	 * process would still be found running by pg_setup_is_alive().
+	 */
+	if (pgSetup->supervise)
+	{
+		(void) pg_reap_postmaster();
+	}
+
+	if (pg_setup_is_alive(pgSetup))
+	{
+		return true;
+	}
+
+	log_info("Postgres is not running, starting postgres");
+
+	if (pgSetup->supervise)
 	{
-		log_info("Postgres is not running, starting postgres");
+		/* we know Postgres is ready when pg_start_postmaster returns true */
+		PostgresSetup newPgSetup = *pgSetup;
+		bool pgIsRunning = pg_start_postmaster(&newPgSetup);
 
-		if (!pg_ctl_start(pgSetup->pg_ctl,
-						  pgSetup->pgdata,
-						  pgSetup->pgport,
-						  pgSetup->listen_addresses))
+		if (pgIsRunning)
 		{
-			/* errors have already been logged */
-			bool pgIsRunning = false;
-			local_postgres_update_pg_failures_tracking(postgres, pgIsRunning);
-			return false;
+			/* update connection string for connection to postgres */
+			local_postgres_init(postgres, &newPgSetup);
 		}
-		else
-		{
-			/* we expect postgres to be running now */
-			PostgresSetup newPgSetup = { 0 };
-			bool missingPgdataIsOk = false;
-			bool postgresNotRunningIsOk = false;
-			bool pgIsRunning = false;
-
-			/*
-			 * We know that pg_ctl start --wait was successfull. Still Postgres
-			 * might not have updated its postmaster.pid file yet. Have a
-			 * couple attempts at
-			 */
-			int maxAttempts = 5;
-			int attempts = 0;
-
-			for (attempts = 0; attempts < maxAttempts; attempts++)
-			{
-				bool pgIsRunning = pg_setup_is_running(pgSetup);
 
-				log_trace("waiting for pg_setup_is_running() [%s], attempt %d/%d",
-						  pgIsRunning ? "true" : "false",
-						  attempts+1,
-						  maxAttempts);
+		local_postgres_update_pg_failures_tracking(postgres, pgIsRunning);
 
-				if (pgIsRunning)
-				{
-					break;
-				}
+		return pgIsRunning;
+	}
 
-				/* wait for 100 ms and try again */
-				pg_usleep(100 * 1000);
-			}
+	if (!pg_ctl_start(pgSetup->pg_ctl,
+					  pgSetup->pgdata,
+					  pgSetup->pgport,
+					  pgSetup->listen_addresses))
+	{
+		/* errors have already been logged */
+		bool pgIsRunning = false;
+		local_postgres_update_pg_failures_tracking(postgres, pgIsRunning);
+		return false;
+	}
+	else
+	{
+		/* we expect postgres to be running now */
+		PostgresSetup newPgSetup = { 0 };
+		bool missingPgdataIsOk = false;
+		bool postgresNotRunningIsOk = false;
+		bool pgIsRunning = false;
+
+		/*
+		 * We know that pg_ctl start --wait was successfull. Still Postgres
+		 * might not have updated its postmaster.pid file yet. Have a
+		 * couple attempts at
+		 */
+		int maxAttempts = 5;
+		int attempts = 0;
+
+		for (attempts = 0; attempts < maxAttempts; attempts++)
+		{
+			bool pgIsRunning = pg_setup_is_running(pgSetup);
 
-			/* update settings from running database */
-			if (!pg_setup_init(&newPgSetup, pgSetup, missingPgdataIsOk,
-							   postgresNotRunningIsOk))
+			log_trace("waiting for pg_setup_is_running() [%s], attempt %d/%d",
+					  pgIsRunning ? "true" : "false",
+					  attempts+1,
+					  maxAttempts);
+
+			if (pgIsRunning)
 			{
-				/* errors have already been logged */
-				pgIsRunning = false;
-				local_postgres_update_pg_failures_tracking(postgres, pgIsRunning);
-				return false;
+				break;
 			}
 
-			/* update connection string for connection to postgres */
-			local_postgres_init(postgres, &newPgSetup);
+			/* wait for 100 ms and try again */
+			pg_usleep(100 * 1000);
+		}
 
-			/* update PostgreSQL restart failure tracking */
-			pgIsRunning = true;
+		/* update settings from running database */
+		if (!pg_setup_init(&newPgSetup, pgSetup, missingPgdataIsOk,
+						   postgresNotRunningIsOk))
+		{
+			/* errors have already been logged */
+			pgIsRunning = false;
 			local_postgres_update_pg_failures_tracking(postgres, pgIsRunning);
+			return false;
 		}
+
+		/* update connection string for connection to postgres */
+		local_postgres_init(postgres, &newPgSetup);
+
+		/* update PostgreSQL restart failure tracking */
+		pgIsRunning = true;
+		local_postgres_update_pg_failures_tracking(postgres, pgIsRunning);
 	}
 
 	return true;
@@ -303,6 +330,25 @@ primary_drop_replication_slots(LocalPostgresServer *postgres)
 }
 
 
+/*
+ * primary_apply_settings applies a batch of settings on the local postgres
+ * node, reloading its configuration at most once.
+ */
+bool
+primary_apply_settings(LocalPostgresServer *postgres, GUCBatch *settings)
+{
+	bool result = false;
+	PGSQL *pgsql = &(postgres->sqlClient);
+
+	log_trace("primary_apply_settings");
+
+	result = pgsql_guc_batch_apply(pgsql, settings);
+
+	pgsql_finish(pgsql);
+	return result;
+}
+
+
 /*
  * primary_enable_synchronous_replication enables synchronous replication
  * on a primary postgres node.
@@ -363,6 +409,62 @@ primary_disable_synchronous_replication(LocalPostgresServer *postgres)
 }
 
 
+/*
+ * primary_drain_sessions prepares the primary for a switchover: new writes
+ * are paused by setting default_transaction_read_only to on, which also makes
+ * the server incompatible with target_session_attrs read-write, and then idle
+ * client sessions are terminated in small batches, so that connection poolers
+ * and applications reconnect to the new primary gradually rather than all at
+ * once. Sessions still in a transaction are left alone for pg_ctl stop to
+ * take care of.
+ */
+bool
+primary_drain_sessions(LocalPostgresServer *postgres)
+{
+	PGSQL *pgsql = &(postgres->sqlClient);
+	int batch = 0;
+	int totalCount = 0;
+
+	log_trace("primary_drain_sessions");
+
+	if (!pgsql_set_default_transaction_mode_read_only(pgsql))
+	{
+		log_error("Failed to pause writes on the primary, "
+				  "see above for details");
+		pgsql_finish(pgsql);
+		return false;
+	}
+
+	for (batch = 0; batch < DRAIN_SESSIONS_MAX_BATCHES; batch++)
+	{
+		int terminatedCount = 0;
+
+		if (!pgsql_terminate_idle_sessions(pgsql,
+										   DRAIN_SESSIONS_BATCH_SIZE,
+										   &terminatedCount))
+		{
+			/* errors have already been logged */
+			pgsql_finish(pgsql);
+			return false;
+		}
+
+		totalCount += terminatedCount;
+
+		if (terminatedCount < DRAIN_SESSIONS_BATCH_SIZE)
+		{
+			break;
+		}
+
+		pg_usleep(DRAIN_SESSIONS_BATCH_SLEEP_MS * 1000);
+	}
+
+	log_info("Terminated %d idle sessions on the primary", totalCount);
+
+	pgsql_finish(pgsql);
+	return true;
+}
+
+
 /*
  * postgres_add_default_settings ensures that postgresql.conf includes a
  * postgresql-auto-failover.conf file that sets a number of good defaults for
@@ -492,11 +594,43 @@ bool
 primary_add_standby_to_hba(LocalPostgresServer *postgres,
 						   char *standbyHostname,
 						   const char *replicationPassword)
+{
+	NodeAddressArray standbyArray = { 0 };
+
+	standbyArray.count = 1;
+	strlcpy(standbyArray.nodes[0].host, standbyHostname,
+			sizeof(standbyArray.nodes[0].host));
+
+	return primary_add_standbys_to_hba(postgres,
+									   &standbyArray,
+									   replicationPassword);
+}
+
+
+/*
+ * primary_add_standbys_to_hba ensures the given standby nodes are added to
+ * pg_hba.conf on the primary. The HBA file is read and written at most once
+ * whatever the number of standby nodes, and Postgres is reloaded only when
+ * we actually added new rules.
+ */
+bool
+primary_add_standbys_to_hba(LocalPostgresServer *postgres,
+							NodeAddressArray *standbyArray,
+							const char *replicationPassword)
 {
 	PGSQL *pgsql = &(postgres->sqlClient);
 	PostgresSetup *postgresSetup = &(postgres->postgresSetup);
 	char hbaFilePath[MAXPGPATH];
 	char *authMethod = pg_setup_get_auth_method(postgresSetup);
+	HBAEditBatch batch = { 0 };
+	int nodeIndex = 0;
+
+	log_trace("primary_add_standbys_to_hba");
+
+	if (standbyArray->count == 0)
+	{
+		return true;
+	}
 
 	if (replicationPassword == NULL)
 	{
@@ -504,16 +638,14 @@ primary_add_standby_to_hba(LocalPostgresServer *postgres,
 		if (strcmp(authMethod, "trust") != 0
 			|| strcmp(authMethod, SKIP_HBA_AUTH_METHOD) != 0)
 		{
-			log_warn("Granting replication connection for \"%s\" "
+			log_warn("Granting replication connection to %d standby node(s) "
 					 "using authentication method \"%s\" although no "
 					 "replication password has been set",
-					 standbyHostname, authMethod);
+					 standbyArray->count, authMethod);
 			log_info("HINT: see `pg_autoctl config get replication.password`");
 		}
 	}
 
-	log_trace("primary_add_standby_to_hba");
-
 	if (!pgsql_get_hba_file_path(pgsql, hbaFilePath, MAXPGPATH))
 	{
 		log_error("Failed to add the standby node to PostgreSQL HBA file: "
@@ -522,30 +654,47 @@ primary_add_standby_to_hba(LocalPostgresServer *postgres,
 		return false;
 	}
 
-	if (!pghba_ensure_host_rule_exists(hbaFilePath,
-									   postgresSetup->ssl.active,
-									   HBA_DATABASE_REPLICATION, NULL,
-									   PG_AUTOCTL_REPLICA_USERNAME,
-									   standbyHostname, authMethod))
+	if (!pghba_batch_init(&batch, hbaFilePath))
 	{
 		log_error("Failed to add the standby node to PostgreSQL HBA file: "
-				  "couldn't modify the pg_hba file");
+				  "couldn't read the pg_hba file");
 		return false;
 	}
 
-	if (!pghba_ensure_host_rule_exists(hbaFilePath,
+	for (nodeIndex = 0; nodeIndex < standbyArray->count; nodeIndex++)
+	{
+		char *standbyHostname = standbyArray->nodes[nodeIndex].host;
+
+		if (!pghba_batch_add_host_rule(&batch,
+									   postgresSetup->ssl.active,
+									   HBA_DATABASE_REPLICATION, NULL,
+									   PG_AUTOCTL_REPLICA_USERNAME,
+									   standbyHostname, authMethod) ||
+			!pghba_batch_add_host_rule(&batch,
 									   postgresSetup->ssl.active,
 									   HBA_DATABASE_DBNAME,
 									   postgresSetup->dbname,
 									   PG_AUTOCTL_REPLICA_USERNAME,
 									   standbyHostname, authMethod))
+		{
+			log_error("Failed to add the standby node \"%s\" to PostgreSQL "
+					  "HBA file, see above for details", standbyHostname);
+			pghba_batch_destroy(&batch);
+			return false;
+		}
+	}
+
+	if (!pghba_batch_write(&batch))
 	{
 		log_error("Failed to add the standby node to PostgreSQL HBA file: "
 				  "couldn't modify the pg_hba file");
+		pghba_batch_destroy(&batch);
 		return false;
 	}
 
-	if (!pgsql_reload_conf(pgsql))
+	pghba_batch_destroy(&batch);
+
+	if (batch.newRuleCount > 0 && !pgsql_reload_conf(pgsql))
 	{
 		log_error("Failed to reload the postgres configuration after adding "
 				  "the standby user to pg_hba");
@@ -693,6 +842,55 @@ primary_rewind_to_standby(LocalPostgresServer *postgres,
 }
 
 
+/*
+ * standby_follow_new_primary configures the local PostgreSQL instance to
+ * replicate from the given primary node, and restarts it.
+ *
+ * This is only safe to use when the local data directory did not diverge
+ * from the new primary's timeline, such as after a planned switchover: the
+ * old primary has been shut down cleanly and its WAL has been received by
+ * the promoted standby, so that we don't need pg_rewind.
+ */
+bool
+standby_follow_new_primary(LocalPostgresServer *postgres,
+						   ReplicationSource *replicationSource)
+{
+	char configFilePath[MAXPGPATH];
+	PostgresSetup *pgSetup = &(postgres->postgresSetup);
+	NodeAddress *primaryNode = &(replicationSource->primaryNode);
+
+	log_trace("standby_follow_new_primary");
+	log_info("Following new primary %s:%d",
+			 primaryNode->host, primaryNode->port);
+
+	/* configFilePath = $PGDATA/postgresql.conf */
+	join_path_components(configFilePath, pgSetup->pgdata, "postgresql.conf");
+
+	if (!pg_ctl_stop(pgSetup->pg_ctl, pgSetup->pgdata))
+	{
+		log_error("Failed to stop postgres to follow the new primary");
+		return false;
+	}
+
+	if (!pg_setup_standby_mode(pgSetup->control.pg_control_version,
+							   configFilePath,
+							   pgSetup->pgdata,
+							   replicationSource))
+	{
+		log_error("Failed to setup Postgres as a standby of the new primary");
+		return false;
+	}
+
+	if (!ensure_local_postgres_is_running(postgres))
+	{
+		log_error("Failed to start postgres as a standby of the new primary");
+		return false;
+	}
+
+	return true;
+}
+
+
 /*
  * standby_promote promotes a standby postgres server to primary.
  */
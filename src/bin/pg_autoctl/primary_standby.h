@@ -31,7 +31,8 @@ typedef struct LocalPostgresServer
 	bool			pgIsRunning;
 	char			pgsrSyncState[PGSR_SYNC_STATE_MAXLENGTH];
 	char            currentLSN[PG_LSN_MAXLENGTH];
-	uint64_t		pgFirstStartFailureTs;
+	StandbyTelemetry standbys;			/* as seen from here when a primary */
+	uint64_t		pgFirstStartFailureMs;	/* monotonic clock */
 	int				pgStartRetries;
 	PgInstanceKind	pgKind;
 } LocalPostgresServer;
@@ -48,10 +49,12 @@ bool primary_create_replication_slot(LocalPostgresServer *postgres,
 bool primary_drop_replication_slot(LocalPostgresServer *postgres,
 								   char *replicationSlotName);
 bool primary_drop_replication_slots(LocalPostgresServer *postgres);
+bool primary_apply_settings(LocalPostgresServer *postgres, GUCBatch *settings);
 bool primary_set_synchronous_standby_names(LocalPostgresServer *postgres,
 										   char *synchronous_standby_names);
 bool primary_enable_synchronous_replication(LocalPostgresServer *postgres);
 bool primary_disable_synchronous_replication(LocalPostgresServer *postgres);
+bool primary_drain_sessions(LocalPostgresServer *postgres);
 bool postgres_add_default_settings(LocalPostgresServer *postgres);
 bool primary_create_user_with_hba(LocalPostgresServer *postgres, char *userName,
 								  char *password, char *hostname, char *authMethod);
@@ -60,8 +63,13 @@ bool primary_create_replication_user(LocalPostgresServer *postgres,
 									 char *replicationPassword);
 bool primary_add_standby_to_hba(LocalPostgresServer *postgres,
 								char *standbyHost, const char *replicationPassword);
+bool primary_add_standbys_to_hba(LocalPostgresServer *postgres,
+								 NodeAddressArray *standbyArray,
+								 const char *replicationPassword);
 bool primary_rewind_to_standby(LocalPostgresServer *postgres,
 							   ReplicationSource *replicationSource);
+bool standby_follow_new_primary(LocalPostgresServer *postgres,
+								ReplicationSource *replicationSource);
 bool standby_init_database(LocalPostgresServer *postgres,
 						   ReplicationSource *replicationSource,
 						   const char *nodename);
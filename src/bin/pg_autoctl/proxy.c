@@ -0,0 +1,1411 @@
+/*
+ * src/bin/pg_autoctl/proxy.c
+ *     Lightweight TCP proxy that routes client connections to the current
+ *     primary node of a group, or to its secondary nodes.
+ *
+ * The proxy LISTENs to the monitor's "state" channel and refreshes its
+ * routing table each time a node of its group changes state, so that a
+ * failover is absorbed here rather than in every client. Clients connected
+ * to the read-write port are routed to the primary, clients connected to the
+ * read-only port are balanced across the healthy secondary nodes in a
+ * round-robin fashion.
+ *
+ * Data is moved between client and server sockets with splice(2) through a
+ * pipe, so that it never needs to be copied into user space, and sockets are
+ * watched with epoll(7). Both are Linux specific, so the proxy is only
+ * available on Linux.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
+#include "postgres_fe.h"
+#include "libpq-fe.h"
+
+#include "clock_utils.h"
+#include "defaults.h"
+#include "file_utils.h"
+#include "log.h"
+#include "monitor.h"
+#include "parsing.h"
+#include "proxy.h"
+#include "signals.h"
+#include "state.h"
+#include "string_utils.h"
+
+
+#if defined(__linux__)
+
+/*
+ * We register every file descriptor in epoll with a 64 bits data field that
+ * encodes where the file descriptor comes from, and the index and generation
+ * of the proxy session it belongs to, when relevant. The generation allows
+ * skipping the events of a session that was closed, and its slot reused,
+ * while processing the same batch of events.
+ */
+typedef enum
+{
+	PROXY_SOURCE_LISTEN_READ_WRITE = 1,
+	PROXY_SOURCE_LISTEN_READ_ONLY,
+	PROXY_SOURCE_MONITOR,
+	PROXY_SOURCE_ROUTES,
+	PROXY_SOURCE_CLIENT,
+	PROXY_SOURCE_SERVER
+} ProxyEventSource;
+
+#define PROXY_EVENT_DATA(source, generation, index) \
+	(((uint64_t) (source) << 56) \
+	 | ((uint64_t) ((generation) & 0xFFFFFF) << 32) \
+	 | (uint32_t) (index))
+#define PROXY_EVENT_SOURCE(data) ((ProxyEventSource) ((data) >> 56))
+#define PROXY_EVENT_GENERATION(data) ((uint32_t) (((data) >> 32) & 0xFFFFFF))
+#define PROXY_EVENT_INDEX(data) ((int) ((data) & 0xFFFFFFFF))
+
+/*
+ * The routes are fetched from the monitor with a single query, that we send
+ * and read without blocking the event loop:
+ *
+ *  - the first row with is_primary set is the writable node of the group,
+ *  - the other rows are the healthy secondary nodes that can serve reads.
+ */
+#define PROXY_ROUTES_QUERY \
+	"SELECT node_name, node_port, node_is_primary " \
+	"  FROM pgautofailover.get_nodes($1, $2) " \
+	" WHERE node_is_primary " \
+	" UNION ALL " \
+	"SELECT node_name, node_port, false " \
+	"  FROM pgautofailover.readable_nodes($1) " \
+	" WHERE group_id = $2"
+
+/* a Postgres node we route connections to, with its resolved address */
+typedef struct ProxyBackend
+{
+	NodeAddress node;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+} ProxyBackend;
+
+/*
+ * Host names are resolved the first time the monitor gives them to us, and
+ * then only when we are asked to reload, so that a slow DNS server does not
+ * stall the sessions we proxy each time we refresh the routes. Failures are
+ * cached too, an unresolved entry has an addrlen of zero.
+ */
+#define PROXY_MAX_ADDRESSES (2 * NODE_ARRAY_MAX_COUNT)
+
+typedef struct ProxyAddressCache
+{
+	int count;
+	int next;					/* entry to replace when the cache is full */
+	ProxyBackend entries[PROXY_MAX_ADDRESSES];
+} ProxyAddressCache;
+
+typedef struct ProxyRoutes
+{
+	bool hasPrimary;
+	ProxyBackend primary;
+
+	int secondaryCount;
+	int nextSecondary;
+	ProxyBackend secondaries[NODE_ARRAY_MAX_COUNT];
+} ProxyRoutes;
+
+/*
+ * A proxy session pairs a client connection with a server connection. Data
+ * that could not be written to the other side yet is kept in the session's
+ * pipe, and we stop reading from a socket until its pipe has been drained.
+ */
+typedef struct ProxySession
+{
+	bool inUse;
+	uint32_t generation;
+	bool readOnly;
+	bool connected;
+	int attempts;
+
+	int clientFd;
+	int serverFd;
+	ProxyBackend backend;
+
+	int toServer[2];
+	int toClient[2];
+	size_t pendingToServer;
+	size_t pendingToClient;
+
+	uint32_t clientEvents;
+	uint32_t serverEvents;
+} ProxySession;
+
+typedef struct ProxyService
+{
+	ProxyConfig *config;
+
+	int epollFd;
+	int readWriteFd;
+	int readOnlyFd;
+
+	Monitor monitor;			/* used to query the routing information */
+	Monitor listener;			/* used to LISTEN to state notifications */
+	bool listening;
+
+	ProxyRoutes routes;
+	ProxyAddressCache addresses;
+	uint64_t lastRefresh;		/* monotonic clock, in ms */
+	bool refreshing;			/* routes query sent, waiting for results */
+	bool refreshRequested;		/* refresh again once the current one is done */
+	int routesFd;				/* monitor socket registered for the query */
+} ProxyService;
+
+static ProxySession sessions[PROXY_MAX_CONNECTIONS];
+
+
+static int proxy_listen(const char *host, int port);
+static bool proxy_epoll_add(ProxyService *service, int fd, uint32_t events,
+							uint64_t data);
+static bool proxy_listen_monitor(ProxyService *service);
+static void proxy_handle_notifications(ProxyService *service);
+static void proxy_refresh_routes(ProxyService *service);
+static void proxy_send_routes_query(ProxyService *service);
+static bool proxy_routes_wait(ProxyService *service, uint32_t events);
+static void proxy_handle_routes(ProxyService *service, uint32_t events);
+static void proxy_apply_routes(ProxyService *service, PGresult *result);
+static void proxy_routes_done(ProxyService *service, bool keepConnection);
+static bool proxy_resolve_backend(ProxyService *service, ProxyBackend *backend);
+static void proxy_accept(ProxyService *service, bool readOnly);
+static bool proxy_session_connect(ProxyService *service, ProxySession *session);
+static void proxy_session_connected(ProxyService *service,
+									ProxySession *session);
+static void proxy_session_handle_event(ProxyService *service,
+									   ProxySession *session,
+									   ProxyEventSource source,
+									   uint32_t events);
+static bool proxy_forward(int fromFd, int pipeFds[2], int toFd,
+						  size_t *pending, bool readMore);
+static void proxy_session_update_events(ProxyService *service,
+										ProxySession *session);
+static void proxy_session_close(ProxySession *session);
+
+
+/*
+ * proxy_service_run runs the proxy until we're asked to stop.
+ */
+bool
+proxy_service_run(ProxyConfig *config)
+{
+	ProxyService service = { 0 };
+
+	service.config = config;
+	service.readOnlyFd = -1;
+	service.routesFd = -1;
+
+	if (!monitor_init(&(service.monitor), config->monitor_pguri) ||
+		!monitor_init(&(service.listener), config->monitor_pguri))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	/* never block the event loop while the monitor is unavailable */
+	service.monitor.pgsql.nonBlocking = true;
+	service.listener.pgsql.nonBlocking = true;
+
+	service.epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (service.epollFd < 0)
+	{
+		log_error("Failed to create epoll instance: %m");
+		return false;
+	}
+
+	service.readWriteFd = proxy_listen(config->listen, config->port);
+
+	if (service.readWriteFd < 0 ||
+		!proxy_epoll_add(&service, service.readWriteFd, EPOLLIN,
+						 PROXY_EVENT_DATA(PROXY_SOURCE_LISTEN_READ_WRITE, 0, 0)))
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	if (config->readOnlyPort > 0)
+	{
+		service.readOnlyFd = proxy_listen(config->listen, config->readOnlyPort);
+
+		if (service.readOnlyFd < 0 ||
+			!proxy_epoll_add(&service, service.readOnlyFd, EPOLLIN,
+							 PROXY_EVENT_DATA(PROXY_SOURCE_LISTEN_READ_ONLY, 0, 0)))
+		{
+			/* errors have already been logged */
+			return false;
+		}
+	}
+
+	/* first LISTEN, then fetch the routes, so that we don't miss a change */
+	(void) proxy_listen_monitor(&service);
+	proxy_refresh_routes(&service);
+
+	log_info("pg_autoctl proxy listening on %s:%d for the primary node "
+			 "of formation \"%s\" group %d",
+			 config->listen, config->port, config->formation, config->groupId);
+
+	if (config->readOnlyPort > 0)
+	{
+		log_info("pg_autoctl proxy listening on %s:%d for secondary nodes",
+				 config->listen, config->readOnlyPort);
+	}
+
+	while (!asked_to_stop && !asked_to_stop_fast)
+	{
+		struct epoll_event events[PROXY_MAX_EVENTS];
+		int timeout = PG_AUTOCTL_KEEPER_SLEEP_TIME * 1000;
+		int eventCount = 0;
+
+		/* wake up in time to give up on a monitor that does not answer */
+		if (service.monitor.pgsql.connecting)
+		{
+			timeout = 1000;
+		}
+
+		eventCount = epoll_wait(service.epollFd,
+								events, PROXY_MAX_EVENTS, timeout);
+
+		if (eventCount < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			log_error("Failed to wait for events: %m");
+			break;
+		}
+
+		if (asked_to_reload)
+		{
+			log_info("Reloading: resolving node host names again");
+
+			service.addresses.count = 0;
+			service.addresses.next = 0;
+			asked_to_reload = 0;
+
+			proxy_refresh_routes(&service);
+		}
+
+		/*
+		 * Notifications are pushed to us by the monitor, we still refresh the
+		 * routes every once in a while in case we missed some, and to get
+		 * back on track after losing the LISTEN connection.
+		 */
+		if ((monotonic_clock_ms() - service.lastRefresh) >=
+			PG_AUTOCTL_KEEPER_SLEEP_TIME * MSECS_PER_SEC)
+		{
+			if (!service.listening)
+			{
+				(void) proxy_listen_monitor(&service);
+			}
+			proxy_refresh_routes(&service);
+		}
+
+		if (service.refreshing && service.monitor.pgsql.connecting)
+		{
+			PGSQL *pgsql = &(service.monitor.pgsql);
+			PostgresPollingStatusType status =
+				pgsql_poll_connection(pgsql, false);
+
+			/* on timeout, we might have moved on to the next monitor host */
+			if (status == PGRES_POLLING_FAILED ||
+				(pgsql->connecting &&
+				 PQsocket(pgsql->connection) != service.routesFd &&
+				 !proxy_routes_wait(&service,
+									status == PGRES_POLLING_READING
+									? EPOLLIN : EPOLLOUT)))
+			{
+				proxy_routes_done(&service, false);
+			}
+		}
+
+		for (int i = 0; i < eventCount; i++)
+		{
+			uint64_t data = events[i].data.u64;
+			ProxyEventSource source = PROXY_EVENT_SOURCE(data);
+
+			switch (source)
+			{
+				case PROXY_SOURCE_LISTEN_READ_WRITE:
+				{
+					proxy_accept(&service, false);
+					break;
+				}
+
+				case PROXY_SOURCE_LISTEN_READ_ONLY:
+				{
+					proxy_accept(&service, true);
+					break;
+				}
+
+				case PROXY_SOURCE_MONITOR:
+				{
+					proxy_handle_notifications(&service);
+					break;
+				}
+
+				case PROXY_SOURCE_ROUTES:
+				{
+					proxy_handle_routes(&service, events[i].events);
+					break;
+				}
+
+				case PROXY_SOURCE_CLIENT:
+				case PROXY_SOURCE_SERVER:
+				{
+					ProxySession *session = &(sessions[PROXY_EVENT_INDEX(data)]);
+
+					/*
+					 * A previous event in this batch might have closed it, and
+					 * a new client connection might even be using its slot.
+					 */
+					if (session->inUse &&
+						session->generation == PROXY_EVENT_GENERATION(data))
+					{
+						proxy_session_handle_event(&service, session,
+												   source, events[i].events);
+					}
+					break;
+				}
+
+				default:
+				{
+					log_error("BUG: unknown proxy event source %d", source);
+					break;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < PROXY_MAX_CONNECTIONS; i++)
+	{
+		if (sessions[i].inUse)
+		{
+			proxy_session_close(&(sessions[i]));
+		}
+	}
+
+	pgsql_finish(&(service.monitor.pgsql));
+	pgsql_finish(&(service.listener.pgsql));
+	close(service.epollFd);
+
+	return true;
+}
+
+
+/*
+ * proxy_listen opens a non-blocking TCP socket that listens on the given host
+ * and port, and returns its file descriptor, or -1 on error.
+ */
+static int
+proxy_listen(const char *host, int port)
+{
+	struct addrinfo hints = { 0 };
+	struct addrinfo *addrs = NULL;
+	char service[BUFSIZE] = { 0 };
+	int fd = -1;
+	int enable = 1;
+	int error = 0;
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	sformat(service, BUFSIZE, "%d", port);
+
+	error = getaddrinfo(host, service, &hints, &addrs);
+
+	if (error != 0)
+	{
+		log_error("Failed to resolve \"%s\": %s", host, gai_strerror(error));
+		return -1;
+	}
+
+	fd = socket(addrs->ai_family,
+				addrs->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				addrs->ai_protocol);
+
+	if (fd < 0)
+	{
+		log_error("Failed to create a socket: %m");
+		freeaddrinfo(addrs);
+		return -1;
+	}
+
+	(void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+	if (bind(fd, addrs->ai_addr, addrs->ai_addrlen) < 0 ||
+		listen(fd, SOMAXCONN) < 0)
+	{
+		log_error("Failed to listen on %s:%d: %m", host, port);
+		close(fd);
+		freeaddrinfo(addrs);
+		return -1;
+	}
+
+	freeaddrinfo(addrs);
+
+	return fd;
+}
+
+
+/*
+ * proxy_epoll_add registers the given file descriptor to our epoll instance.
+ */
+static bool
+proxy_epoll_add(ProxyService *service, int fd, uint32_t events, uint64_t data)
+{
+	struct epoll_event event = { 0 };
+
+	event.events = events;
+	event.data.u64 = data;
+
+	if (epoll_ctl(service->epollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		log_error("Failed to register file descriptor %d to epoll: %m", fd);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * proxy_listen_monitor opens our LISTEN connection to the monitor and
+ * registers its socket in our epoll instance.
+ */
+static bool
+proxy_listen_monitor(ProxyService *service)
+{
+	char *channels[] = { "state", NULL };
+	PGSQL *pgsql = &(service->listener.pgsql);
+
+	if (!pgsql_listen(pgsql, channels))
+	{
+		log_warn("Failed to listen to the monitor notifications, "
+				 "retrying later");
+		pgsql_finish(pgsql);
+		return false;
+	}
+
+	if (!proxy_epoll_add(service, PQsocket(pgsql->connection), EPOLLIN,
+						 PROXY_EVENT_DATA(PROXY_SOURCE_MONITOR, 0, 0)))
+	{
+		pgsql_finish(pgsql);
+		return false;
+	}
+
+	service->listening = true;
+
+	return true;
+}
+
+
+/*
+ * proxy_handle_notifications consumes the notifications received from the
+ * monitor and refreshes the routes when a node of our group changed state.
+ */
+static void
+proxy_handle_notifications(ProxyService *service)
+{
+	ProxyConfig *config = service->config;
+	PGSQL *pgsql = &(service->listener.pgsql);
+	PGnotify *notify = NULL;
+	bool refresh = false;
+
+	if (PQconsumeInput(pgsql->connection) == 0)
+	{
+		log_warn("Lost connection to the monitor: %s",
+				 PQerrorMessage(pgsql->connection));
+
+		(void) epoll_ctl(service->epollFd, EPOLL_CTL_DEL,
+						 PQsocket(pgsql->connection), NULL);
+		pgsql_finish(pgsql);
+		service->listening = false;
+
+		return;
+	}
+
+	while ((notify = PQnotifies(pgsql->connection)) != NULL)
+	{
+		StateNotification notification = { 0 };
+
+		/* the parsing scribbles on the message, make a copy now */
+		strlcpy(notification.message, notify->extra, BUFSIZE);
+
+		/* errors are logged by parse_state_notification_message */
+		if (strcmp(notify->relname, "state") == 0 &&
+			parse_state_notification_message(&notification) &&
+			strcmp(notification.formationId, config->formation) == 0 &&
+			notification.groupId == config->groupId)
+		{
+			log_debug("New state for %s:%d: %s/%s",
+					  notification.nodeName,
+					  notification.nodePort,
+					  NodeStateToString(notification.reportedState),
+					  NodeStateToString(notification.goalState));
+
+			refresh = true;
+		}
+
+		PQfreemem(notify);
+	}
+
+	if (refresh)
+	{
+		proxy_refresh_routes(service);
+	}
+}
+
+
+/*
+ * proxy_refresh_routes sends the routes query to the monitor. Connecting to
+ * the monitor, sending the query and reading its results all happen in
+ * proxy_handle_routes when the monitor socket is ready, so that client
+ * traffic keeps flowing while the monitor answers. When a refresh is already
+ * in progress, we refresh again once it's done.
+ */
+static void
+proxy_refresh_routes(ProxyService *service)
+{
+	PGSQL *pgsql = &(service->monitor.pgsql);
+
+	if (service->refreshing)
+	{
+		service->refreshRequested = true;
+		return;
+	}
+
+	service->lastRefresh = monotonic_clock_ms();
+	service->refreshRequested = false;
+
+	/* keep routing to the nodes we know while the monitor is unavailable */
+	if (!pgsql_start_connection(pgsql))
+	{
+		log_debug("Failed to connect to the monitor, keeping current routes");
+		return;
+	}
+
+	service->refreshing = true;
+
+	if (pgsql->connecting)
+	{
+		if (!proxy_routes_wait(service, EPOLLOUT))
+		{
+			proxy_routes_done(service, false);
+		}
+		return;
+	}
+
+	proxy_send_routes_query(service);
+}
+
+
+/*
+ * proxy_send_routes_query sends the routes query on our established
+ * connection to the monitor, and registers the monitor socket to read the
+ * results.
+ */
+static void
+proxy_send_routes_query(ProxyService *service)
+{
+	ProxyConfig *config = service->config;
+	PGSQL *pgsql = &(service->monitor.pgsql);
+	char groupId[BUFSIZE] = { 0 };
+	const Oid paramTypes[2] = { TEXTOID, INT4OID };
+	const char *paramValues[2] = { config->formation, groupId };
+	int flushStatus = 0;
+
+	sformat(groupId, BUFSIZE, "%d", config->groupId);
+
+	if (PQsetnonblocking(pgsql->connection, 1) != 0 ||
+		PQsendQueryParams(pgsql->connection, PROXY_ROUTES_QUERY,
+						  2, paramTypes, paramValues, NULL, NULL, 0) == 0 ||
+		(flushStatus = PQflush(pgsql->connection)) < 0)
+	{
+		log_warn("Failed to query the routes from the monitor: %s",
+				 PQerrorMessage(pgsql->connection));
+		proxy_routes_done(service, false);
+		return;
+	}
+
+	/* wait until the query is sent, then for its results */
+	if (!proxy_routes_wait(service,
+						   flushStatus == 1 ? (EPOLLIN | EPOLLOUT) : EPOLLIN))
+	{
+		proxy_routes_done(service, false);
+	}
+}
+
+
+/*
+ * proxy_routes_wait registers the monitor socket with our epoll instance for
+ * the given events. While connecting, libpq might close its socket and open
+ * another one to try the next host, so we always register PQsocket() again.
+ */
+static bool
+proxy_routes_wait(ProxyService *service, uint32_t events)
+{
+	int fd = PQsocket(service->monitor.pgsql.connection);
+
+	if (service->routesFd >= 0)
+	{
+		/* the socket might already be closed, ignore errors */
+		(void) epoll_ctl(service->epollFd, EPOLL_CTL_DEL,
+						 service->routesFd, NULL);
+		service->routesFd = -1;
+	}
+
+	if (fd < 0 ||
+		!proxy_epoll_add(service, fd, events,
+						 PROXY_EVENT_DATA(PROXY_SOURCE_ROUTES, 0, 0)))
+	{
+		return false;
+	}
+
+	service->routesFd = fd;
+
+	return true;
+}
+
+
+/*
+ * proxy_handle_routes connects to the monitor, and then reads the results of
+ * the routes query, when the monitor socket is ready. The routes are applied
+ * once all the results have been received.
+ */
+static void
+proxy_handle_routes(ProxyService *service, uint32_t events)
+{
+	PGSQL *pgsql = &(service->monitor.pgsql);
+	PGconn *connection = pgsql->connection;
+	PGresult *result = NULL;
+	bool success = true;
+
+	if (connection == NULL)
+	{
+		return;
+	}
+
+	if (pgsql->connecting)
+	{
+		switch (pgsql_poll_connection(pgsql, true))
+		{
+			case PGRES_POLLING_OK:
+			{
+				proxy_send_routes_query(service);
+				break;
+			}
+
+			case PGRES_POLLING_READING:
+			{
+				if (!proxy_routes_wait(service, EPOLLIN))
+				{
+					proxy_routes_done(service, false);
+				}
+				break;
+			}
+
+			case PGRES_POLLING_WRITING:
+			{
+				if (!proxy_routes_wait(service, EPOLLOUT))
+				{
+					proxy_routes_done(service, false);
+				}
+				break;
+			}
+
+			default:
+			{
+				/* errors have already been logged */
+				proxy_routes_done(service, false);
+				break;
+			}
+		}
+		return;
+	}
+
+	if (events & EPOLLOUT)
+	{
+		int flushStatus = PQflush(connection);
+
+		if (flushStatus < 0)
+		{
+			log_warn("Failed to query the routes from the monitor: %s",
+					 PQerrorMessage(connection));
+			proxy_routes_done(service, false);
+			return;
+		}
+
+		if (flushStatus == 0)
+		{
+			struct epoll_event event = { 0 };
+
+			event.events = EPOLLIN;
+			event.data.u64 = PROXY_EVENT_DATA(PROXY_SOURCE_ROUTES, 0, 0);
+
+			(void) epoll_ctl(service->epollFd, EPOLL_CTL_MOD,
+							 service->routesFd, &event);
+		}
+	}
+
+	if (PQconsumeInput(connection) == 0)
+	{
+		log_warn("Lost connection to the monitor: %s",
+				 PQerrorMessage(connection));
+		proxy_routes_done(service, false);
+		return;
+	}
+
+	if (PQisBusy(connection))
+	{
+		/* wait for more data */
+		return;
+	}
+
+	while ((result = PQgetResult(connection)) != NULL)
+	{
+		if (PQresultStatus(result) == PGRES_TUPLES_OK)
+		{
+			proxy_apply_routes(service, result);
+		}
+		else
+		{
+			log_warn("Failed to query the routes from the monitor: %s",
+					 PQresultErrorMessage(result));
+			success = false;
+		}
+		PQclear(result);
+	}
+
+	proxy_routes_done(service, success);
+}
+
+
+/*
+ * proxy_routes_done unregisters the monitor socket once the routes query is
+ * done, and sends it again when a refresh was requested in the meantime. On
+ * errors we disconnect, and connect again at the next refresh.
+ */
+static void
+proxy_routes_done(ProxyService *service, bool keepConnection)
+{
+	PGSQL *pgsql = &(service->monitor.pgsql);
+
+	if (service->routesFd >= 0)
+	{
+		(void) epoll_ctl(service->epollFd, EPOLL_CTL_DEL,
+						 service->routesFd, NULL);
+		service->routesFd = -1;
+	}
+
+	if (!keepConnection)
+	{
+		pgsql_finish(pgsql);
+	}
+
+	service->refreshing = false;
+
+	if (service->refreshRequested)
+	{
+		proxy_refresh_routes(service);
+	}
+}
+
+
+/*
+ * proxy_apply_routes updates our routes from the results of the routes
+ * query. When the primary node changed, sessions that were routed to the
+ * previous one are closed so that clients reconnect to the new primary right
+ * away. Only the healthy secondary nodes, as listed by the monitor's
+ * readable_nodes, serve read-only traffic.
+ */
+static void
+proxy_apply_routes(ProxyService *service, PGresult *result)
+{
+	ProxyConfig *config = service->config;
+	ProxyRoutes *routes = &(service->routes);
+	ProxyBackend primary = { 0 };
+	bool hasPrimary = false;
+	bool primaryChanged = false;
+	int secondaryCount = 0;
+
+	if (PQnfields(result) != 3)
+	{
+		log_error("Query returned %d columns, expected 3", PQnfields(result));
+		return;
+	}
+
+	for (int row = 0; row < PQntuples(result); row++)
+	{
+		bool isPrimary = strcmp(PQgetvalue(result, row, 2), "t") == 0;
+		ProxyBackend *backend = NULL;
+
+		if (isPrimary && hasPrimary)
+		{
+			/* the first one is the writable node */
+			continue;
+		}
+
+		if (!isPrimary &&
+			(config->readOnlyPort == 0 || secondaryCount >= NODE_ARRAY_MAX_COUNT))
+		{
+			continue;
+		}
+
+		backend = isPrimary ? &primary : &(routes->secondaries[secondaryCount]);
+
+		strlcpy(backend->node.host, PQgetvalue(result, row, 0),
+				_POSIX_HOST_NAME_MAX);
+
+		if (!stringToInt(PQgetvalue(result, row, 1), &(backend->node.port)))
+		{
+			log_error("Invalid port number: \"%s\"",
+					  PQgetvalue(result, row, 1));
+			continue;
+		}
+
+		backend->node.isPrimary = isPrimary;
+
+		if (!proxy_resolve_backend(service, backend))
+		{
+			continue;
+		}
+
+		if (isPrimary)
+		{
+			hasPrimary = true;
+		}
+		else
+		{
+			++secondaryCount;
+		}
+	}
+
+	routes->secondaryCount = secondaryCount;
+
+	primaryChanged =
+		hasPrimary != routes->hasPrimary
+		|| (hasPrimary
+			&& (routes->primary.node.port != primary.node.port
+				|| strcmp(routes->primary.node.host, primary.node.host) != 0));
+
+	if (routes->hasPrimary && primaryChanged)
+	{
+		log_info("Closing sessions to the previous primary %s:%d",
+				 routes->primary.node.host, routes->primary.node.port);
+
+		for (int i = 0; i < PROXY_MAX_CONNECTIONS; i++)
+		{
+			if (sessions[i].inUse && !sessions[i].readOnly)
+			{
+				proxy_session_close(&(sessions[i]));
+			}
+		}
+	}
+
+	if (hasPrimary && primaryChanged)
+	{
+		log_info("Routing read-write connections to %s:%d",
+				 primary.node.host, primary.node.port);
+	}
+
+	routes->hasPrimary = hasPrimary;
+	routes->primary = primary;
+}
+
+
+/*
+ * proxy_resolve_backend sets the address of the given backend node from our
+ * cache. Host names that are not in the cache yet are resolved here, once,
+ * and numeric addresses are parsed without any network round-trip.
+ */
+static bool
+proxy_resolve_backend(ProxyService *service, ProxyBackend *backend)
+{
+	ProxyAddressCache *cache = &(service->addresses);
+	ProxyBackend *entry = NULL;
+	struct addrinfo hints = { 0 };
+	struct addrinfo *addrs = NULL;
+	char portString[BUFSIZE] = { 0 };
+	int error = 0;
+
+	for (int i = 0; i < cache->count; i++)
+	{
+		entry = &(cache->entries[i]);
+
+		if (entry->node.port == backend->node.port &&
+			strcmp(entry->node.host, backend->node.host) == 0)
+		{
+			backend->addr = entry->addr;
+			backend->addrlen = entry->addrlen;
+
+			return backend->addrlen > 0;
+		}
+	}
+
+	if (cache->count < PROXY_MAX_ADDRESSES)
+	{
+		entry = &(cache->entries[cache->count++]);
+	}
+	else
+	{
+		entry = &(cache->entries[cache->next]);
+		cache->next = (cache->next + 1) % PROXY_MAX_ADDRESSES;
+	}
+
+	memset(entry, 0, sizeof(ProxyBackend));
+	entry->node = backend->node;
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICHOST;
+
+	sformat(portString, BUFSIZE, "%d", backend->node.port);
+
+	error = getaddrinfo(backend->node.host, portString, &hints, &addrs);
+
+	if (error == EAI_NONAME)
+	{
+		log_debug("Resolving \"%s\"", backend->node.host);
+
+		hints.ai_flags = 0;
+		error = getaddrinfo(backend->node.host, portString, &hints, &addrs);
+	}
+
+	if (error != 0)
+	{
+		log_warn("Failed to resolve \"%s\": %s",
+				 backend->node.host, gai_strerror(error));
+		return false;
+	}
+
+	memcpy(&(entry->addr), addrs->ai_addr, addrs->ai_addrlen);
+	entry->addrlen = addrs->ai_addrlen;
+
+	freeaddrinfo(addrs);
+
+	backend->addr = entry->addr;
+	backend->addrlen = entry->addrlen;
+
+	return true;
+}
+
+
+/*
+ * proxy_accept accepts all the pending client connections on the read-write
+ * or read-only listening socket, and starts connecting to a backend node for
+ * each of them.
+ */
+static void
+proxy_accept(ProxyService *service, bool readOnly)
+{
+	static uint32_t generation = 0;
+	int listenFd = readOnly ? service->readOnlyFd : service->readWriteFd;
+
+	for (;;)
+	{
+		ProxySession *session = NULL;
+		int index = 0;
+		int clientFd = accept4(listenFd, NULL, NULL,
+							   SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (clientFd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			{
+				log_warn("Failed to accept a client connection: %m");
+			}
+			return;
+		}
+
+		for (index = 0; index < PROXY_MAX_CONNECTIONS; index++)
+		{
+			if (!sessions[index].inUse)
+			{
+				session = &(sessions[index]);
+				break;
+			}
+		}
+
+		if (session == NULL)
+		{
+			log_warn("Refusing client connection: already handling %d "
+					 "connections", PROXY_MAX_CONNECTIONS);
+			close(clientFd);
+			continue;
+		}
+
+		memset(session, 0, sizeof(ProxySession));
+
+		session->generation = ++generation;
+		session->readOnly = readOnly;
+		session->clientFd = clientFd;
+		session->serverFd = -1;
+		session->toServer[0] = session->toServer[1] = -1;
+		session->toClient[0] = session->toClient[1] = -1;
+
+		if (pipe2(session->toServer, O_NONBLOCK | O_CLOEXEC) < 0 ||
+			pipe2(session->toClient, O_NONBLOCK | O_CLOEXEC) < 0)
+		{
+			log_warn("Failed to create a pipe for a client connection: %m");
+			session->inUse = true;
+			proxy_session_close(session);
+			continue;
+		}
+
+		session->inUse = true;
+
+		/* client events are enabled once connected to the server */
+		if (!proxy_epoll_add(service, clientFd, 0,
+							 PROXY_EVENT_DATA(PROXY_SOURCE_CLIENT,
+											  session->generation, index)) ||
+			!proxy_session_connect(service, session))
+		{
+			proxy_session_close(session);
+		}
+	}
+}
+
+
+/*
+ * proxy_session_connect starts a non-blocking connection to the backend node
+ * for the given session: the primary node, or the next secondary node.
+ */
+static bool
+proxy_session_connect(ProxyService *service, ProxySession *session)
+{
+	ProxyRoutes *routes = &(service->routes);
+	int index = session - sessions;
+
+	if (session->readOnly)
+	{
+		if (routes->secondaryCount == 0 ||
+			session->attempts >= routes->secondaryCount)
+		{
+			log_warn("Refusing read-only client connection: "
+					 "no secondary node available");
+			return false;
+		}
+
+		routes->nextSecondary = (routes->nextSecondary + 1)
+								% routes->secondaryCount;
+		session->backend = routes->secondaries[routes->nextSecondary];
+	}
+	else
+	{
+		if (!routes->hasPrimary)
+		{
+			log_warn("Refusing read-write client connection: "
+					 "no primary node available");
+			return false;
+		}
+
+		session->backend = routes->primary;
+	}
+
+	++session->attempts;
+
+	session->serverFd =
+		socket(session->backend.addr.ss_family,
+			   SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (session->serverFd < 0)
+	{
+		log_warn("Failed to create a socket: %m");
+		return false;
+	}
+
+	if (connect(session->serverFd,
+				(struct sockaddr *) &(session->backend.addr),
+				session->backend.addrlen) < 0 &&
+		errno != EINPROGRESS)
+	{
+		log_warn("Failed to connect to %s:%d: %m",
+				 session->backend.node.host, session->backend.node.port);
+		return false;
+	}
+
+	session->serverEvents = EPOLLOUT;
+
+	return proxy_epoll_add(service, session->serverFd, EPOLLOUT,
+						   PROXY_EVENT_DATA(PROXY_SOURCE_SERVER,
+											session->generation, index));
+}
+
+
+/*
+ * proxy_session_connected is called when the server socket of a session is
+ * writable for the first time, which is when the connection completed, or
+ * failed. Read-only sessions are given another chance with the next
+ * secondary node.
+ */
+static void
+proxy_session_connected(ProxyService *service, ProxySession *session)
+{
+	int error = 0;
+	socklen_t len = sizeof(error);
+
+	if (getsockopt(session->serverFd, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+	{
+		error = errno;
+	}
+
+	if (error != 0)
+	{
+		log_warn("Failed to connect to %s:%d: %s",
+				 session->backend.node.host, session->backend.node.port,
+				 strerror(error));
+
+		/* closing the socket also removes it from the epoll instance */
+		close(session->serverFd);
+		session->serverFd = -1;
+
+		if (!session->readOnly || !proxy_session_connect(service, session))
+		{
+			proxy_session_close(session);
+		}
+		return;
+	}
+
+	log_debug("Proxying client connection to %s:%d",
+			  session->backend.node.host, session->backend.node.port);
+
+	session->connected = true;
+	proxy_session_update_events(service, session);
+}
+
+
+/*
+ * proxy_session_handle_event forwards data in between the client and the
+ * server sockets of a session.
+ */
+static void
+proxy_session_handle_event(ProxyService *service, ProxySession *session,
+						   ProxyEventSource source, uint32_t events)
+{
+	bool readable = (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+	bool writable = (events & EPOLLOUT) != 0;
+	bool success = true;
+
+	if (!session->connected)
+	{
+		if (source == PROXY_SOURCE_SERVER)
+		{
+			proxy_session_connected(service, session);
+		}
+		else if (events & (EPOLLHUP | EPOLLERR))
+		{
+			/* the client went away before we connected to the server */
+			proxy_session_close(session);
+		}
+		return;
+	}
+
+	if (source == PROXY_SOURCE_CLIENT)
+	{
+		if (readable)
+		{
+			success = proxy_forward(session->clientFd, session->toServer,
+									session->serverFd,
+									&(session->pendingToServer), true);
+		}
+
+		if (success && writable)
+		{
+			success = proxy_forward(session->serverFd, session->toClient,
+									session->clientFd,
+									&(session->pendingToClient), false);
+		}
+	}
+	else
+	{
+		if (readable)
+		{
+			success = proxy_forward(session->serverFd, session->toClient,
+									session->clientFd,
+									&(session->pendingToClient), true);
+		}
+
+		if (success && writable)
+		{
+			success = proxy_forward(session->clientFd, session->toServer,
+									session->serverFd,
+									&(session->pendingToServer), false);
+		}
+	}
+
+	if (!success)
+	{
+		proxy_session_close(session);
+		return;
+	}
+
+	proxy_session_update_events(service, session);
+}
+
+
+/*
+ * proxy_forward moves data from fromFd to toFd through the given pipe, using
+ * splice(2). When readMore is false, or when the pipe still has pending data,
+ * we only try to flush the pipe to toFd.
+ *
+ * Returns false when either side of the connection is closed or failed.
+ */
+static bool
+proxy_forward(int fromFd, int pipeFds[2], int toFd,
+			  size_t *pending, bool readMore)
+{
+	if (readMore && *pending == 0)
+	{
+		ssize_t bytes = splice(fromFd, NULL, pipeFds[1], NULL,
+							   PROXY_PIPE_SIZE,
+							   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+		if (bytes == 0)
+		{
+			/* end of file */
+			return false;
+		}
+		else if (bytes < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				return false;
+			}
+		}
+		else
+		{
+			*pending += bytes;
+		}
+	}
+
+	while (*pending > 0)
+	{
+		ssize_t bytes = splice(pipeFds[0], NULL, toFd, NULL, *pending,
+							   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+		if (bytes < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				/* wait until toFd is writable again */
+				break;
+			}
+			return false;
+		}
+
+		*pending -= bytes;
+	}
+
+	return true;
+}
+
+
+/*
+ * proxy_session_update_events registers the events we want to be notified of
+ * for the session sockets: we only read from a socket when its pipe to the
+ * other side is empty, and we only wait for a socket to be writable when we
+ * have pending data to send there.
+ */
+static void
+proxy_session_update_events(ProxyService *service, ProxySession *session)
+{
+	int index = session - sessions;
+	uint32_t clientEvents =
+		(session->pendingToServer == 0 ? EPOLLIN : 0)
+		| (session->pendingToClient > 0 ? EPOLLOUT : 0);
+	uint32_t serverEvents =
+		(session->pendingToClient == 0 ? EPOLLIN : 0)
+		| (session->pendingToServer > 0 ? EPOLLOUT : 0);
+
+	if (clientEvents != session->clientEvents)
+	{
+		struct epoll_event event = { 0 };
+
+		event.events = clientEvents;
+		event.data.u64 = PROXY_EVENT_DATA(PROXY_SOURCE_CLIENT,
+										  session->generation, index);
+
+		(void) epoll_ctl(service->epollFd, EPOLL_CTL_MOD,
+						 session->clientFd, &event);
+		session->clientEvents = clientEvents;
+	}
+
+	if (serverEvents != session->serverEvents)
+	{
+		struct epoll_event event = { 0 };
+
+		event.events = serverEvents;
+		event.data.u64 = PROXY_EVENT_DATA(PROXY_SOURCE_SERVER,
+										  session->generation, index);
+
+		(void) epoll_ctl(service->epollFd, EPOLL_CTL_MOD,
+						 session->serverFd, &event);
+		session->serverEvents = serverEvents;
+	}
+}
+
+
+/*
+ * proxy_session_close closes all the file descriptors of a session, which
+ * also removes them from the epoll instance, and makes the session slot
+ * available again.
+ */
+static void
+proxy_session_close(ProxySession *session)
+{
+	int fds[] = {
+		session->clientFd,
+		session->serverFd,
+		session->toServer[0],
+		session->toServer[1],
+		session->toClient[0],
+		session->toClient[1]
+	};
+
+	for (int i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+	{
+		if (fds[i] >= 0)
+		{
+			close(fds[i]);
+		}
+	}
+
+	session->inUse = false;
+}
+
+
+#else
+
+/*
+ * proxy_service_run is only implemented on Linux.
+ */
+bool
+proxy_service_run(ProxyConfig *config)
+{
+	log_fatal("pg_autoctl proxy relies on epoll and splice, "
+			  "which are only available on Linux");
+	return false;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,34 @@
+/*
+ * src/bin/pg_autoctl/proxy.h
+ *     Lightweight TCP proxy that routes client connections to the current
+ *     primary node of a group, or to its secondary nodes.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <limits.h>
+#include <stdbool.h>
+
+#include "pgsql.h"
+
+
+typedef struct ProxyConfig
+{
+	char monitor_pguri[MAXCONNINFO];
+	char formation[NAMEDATALEN];
+	int groupId;
+
+	char listen[_POSIX_HOST_NAME_MAX];
+	int port;					/* routes to the primary node */
+	int readOnlyPort;			/* routes to secondary nodes, 0 to disable */
+} ProxyConfig;
+
+
+bool proxy_service_run(ProxyConfig *config);
+
+#endif /* PROXY_H */
@@ -20,6 +20,7 @@
 volatile sig_atomic_t asked_to_stop = 0;	  /* SIGTERM */
 volatile sig_atomic_t asked_to_stop_fast = 0; /* SIGINT */
 volatile sig_atomic_t asked_to_reload = 0;	  /* SIGHUP */
+volatile sig_atomic_t asked_to_reap = 0;	  /* SIGCHLD */
 
 
 /*
@@ -82,3 +83,19 @@ catch_quit(int sig)
 	log_warn("Immediate shutdown: received signal %s", strsignal(sig));
 	exit(EXIT_CODE_QUIT);
 }
+
+
+/*
+ * catch_child receives the SIGCHLD signal. It is only installed when
+ * pg_autoctl supervises the postmaster as its own child process, and the
+ * main loop then reaps the postmaster with pg_reap_postmaster().
+ *
+ * We don't log anything here: all our pg_ctl and other sub-processes also
+ * raise SIGCHLD when they exit.
+ */
+void
+catch_child(int sig)
+{
+	asked_to_reap = 1;
+	signal(sig, catch_child);
+}
@@ -17,6 +17,7 @@
 extern volatile sig_atomic_t asked_to_stop;		 /* SIGTERM */
 extern volatile sig_atomic_t asked_to_stop_fast; /* SIGINT */
 extern volatile sig_atomic_t asked_to_reload;	 /* SIGHUP */
+extern volatile sig_atomic_t asked_to_reap;		 /* SIGCHLD */
 
 #define CHECK_FOR_FAST_SHUTDOWN {if (asked_to_stop_fast) {break;}}
 
@@ -25,5 +26,6 @@ void catch_reload(int sig);
 void catch_int(int sig);
 void catch_term(int sig);
 void catch_quit(int sig);
+void catch_child(int sig);
 
 #endif /* SIGNALS_H */
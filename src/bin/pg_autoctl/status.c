@@ -0,0 +1,362 @@
+/*
+ * src/bin/pg_autoctl/status.c
+ *     Shared memory status page published by a running keeper.
+ *
+ * The state file is the source of truth for the keeper FSM, and is replaced
+ * on disk at each iteration of the main loop. The status page is meant for
+ * observability instead: the keeper maps a small file in its runtime
+ * directory and updates it in place, and local readers such as
+ * `pg_autoctl show file --status --contents` or an exporter map the same
+ * file and copy a consistent snapshot of it without any lock and without
+ * any system call once the file is mapped.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+
+#include "parson.h"
+
+#include "defaults.h"
+#include "file_utils.h"
+#include "log.h"
+#include "status.h"
+
+/*
+ * The keeper is the only writer of the page, so the sequence lock only needs
+ * atomic accesses to the sequence number and memory barriers around the data
+ * copy, see keeper_status_publish() and keeper_status_snapshot().
+ */
+#define status_sequence_load(page) \
+	__atomic_load_n(&((page)->sequence), __ATOMIC_ACQUIRE)
+#define status_sequence_store(page, value) \
+	__atomic_store_n(&((page)->sequence), (value), __ATOMIC_RELEASE)
+
+#define status_write_barrier()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define status_read_barrier()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+/* how many times a reader retries while the keeper is writing the page */
+#define KEEPER_STATUS_READ_RETRIES 1000
+
+static KeeperStatusPage * keeper_status_map(const char *filename,
+											bool readOnly);
+
+
+/*
+ * keeper_status_create creates the status file and maps it in our memory
+ * for writing.
+ */
+bool
+keeper_status_create(KeeperStatus *status, const char *filename)
+{
+	int fd = open(filename, O_RDWR | O_CREAT, 0600);
+
+	if (fd == -1)
+	{
+		log_error("Failed to create status file \"%s\": %m", filename);
+		return false;
+	}
+
+	/* the file might be left-over from a previous version, with mode 0644 */
+	if (fchmod(fd, 0600) != 0)
+	{
+		log_error("Failed to set permissions of status file \"%s\": %m",
+				  filename);
+		close(fd);
+		return false;
+	}
+
+	if (ftruncate(fd, sizeof(KeeperStatusPage)) != 0)
+	{
+		log_error("Failed to resize status file \"%s\": %m", filename);
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	status->page = keeper_status_map(filename, false);
+
+	if (status->page == NULL)
+	{
+		/* errors have already been logged */
+		return false;
+	}
+
+	status->readOnly = false;
+
+	/* a previous keeper might have crashed in the middle of an update */
+	status_sequence_store(status->page, 0);
+	status->page->version = KEEPER_STATUS_VERSION;
+	memset(&(status->data), 0, sizeof(KeeperStatusData));
+
+	return true;
+}
+
+
+/*
+ * keeper_status_publish copies the keeper's working copy of the status data
+ * to the shared page.
+ */
+void
+keeper_status_publish(KeeperStatus *status)
+{
+	KeeperStatusPage *page = status->page;
+	uint32_t sequence = 0;
+
+	if (page == NULL || status->readOnly)
+	{
+		return;
+	}
+
+	sequence = status_sequence_load(page);
+
+	/* readers must see the odd sequence number before any of the data */
+	status_sequence_store(page, sequence + 1);
+	status_write_barrier();
+
+	memcpy(&(page->data), &(status->data), sizeof(KeeperStatusData));
+
+	/* and the data before the next even sequence number */
+	status_write_barrier();
+	status_sequence_store(page, sequence + 2);
+}
+
+
+/*
+ * keeper_status_remove unmaps the status page and removes the status file.
+ */
+bool
+keeper_status_remove(KeeperStatus *status, const char *filename)
+{
+	(void) keeper_status_detach(status);
+
+	return unlink_file(filename);
+}
+
+
+/*
+ * keeper_status_attach maps an existing status file for reading.
+ */
+bool
+keeper_status_attach(KeeperStatus *status, const char *filename)
+{
+	if (!file_exists(filename))
+	{
+		log_error("Status file \"%s\" does not exist, "
+				  "is pg_autoctl running?", filename);
+		return false;
+	}
+
+	status->page = keeper_status_map(filename, true);
+	status->readOnly = true;
+
+	return status->page != NULL;
+}
+
+
+/*
+ * keeper_status_snapshot copies a consistent version of the shared page to
+ * the given data. It returns false when the page has not been published
+ * yet, or when the keeper kept updating it while we were reading.
+ */
+bool
+keeper_status_snapshot(KeeperStatus *status, KeeperStatusData *data)
+{
+	KeeperStatusPage *page = status->page;
+	int retries = 0;
+
+	if (page == NULL)
+	{
+		return false;
+	}
+
+	if (page->version != KEEPER_STATUS_VERSION)
+	{
+		log_error("Unsupported status page version %u, expected %u",
+				  page->version, KEEPER_STATUS_VERSION);
+		return false;
+	}
+
+	for (retries = 0; retries < KEEPER_STATUS_READ_RETRIES; retries++)
+	{
+		uint32_t before = status_sequence_load(page);
+		uint32_t after = 0;
+
+		if (before == 0)
+		{
+			log_error("The keeper has not published its status yet");
+			return false;
+		}
+
+		/* odd sequence numbers mean that the keeper is writing */
+		if (before % 2 == 1)
+		{
+			continue;
+		}
+
+		/* the data must be read after the sequence number... */
+		status_read_barrier();
+		memcpy(data, &(page->data), sizeof(KeeperStatusData));
+
+		/* ...and before we check the sequence number again */
+		status_read_barrier();
+		after = status_sequence_load(page);
+
+		if (before == after)
+		{
+			return true;
+		}
+	}
+
+	log_error("Failed to read a consistent status page after %d attempts",
+			  KEEPER_STATUS_READ_RETRIES);
+
+	return false;
+}
+
+
+/*
+ * keeper_status_detach unmaps the status page.
+ */
+void
+keeper_status_detach(KeeperStatus *status)
+{
+	if (status->page != NULL)
+	{
+		munmap(status->page, sizeof(KeeperStatusPage));
+		status->page = NULL;
+	}
+}
+
+
+/*
+ * keeper_status_map maps the given status file in memory, and returns NULL
+ * when that fails.
+ */
+static KeeperStatusPage *
+keeper_status_map(const char *filename, bool readOnly)
+{
+	int fd = open(filename, readOnly ? O_RDONLY : O_RDWR);
+	void *page = NULL;
+
+	if (fd == -1)
+	{
+		log_error("Failed to open status file \"%s\": %m", filename);
+		return NULL;
+	}
+
+	page = mmap(NULL, sizeof(KeeperStatusPage),
+				readOnly ? PROT_READ : PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0);
+
+	/* the mapping stays valid after closing the file descriptor */
+	close(fd);
+
+	if (page == MAP_FAILED)
+	{
+		log_error("Failed to map status file \"%s\": %m", filename);
+		return NULL;
+	}
+
+	return (KeeperStatusPage *) page;
+}
+
+
+/*
+ * print_keeper_status prints the given status of the keeper to given FILE
+ * output (stdout, stderr, etc).
+ */
+void
+print_keeper_status(KeeperStatusData *data, FILE *stream)
+{
+	char timestring[MAXCTIMESIZE];
+
+	fformat(stream, "pg_autoctl pid:           %d\n", data->pid);
+	fformat(stream, "Current Role:             %s\n",
+			NodeStateToString(data->currentRole));
+	fformat(stream, "Assigned Role:            %s\n",
+			NodeStateToString(data->assignedRole));
+
+	if (data->transitionInProgress)
+	{
+		fformat(stream, "Transition Started:       %s\n",
+				epoch_to_string(data->transitionStartTime, timestring));
+	}
+
+	fformat(stream, "Last Update:              %s\n",
+			epoch_to_string(data->lastUpdate, timestring));
+	fformat(stream, "Last Monitor Contact:     %s\n",
+			epoch_to_string(data->lastMonitorContact, timestring));
+	fformat(stream, "Last Secondary Contact:   %s\n",
+			epoch_to_string(data->lastSecondaryContact, timestring));
+
+	fformat(stream, "group:                    %d\n", data->groupId);
+	fformat(stream, "node id:                  %d\n", data->nodeId);
+
+	fformat(stream, "PostgreSQL is running:    %s\n",
+			data->pgIsRunning ? "true" : "false");
+	fformat(stream, "Current LSN:              %s\n", data->currentLSN);
+	fformat(stream, "Sync State:               %s\n", data->pgsrSyncState);
+	fformat(stream, "Xlog Lag:                 %" PRId64 "\n", data->xlogLag);
+
+	fformat(stream, "Iterations:               %" PRIu64 "\n",
+			data->iterations);
+	fformat(stream, "Prepare Duration:         %" PRIu64 "ms\n",
+			data->prepareDurationMs);
+	fformat(stream, "Monitor Duration:         %" PRIu64 "ms\n",
+			data->monitorDurationMs);
+	fformat(stream, "Transition Duration:      %" PRIu64 "ms\n",
+			data->transitionDurationMs);
+
+	fflush(stream);
+}
+
+
+/*
+ * keeperStatusAsJSON populates the given JSON object with the keeper status.
+ */
+bool
+keeperStatusAsJSON(KeeperStatusData *data, JSON_Value *js)
+{
+	JSON_Object *jsobj = json_value_get_object(js);
+
+	json_object_set_number(jsobj, "pid", (double) data->pid);
+	json_object_set_string(jsobj, "current_role",
+						   NodeStateToString(data->currentRole));
+	json_object_set_string(jsobj, "assigned_role",
+						   NodeStateToString(data->assignedRole));
+	json_object_set_boolean(jsobj, "transition_in_progress",
+							data->transitionInProgress);
+	json_object_set_number(jsobj, "transition_start_time",
+						   (double) data->transitionStartTime);
+	json_object_set_number(jsobj, "last_update", (double) data->lastUpdate);
+	json_object_set_number(jsobj, "last_monitor_contact",
+						   (double) data->lastMonitorContact);
+	json_object_set_number(jsobj, "last_secondary_contact",
+						   (double) data->lastSecondaryContact);
+	json_object_set_number(jsobj, "groupId", (double) data->groupId);
+	json_object_set_number(jsobj, "nodeId", (double) data->nodeId);
+	json_object_set_boolean(jsobj, "pg_is_running", data->pgIsRunning);
+	json_object_set_string(jsobj, "current_lsn", data->currentLSN);
+	json_object_set_string(jsobj, "sync_state", data->pgsrSyncState);
+	json_object_set_number(jsobj, "xlog_lag", (double) data->xlogLag);
+	json_object_set_number(jsobj, "iterations", (double) data->iterations);
+	json_object_set_number(jsobj, "prepare_duration_ms",
+						   (double) data->prepareDurationMs);
+	json_object_set_number(jsobj, "monitor_duration_ms",
+						   (double) data->monitorDurationMs);
+	json_object_set_number(jsobj, "transition_duration_ms",
+						   (double) data->transitionDurationMs);
+
+	return true;
+}
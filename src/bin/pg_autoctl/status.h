@@ -0,0 +1,89 @@
+/*
+ * src/bin/pg_autoctl/status.h
+ *     Shared memory status page published by a running keeper.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef KEEPER_STATUS_H
+#define KEEPER_STATUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "parson.h"
+#include "pgsetup.h"
+#include "pgsql.h"
+#include "state.h"
+
+#define KEEPER_STATUS_VERSION 1
+
+/*
+ * KeeperStatusData is what the keeper main loop knows about the local node
+ * at the end of its last step. Timestamps are seconds since epoch, durations
+ * are in milliseconds.
+ */
+typedef struct KeeperStatusData
+{
+	int pid;
+	int nodeId;
+	int groupId;
+	NodeState currentRole;
+	NodeState assignedRole;
+
+	/* set while the FSM is transitioning from currentRole to assignedRole */
+	bool transitionInProgress;
+	uint64_t transitionStartTime;
+
+	uint64_t lastUpdate;
+	uint64_t lastMonitorContact;
+	uint64_t lastSecondaryContact;
+
+	bool pgIsRunning;
+	char currentLSN[PG_LSN_MAXLENGTH];
+	char pgsrSyncState[PGSR_SYNC_STATE_MAXLENGTH];
+	int64_t xlogLag;
+
+	/* durations of the phases of the last main loop iteration */
+	uint64_t iterations;
+	uint64_t prepareDurationMs;
+	uint64_t monitorDurationMs;
+	uint64_t transitionDurationMs;
+} KeeperStatusData;
+
+/*
+ * KeeperStatusPage is the layout of the status file in the runtime
+ * directory, which the keeper and its readers mmap. The keeper is the only
+ * writer, and uses a sequence lock: the sequence number is odd while the
+ * data is being written, and readers retry when it changed while they were
+ * copying the data.
+ */
+typedef struct KeeperStatusPage
+{
+	volatile uint32_t version;
+	uint32_t sequence;          /* only accessed with __atomic builtins */
+	KeeperStatusData data;
+} KeeperStatusPage;
+
+typedef struct KeeperStatus
+{
+	KeeperStatusPage *page;
+	bool readOnly;
+	KeeperStatusData data;      /* the keeper's working copy */
+} KeeperStatus;
+
+bool keeper_status_create(KeeperStatus *status, const char *filename);
+void keeper_status_publish(KeeperStatus *status);
+bool keeper_status_remove(KeeperStatus *status, const char *filename);
+
+bool keeper_status_attach(KeeperStatus *status, const char *filename);
+bool keeper_status_snapshot(KeeperStatus *status, KeeperStatusData *data);
+void keeper_status_detach(KeeperStatus *status);
+
+void print_keeper_status(KeeperStatusData *data, FILE *stream);
+bool keeperStatusAsJSON(KeeperStatusData *data, JSON_Value *js);
+
+#endif /* KEEPER_STATUS_H */
@@ -0,0 +1,289 @@
+/*
+ * src/bin/pg_autoctl/watchdog.c
+ *   Fencing watchdog process that stops a partitioned primary node
+ *   independently of the keeper main loop.
+ *
+ * The keeper main loop only checks for network partitions when a call to the
+ * monitor fails, and such a call may block for a long time, up to
+ * POSTGRES_PING_RETRY_TIMEOUT when the monitor can't be reached. Meanwhile
+ * the monitor may already have promoted a standby on the other side of the
+ * partition. The watchdog is a small child process of the keeper that checks
+ * every FENCING_WATCHDOG_INTERVAL_MS whether the local primary still has a
+ * live replica, and stops Postgres as soon as neither the monitor nor any
+ * replica have been heard of for network_partition_timeout, whatever the
+ * main loop is busy with.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "postgres_fe.h"
+
+#include "clock_utils.h"
+#include "defaults.h"
+#include "log.h"
+#include "pgctl.h"
+#include "pgsql.h"
+#include "signals.h"
+#include "watchdog.h"
+
+
+static void fencing_watchdog_run(FencingWatchdogShared *shared,
+								 PostgresSetup *pgSetup,
+								 pid_t parentPid);
+
+
+/*
+ * fencing_watchdog_start forks the watchdog process for the given local
+ * Postgres instance. The watchdog does nothing until the main loop tells it
+ * that the node is a primary, see fencing_watchdog_update().
+ */
+bool
+fencing_watchdog_start(FencingWatchdog *watchdog, PostgresSetup *pgSetup)
+{
+	pid_t parentPid = getpid();
+	pid_t pid = 0;
+
+	if (watchdog->shared == NULL)
+	{
+		void *shared = mmap(NULL, sizeof(FencingWatchdogShared),
+							PROT_READ | PROT_WRITE,
+							MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+		if (shared == MAP_FAILED)
+		{
+			log_error("Failed to allocate shared memory for the "
+					  "fencing watchdog: %m");
+			return false;
+		}
+
+		watchdog->shared = (FencingWatchdogShared *) shared;
+		memset(shared, 0, sizeof(FencingWatchdogShared));
+	}
+
+	watchdog->pgSetup = pgSetup;
+
+	/* flush stdio buffers before forking, to avoid duplicate output */
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+
+	switch (pid)
+	{
+		case -1:
+		{
+			log_error("Failed to fork the fencing watchdog process: %m");
+			return false;
+		}
+
+		case 0:
+		{
+			(void) fencing_watchdog_run(watchdog->shared, pgSetup, parentPid);
+			exit(EXIT_CODE_QUIT);
+		}
+
+		default:
+		{
+			log_debug("Started fencing watchdog for \"%s\" with pid %d",
+					  pgSetup->pgdata, pid);
+			watchdog->pid = pid;
+			return true;
+		}
+	}
+}
+
+
+/*
+ * fencing_watchdog_update publishes what the keeper main loop knows to the
+ * watchdog process, and restarts the watchdog if it exited.
+ */
+void
+fencing_watchdog_update(FencingWatchdog *watchdog,
+						uint64_t lastMonitorContactMs,
+						uint64_t lastSecondaryContactMs,
+						int networkPartitionTimeout,
+						bool isPrimary)
+{
+	FencingWatchdogShared *shared = watchdog->shared;
+
+	if (shared == NULL)
+	{
+		return;
+	}
+
+	shared->lastMonitorContactMs = lastMonitorContactMs;
+	shared->lastSecondaryContactMs = lastSecondaryContactMs;
+	shared->networkPartitionTimeoutMs =
+		(uint64_t) networkPartitionTimeout * MSECS_PER_SEC;
+	shared->isPrimary = isPrimary;
+
+	if (watchdog->pid > 0)
+	{
+		int status = 0;
+
+		if (waitpid(watchdog->pid, &status, WNOHANG) == watchdog->pid)
+		{
+			log_warn("Fencing watchdog process %d exited unexpectedly, "
+					 "restarting it", watchdog->pid);
+			watchdog->pid = 0;
+
+			(void) fencing_watchdog_start(watchdog, watchdog->pgSetup);
+		}
+	}
+}
+
+
+/*
+ * fencing_watchdog_fenced returns true when the watchdog stopped Postgres
+ * because of a network partition, and resets the flag.
+ */
+bool
+fencing_watchdog_fenced(FencingWatchdog *watchdog)
+{
+	if (watchdog->shared == NULL || !watchdog->shared->fenced)
+	{
+		return false;
+	}
+
+	watchdog->shared->fenced = false;
+
+	return true;
+}
+
+
+/*
+ * fencing_watchdog_stop terminates the watchdog process and releases its
+ * shared memory.
+ */
+void
+fencing_watchdog_stop(FencingWatchdog *watchdog)
+{
+	if (watchdog->pid > 0)
+	{
+		int status = 0;
+
+		if (kill(watchdog->pid, SIGTERM) == 0)
+		{
+			if (waitpid(watchdog->pid, &status, 0) == -1 && errno != ECHILD)
+			{
+				log_warn("Failed to wait for the fencing watchdog "
+						 "process %d: %m", watchdog->pid);
+			}
+		}
+		watchdog->pid = 0;
+	}
+
+	if (watchdog->shared != NULL)
+	{
+		munmap(watchdog->shared, sizeof(FencingWatchdogShared));
+		watchdog->shared = NULL;
+	}
+}
+
+
+/*
+ * fencing_watchdog_run is the main loop of the watchdog process. It uses its
+ * own connection to the local Postgres instance, and never touches the
+ * connections that it inherited from the keeper.
+ *
+ * The replica is considered alive when pg_stat_replication shows a reply
+ * within network_partition_timeout, or when the keeper main loop recently
+ * saw it. Without reply_time (before Postgres 12) we track the last time a
+ * walsender was found ourselves.
+ */
+static void
+fencing_watchdog_run(FencingWatchdogShared *shared,
+					 PostgresSetup *pgSetup,
+					 pid_t parentPid)
+{
+	PGSQL pgsql = { 0 };
+	char connInfo[MAXCONNINFO];
+	bool hasReplyTime = pgSetup->control.pg_control_version >= 1200;
+	uint64_t lastReplicaContactMs = 0;
+
+	pg_setup_get_local_connection_string(pgSetup, connInfo);
+	pgsql_init(&pgsql, connInfo, PGSQL_CONN_LOCAL);
+
+	/* exit when asked to, or when the keeper is gone */
+	while (!asked_to_stop && !asked_to_stop_fast && getppid() == parentPid)
+	{
+		uint64_t nowMs = 0;
+		uint64_t timeoutMs = shared->networkPartitionTimeoutMs;
+		uint64_t lastMonitorContactMs = shared->lastMonitorContactMs;
+		bool hasReplica = false;
+		bool replicaIsSilent = false;
+
+		pg_usleep(FENCING_WATCHDOG_INTERVAL_MS * 1000);
+
+		if (!shared->isPrimary || shared->fenced || timeoutMs == 0)
+		{
+			pgsql_finish(&pgsql);
+			continue;
+		}
+
+		nowMs = monotonic_clock_ms();
+
+		if (shared->lastSecondaryContactMs > lastReplicaContactMs)
+		{
+			lastReplicaContactMs = shared->lastSecondaryContactMs;
+		}
+
+		if (pgsql_has_live_replica(&pgsql, PG_AUTOCTL_REPLICA_USERNAME,
+								   hasReplyTime, (int) timeoutMs,
+								   &hasReplica))
+		{
+			if (hasReplica)
+			{
+				lastReplicaContactMs = nowMs;
+			}
+
+			replicaIsSilent =
+				!hasReplica &&
+				(hasReplyTime ||
+				 (lastReplicaContactMs > 0 &&
+				  nowMs - lastReplicaContactMs > timeoutMs));
+		}
+		else
+		{
+			replicaIsSilent =
+				lastReplicaContactMs > 0 &&
+				nowMs - lastReplicaContactMs > timeoutMs;
+		}
+
+		if (!replicaIsSilent ||
+			lastMonitorContactMs == 0 ||
+			nowMs - lastMonitorContactMs <= timeoutMs)
+		{
+			continue;
+		}
+
+		log_warn("Failed to contact the monitor in %" PRIu64 "ms and no "
+				 "standby replied in the last %" PRIu64 "ms, "
+				 "stopping PostgreSQL to prevent split brain issues",
+				 nowMs - lastMonitorContactMs, timeoutMs);
+
+		pgsql_finish(&pgsql);
+
+		if (!pg_ctl_stop(pgSetup->pg_ctl, pgSetup->pgdata))
+		{
+			log_error("Failed to stop PostgreSQL at \"%s\", "
+					  "see above for details", pgSetup->pgdata);
+			continue;
+		}
+
+		shared->fenced = true;
+	}
+
+	pgsql_finish(&pgsql);
+}
@@ -0,0 +1,50 @@
+/*
+ * src/bin/pg_autoctl/watchdog.h
+ *   Fencing watchdog process that stops a partitioned primary node
+ *   independently of the keeper main loop.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "pgsetup.h"
+
+/*
+ * The keeper main loop and the watchdog process share this structure in an
+ * anonymous shared memory mapping. The main loop is the only writer of every
+ * field but "fenced", which only the watchdog sets.
+ */
+typedef struct FencingWatchdogShared
+{
+	volatile uint64_t lastMonitorContactMs;
+	volatile uint64_t lastSecondaryContactMs;
+	volatile uint64_t networkPartitionTimeoutMs;
+	volatile bool isPrimary;
+	volatile bool fenced;
+} FencingWatchdogShared;
+
+typedef struct FencingWatchdog
+{
+	pid_t pid;
+	PostgresSetup *pgSetup;
+	FencingWatchdogShared *shared;
+} FencingWatchdog;
+
+bool fencing_watchdog_start(FencingWatchdog *watchdog, PostgresSetup *pgSetup);
+void fencing_watchdog_update(FencingWatchdog *watchdog,
+							 uint64_t lastMonitorContactMs,
+							 uint64_t lastSecondaryContactMs,
+							 int networkPartitionTimeout,
+							 bool isPrimary);
+bool fencing_watchdog_fenced(FencingWatchdog *watchdog);
+void fencing_watchdog_stop(FencingWatchdog *watchdog);
+
+#endif /* WATCHDOG_H */
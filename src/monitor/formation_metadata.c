@@ -20,6 +20,7 @@
 #include "formation_metadata.h"
 #include "node_metadata.h"
 #include "notifications.h"
+#include "plan_cache.h"
 
 #include "access/htup_details.h"
 #include "access/xlogdefs.h"
@@ -68,8 +69,8 @@ GetFormation(const char *formationId)
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-									  NULL, false, 1);
+	spiStatus = ExecuteCachedPlan(selectQuery, argCount, argTypes, argValues,
+								  NULL, false, 1);
 	if (spiStatus != SPI_OK_SELECT)
 	{
 		elog(ERROR, "could not select from " AUTO_FAILOVER_FORMATION_TABLE);
@@ -237,8 +238,8 @@ AddFormation(const char *formationId,
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(insertQuery, argCount, argTypes,
-									  argValues, NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(insertQuery, argCount, argTypes,
+								  argValues, NULL, false, 0);
 
 	if (spiStatus != SPI_OK_INSERT)
 	{
@@ -273,9 +274,9 @@ RemoveFormation(const char *formationId)
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(deleteQuery,
-									  argCount, argTypes, argValues,
-									  NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(deleteQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
 
 	if (spiStatus != SPI_OK_DELETE)
 	{
@@ -323,9 +324,9 @@ SetFormationKind(const char *formationId, FormationKind kind)
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(updateQuery,
-									  argCount, argTypes, argValues,
-									  NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(updateQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
 	if (spiStatus != SPI_OK_UPDATE)
 	{
 		elog(ERROR, "could not update " AUTO_FAILOVER_FORMATION_TABLE);
@@ -359,9 +360,9 @@ SetFormationDBName(const char *formationId, const char *dbname)
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(updateQuery,
-									  argCount, argTypes, argValues,
-									  NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(updateQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
 	if (spiStatus != SPI_OK_UPDATE)
 	{
 		elog(ERROR, "could not update " AUTO_FAILOVER_FORMATION_TABLE);
@@ -400,9 +401,9 @@ SetFormationOptSecondary(const char *formationId, bool optSecondary)
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(updateQuery,
-									  argCount, argTypes, argValues,
-									  NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(updateQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
 	if (spiStatus != SPI_OK_UPDATE)
 	{
 		elog(ERROR, "could not update " AUTO_FAILOVER_FORMATION_TABLE);
@@ -702,9 +703,9 @@ SetFormationNumberSyncStandbys(const char *formationId, int numberSyncStandbys)
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(updateQuery,
-									  argCount, argTypes, argValues,
-									  NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(updateQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
 	SPI_finish();
 
 	if (spiStatus != SPI_OK_UPDATE)
@@ -18,9 +18,13 @@
 
 #include "formation_metadata.h"
 #include "group_state_machine.h"
+#include "metadata.h"
 #include "node_metadata.h"
 #include "notifications.h"
 #include "replication_state.h"
+#include "telemetry_metadata.h"
+
+/* list_qsort is only in Postgres 11 and 12 */
 #include "version_compat.h"
 
 #include "access/htup_details.h"
@@ -37,14 +41,27 @@
 
 /* private function forward declarations */
 static bool ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode);
-static void AssignGoalState(AutoFailoverNode *pgAutoFailoverNode,
-							ReplicationState state, char *description);
+static bool ProceedGroupStateForSwitchover(AutoFailoverNode *activeNode,
+										   List *nodesGroupList);
+static bool HasReportedCleanShutdown(AutoFailoverNode *pgAutoFailoverNode);
+static bool ProceedGroupStateForExpiredSwitchover(AutoFailoverNode *drainingNode,
+												  List *nodesGroupList);
 static bool IsDrainTimeExpired(AutoFailoverNode *pgAutoFailoverNode);
+static bool IsSwitchoverTimeExpired(AutoFailoverNode *pgAutoFailoverNode);
 static bool WalDifferenceWithin(AutoFailoverNode *secondaryNode,
 								AutoFailoverNode *primaryNode,
-								int64 delta);
+								int64 delta,
+								List *telemetryList);
+static bool StandbyLSNSeenByPrimary(AutoFailoverNode *standbyNode,
+									AutoFailoverNode *primaryNode,
+									List *telemetryList,
+									XLogRecPtr *standbyLSN);
 static bool IsHealthy(AutoFailoverNode *pgAutoFailoverNode);
 static bool IsUnhealthy(AutoFailoverNode *pgAutoFailoverNode);
+static bool UpdateSyncStandbyExclusions(AutoFailoverNode *primaryNode);
+static bool HasBetterCandidateInZone(AutoFailoverNode *activeNode,
+									 AutoFailoverNode *primaryNode);
+static int pgautofailover_node_group_compare(const void *a, const void *b);
 
 /* GUC variables */
 int EnableSyncXlogThreshold = DEFAULT_XLOG_SEG_SIZE;
@@ -52,6 +69,7 @@ int PromoteXlogThreshold = DEFAULT_XLOG_SEG_SIZE;
 int DrainTimeoutMs = 30 * 1000;
 int UnhealthyTimeoutMs = 20 * 1000;
 int StartupGracePeriodMs = 10 * 1000;
+int SyncStandbyMaxLagBytes = 0;
 
 
 /*
@@ -68,6 +86,7 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 	AutoFailoverNode *primaryNode = NULL;
 
 	List *nodesGroupList = AutoFailoverNodeGroup(formationId, groupId);
+	List *telemetryList = NIL;
 	int nodesCount = list_length(nodesGroupList);
 
 	if (formation == NULL)
@@ -95,6 +114,15 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 		return true;
 	}
 
+	/*
+	 * A planned switchover has its own set of transitions, that allow skipping
+	 * the demote timeout and pg_rewind entirely.
+	 */
+	if (ProceedGroupStateForSwitchover(activeNode, nodesGroupList))
+	{
+		return true;
+	}
+
 	/*
 	 * We separate out the FSM for the primary server, because that one needs
 	 * to loop over every other node to take decisions. That induces some
@@ -124,6 +152,9 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 		/* TODO: Multiple Stanby Failover Logic */
 	}
 
+	/* what the primary node last reported about its standby nodes */
+	telemetryList = GetStandbyTelemetryList(primaryNode->nodeId);
+
 	/*
 	 * when primary node is ready for replication:
 	 *  prepare_standby -> catchingup
@@ -156,7 +187,8 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 		(IsCurrentState(primaryNode, REPLICATION_STATE_WAIT_PRIMARY) ||
 		 IsCurrentState(primaryNode, REPLICATION_STATE_JOIN_PRIMARY)) &&
 		IsHealthy(activeNode) &&
-		WalDifferenceWithin(activeNode, primaryNode, EnableSyncXlogThreshold))
+		WalDifferenceWithin(activeNode, primaryNode, EnableSyncXlogThreshold,
+							telemetryList))
 	{
 		char message[BUFSIZE];
 
@@ -177,6 +209,31 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 		return true;
 	}
 
+	/*
+	 * when secondary caught up while the primary kept synchronous replication
+	 * enabled, as when another standby node keeps acknowledging commits:
+	 *      catchingup -> secondary
+	 */
+	if (IsCurrentState(activeNode, REPLICATION_STATE_CATCHINGUP) &&
+		IsCurrentState(primaryNode, REPLICATION_STATE_PRIMARY) &&
+		IsHealthy(activeNode) &&
+		WalDifferenceWithin(activeNode, primaryNode, EnableSyncXlogThreshold,
+							telemetryList))
+	{
+		char message[BUFSIZE];
+
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Setting goal state of %s:%d to secondary after it caught up "
+			"with %s:%d.",
+			activeNode->nodeName, activeNode->nodePort,
+			primaryNode->nodeName, primaryNode->nodePort);
+
+		AssignGoalState(activeNode, REPLICATION_STATE_SECONDARY, message);
+
+		return true;
+	}
+
 	/*
 	 * TODO:
 	 *   Implement Multiple Standby failover logic.
@@ -188,7 +245,9 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 	if (IsCurrentState(activeNode, REPLICATION_STATE_SECONDARY) &&
 		IsInPrimaryState(primaryNode) &&
 		IsUnhealthy(primaryNode) && IsHealthy(activeNode) &&
-		WalDifferenceWithin(activeNode, primaryNode, PromoteXlogThreshold))
+		WalDifferenceWithin(activeNode, primaryNode, PromoteXlogThreshold,
+							telemetryList) &&
+		!HasBetterCandidateInZone(activeNode, primaryNode))
 	{
 		char message[BUFSIZE];
 
@@ -337,6 +396,112 @@ ProceedGroupState(AutoFailoverNode *activeNode)
 }
 
 
+/*
+ * ProceedGroupStateForFailedPrimaries is called by the health check worker
+ * with the list of primary nodes that failed their health checks in the
+ * same round. In Citus formations, a rack failure takes down primary nodes
+ * in many worker groups at once: rather than waiting for a standby node of
+ * each group to call node_active, we start the failover of every affected
+ * group right away, all in the current transaction.
+ *
+ * Returns the number of groups where a failover has been started.
+ */
+int
+ProceedGroupStateForFailedPrimaries(List *primaryNodesList)
+{
+	List *sortedNodesList = NIL;
+	ListCell *nodeCell = NULL;
+	int failoverCount = 0;
+
+	/* always take the group locks in the same order */
+	sortedNodesList =
+		list_qsort(primaryNodesList, pgautofailover_node_group_compare);
+
+	foreach(nodeCell, sortedNodesList)
+	{
+		AutoFailoverNode *failedNode = (AutoFailoverNode *) lfirst(nodeCell);
+		AutoFailoverFormation *formation = GetFormation(failedNode->formationId);
+		AutoFailoverNode *primaryNode = NULL;
+		AutoFailoverNode *candidateNode = NULL;
+
+		if (formation == NULL || !IsCitusFormation(formation))
+		{
+			continue;
+		}
+
+		LockFormation(failedNode->formationId, ShareLock);
+		LockNodeGroup(failedNode->formationId, failedNode->groupId,
+					  ExclusiveLock);
+
+		/* re-read the group now that we hold the lock */
+		primaryNode =
+			GetPrimaryNodeInGroup(failedNode->formationId, failedNode->groupId);
+
+		if (primaryNode == NULL
+			|| primaryNode->nodeId != failedNode->nodeId
+			|| !IsInPrimaryState(primaryNode)
+			|| !IsUnhealthy(primaryNode))
+		{
+			continue;
+		}
+
+		candidateNode = FindSwitchoverCandidate(primaryNode, false);
+
+		/*
+		 * Only promote a standby node whose keeper is still reporting to us,
+		 * otherwise wait until it calls node_active again.
+		 */
+		if (candidateNode == NULL
+			|| TimestampDifferenceExceeds(candidateNode->reportTime,
+										  GetCurrentTimestamp(),
+										  UnhealthyTimeoutMs))
+		{
+			continue;
+		}
+
+		if (ProceedGroupState(candidateNode))
+		{
+			++failoverCount;
+		}
+	}
+
+	if (failoverCount > 1)
+	{
+		char message[BUFSIZE];
+
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Started failover in %d groups after their primary nodes "
+			"failed health checks in the same round.",
+			failoverCount);
+	}
+
+	list_free(sortedNodesList);
+
+	return failoverCount;
+}
+
+
+/*
+ * pgautofailover_node_group_compare
+ *	  qsort comparator for sorting node lists by formation and group
+ */
+static int
+pgautofailover_node_group_compare(const void *a, const void *b)
+{
+	AutoFailoverNode *node1 = (AutoFailoverNode *) lfirst(*(ListCell **) a);
+	AutoFailoverNode *node2 = (AutoFailoverNode *) lfirst(*(ListCell **) b);
+	int formationCmp = strcmp(node1->formationId, node2->formationId);
+
+	if (formationCmp != 0)
+	{
+		return formationCmp;
+	}
+
+	return node1->groupId - node2->groupId;
+}
+
+
 /*
  * Group State Machine when a primary node contacts the monitor.
  */
@@ -422,6 +587,7 @@ ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode)
 	if (IsCurrentState(primaryNode, REPLICATION_STATE_PRIMARY))
 	{
 		int failoverCandidateCount = otherNodesCount;
+		bool assigned = false;
 		ListCell *nodeCell = NULL;
 
 		foreach(nodeCell, otherNodesGroupList)
@@ -444,7 +610,7 @@ ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode)
 				/* other node is behind, no longer eligible for promotion */
 				AssignGoalState(otherNode,
 								REPLICATION_STATE_CATCHINGUP, message);
-
+				assigned = true;
 			}
 			else if (!otherNode->replicationQuorum
 					 || otherNode->candidatePriority == 0)
@@ -466,10 +632,15 @@ ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode)
 
 				AssignGoalState(primaryNode,
 								REPLICATION_STATE_WAIT_PRIMARY, message);
+				assigned = true;
 			}
 		}
 
-		return true;
+		/* otherwise, see if the synchronous standby names need an update */
+		if (assigned)
+		{
+			return true;
+		}
 	}
 
 	/*
@@ -491,14 +662,475 @@ ProceedGroupStateForPrimaryNode(AutoFailoverNode *primaryNode)
 		return true;
 	}
 
+	/*
+	 * when a synchronous standby became slow, or caught up again:
+	 *     primary ➜ apply_settings
+	 */
+	if (IsCurrentState(primaryNode, REPLICATION_STATE_PRIMARY) &&
+		UpdateSyncStandbyExclusions(primaryNode))
+	{
+		char message[BUFSIZE];
+
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Setting goal state of %s:%d to apply_settings "
+			"after updating its synchronous standby names.",
+			primaryNode->nodeName, primaryNode->nodePort);
+
+		AssignGoalState(primaryNode, REPLICATION_STATE_APPLY_SETTINGS, message);
+
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * UpdateSyncStandbyExclusions implements the opt-in policy where slow
+ * synchronous standby nodes are temporarily left out of the primary's
+ * synchronous_standby_names, so that commits don't have to wait for them.
+ *
+ * A standby is excluded when it lags more than SyncStandbyMaxLagBytes behind
+ * the primary, or when it has not reported its LSN for UnhealthyTimeoutMs.
+ * It is included again once its lag is back under half the threshold. We
+ * always keep at least number_sync_standbys nodes, the least lagging ones.
+ *
+ * Returns true when the exclusions changed and the primary node needs to
+ * apply its settings again.
+ */
+static bool
+UpdateSyncStandbyExclusions(AutoFailoverNode *primaryNode)
+{
+	AutoFailoverFormation *formation = GetFormation(primaryNode->formationId);
+	List *otherNodesGroupList = AutoFailoverOtherNodesList(primaryNode);
+	List *syncStandbyNodesList = GroupListSyncStandbys(otherNodesGroupList);
+	int syncStandbyCount = list_length(syncStandbyNodesList);
+	List *telemetryList = NIL;
+	bool *excluded = NULL;
+	XLogRecPtr *standbyLSNs = NULL;
+	int includedCount = 0;
+	bool changed = false;
+	TimestampTz now = GetCurrentTimestamp();
+	ListCell *nodeCell = NULL;
+	int nodeIndex = 0;
+
+	/* with a single standby, synchronous_standby_names is always '*' */
+	if (formation == NULL || list_length(otherNodesGroupList) < 2 ||
+		syncStandbyCount == 0)
+	{
+		return false;
+	}
+
+	telemetryList = GetStandbyTelemetryList(primaryNode->nodeId);
+	excluded = (bool *) palloc0(syncStandbyCount * sizeof(bool));
+
+	/* the LSN we judge each standby with, also used to pick and to log */
+	standbyLSNs = (XLogRecPtr *) palloc0(syncStandbyCount * sizeof(XLogRecPtr));
+
+	foreach(nodeCell, syncStandbyNodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+		XLogRecPtr standbyLSN = node->reportedLSN;
+		bool staleReport = TimestampDifferenceExceeds(node->walReportTime,
+													  now,
+													  UnhealthyTimeoutMs);
+		int64 lag = 0;
+
+		/* the primary has just seen this standby flush WAL, so it's alive */
+		if (StandbyLSNSeenByPrimary(node, primaryNode, telemetryList,
+									&standbyLSN))
+		{
+			staleReport = false;
+		}
+
+		lag = primaryNode->reportedLSN > standbyLSN
+			  ? primaryNode->reportedLSN - standbyLSN : 0;
+
+		standbyLSNs[nodeIndex] = standbyLSN;
+		excluded[nodeIndex] = node->quorumExcluded;
+
+		if (SyncStandbyMaxLagBytes <= 0)
+		{
+			excluded[nodeIndex] = false;
+		}
+		else if (staleReport || lag > SyncStandbyMaxLagBytes)
+		{
+			excluded[nodeIndex] = true;
+		}
+		else if (lag <= SyncStandbyMaxLagBytes / 2)
+		{
+			excluded[nodeIndex] = false;
+		}
+
+		if (!excluded[nodeIndex])
+		{
+			++includedCount;
+		}
+		++nodeIndex;
+	}
+
+	/* stay within the durability bounds set with number_sync_standbys */
+	while (includedCount < formation->number_sync_standbys &&
+		   includedCount < syncStandbyCount)
+	{
+		int bestIndex = -1;
+		XLogRecPtr bestLSN = InvalidXLogRecPtr;
+
+		for (nodeIndex = 0; nodeIndex < syncStandbyCount; nodeIndex++)
+		{
+			if (excluded[nodeIndex] &&
+				(bestIndex == -1 || standbyLSNs[nodeIndex] > bestLSN))
+			{
+				bestIndex = nodeIndex;
+				bestLSN = standbyLSNs[nodeIndex];
+			}
+		}
+
+		excluded[bestIndex] = false;
+		++includedCount;
+	}
+
+	nodeIndex = 0;
+	foreach(nodeCell, syncStandbyNodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (excluded[nodeIndex] != node->quorumExcluded)
+		{
+			char message[BUFSIZE];
+
+			LogAndNotifyMessage(
+				message, BUFSIZE,
+				"%s node %s:%d %s the synchronous standby names of %s:%d, "
+				"with a lag of " INT64_FORMAT " bytes.",
+				excluded[nodeIndex] ? "Removing" : "Adding back",
+				node->nodeName, node->nodePort,
+				excluded[nodeIndex] ? "from" : "to",
+				primaryNode->nodeName, primaryNode->nodePort,
+				(int64) (primaryNode->reportedLSN > standbyLSNs[nodeIndex]
+						 ? primaryNode->reportedLSN - standbyLSNs[nodeIndex]
+						 : 0));
+
+			SetNodeQuorumExcluded(node->nodeId, excluded[nodeIndex]);
+			node->quorumExcluded = excluded[nodeIndex];
+
+			changed = true;
+		}
+		++nodeIndex;
+	}
+
+	pfree(excluded);
+	pfree(standbyLSNs);
+
+	return changed;
+}
+
+
+/*
+ * Group State Machine for a planned switchover, as initiated by a call to
+ * perform_switchover().
+ *
+ * A switchover starts with the primary node being assigned the draining state
+ * alone, without any node being assigned prepare_promotion: that's how we
+ * tell a planned switchover from a failover. Then:
+ *
+ * when the primary is stopped and a standby received all its WAL:
+ *   secondary ➜ wait_primary
+ *
+ * when the new primary is ready:
+ *    draining ➜ catchingup
+ *   secondary ➜ catchingup
+ *
+ * When no standby could receive all the WAL from the primary, the best
+ * candidate is assigned prepare_promotion and we continue with the failover
+ * transitions, including the demote timeout. When the switchover does not
+ * complete in time, see ProceedGroupStateForExpiredSwitchover.
+ */
+static bool
+ProceedGroupStateForSwitchover(AutoFailoverNode *activeNode,
+							   List *nodesGroupList)
+{
+	AutoFailoverNode *drainingNode = NULL;
+	AutoFailoverNode *newPrimaryNode = NULL;
+	ListCell *nodeCell = NULL;
+
+	foreach(nodeCell, nodesGroupList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (node->goalState == REPLICATION_STATE_DRAINING)
+		{
+			drainingNode = node;
+		}
+		else if (node->goalState == REPLICATION_STATE_WAIT_PRIMARY)
+		{
+			newPrimaryNode = node;
+		}
+		else if (node->goalState == REPLICATION_STATE_PREPARE_PROMOTION ||
+				 node->goalState == REPLICATION_STATE_STOP_REPLICATION)
+		{
+			/* that's a failover, not a switchover */
+			return false;
+		}
+	}
+
+	if (drainingNode == NULL)
+	{
+		return false;
+	}
+
+	/*
+	 * when the switchover could not complete in time:
+	 *    draining ➜ wait_primary
+	 *   secondary ➜ catchingup
+	 */
+	if (newPrimaryNode == NULL && IsSwitchoverTimeExpired(drainingNode))
+	{
+		return ProceedGroupStateForExpiredSwitchover(drainingNode,
+													 nodesGroupList);
+	}
+
+	/*
+	 * when the primary is stopped and a standby received all its WAL:
+	 *   secondary ➜ wait_primary
+	 */
+	if (newPrimaryNode == NULL &&
+		IsCurrentState(drainingNode, REPLICATION_STATE_DRAINING) &&
+		HasReportedCleanShutdown(drainingNode))
+	{
+		char message[BUFSIZE];
+		bool walReceivedAll = true;
+		AutoFailoverNode *candidateNode =
+			FindSwitchoverCandidate(drainingNode, walReceivedAll);
+
+		if (candidateNode != NULL)
+		{
+			LogAndNotifyMessage(
+				message, BUFSIZE,
+				"Setting goal state of %s:%d to wait_primary after %s:%d "
+				"stopped at %X/%X and the switchover candidate received "
+				"all of its WAL.",
+				candidateNode->nodeName, candidateNode->nodePort,
+				drainingNode->nodeName, drainingNode->nodePort,
+				(uint32) (drainingNode->reportedLSN >> 32),
+				(uint32) drainingNode->reportedLSN);
+
+			/* promote now, there's nothing to wait for */
+			AssignGoalState(candidateNode,
+							REPLICATION_STATE_WAIT_PRIMARY, message);
+
+			return true;
+		}
+
+		/*
+		 * The best candidate still didn't receive all the WAL from the
+		 * primary: fall back to the failover transitions. A report sent
+		 * before the primary was done shutting down may lag behind its
+		 * shutdown checkpoint, so only fall back once the candidate reported
+		 * its LSN after that, or when it fails to do so for DrainTimeoutMs.
+		 */
+		walReceivedAll = false;
+		candidateNode = FindSwitchoverCandidate(drainingNode, walReceivedAll);
+
+		if (candidateNode == activeNode &&
+			(activeNode->walReportTime > drainingNode->walReportTime ||
+			 TimestampDifferenceExceeds(drainingNode->walReportTime,
+										GetCurrentTimestamp(),
+										DrainTimeoutMs)))
+		{
+			LogAndNotifyMessage(
+				message, BUFSIZE,
+				"Setting goal state of %s:%d to prepare_promotion after it "
+				"failed to receive all the WAL from %s:%d, "
+				"falling back to a failover.",
+				activeNode->nodeName, activeNode->nodePort,
+				drainingNode->nodeName, drainingNode->nodePort);
+
+			AssignGoalState(activeNode,
+							REPLICATION_STATE_PREPARE_PROMOTION, message);
+
+			return true;
+		}
+
+		return false;
+	}
+
+	/*
+	 * when the new primary is ready:
+	 *    draining ➜ catchingup
+	 *   secondary ➜ catchingup
+	 */
+	if (IsCurrentState(newPrimaryNode, REPLICATION_STATE_WAIT_PRIMARY) &&
+		IsCurrentState(drainingNode, REPLICATION_STATE_DRAINING))
+	{
+		char message[BUFSIZE];
+
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Setting goal state of %s:%d to catchingup after %s:%d "
+			"converged to wait_primary, no pg_rewind needed.",
+			drainingNode->nodeName, drainingNode->nodePort,
+			newPrimaryNode->nodeName, newPrimaryNode->nodePort);
+
+		/* the old primary was cleanly stopped, it can follow right away */
+		AssignGoalState(drainingNode, REPLICATION_STATE_CATCHINGUP, message);
+
+		foreach(nodeCell, nodesGroupList)
+		{
+			AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+			if (node->goalState == REPLICATION_STATE_SECONDARY)
+			{
+				LogAndNotifyMessage(
+					message, BUFSIZE,
+					"Setting goal state of %s:%d to catchingup "
+					"to follow the new primary %s:%d.",
+					node->nodeName, node->nodePort,
+					newPrimaryNode->nodeName, newPrimaryNode->nodePort);
+
+				AssignGoalState(node, REPLICATION_STATE_CATCHINGUP, message);
+			}
+		}
+
+		return true;
+	}
+
 	return false;
 }
 
 
+/*
+ * ProceedGroupStateForExpiredSwitchover gets a group out of a switchover that
+ * did not complete in time, either because the old primary never reported a
+ * clean shutdown, or because no standby node qualified as the candidate.
+ *
+ * When the keeper of the old primary is still reporting, it resumes as the
+ * primary: it goes to wait_primary, and the standby nodes go to catchingup,
+ * which they reach without any change since they still follow it. Otherwise
+ * we fall back to the failover transitions with the best candidate, if any.
+ */
+static bool
+ProceedGroupStateForExpiredSwitchover(AutoFailoverNode *drainingNode,
+									  List *nodesGroupList)
+{
+	char message[BUFSIZE];
+	bool walReceivedAll = false;
+	AutoFailoverNode *candidateNode = NULL;
+	ListCell *nodeCell = NULL;
+
+	if (!TimestampDifferenceExceeds(drainingNode->reportTime,
+									GetCurrentTimestamp(),
+									UnhealthyTimeoutMs))
+	{
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Setting goal state of %s:%d to wait_primary after the "
+			"switchover failed to complete within %d ms.",
+			drainingNode->nodeName, drainingNode->nodePort,
+			2 * DrainTimeoutMs);
+
+		AssignGoalState(drainingNode, REPLICATION_STATE_WAIT_PRIMARY, message);
+
+		foreach(nodeCell, nodesGroupList)
+		{
+			AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+			if (node->goalState == REPLICATION_STATE_SECONDARY)
+			{
+				LogAndNotifyMessage(
+					message, BUFSIZE,
+					"Setting goal state of %s:%d to catchingup "
+					"while %s:%d resumes as the primary.",
+					node->nodeName, node->nodePort,
+					drainingNode->nodeName, drainingNode->nodePort);
+
+				AssignGoalState(node, REPLICATION_STATE_CATCHINGUP, message);
+			}
+		}
+
+		return true;
+	}
+
+	candidateNode = FindSwitchoverCandidate(drainingNode, walReceivedAll);
+
+	if (candidateNode == NULL)
+	{
+		return false;
+	}
+
+	LogAndNotifyMessage(
+		message, BUFSIZE,
+		"Setting goal state of %s:%d to prepare_promotion after the "
+		"switchover failed to complete within %d ms and %s:%d stopped "
+		"reporting, falling back to a failover.",
+		candidateNode->nodeName, candidateNode->nodePort,
+		2 * DrainTimeoutMs,
+		drainingNode->nodeName, drainingNode->nodePort);
+
+	AssignGoalState(candidateNode, REPLICATION_STATE_PREPARE_PROMOTION, message);
+
+	return true;
+}
+
+
+/*
+ * FindSwitchoverCandidate returns the standby node to promote when switching
+ * over from the given primary node, or NULL when there's none: a healthy node
+ * in the secondary state, with the highest candidate priority. Among nodes
+ * with the same candidate priority, we prefer the zone of the primary node.
+ *
+ * When walReceivedAll is true, the candidate must have reported an LSN past
+ * the primary's last reported LSN, otherwise it must be within
+ * PromoteXlogThreshold bytes of it.
+ */
+AutoFailoverNode *
+FindSwitchoverCandidate(AutoFailoverNode *primaryNode, bool walReceivedAll)
+{
+	List *otherNodesGroupList = AutoFailoverOtherNodesList(primaryNode);
+	List *candidateNodesList =
+		GroupListCandidatesInZone(otherNodesGroupList, primaryNode->nodeZone);
+	List *telemetryList = NIL;
+	ListCell *nodeCell = NULL;
+
+	if (!walReceivedAll)
+	{
+		telemetryList = GetStandbyTelemetryList(primaryNode->nodeId);
+	}
+
+	foreach(nodeCell, candidateNodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (!IsCurrentState(node, REPLICATION_STATE_SECONDARY) ||
+			!IsHealthy(node))
+		{
+			continue;
+		}
+
+		if (walReceivedAll)
+		{
+			if (primaryNode->reportedLSN != 0 &&
+				node->reportedLSN > primaryNode->reportedLSN)
+			{
+				return node;
+			}
+		}
+		else if (WalDifferenceWithin(node, primaryNode, PromoteXlogThreshold,
+									 telemetryList))
+		{
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
+
 /*
  * AssignGoalState assigns a new goal state to a AutoFailover node.
  */
-static void
+void
 AssignGoalState(AutoFailoverNode *pgAutoFailoverNode,
 				ReplicationState state, char *description)
 {
@@ -529,10 +1161,16 @@ AssignGoalState(AutoFailoverNode *pgAutoFailoverNode,
  * WalDifferenceWithin returns whether the most recently reported relative log
  * position of the given nodes is within the specified bound. Returns false if
  * neither node has reported a relative xlog position
+ *
+ * When the other node is the primary node of the secondary node, we prefer
+ * the flush LSN of the secondary node as seen by the primary node in the
+ * same report as its own LSN, found in the given telemetryList as obtained
+ * with GetStandbyTelemetryList() for the other node.
  */
 static bool
 WalDifferenceWithin(AutoFailoverNode *secondaryNode,
-					AutoFailoverNode *otherNode, int64 delta)
+					AutoFailoverNode *otherNode, int64 delta,
+					List *telemetryList)
 {
 	int64 walDifference = 0;
 	XLogRecPtr secondaryLsn = 0;
@@ -547,6 +1185,9 @@ WalDifferenceWithin(AutoFailoverNode *secondaryNode,
 	secondaryLsn = secondaryNode->reportedLSN;
 	otherNodeLsn = otherNode->reportedLSN;
 
+	(void) StandbyLSNSeenByPrimary(secondaryNode, otherNode, telemetryList,
+								   &secondaryLsn);
+
 	if (secondaryLsn == 0 || otherNodeLsn == 0)
 	{
 		/* we don't have any data yet */
@@ -559,6 +1200,48 @@ WalDifferenceWithin(AutoFailoverNode *secondaryNode,
 }
 
 
+/*
+ * StandbyLSNSeenByPrimary sets standbyLSN to the flush LSN of the standby
+ * node that the primary node reported along with its own LSN, and returns
+ * true. The two LSNs then come from the same query on the primary, which
+ * makes for a consistent lag computation. When the primary node has sent
+ * another heartbeat since, or when the telemetry is about another primary,
+ * standbyLSN is left untouched and we return false.
+ *
+ * The telemetryList is the telemetry of the primary node, as obtained with
+ * GetStandbyTelemetryList(), so that we scan the table only once per group
+ * state machine decision rather than once per standby node.
+ */
+static bool
+StandbyLSNSeenByPrimary(AutoFailoverNode *standbyNode,
+						AutoFailoverNode *primaryNode,
+						List *telemetryList,
+						XLogRecPtr *standbyLSN)
+{
+	StandbyTelemetry *telemetry = NULL;
+
+	if (standbyNode == NULL || primaryNode == NULL ||
+		standbyNode->nodeId == primaryNode->nodeId)
+	{
+		return false;
+	}
+
+	telemetry = FindStandbyTelemetry(telemetryList, standbyNode->nodeId);
+
+	if (telemetry == NULL ||
+		telemetry->primaryNodeId != primaryNode->nodeId ||
+		telemetry->reportTime < primaryNode->walReportTime ||
+		telemetry->flushLSN == InvalidXLogRecPtr)
+	{
+		return false;
+	}
+
+	*standbyLSN = telemetry->flushLSN;
+
+	return true;
+}
+
+
 /*
  * IsHealthy returns whether the given node is heathly, meaning it succeeds the
  * last health check and its PostgreSQL instance is reported as running by the
@@ -624,6 +1307,69 @@ IsUnhealthy(AutoFailoverNode *pgAutoFailoverNode)
 }
 
 
+/*
+ * HasBetterCandidateInZone returns true when another standby node with the
+ * same candidate priority as the active node is in the zone of the failed
+ * primary node, while the active node is not. That node is healthy and its
+ * keeper is still reporting, so we let it proceed with the failover, to keep
+ * the new primary close to the clients.
+ */
+static bool
+HasBetterCandidateInZone(AutoFailoverNode *activeNode,
+						 AutoFailoverNode *primaryNode)
+{
+	AutoFailoverNode *candidateNode = NULL;
+
+	if (IsNodeInZone(activeNode, primaryNode->nodeZone))
+	{
+		return false;
+	}
+
+	candidateNode = FindSwitchoverCandidate(primaryNode, false);
+
+	return candidateNode != NULL
+		&& candidateNode->nodeId != activeNode->nodeId
+		&& candidateNode->candidatePriority == activeNode->candidatePriority
+		&& IsNodeInZone(candidateNode, primaryNode->nodeZone)
+		&& !TimestampDifferenceExceeds(candidateNode->reportTime,
+									   GetCurrentTimestamp(),
+									   UnhealthyTimeoutMs);
+}
+
+
+/*
+ * HasReportedCleanShutdown returns whether the given node reported that its
+ * PostgreSQL instance is stopped, in the same report as an LSN: the keeper
+ * only does that when Postgres has been shut down cleanly, and then the LSN
+ * is the location of the shutdown checkpoint.
+ */
+static bool
+HasReportedCleanShutdown(AutoFailoverNode *pgAutoFailoverNode)
+{
+	return pgAutoFailoverNode != NULL
+		&& !pgAutoFailoverNode->pgIsRunning
+		&& pgAutoFailoverNode->reportedLSN != 0
+		&& pgAutoFailoverNode->walReportTime == pgAutoFailoverNode->reportTime;
+}
+
+
+/*
+ * IsSwitchoverTimeExpired returns whether a node assigned the draining state
+ * in a switchover has been given enough time: DrainTimeoutMs to drain its
+ * sessions and stop, and as much again for a standby node to receive all of
+ * its WAL and be promoted.
+ */
+static bool
+IsSwitchoverTimeExpired(AutoFailoverNode *pgAutoFailoverNode)
+{
+	return pgAutoFailoverNode != NULL
+		&& pgAutoFailoverNode->goalState == REPLICATION_STATE_DRAINING
+		&& TimestampDifferenceExceeds(pgAutoFailoverNode->stateChangeTime,
+									  GetCurrentTimestamp(),
+									  2 * DrainTimeoutMs);
+}
+
+
 /*
  * IsDrainTimeExpired returns whether the node should be done according
  * to the drain time-outs.
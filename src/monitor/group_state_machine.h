@@ -35,6 +35,11 @@ typedef struct AutoFailoverNodeState
 
 /* public function declarations */
 extern bool ProceedGroupState(AutoFailoverNode *activeNode);
+extern int ProceedGroupStateForFailedPrimaries(List *primaryNodesList);
+extern AutoFailoverNode * FindSwitchoverCandidate(AutoFailoverNode *primaryNode,
+												  bool walReceivedAll);
+extern void AssignGoalState(AutoFailoverNode *pgAutoFailoverNode,
+							ReplicationState state, char *description);
 
 /* GUCs */
 extern int EnableSyncXlogThreshold;
@@ -42,3 +47,4 @@ extern int PromoteXlogThreshold;
 extern int DrainTimeoutMs;
 extern int UnhealthyTimeoutMs;
 extern int StartupGracePeriodMs;
+extern int SyncStandbyMaxLagBytes;
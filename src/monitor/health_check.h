@@ -58,4 +58,5 @@ extern List * LoadNodeHealthList(void);
 extern NodeHealth * TupleToNodeHealth(HeapTuple heapTuple,
 									  TupleDesc tupleDescriptor);
 extern void SetNodeHealthState(char *nodeName, uint16 nodePort, int healthStatus);
+extern void StartFailoverForUnhealthyNodes(List *nodeHealthList);
 extern void StopHealthCheckWorker(Oid databaseId);
@@ -13,12 +13,16 @@
 #include "postgres.h"
 #include "miscadmin.h"
 
+#include "group_state_machine.h"
 #include "health_check.h"
 #include "metadata.h"
+#include "node_metadata.h"
+#include "plan_cache.h"
 
 #include "access/htup.h"
 #include "access/tupdesc.h"
 #include "access/xact.h"
+#include "catalog/pg_type.h"
 #include "commands/extension.h"
 #include "executor/spi.h"
 #include "lib/stringinfo.h"
@@ -40,6 +44,7 @@ bool HealthChecksEnabled = true;
 
 
 static bool HaMonitorHasBeenLoaded(void);
+static bool HaMonitorVersionMatches(void);
 static void StartSPITransaction(void);
 static void EndSPITransaction(void);
 
@@ -197,6 +202,102 @@ SetNodeHealthState(char *nodeName, uint16 nodePort, int healthState)
 }
 
 
+/*
+ * StartFailoverForUnhealthyNodes starts a failover in the groups of the
+ * primary nodes found in the given list of nodes that just failed their
+ * health checks. All the groups are processed in a single transaction.
+ */
+void
+StartFailoverForUnhealthyNodes(List *nodeHealthList)
+{
+	ListCell *nodeHealthCell = NULL;
+	List *primaryNodesList = NIL;
+	MemoryContext upperContext = CurrentMemoryContext;
+
+	if (nodeHealthList == NIL)
+	{
+		return;
+	}
+
+	StartSPITransaction();
+
+	if (HaMonitorHasBeenLoaded() && HaMonitorVersionMatches())
+	{
+		pgstat_report_activity(STATE_RUNNING,
+								"starting failover for unhealthy nodes");
+
+		foreach(nodeHealthCell, nodeHealthList)
+		{
+			NodeHealth *nodeHealth = (NodeHealth *) lfirst(nodeHealthCell);
+			AutoFailoverNode *node =
+				GetAutoFailoverNode(nodeHealth->nodeName, nodeHealth->nodePort);
+
+			if (node != NULL && IsInPrimaryState(node))
+			{
+				primaryNodesList = lappend(primaryNodesList, node);
+			}
+		}
+
+		if (primaryNodesList != NIL)
+		{
+			(void) ProceedGroupStateForFailedPrimaries(primaryNodesList);
+		}
+	}
+	else
+	{
+		/* extension has been dropped or is being upgraded, skip */
+	}
+
+	EndSPITransaction();
+
+	MemoryContextSwitchTo(upperContext);
+}
+
+
+/*
+ * HaMonitorVersionMatches returns true when the installed extension version
+ * is the one this library has been built for. Unlike
+ * checkPgAutoFailoverVersion it does not raise an error, which would stop
+ * the health check worker until the extension is updated.
+ */
+static bool
+HaMonitorVersionMatches(void)
+{
+	int spiStatus = 0;
+	bool versionMatches = false;
+	const int argCount = 2;
+	Oid argTypes[] = { TEXTOID, TEXTOID };
+	Datum argValues[] = {
+		CStringGetTextDatum(AUTO_FAILOVER_EXTENSION_NAME),
+		CStringGetTextDatum(AUTO_FAILOVER_EXTENSION_VERSION)
+	};
+
+	const char *selectQuery =
+		"SELECT extversion = $2 "
+		"FROM pg_catalog.pg_extension WHERE extname = $1";
+
+	if (!EnableVersionChecks)
+	{
+		return true;
+	}
+
+	spiStatus = ExecuteCachedPlan(selectQuery, argCount, argTypes, argValues,
+								  NULL, true, 1);
+
+	if (spiStatus == SPI_OK_SELECT && SPI_processed == 1)
+	{
+		bool isNull = false;
+		Datum matchesDatum = SPI_getbinval(SPI_tuptable->vals[0],
+										   SPI_tuptable->tupdesc,
+										   1, &isNull);
+
+		versionMatches = !isNull && DatumGetBool(matchesDatum);
+	}
+
+	return versionMatches;
+}
+
+
 /*
  * StartSPITransaction starts a transaction using SPI.
  */
@@ -21,6 +21,7 @@
 #include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/xact.h"
+#include "access/xlog.h"
 #include "catalog/pg_database.h"
 #include "commands/extension.h"
 #include "miscadmin.h"
@@ -126,6 +127,7 @@ static bool pgAutoFailoverExtensionExists(void);
 static List * CreateHealthChecks(List *nodeHealthList);
 static HealthCheck * CreateHealthCheck(NodeHealth *nodeHealth);
 static void DoHealthChecks(List *healthCheckList);
+static List * FailedNodeHealthList(List *healthCheckList);
 static void ManageHealthCheck(HealthCheck *healthCheck, struct timeval currentTime);
 static int WaitForEvent(List *healthCheckList);
 static int CompareTimes(struct timeval *leftTime, struct timeval *rightTime);
@@ -485,13 +487,21 @@ HealthCheckWorkerMain(Datum arg)
 			}
 		}
 
-		if (foundPgAutoFailoverExtension)
+		/*
+		 * A standby monitor, fed by streaming replication from the primary
+		 * monitor, can't record health check results nor orchestrate
+		 * failovers. It starts doing health checks once it's promoted.
+		 */
+		if (foundPgAutoFailoverExtension && !RecoveryInProgress())
 		{
 			nodeHealthList = LoadNodeHealthList();
 			healthCheckList = CreateHealthChecks(nodeHealthList);
 
 			DoHealthChecks(healthCheckList);
 
+			/* fail over every group that lost its primary in this round */
+			StartFailoverForUnhealthyNodes(FailedNodeHealthList(healthCheckList));
+
 			MemoryContextReset(healthCheckContext);
 		}
 
@@ -618,6 +628,30 @@ DoHealthChecks(List *healthCheckList)
 }
 
 
+/*
+ * FailedNodeHealthList returns the list of nodes that failed the given round
+ * of health checks.
+ */
+static List *
+FailedNodeHealthList(List *healthCheckList)
+{
+	List *failedNodeList = NIL;
+	ListCell *healthCheckCell = NULL;
+
+	foreach(healthCheckCell, healthCheckList)
+	{
+		HealthCheck *healthCheck = (HealthCheck *) lfirst(healthCheckCell);
+
+		if (healthCheck->state == HEALTH_CHECK_DEAD)
+		{
+			failedNodeList = lappend(failedNodeList, healthCheck->node);
+		}
+	}
+
+	return failedNodeList;
+}
+
+
 /*
  * WaitForEvent sleeps until a time-based or I/O event occurs in any of the health
  * checks.
@@ -30,15 +30,26 @@
 #include "executor/spi.h"
 #include "lib/stringinfo.h"
 #include "nodes/pg_list.h"
+#include "storage/fd.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
 #include "utils/lsyscache.h"
 #include "utils/hsearch.h"
+#include "utils/guc.h"
+#include "utils/inval.h"
 #include "utils/rel.h"
 #include "utils/relcache.h"
 
 bool EnableVersionChecks = true; /* version checks are enabled */
 
+/* set once the version checks passed in this backend */
+static bool extensionVersionIsCompatible = false;
+static bool extensionCacheCallbackRegistered = false;
+
+static void ExtensionVersionCacheCallback(Datum argument, Oid relationId);
+static char * GetAvailableExtensionVersion(void);
+static char * GetInstalledExtensionVersion(void);
+
 /*
  * pgAutoFailoverRelationId returns the OID of a given relation in the
  * pgautofailover schema.
@@ -180,6 +191,11 @@ LockNodeGroup(char *formationId, int groupId, LOCKMODE lockMode)
  * We need to be careful that the pgautofailover.so that is currently loaded in
  * the Postgres backend is intended to work with the current extension version
  * definition (schema and SQL definitions of C coded functions).
+ *
+ * This is called at the beginning of most of our SQL functions, so once the
+ * checks passed we remember it for the lifetime of the backend, until the
+ * extension is created, updated, or dropped, see
+ * InvalidateExtensionVersionCache().
  */
 bool
 checkPgAutoFailoverVersion()
@@ -187,62 +203,25 @@ checkPgAutoFailoverVersion()
 	char *installedVersion = NULL;
 	char *availableVersion = NULL;
 
-	int spiStatus = 0;
-	const int argCount = 1;
-	Oid argTypes[] = { TEXTOID };
-	Datum argValues[] = { CStringGetTextDatum(AUTO_FAILOVER_EXTENSION_NAME) };
-	MemoryContext callerContext = CurrentMemoryContext;
-
-	char *selectQuery =
-		"SELECT default_version, installed_version "
-		"FROM pg_catalog.pg_available_extensions WHERE name = $1;";
-
 	if (!EnableVersionChecks)
 	{
 		return true;
 	}
 
-	SPI_connect();
-
-	spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-									  NULL, false, 1);
-	if (spiStatus != SPI_OK_SELECT)
+	if (extensionVersionIsCompatible)
 	{
-		elog(ERROR, "could not select from pg_catalog.pg_available_extensions");
+		return true;
 	}
 
-	if (SPI_processed != 1)
+	if (!extensionCacheCallbackRegistered)
 	{
-		elog(ERROR, "expected a single entry for extension \"%s\"",
-			 AUTO_FAILOVER_EXTENSION_NAME);
-	}
-	else
-	{
-		TupleDesc tupleDescriptor = SPI_tuptable->tupdesc;
-		HeapTuple heapTuple = SPI_tuptable->vals[0];
-		bool defaultIsNull = false, installedIsNull = false;
-		MemoryContext spiContext = MemoryContextSwitchTo(callerContext);
-
-		Datum defaultVersionDatum =
-			heap_getattr(heapTuple, 1, tupleDescriptor, &defaultIsNull);
-
-		Datum installedVersionDatum =
-			heap_getattr(heapTuple, 2, tupleDescriptor, &installedIsNull);
-
-		if (!defaultIsNull)
-		{
-			availableVersion = TextDatumGetCString(defaultVersionDatum);
-		}
-
-		if (!installedIsNull)
-		{
-			installedVersion = TextDatumGetCString(installedVersionDatum);
-		}
-
-		MemoryContextSwitchTo(spiContext);
+		CacheRegisterRelcacheCallback(ExtensionVersionCacheCallback,
+									  (Datum) 0);
+		extensionCacheCallbackRegistered = true;
 	}
 
-	SPI_finish();
+	availableVersion = GetAvailableExtensionVersion();
+	installedVersion = GetInstalledExtensionVersion();
 
 	if (strcmp(AUTO_FAILOVER_EXTENSION_VERSION, availableVersion) != 0)
 	{
@@ -275,5 +254,144 @@ checkPgAutoFailoverVersion()
 		return false;
 	}
 
+	extensionVersionIsCompatible = true;
+
 	return true;
 }
+
+
+/*
+ * InvalidateExtensionVersionCache makes every backend check the extension
+ * versions again, after the current transaction commits. We use a relcache
+ * invalidation of pg_extension to reach the other backends, because catalog
+ * updates of pg_extension don't send any invalidation message on their own.
+ */
+void
+InvalidateExtensionVersionCache(void)
+{
+	extensionVersionIsCompatible = false;
+
+	CacheInvalidateRelcacheByRelid(ExtensionRelationId);
+}
+
+
+/*
+ * ExtensionVersionCacheCallback resets our cached version checks when
+ * pg_extension is invalidated, or when the whole relcache is reset.
+ */
+static void
+ExtensionVersionCacheCallback(Datum argument, Oid relationId)
+{
+	if (relationId == InvalidOid || relationId == ExtensionRelationId)
+	{
+		extensionVersionIsCompatible = false;
+	}
+}
+
+
+/*
+ * GetAvailableExtensionVersion returns the default_version of our extension
+ * control file. We only read our own control file, where the
+ * pg_available_extensions view reads every control file on disk.
+ */
+static char *
+GetAvailableExtensionVersion(void)
+{
+	char sharePath[MAXPGPATH];
+	char controlFilePath[MAXPGPATH];
+	FILE *controlFile = NULL;
+	ConfigVariable *head = NULL;
+	ConfigVariable *tail = NULL;
+	ConfigVariable *item = NULL;
+	char *defaultVersion = NULL;
+
+	get_share_path(my_exec_path, sharePath);
+	snprintf(controlFilePath, MAXPGPATH, "%s/extension/%s.control",
+			 sharePath, AUTO_FAILOVER_EXTENSION_NAME);
+
+	controlFile = AllocateFile(controlFilePath, "r");
+
+	if (controlFile == NULL)
+	{
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open extension control file \"%s\": %m",
+						controlFilePath)));
+	}
+
+	(void) ParseConfigFp(controlFile, controlFilePath, 0, ERROR, &head, &tail);
+
+	FreeFile(controlFile);
+
+	for (item = head; item != NULL; item = item->next)
+	{
+		if (strcmp(item->name, "default_version") == 0)
+		{
+			defaultVersion = pstrdup(item->value);
+		}
+	}
+
+	FreeConfigVariables(head);
+
+	if (defaultVersion == NULL)
+	{
+		ereport(ERROR,
+				(errmsg("extension control file \"%s\" does not specify "
+						"a default_version", controlFilePath)));
+	}
+
+	return defaultVersion;
+}
+
+
+/*
+ * GetInstalledExtensionVersion returns the installed version of our
+ * extension, from pg_extension.
+ */
+static char *
+GetInstalledExtensionVersion(void)
+{
+	Relation pgExtension = NULL;
+	SysScanDesc scanDescriptor;
+	ScanKeyData scanKey[1];
+	bool indexOK = true;
+	HeapTuple extensionTuple = NULL;
+	char *installedVersion = NULL;
+
+	pgExtension = heap_open(ExtensionRelationId, AccessShareLock);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_extension_extname, BTEqualStrategyNumber,
+				F_NAMEEQ, CStringGetDatum(AUTO_FAILOVER_EXTENSION_NAME));
+
+	scanDescriptor = systable_beginscan(pgExtension, ExtensionNameIndexId, indexOK,
+										NULL, 1, scanKey);
+
+	extensionTuple = systable_getnext(scanDescriptor);
+
+	if (HeapTupleIsValid(extensionTuple))
+	{
+		bool isNull = false;
+		Datum versionDatum = heap_getattr(extensionTuple,
+										  Anum_pg_extension_extversion,
+										  RelationGetDescr(pgExtension),
+										  &isNull);
+
+		if (!isNull)
+		{
+			installedVersion = TextDatumGetCString(versionDatum);
+		}
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgExtension, AccessShareLock);
+
+	if (installedVersion == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						errmsg("extension not loaded"),
+						errhint("Run: CREATE EXTENSION %s",
+								AUTO_FAILOVER_EXTENSION_NAME)));
+	}
+
+	return installedVersion;
+}
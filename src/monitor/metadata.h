@@ -15,12 +15,14 @@
 
 #include "storage/lockdefs.h"
 
-#define AUTO_FAILOVER_EXTENSION_VERSION "1.2"
+#define AUTO_FAILOVER_EXTENSION_VERSION "1.3"
 #define AUTO_FAILOVER_EXTENSION_NAME "pgautofailover"
 #define AUTO_FAILOVER_SCHEMA_NAME "pgautofailover"
 #define AUTO_FAILOVER_FORMATION_TABLE "pgautofailover.formation"
 #define AUTO_FAILOVER_NODE_TABLE "pgautofailover.node"
 #define AUTO_FAILOVER_EVENT_TABLE "pgautofailover.event"
+#define AUTO_FAILOVER_ROLLING_RESTART_TABLE "pgautofailover.rolling_restart"
+#define AUTO_FAILOVER_STANDBY_TELEMETRY_TABLE "pgautofailover.standby_telemetry"
 #define REPLICATION_STATE_TYPE_NAME "replication_state"
 
 
@@ -45,3 +47,4 @@ extern Oid pgAutoFailoverExtensionOwner(void);
 extern void LockFormation(char *formationId, LOCKMODE lockMode);
 extern void LockNodeGroup(char *formationId, int groupId, LOCKMODE lockMode);
 extern bool checkPgAutoFailoverVersion(void);
+extern void InvalidateExtensionVersionCache(void);
@@ -23,6 +23,7 @@
 #include "node_metadata.h"
 #include "notifications.h"
 #include "replication_state.h"
+#include "telemetry_metadata.h"
 
 #include "access/htup_details.h"
 #include "access/xlogdefs.h"
@@ -39,15 +40,22 @@
 /* private function forward declarations */
 static AutoFailoverNodeState * NodeActive(char *formationId,
 										  char *nodeName, int32 nodePort,
-										  AutoFailoverNodeState *currentNodeState);
+										  AutoFailoverNodeState *currentNodeState,
+										  StandbyTelemetryReport *standbyTelemetry);
 static void JoinAutoFailoverFormation(AutoFailoverFormation *formation,
 									  char *nodeName, int nodePort,
+									  char *nodeZone,
 									  AutoFailoverNodeState *currentNodeState);
 static int AssignGroupId(AutoFailoverFormation *formation,
 						 char *nodeName, int nodePort,
 						 ReplicationState *initialState);
 
 static bool IsStateIn(ReplicationState state, List *allowedStates);
+static int ProceedRollingRestartForGroup(List *groupNodeList,
+										 List *pendingNodeIds);
+static bool HasOtherSyncStandbys(AutoFailoverNode *primaryNode,
+								 AutoFailoverNode *maintenanceNode,
+								 List *groupNodeList);
 
 
 /* SQL-callable function declarations */
@@ -55,10 +63,13 @@ PG_FUNCTION_INFO_V1(register_node);
 PG_FUNCTION_INFO_V1(node_active);
 PG_FUNCTION_INFO_V1(get_nodes);
 PG_FUNCTION_INFO_V1(get_primary);
+PG_FUNCTION_INFO_V1(readable_nodes);
 PG_FUNCTION_INFO_V1(get_other_node);
 PG_FUNCTION_INFO_V1(get_other_nodes);
 PG_FUNCTION_INFO_V1(remove_node);
 PG_FUNCTION_INFO_V1(perform_failover);
+PG_FUNCTION_INFO_V1(perform_switchover);
+PG_FUNCTION_INFO_V1(perform_rolling_restart);
 PG_FUNCTION_INFO_V1(start_maintenance);
 PG_FUNCTION_INFO_V1(stop_maintenance);
 PG_FUNCTION_INFO_V1(set_node_candidate_priority);
@@ -93,6 +104,8 @@ register_node(PG_FUNCTION_ARGS)
 		FormationKindFromNodeKindString(nodeKind);
 	int candidatePriority = PG_GETARG_INT32(7);
 	bool replicationQuorum = PG_GETARG_BOOL(8);
+	text *nodeZoneText = PG_GETARG_TEXT_P(9);
+	char *nodeZone = text_to_cstring(nodeZoneText);
 
 	AutoFailoverFormation *formation = NULL;
 	AutoFailoverNode *pgAutoFailoverNode = NULL;
@@ -175,7 +188,8 @@ register_node(PG_FUNCTION_ARGS)
 		}
 	}
 
-	JoinAutoFailoverFormation(formation, nodeName, nodePort, &currentNodeState);
+	JoinAutoFailoverFormation(formation, nodeName, nodePort, nodeZone,
+							  &currentNodeState);
 	LockNodeGroup(formationId, currentNodeState.groupId, ExclusiveLock);
 
 	pgAutoFailoverNode = GetAutoFailoverNode(nodeName, nodePort);
@@ -271,6 +285,8 @@ node_active(PG_FUNCTION_ARGS)
 	text *currentPgsrSyncStateText = PG_GETARG_TEXT_P(8);
 	char *currentPgsrSyncState = text_to_cstring(currentPgsrSyncStateText);
 
+	StandbyTelemetryReport standbyTelemetry = { 0 };
+
 	AutoFailoverNodeState currentNodeState = { 0 };
 	AutoFailoverNodeState *assignedNodeState = NULL;
 	Oid newReplicationStateOid = InvalidOid;
@@ -291,8 +307,18 @@ node_active(PG_FUNCTION_ARGS)
 	currentNodeState.reportedLSN = currentLSN;
 	currentNodeState.pgsrSyncState = SyncStateFromString(currentPgsrSyncState);
 	currentNodeState.pgIsRunning = currentPgIsRunning;
+
+	standbyTelemetry.nodeIds = PG_GETARG_DATUM(9);
+	standbyTelemetry.writeLSNs = PG_GETARG_DATUM(10);
+	standbyTelemetry.flushLSNs = PG_GETARG_DATUM(11);
+	standbyTelemetry.replayLSNs = PG_GETARG_DATUM(12);
+	standbyTelemetry.writeLags = PG_GETARG_DATUM(13);
+	standbyTelemetry.flushLags = PG_GETARG_DATUM(14);
+	standbyTelemetry.replayLags = PG_GETARG_DATUM(15);
+
 	assignedNodeState =
-		NodeActive(formationId, nodeName, nodePort, &currentNodeState);
+		NodeActive(formationId, nodeName, nodePort, &currentNodeState,
+				   &standbyTelemetry);
 
 	newReplicationStateOid =
 		ReplicationStateGetEnum(assignedNodeState->replicationState);
@@ -320,11 +346,15 @@ node_active(PG_FUNCTION_ARGS)
 
 
 /*
- * NodeActive reports the current state of a node and returns the assigned state.
+ * NodeActive reports the current state of a node and returns the assigned
+ * state. A primary node also reports the replication telemetry of its
+ * standby nodes, which we store before running the group state machine, so
+ * that it uses fresh data.
  */
 static AutoFailoverNodeState *
 NodeActive(char *formationId, char *nodeName, int32 nodePort,
-		   AutoFailoverNodeState *currentNodeState)
+		   AutoFailoverNodeState *currentNodeState,
+		   StandbyTelemetryReport *standbyTelemetry)
 {
 	AutoFailoverNode *pgAutoFailoverNode = NULL;
 	AutoFailoverNodeState *assignedNodeState = NULL;
@@ -392,6 +422,8 @@ NodeActive(char *formationId, char *nodeName, int32 nodePort,
 									currentNodeState->pgIsRunning,
 									currentNodeState->pgsrSyncState,
 									currentNodeState->reportedLSN);
+
+		ReportStandbyTelemetry(pgAutoFailoverNode->nodeId, standbyTelemetry);
 	}
 
 	LockNodeGroup(formationId, currentNodeState->groupId, ExclusiveLock);
@@ -415,7 +447,7 @@ NodeActive(char *formationId, char *nodeName, int32 nodePort,
  */
 static void
 JoinAutoFailoverFormation(AutoFailoverFormation *formation,
-						  char *nodeName, int nodePort,
+						  char *nodeName, int nodePort, char *nodeZone,
 						  AutoFailoverNodeState *currentNodeState)
 {
 	int groupId = -1;
@@ -537,7 +569,8 @@ JoinAutoFailoverFormation(AutoFailoverFormation *formation,
 	AddAutoFailoverNode(formation->formationId, groupId, nodeName, nodePort,
 						initialState, currentNodeState->replicationState,
 						currentNodeState->candidatePriority,
-						currentNodeState->replicationQuorum);
+						currentNodeState->replicationQuorum,
+						nodeZone);
 
 	currentNodeState->groupId = groupId;
 }
@@ -633,6 +666,7 @@ get_primary(PG_FUNCTION_ARGS)
 typedef struct get_nodes_fctx
 {
 	List *nodesList;
+	List *allNodesList;			/* only used in readable_nodes */
 } get_nodes_fctx;
 
 /*
@@ -735,6 +769,107 @@ get_nodes(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * readable_nodes returns the nodes of a formation that can serve read-only
+ * traffic, most up-to-date first, see ListReadableNodes.
+ */
+Datum
+readable_nodes(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	get_nodes_fctx *fctx;
+	MemoryContext oldcontext;
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
+	{
+		char *formationId = text_to_cstring(PG_GETARG_TEXT_P(0));
+
+		/* a negative value, the default, means any lag */
+		int64 maxLagBytes = PG_GETARG_INT64(1);
+
+		if (PG_ARGISNULL(0))
+		{
+			ereport(ERROR, (errmsg("formation_id must not be null")));
+		}
+
+		checkPgAutoFailoverVersion();
+
+		/* create a function context for cross-call persistence */
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		/*
+		 * switch to memory context appropriate for multiple function calls
+		 */
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		/* allocate memory for user context */
+		fctx = (get_nodes_fctx *) palloc(sizeof(get_nodes_fctx));
+
+		fctx->allNodesList = AllAutoFailoverNodes(formationId);
+		fctx->nodesList = ListReadableNodes(fctx->allNodesList, maxLagBytes);
+
+		funcctx->user_fctx = fctx;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* stuff done on every call of the function */
+	funcctx = SRF_PERCALL_SETUP();
+
+	/*
+	 * get the saved state and use current as the result for this iteration
+	 */
+	fctx = funcctx->user_fctx;
+
+	if (fctx->nodesList != NIL)
+	{
+		TupleDesc resultDescriptor = NULL;
+		TypeFuncClass resultTypeClass = 0;
+		Datum resultDatum = 0;
+		HeapTuple resultTuple = NULL;
+		Datum values[6];
+		bool isNulls[6];
+		int64 lagBytes = 0;
+
+		AutoFailoverNode *node = (AutoFailoverNode *) linitial(fctx->nodesList);
+
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = Int32GetDatum(node->nodeId);
+		values[1] = Int32GetDatum(node->groupId);
+		values[2] = CStringGetTextDatum(node->nodeName);
+		values[3] = Int32GetDatum(node->nodePort);
+		values[4] = LSNGetDatum(node->reportedLSN);
+
+		if (NodeReplicationLag(node, fctx->allNodesList, &lagBytes))
+		{
+			values[5] = Int64GetDatum(lagBytes);
+		}
+		else
+		{
+			isNulls[5] = true;
+		}
+
+		resultTypeClass = get_call_result_type(fcinfo, NULL, &resultDescriptor);
+		if (resultTypeClass != TYPEFUNC_COMPOSITE)
+		{
+			ereport(ERROR, (errmsg("return type must be a row type")));
+		}
+
+		resultTuple = heap_form_tuple(resultDescriptor, values, isNulls);
+		resultDatum = HeapTupleGetDatum(resultTuple);
+
+		/* prepare next SRF call */
+		fctx->nodesList = list_delete_first(fctx->nodesList);
+
+		SRF_RETURN_NEXT(funcctx, PointerGetDatum(resultDatum));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+
 /*
  * get_other_node is not supported anymore, but we might want to be able to
  * have the pgautofailover.so for 1.1 co-exists with the SQL definitions for
@@ -1030,6 +1165,394 @@ perform_failover(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * perform_switchover implements a planned switchover in the given group: the
+ * primary is asked to checkpoint and stop cleanly, and as soon as a standby
+ * has received all of its WAL, that standby is promoted without waiting for
+ * the demote timeout. The old primary then follows the new one without
+ * having to use pg_rewind. See ProceedGroupStateForSwitchover.
+ *
+ * As opposed to perform_failover, any number of standby nodes is supported.
+ */
+Datum
+perform_switchover(PG_FUNCTION_ARGS)
+{
+	text *formationIdText = PG_GETARG_TEXT_P(0);
+	char *formationId = text_to_cstring(formationIdText);
+	int32 groupId = PG_GETARG_INT32(1);
+
+	AutoFailoverNode *primaryNode = NULL;
+	AutoFailoverNode *candidateNode = NULL;
+	bool walReceivedAll = false;
+
+	char message[BUFSIZE];
+
+	checkPgAutoFailoverVersion();
+
+	LockFormation(formationId, ShareLock);
+	LockNodeGroup(formationId, groupId, ExclusiveLock);
+
+	primaryNode = GetPrimaryNodeInGroup(formationId, groupId);
+
+	if (primaryNode == NULL ||
+		!IsCurrentState(primaryNode, REPLICATION_STATE_PRIMARY))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("cannot perform switchover: there is no node in "
+						"state \"primary\" in formation \"%s\" group %d",
+						formationId, groupId)));
+	}
+
+	/*
+	 * Before stopping the primary, check that we have a candidate that is
+	 * close enough to have received all the WAL by the time the primary is
+	 * done with its shutdown checkpoint.
+	 */
+	candidateNode = FindSwitchoverCandidate(primaryNode, walReceivedAll);
+
+	if (candidateNode == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("cannot perform switchover: there is no standby node "
+						"ready to be promoted in formation \"%s\" group %d",
+						formationId, groupId),
+				 errdetail("A standby node must be healthy, in state "
+						   "\"secondary\", have a non-zero candidate "
+						   "priority, and be within %d bytes of the primary.",
+						   PromoteXlogThreshold)));
+	}
+
+	LogAndNotifyMessage(
+		message, BUFSIZE,
+		"Setting goal state of %s:%d to draining after a user-initiated "
+		"switchover, %s:%d is the candidate for promotion.",
+		primaryNode->nodeName, primaryNode->nodePort,
+		candidateNode->nodeName, candidateNode->nodePort);
+
+	SetNodeGoalState(primaryNode->nodeName, primaryNode->nodePort,
+					 REPLICATION_STATE_DRAINING);
+
+	NotifyStateChange(primaryNode->reportedState,
+					  REPLICATION_STATE_DRAINING,
+					  primaryNode->formationId,
+					  primaryNode->groupId,
+					  primaryNode->nodeId,
+					  primaryNode->nodeName,
+					  primaryNode->nodePort,
+					  primaryNode->pgsrSyncState,
+					  primaryNode->reportedLSN,
+					  primaryNode->candidatePriority,
+					  primaryNode->replicationQuorum,
+					  message);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * perform_rolling_restart drives the restart of every node of a formation,
+ * so that a new Postgres minor version or new settings that require a
+ * restart can be deployed without downtime.
+ *
+ * Each call advances the rolling restart by one step in every group, and
+ * returns how many nodes are still to be restarted: pg_autoctl calls this
+ * function in a loop until it returns zero. Groups progress in parallel, but
+ * only one node per group is ever restarted at a time, and only when every
+ * other node of the group is healthy. Secondary nodes are restarted first by
+ * going through maintenance, then the primary node is restarted by means of
+ * a switchover.
+ *
+ * Progress is tracked in the pgautofailover.rolling_restart table, and each
+ * step is logged in the pgautofailover.event table.
+ */
+Datum
+perform_rolling_restart(PG_FUNCTION_ARGS)
+{
+	text *formationIdText = PG_GETARG_TEXT_P(0);
+	char *formationId = text_to_cstring(formationIdText);
+
+	AutoFailoverFormation *formation = NULL;
+	List *pendingNodeIds = NIL;
+	List *nodesList = NIL;
+	List *groupIdList = NIL;
+	ListCell *cell = NULL;
+	int remainingCount = 0;
+
+	char message[BUFSIZE];
+
+	checkPgAutoFailoverVersion();
+
+	/* concurrent calls for the same formation must not step on each other */
+	LockFormation(formationId, ExclusiveLock);
+
+	formation = GetFormation(formationId);
+
+	if (formation == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("formation \"%s\" does not exist", formationId)));
+	}
+
+	if (StartRollingRestart(formationId))
+	{
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Starting a rolling restart of formation \"%s\".", formationId);
+	}
+
+	pendingNodeIds = RollingRestartPendingNodeIds(formationId);
+	nodesList = AllAutoFailoverNodes(formationId);
+
+	foreach(cell, nodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(cell);
+
+		groupIdList = list_append_unique_int(groupIdList, node->groupId);
+	}
+
+	foreach(cell, groupIdList)
+	{
+		int groupId = lfirst_int(cell);
+		List *groupNodeList = NIL;
+
+		LockNodeGroup(formationId, groupId, ExclusiveLock);
+
+		groupNodeList = AutoFailoverNodeGroup(formationId, groupId);
+
+		remainingCount +=
+			ProceedRollingRestartForGroup(groupNodeList, pendingNodeIds);
+	}
+
+	if (remainingCount == 0)
+	{
+		FinishRollingRestart(formationId);
+
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Rolling restart of formation \"%s\" is done.", formationId);
+	}
+
+	PG_RETURN_INT32(remainingCount);
+}
+
+
+/*
+ * ProceedRollingRestartForGroup advances the rolling restart of a group by
+ * one step, and returns how many nodes of the group are still to be
+ * restarted, counting the node currently being restarted.
+ */
+static int
+ProceedRollingRestartForGroup(List *groupNodeList, List *pendingNodeIds)
+{
+	AutoFailoverNode *primaryNode = NULL;
+	AutoFailoverNode *maintenanceNode = NULL;
+	AutoFailoverNode *pendingSecondaryNode = NULL;
+	bool groupIsStable = true;
+	bool groupIsHealthy = true;
+	int pendingCount = 0;
+	ListCell *nodeCell = NULL;
+
+	char message[BUFSIZE];
+
+	foreach(nodeCell, groupNodeList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+		bool isPending = list_member_int(pendingNodeIds, node->nodeId);
+
+		if (node->reportedState != node->goalState)
+		{
+			groupIsStable = false;
+		}
+
+		if (node->health != NODE_HEALTH_GOOD || !node->pgIsRunning)
+		{
+			groupIsHealthy = false;
+		}
+
+		if (isPending)
+		{
+			++pendingCount;
+		}
+
+		if (StateBelongsToPrimary(node->reportedState))
+		{
+			primaryNode = node;
+		}
+		else if (isPending &&
+				 IsCurrentState(node, REPLICATION_STATE_MAINTENANCE))
+		{
+			maintenanceNode = node;
+		}
+		else if (isPending && pendingSecondaryNode == NULL &&
+				 IsCurrentState(node, REPLICATION_STATE_SECONDARY))
+		{
+			pendingSecondaryNode = node;
+		}
+	}
+
+	/* wait until the previous step has been done */
+	if (!groupIsStable)
+	{
+		return pendingCount > 0 ? pendingCount : 1;
+	}
+
+	if (pendingCount == 0)
+	{
+		return 0;
+	}
+
+	/*
+	 * Restarting the only node of a group would make the service unavailable,
+	 * so we skip it. Users can still restart it with pg_autoctl.
+	 */
+	if (list_length(groupNodeList) == 1)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) linitial(groupNodeList);
+
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Skipping %s:%d in the rolling restart: it is the only node "
+			"in its group.",
+			node->nodeName, node->nodePort);
+
+		SetNodeRestarted(node->nodeId);
+
+		return 0;
+	}
+
+	/* a secondary node in maintenance is restarted when leaving it */
+	if (maintenanceNode != NULL)
+	{
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Setting goal state of %s:%d to catchingup to restart it "
+			"as part of a rolling restart.",
+			maintenanceNode->nodeName, maintenanceNode->nodePort);
+
+		AssignGoalState(maintenanceNode,
+						REPLICATION_STATE_CATCHINGUP, message);
+
+		SetNodeRestarted(maintenanceNode->nodeId);
+
+		return pendingCount;
+	}
+
+	if (primaryNode == NULL ||
+		!IsCurrentState(primaryNode, REPLICATION_STATE_PRIMARY) ||
+		!groupIsHealthy)
+	{
+		return pendingCount;
+	}
+
+	if (pendingSecondaryNode != NULL &&
+		HasOtherSyncStandbys(primaryNode, pendingSecondaryNode, groupNodeList))
+	{
+		/*
+		 * The other standby nodes keep acknowledging commits, so the primary
+		 * node keeps synchronous replication enabled.
+		 */
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Setting goal state of %s:%d to maintenance as part of a "
+			"rolling restart.",
+			pendingSecondaryNode->nodeName, pendingSecondaryNode->nodePort);
+
+		AssignGoalState(pendingSecondaryNode,
+						REPLICATION_STATE_MAINTENANCE, message);
+
+		return pendingCount;
+	}
+	else if (pendingSecondaryNode != NULL)
+	{
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Setting goal state of %s:%d to wait_primary and %s:%d to "
+			"maintenance as part of a rolling restart.",
+			primaryNode->nodeName, primaryNode->nodePort,
+			pendingSecondaryNode->nodeName, pendingSecondaryNode->nodePort);
+
+		AssignGoalState(primaryNode, REPLICATION_STATE_WAIT_PRIMARY, message);
+		AssignGoalState(pendingSecondaryNode,
+						REPLICATION_STATE_MAINTENANCE, message);
+
+		return pendingCount;
+	}
+
+	/* the primary is restarted last, by means of a switchover */
+	if (list_member_int(pendingNodeIds, primaryNode->nodeId))
+	{
+		bool walReceivedAll = false;
+		AutoFailoverNode *candidateNode =
+			FindSwitchoverCandidate(primaryNode, walReceivedAll);
+
+		if (candidateNode == NULL)
+		{
+			return pendingCount;
+		}
+
+		LogAndNotifyMessage(
+			message, BUFSIZE,
+			"Setting goal state of %s:%d to draining to restart it "
+			"as part of a rolling restart, %s:%d is the candidate "
+			"for promotion.",
+			primaryNode->nodeName, primaryNode->nodePort,
+			candidateNode->nodeName, candidateNode->nodePort);
+
+		AssignGoalState(primaryNode, REPLICATION_STATE_DRAINING, message);
+
+		SetNodeRestarted(primaryNode->nodeId);
+	}
+
+	return pendingCount;
+}
+
+
+/*
+ * HasOtherSyncStandbys returns true when the group has more than one standby
+ * node and, once the given standby node is in maintenance, enough standby
+ * nodes remain in the replication quorum to satisfy the formation's
+ * number_sync_standbys. The primary node can then stay in the primary state.
+ */
+static bool
+HasOtherSyncStandbys(AutoFailoverNode *primaryNode,
+					 AutoFailoverNode *maintenanceNode,
+					 List *groupNodeList)
+{
+	AutoFailoverFormation *formation = GetFormation(primaryNode->formationId);
+	int syncStandbyCount = 0;
+	ListCell *nodeCell = NULL;
+
+	if (list_length(groupNodeList) <= 2)
+	{
+		return false;
+	}
+
+	foreach(nodeCell, groupNodeList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (node->nodeId == primaryNode->nodeId ||
+			node->nodeId == maintenanceNode->nodeId)
+		{
+			continue;
+		}
+
+		if (node->replicationQuorum &&
+			!node->quorumExcluded &&
+			IsCurrentState(node, REPLICATION_STATE_SECONDARY))
+		{
+			++syncStandbyCount;
+		}
+	}
+
+	return syncStandbyCount > 0 &&
+		   syncStandbyCount >= formation->number_sync_standbys;
+}
+
+
 /*
  * start_maintenance sets the given node in maintenance state.
  *
@@ -1602,7 +2125,9 @@ synchronous_standby_names(PG_FUNCTION_ARGS)
 	 *   - candidateNodesGroupList contains only nodes that have a
 	 *     candidatePriority greater than zero
 	 *
-	 *   - we skip nodes that have replicationQuorum set to false
+	 *   - we skip nodes that have replicationQuorum set to false, and nodes
+	 *     that are temporarily excluded because they are lagging, see
+	 *     pgautofailover.sync_standby_max_lag
 	 *
 	 *   - then we build synchronous_standby_names with one of the two
 	 *     following models:
@@ -1613,11 +2138,31 @@ synchronous_standby_names(PG_FUNCTION_ARGS)
 	 *     We use ANY when all the standby nodes have the same
 	 *     candidatePriority, and we use FIRST otherwise.
 	 *
+	 *   - among the standby nodes that have the same candidatePriority, we
+	 *     list the nodes in another zone than the primary node first, so
+	 *     that with FIRST commits are acknowledged from another zone
+	 *     whenever possible
+	 *
 	 *     The num_sync number is the formation number_sync_standbys property.
 	 */
 	{
-		List *syncStandbyNodesGroupList =
-			GroupListSyncStandbys(standbyNodesGroupList);
+		List *quorumNodesGroupList = NIL;
+		List *syncStandbyNodesGroupList = NIL;
+		ListCell *standbyNodeCell = NULL;
+
+		foreach(standbyNodeCell, GroupListSyncStandbys(standbyNodesGroupList))
+		{
+			AutoFailoverNode *node = (AutoFailoverNode *) lfirst(standbyNodeCell);
+
+			if (!node->quorumExcluded)
+			{
+				quorumNodesGroupList = lappend(quorumNodesGroupList, node);
+			}
+		}
+
+		syncStandbyNodesGroupList =
+			NodesInOtherZonesFirst(quorumNodesGroupList,
+								   primaryNode->nodeZone);
 
 		int count = list_length(syncStandbyNodesGroupList);
 
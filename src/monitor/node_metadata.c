@@ -22,6 +22,7 @@
 #include "health_check.h"
 #include "metadata.h"
 #include "node_metadata.h"
+#include "plan_cache.h"
 
 #include "access/genam.h"
 #include "access/heapam.h"
@@ -32,21 +33,104 @@
 #include "access/xlogdefs.h"
 #include "catalog/indexing.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_am.h"
 #include "catalog/pg_extension.h"
+#include "catalog/pg_publication.h"
+#include "catalog/pg_trigger.h"
 #include "catalog/pg_type.h"
 #include "commands/sequence.h"
+#include "commands/trigger.h"
 #include "executor/spi.h"
 #include "lib/stringinfo.h"
 #include "nodes/pg_list.h"
+#include "storage/bufmgr.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
 #include "utils/pg_lsn.h"
 #include "utils/rel.h"
 #include "utils/relcache.h"
+#include "utils/snapmgr.h"
 #include "utils/syscache.h"
 
 
+/*
+ * node_active is called by every keeper every few seconds, and only reads and
+ * updates a handful of rows of pgautofailover.node. For those calls we scan
+ * the table directly with its (nodename, nodeport) and (formationid,
+ * groupid) indexes rather than going through SPI. As the physical attribute
+ * numbers of the table depend on the upgrade path that created it, we look
+ * them up by name once per backend, and reset them when the table is
+ * invalidated in the relcache. Whether the table supports in-place updates
+ * is cached the same way, as adding a trigger, an index, a constraint, a
+ * publication, or enabling row level security all invalidate the table.
+ */
+typedef struct NodeRelationCache
+{
+	bool valid;
+	Oid relationId;
+	Oid nodeNameIndexId;
+	Oid groupIndexId;
+	bool canUpdateInPlace;
+	AttrNumber attributeNumbers[Natts_pgautofailover_node + 1];
+} NodeRelationCache;
+
+static NodeRelationCache nodeRelationCache = { 0 };
+static bool nodeRelationCallbackRegistered = false;
+
+/* column names, indexed by Anum_pgautofailover_node_* */
+static const char *NodeColumnNames[Natts_pgautofailover_node + 1] = {
+	NULL,
+	"formationid",
+	"nodeid",
+	"groupid",
+	"nodename",
+	"nodeport",
+	"goalstate",
+	"reportedstate",
+	"reportedpgisrunning",
+	"reportedrepstate",
+	"reporttime",
+	"walreporttime",
+	"health",
+	"healthchecktime",
+	"statechangetime",
+	"reportedlsn",
+	"candidatepriority",
+	"replicationquorum",
+	"nodezone",
+	"quorumexcluded"
+};
+
+/* attribute numbers of SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE */
+static const AttrNumber SelectAttributeNumbers[Natts_pgautofailover_node + 1] = {
+	InvalidAttrNumber, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+	11, 12, 13, 14, 15, 16, 17, 18, 19
+};
+
+
+static AutoFailoverNode * HeapTupleToAutoFailoverNode(TupleDesc tupleDescriptor,
+													  HeapTuple heapTuple,
+													  const AttrNumber *attributeNumbers);
+static void InitNodeRelationCache(void);
+static Oid FindNodeIndex(Relation nodeRelation,
+						 AttrNumber firstAttributeNumber,
+						 AttrNumber secondAttributeNumber);
+static void InvalidateNodeRelationCache(Datum argument, Oid relationId);
+static void InitNodeScanKey(ScanKey scanKey, Relation nodeRelation,
+							int anum, RegProcedure procedure, Datum argument);
+static List * ScanAutoFailoverNodes(Relation nodeRelation, Oid indexId,
+									ScanKey scanKey, int scanKeyCount,
+									int maxCount);
+static int pgautofailover_node_nodeid_compare(const void *a, const void *b);
+static bool CanUpdateNodeInPlace(Relation relation);
+static bool UpdateNodeStateInPlace(char *nodeName, int nodePort,
+								   ReplicationState reportedState,
+								   bool pgIsRunning, SyncState pgSyncState,
+								   XLogRecPtr reportedLSN);
+
+
 /*
  * AllAutoFailoverNodes returns all AutoFailover nodes in a formation as a
  * list.
@@ -74,8 +158,8 @@ AllAutoFailoverNodes(char *formationId)
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-									  NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(selectQuery, argCount, argTypes, argValues,
+								  NULL, false, 0);
 	if (spiStatus != SPI_OK_SELECT)
 	{
 		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_TABLE);
@@ -101,57 +185,105 @@ AllAutoFailoverNodes(char *formationId)
 
 
 /*
- * TupleToAutoFailoverNode constructs a AutoFailoverNode from a heap tuple.
+ * TupleToAutoFailoverNode constructs a AutoFailoverNode from a heap tuple
+ * that has the columns of SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE.
  */
 AutoFailoverNode *
 TupleToAutoFailoverNode(TupleDesc tupleDescriptor, HeapTuple heapTuple)
+{
+	return HeapTupleToAutoFailoverNode(tupleDescriptor, heapTuple,
+									   SelectAttributeNumbers);
+}
+
+
+/*
+ * HeapTupleToAutoFailoverNode constructs a AutoFailoverNode from a heap
+ * tuple, where attributeNumbers maps the Anum_pgautofailover_node_* column
+ * indexes to the attribute numbers of the tuple.
+ */
+static AutoFailoverNode *
+HeapTupleToAutoFailoverNode(TupleDesc tupleDescriptor, HeapTuple heapTuple,
+							const AttrNumber *attributeNumbers)
 {
 	AutoFailoverNode *pgAutoFailoverNode = NULL;
 	bool isNull = false;
 
-	Datum formationId = heap_getattr(heapTuple,
-									 Anum_pgautofailover_node_formationid,
-									 tupleDescriptor, &isNull);
-	Datum nodeId = heap_getattr(heapTuple, Anum_pgautofailover_node_nodeid,
-								tupleDescriptor, &isNull);
-	Datum groupId = heap_getattr(heapTuple, Anum_pgautofailover_node_groupid,
-								 tupleDescriptor, &isNull);
-	Datum nodeName = heap_getattr(heapTuple, Anum_pgautofailover_node_nodename,
-								  tupleDescriptor, &isNull);
-	Datum nodePort = heap_getattr(heapTuple, Anum_pgautofailover_node_nodeport,
-								  tupleDescriptor, &isNull);
-	Datum goalState = heap_getattr(heapTuple, Anum_pgautofailover_node_goalstate,
-								   tupleDescriptor, &isNull);
-	Datum reportedState = heap_getattr(heapTuple,
-									   Anum_pgautofailover_node_reportedstate,
-									   tupleDescriptor, &isNull);
-	Datum pgIsRunning = heap_getattr(heapTuple,
-									 Anum_pgautofailover_node_reportedpgisrunning,
-									 tupleDescriptor, &isNull);
-	Datum pgsrSyncState = heap_getattr(heapTuple,
-									   Anum_pgautofailover_node_reportedrepstate,
-									   tupleDescriptor, &isNull);
-	Datum reportTime = heap_getattr(heapTuple, Anum_pgautofailover_node_reporttime,
-									tupleDescriptor, &isNull);
-	Datum walReportTime = heap_getattr(heapTuple,
-										Anum_pgautofailover_node_walreporttime,
-										tupleDescriptor, &isNull);
-	Datum health = heap_getattr(heapTuple, Anum_pgautofailover_node_health,
-								tupleDescriptor, &isNull);
-	Datum healthCheckTime = heap_getattr(heapTuple,
-										 Anum_pgautofailover_node_healthchecktime,
-										 tupleDescriptor, &isNull);
-	Datum stateChangeTime = heap_getattr(heapTuple,
-										 Anum_pgautofailover_node_statechangetime,
-										 tupleDescriptor, &isNull);
-	Datum reportedLSN = heap_getattr(heapTuple, Anum_pgautofailover_node_reportedLSN,
-								   tupleDescriptor, &isNull);
-	Datum candidatePriority = heap_getattr(heapTuple,
-										 Anum_pgautofailover_node_candidate_priority,
-										 tupleDescriptor, &isNull);
-	Datum replicationQuorum = heap_getattr(heapTuple,
-										 Anum_pgautofailover_node_replication_quorum,
-										 tupleDescriptor, &isNull);
+	Datum formationId =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_formationid],
+					 tupleDescriptor, &isNull);
+	Datum nodeId =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_nodeid],
+					 tupleDescriptor, &isNull);
+	Datum groupId =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_groupid],
+					 tupleDescriptor, &isNull);
+	Datum nodeName =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_nodename],
+					 tupleDescriptor, &isNull);
+	Datum nodePort =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_nodeport],
+					 tupleDescriptor, &isNull);
+	Datum goalState =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_goalstate],
+					 tupleDescriptor, &isNull);
+	Datum reportedState =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_reportedstate],
+					 tupleDescriptor, &isNull);
+	Datum pgIsRunning =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_reportedpgisrunning],
+					 tupleDescriptor, &isNull);
+	Datum pgsrSyncState =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_reportedrepstate],
+					 tupleDescriptor, &isNull);
+	Datum reportTime =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_reporttime],
+					 tupleDescriptor, &isNull);
+	Datum walReportTime =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_walreporttime],
+					 tupleDescriptor, &isNull);
+	Datum health =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_health],
+					 tupleDescriptor, &isNull);
+	Datum healthCheckTime =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_healthchecktime],
+					 tupleDescriptor, &isNull);
+	Datum stateChangeTime =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_statechangetime],
+					 tupleDescriptor, &isNull);
+	Datum reportedLSN =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_reportedLSN],
+					 tupleDescriptor, &isNull);
+	Datum candidatePriority =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_candidate_priority],
+					 tupleDescriptor, &isNull);
+	Datum replicationQuorum =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_replication_quorum],
+					 tupleDescriptor, &isNull);
+	Datum nodeZone =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_nodezone],
+					 tupleDescriptor, &isNull);
+	Datum quorumExcluded =
+		heap_getattr(heapTuple,
+					 attributeNumbers[Anum_pgautofailover_node_quorumexcluded],
+					 tupleDescriptor, &isNull);
 
 	Oid goalStateOid = DatumGetObjectId(goalState);
 	Oid reportedStateOid = DatumGetObjectId(reportedState);
@@ -175,6 +307,8 @@ TupleToAutoFailoverNode(TupleDesc tupleDescriptor, HeapTuple heapTuple)
 	pgAutoFailoverNode->reportedLSN = DatumGetLSN(reportedLSN);
 	pgAutoFailoverNode->candidatePriority = DatumGetInt32(candidatePriority);
 	pgAutoFailoverNode->replicationQuorum = DatumGetBool(replicationQuorum);
+	pgAutoFailoverNode->nodeZone = TextDatumGetCString(nodeZone);
+	pgAutoFailoverNode->quorumExcluded = DatumGetBool(quorumExcluded);
 
 	return pgAutoFailoverNode;
 }
@@ -187,52 +321,29 @@ TupleToAutoFailoverNode(TupleDesc tupleDescriptor, HeapTuple heapTuple)
 List *
 AutoFailoverNodeGroup(char *formationId, int groupId)
 {
+	ScanKeyData scanKey[2];
+	Relation nodeRelation = NULL;
 	List *nodeList = NIL;
-	MemoryContext callerContext = CurrentMemoryContext;
-	MemoryContext spiContext = NULL;
-
-	Oid argTypes[] = {
-		TEXTOID, /* formationid */
-		INT4OID  /* groupid */
-	};
-
-	Datum argValues[] = {
-		CStringGetTextDatum(formationId), /* formationid */
-		Int32GetDatum(groupId)            /* groupid */
-	};
-	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
-	int spiStatus = 0;
-	uint64 rowNumber = 0;
-
-	const char *selectQuery =
-		SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE
-		" WHERE formationid = $1 AND groupid = $2";
-
-	SPI_connect();
-
-	spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-									  NULL, false, 0);
-	if (spiStatus != SPI_OK_SELECT)
-	{
-		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_TABLE);
-	}
 
-	spiContext = MemoryContextSwitchTo(callerContext);
+	InitNodeRelationCache();
 
-	for (rowNumber = 0; rowNumber < SPI_processed; rowNumber++)
-	{
-		HeapTuple heapTuple = SPI_tuptable->vals[rowNumber];
-		AutoFailoverNode *pgAutoFailoverNode =
-			TupleToAutoFailoverNode(SPI_tuptable->tupdesc, heapTuple);
+	nodeRelation = heap_open(nodeRelationCache.relationId, AccessShareLock);
 
-		nodeList = lappend(nodeList, pgAutoFailoverNode);
-	}
+	InitNodeScanKey(&scanKey[0], nodeRelation,
+					Anum_pgautofailover_node_formationid, F_TEXTEQ,
+					CStringGetTextDatum(formationId));
+	InitNodeScanKey(&scanKey[1], nodeRelation,
+					Anum_pgautofailover_node_groupid, F_INT4EQ,
+					Int32GetDatum(groupId));
 
-	MemoryContextSwitchTo(spiContext);
+	nodeList = ScanAutoFailoverNodes(nodeRelation,
+									 nodeRelationCache.groupIndexId,
+									 scanKey, 2, 0);
 
-	SPI_finish();
+	heap_close(nodeRelation, AccessShareLock);
 
-	return nodeList;
+	/* index order is not the table order, make it stable */
+	return list_qsort(nodeList, pgautofailover_node_nodeid_compare);
 }
 
 
@@ -376,6 +487,31 @@ pgautofailover_node_candidate_priority_compare(const void *a, const void *b)
 }
 
 
+/*
+ * pgautofailover_node_reportedlsn_compare
+ *	  qsort comparator for sorting node lists by reported LSN, most recent
+ *	  first
+ */
+static int
+pgautofailover_node_reportedlsn_compare(const void *a, const void *b)
+{
+	AutoFailoverNode *node1 = (AutoFailoverNode *) lfirst(*(ListCell **) a);
+	AutoFailoverNode *node2 = (AutoFailoverNode *) lfirst(*(ListCell **) b);
+
+	if (node1->reportedLSN > node2->reportedLSN)
+	{
+		return -1;
+	}
+
+	if (node1->reportedLSN < node2->reportedLSN)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
 /*
  * GroupListCandidates returns a list of nodes in groupNodeList that are all
  * candidates for failover (those with AutoFailoverNode.candidatePriority > 0),
@@ -405,6 +541,78 @@ GroupListCandidates(List *groupNodeList)
 }
 
 
+/*
+ * NodeReplicationLag sets lagBytes to how many bytes of WAL the given node is
+ * behind the writable node of its group, as last reported by the keepers. It
+ * returns false when nodesList has no writable node for the group.
+ */
+bool
+NodeReplicationLag(AutoFailoverNode *node, List *nodesList, int64 *lagBytes)
+{
+	ListCell *nodeCell = NULL;
+
+	foreach(nodeCell, nodesList)
+	{
+		AutoFailoverNode *otherNode = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (otherNode->groupId == node->groupId &&
+			otherNode->nodeId != node->nodeId &&
+			CanTakeWritesInState(otherNode->reportedState))
+		{
+			*lagBytes = otherNode->reportedLSN > node->reportedLSN
+						? (int64) (otherNode->reportedLSN - node->reportedLSN)
+						: 0;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * ListReadableNodes returns the nodes in nodesList that can serve read-only
+ * traffic: healthy secondary nodes that are at most maxLagBytes behind the
+ * writable node of their group, or with any lag when maxLagBytes is
+ * negative. The nodes are sorted by freshness, most recent LSN first.
+ */
+List *
+ListReadableNodes(List *nodesList, int64 maxLagBytes)
+{
+	ListCell *nodeCell = NULL;
+	List *readableNodesList = NIL;
+	List *sortedNodeList = NIL;
+
+	foreach(nodeCell, nodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+		int64 lagBytes = 0;
+
+		if (!IsCurrentState(node, REPLICATION_STATE_SECONDARY) ||
+			node->health != NODE_HEALTH_GOOD ||
+			!node->pgIsRunning)
+		{
+			continue;
+		}
+
+		if (maxLagBytes >= 0 &&
+			(!NodeReplicationLag(node, nodesList, &lagBytes) ||
+			 lagBytes > maxLagBytes))
+		{
+			continue;
+		}
+
+		readableNodesList = lappend(readableNodesList, node);
+	}
+
+	sortedNodeList =
+		list_qsort(readableNodesList, pgautofailover_node_reportedlsn_compare);
+	list_free(readableNodesList);
+
+	return sortedNodeList;
+}
+
+
 /*
  * GroupListSyncStandbys returns a list of nodes in groupNodeList that are all
  * candidates for failover (those with AutoFailoverNode.replicationQuorum set
@@ -434,6 +642,112 @@ GroupListSyncStandbys(List *groupNodeList)
 }
 
 
+/*
+ * GroupListCandidatesInZone returns the same list as GroupListCandidates,
+ * except that among the nodes that have the same candidate priority, the
+ * nodes that are in the given zone come first. When the zone is empty, we
+ * have no preference.
+ */
+List *
+GroupListCandidatesInZone(List *groupNodeList, const char *zone)
+{
+	List *candidateNodesList = GroupListCandidates(groupNodeList);
+	List *sortedNodesList = NIL;
+	List *otherZoneNodesList = NIL;
+	ListCell *nodeCell = NULL;
+	int currentPriority = -1;
+
+	if (zone == NULL || zone[0] == '\0')
+	{
+		return candidateNodesList;
+	}
+
+	foreach(nodeCell, candidateNodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (node->candidatePriority != currentPriority)
+		{
+			sortedNodesList = list_concat(sortedNodesList, otherZoneNodesList);
+			otherZoneNodesList = NIL;
+			currentPriority = node->candidatePriority;
+		}
+
+		if (IsNodeInZone(node, zone))
+		{
+			sortedNodesList = lappend(sortedNodesList, node);
+		}
+		else
+		{
+			otherZoneNodesList = lappend(otherZoneNodesList, node);
+		}
+	}
+	sortedNodesList = list_concat(sortedNodesList, otherZoneNodesList);
+	list_free(candidateNodesList);
+
+	return sortedNodesList;
+}
+
+
+/*
+ * NodesInOtherZonesFirst returns a new list with the nodes of nodesList, which
+ * is sorted by candidate priority, where among the nodes that have the same
+ * candidate priority, the nodes that are known to be in another zone than the
+ * given one come first. The order of the priorities is kept.
+ */
+List *
+NodesInOtherZonesFirst(List *nodesList, const char *zone)
+{
+	List *sortedNodesList = NIL;
+	List *sameZoneNodesList = NIL;
+	ListCell *nodeCell = NULL;
+	int currentPriority = -1;
+
+	if (zone == NULL || zone[0] == '\0')
+	{
+		return list_copy(nodesList);
+	}
+
+	foreach(nodeCell, nodesList)
+	{
+		AutoFailoverNode *node = (AutoFailoverNode *) lfirst(nodeCell);
+
+		if (node->candidatePriority != currentPriority)
+		{
+			sortedNodesList = list_concat(sortedNodesList, sameZoneNodesList);
+			sameZoneNodesList = NIL;
+			currentPriority = node->candidatePriority;
+		}
+
+		if (node->nodeZone[0] != '\0' && !IsNodeInZone(node, zone))
+		{
+			sortedNodesList = lappend(sortedNodesList, node);
+		}
+		else
+		{
+			sameZoneNodesList = lappend(sameZoneNodesList, node);
+		}
+	}
+	sortedNodesList = list_concat(sortedNodesList, sameZoneNodesList);
+
+	return sortedNodesList;
+}
+
+
+/*
+ * IsNodeInZone returns true when the given node has been registered in the
+ * given zone.
+ */
+bool
+IsNodeInZone(AutoFailoverNode *node, const char *zone)
+{
+	return node != NULL
+		&& zone != NULL
+		&& zone[0] != '\0'
+		&& strcmp(node->nodeZone, zone) == 0;
+}
+
+
 /*
  * AllNodesHaveSameCandidatePriority returns true when all the nodes in the
  * given list have the same candidate priority.
@@ -464,49 +778,33 @@ AllNodesHaveSameCandidatePriority(List *groupNodeList)
 AutoFailoverNode *
 GetAutoFailoverNode(char *nodeName, int nodePort)
 {
-	AutoFailoverNode *pgAutoFailoverNode = NULL;
-	MemoryContext callerContext = CurrentMemoryContext;
+	ScanKeyData scanKey[2];
+	Relation nodeRelation = NULL;
+	List *nodeList = NIL;
 
-	Oid argTypes[] = {
-		TEXTOID, /* nodename */
-		INT4OID  /* nodeport */
-	};
+	InitNodeRelationCache();
 
-	Datum argValues[] = {
-		CStringGetTextDatum(nodeName), /* nodename */
-		Int32GetDatum(nodePort)        /* nodeport */
-	};
-	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
-	int spiStatus = 0;
+	nodeRelation = heap_open(nodeRelationCache.relationId, AccessShareLock);
 
-	const char *selectQuery =
-		SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE
-		" WHERE nodename = $1 AND nodeport = $2";
+	InitNodeScanKey(&scanKey[0], nodeRelation,
+					Anum_pgautofailover_node_nodename, F_TEXTEQ,
+					CStringGetTextDatum(nodeName));
+	InitNodeScanKey(&scanKey[1], nodeRelation,
+					Anum_pgautofailover_node_nodeport, F_INT4EQ,
+					Int32GetDatum(nodePort));
 
-	SPI_connect();
+	nodeList = ScanAutoFailoverNodes(nodeRelation,
+									 nodeRelationCache.nodeNameIndexId,
+									 scanKey, 2, 1);
 
-	spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-									  NULL, false, 1);
-	if (spiStatus != SPI_OK_SELECT)
-	{
-		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_TABLE);
-	}
+	heap_close(nodeRelation, AccessShareLock);
 
-	if (SPI_processed > 0)
-	{
-		MemoryContext spiContext = MemoryContextSwitchTo(callerContext);
-		pgAutoFailoverNode = TupleToAutoFailoverNode(SPI_tuptable->tupdesc,
-													 SPI_tuptable->vals[0]);
-		MemoryContextSwitchTo(spiContext);
-	}
-	else
+	if (nodeList == NIL)
 	{
-		pgAutoFailoverNode = NULL;
+		return NULL;
 	}
 
-	SPI_finish();
-
-	return pgAutoFailoverNode;
+	return (AutoFailoverNode *) linitial(nodeList);
 }
 
 
@@ -540,8 +838,8 @@ GetAutoFailoverNodeWithId(int nodeid, char *nodeName, int nodePort)
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(selectQuery, argCount, argTypes, argValues,
-									  NULL, false, 1);
+	spiStatus = ExecuteCachedPlan(selectQuery, argCount, argTypes, argValues,
+								  NULL, false, 1);
 	if (spiStatus != SPI_OK_SELECT)
 	{
 		elog(ERROR, "could not select from " AUTO_FAILOVER_NODE_TABLE);
@@ -629,7 +927,8 @@ AddAutoFailoverNode(char *formationId, int groupId, char *nodeName, int nodePort
 					ReplicationState goalState,
 					ReplicationState reportedState,
 					int candidatePriority,
-					bool replicationQuorum)
+					bool replicationQuorum,
+					char *nodeZone)
 {
 	Oid goalStateOid = ReplicationStateGetEnum(goalState);
 	Oid reportedStateOid = ReplicationStateGetEnum(reportedState);
@@ -643,7 +942,8 @@ AddAutoFailoverNode(char *formationId, int groupId, char *nodeName, int nodePort
 		replicationStateTypeOid, /* goalstate */
 		replicationStateTypeOid, /* reportedstate */
 		INT4OID, /* candidate_priority */
-		BOOLOID  /* replication_quorum */
+		BOOLOID, /* replication_quorum */
+		TEXTOID  /* nodezone */
 	};
 
 	Datum argValues[] = {
@@ -654,7 +954,8 @@ AddAutoFailoverNode(char *formationId, int groupId, char *nodeName, int nodePort
 		ObjectIdGetDatum(goalStateOid),	    /* goalstate */
 		ObjectIdGetDatum(reportedStateOid), /* reportedstate */
 		Int32GetDatum(candidatePriority),   /* candidate_priority */
-		BoolGetDatum(replicationQuorum)	/* replication_quorum */
+		BoolGetDatum(replicationQuorum),	/* replication_quorum */
+		CStringGetTextDatum(nodeZone)		/* nodezone */
 	};
 
 	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
@@ -663,13 +964,13 @@ AddAutoFailoverNode(char *formationId, int groupId, char *nodeName, int nodePort
 
 	const char *insertQuery =
 		"INSERT INTO " AUTO_FAILOVER_NODE_TABLE
-		" (formationid, groupid, nodename, nodeport, goalstate, reportedstate, candidatepriority, replicationquorum)"
-		" VALUES ($1, $2, $3, $4, $5, $6, $7, $8) RETURNING nodeid";
+		" (formationid, groupid, nodename, nodeport, goalstate, reportedstate, candidatepriority, replicationquorum, nodezone)"
+		" VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9) RETURNING nodeid";
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(insertQuery, argCount, argTypes,
-									  argValues, NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(insertQuery, argCount, argTypes,
+								  argValues, NULL, false, 0);
 
 	if (spiStatus == SPI_OK_INSERT_RETURNING && SPI_processed > 0)
 	{
@@ -724,9 +1025,9 @@ SetNodeGoalState(char *nodeName, int nodePort, ReplicationState goalState)
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(updateQuery,
-									  argCount, argTypes, argValues,
-									  NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(updateQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
 	if (spiStatus != SPI_OK_UPDATE)
 	{
 		elog(ERROR, "could not update " AUTO_FAILOVER_NODE_TABLE);
@@ -740,7 +1041,9 @@ SetNodeGoalState(char *nodeName, int nodePort, ReplicationState goalState)
  * ReportAutoFailoverNodeState persists the reported state and nodes version of
  * a node.
  *
- * We use SPI to automatically handle triggers, function calls, etc.
+ * This runs at each node_active call, so we update the row in place when we
+ * can, see UpdateNodeStateInPlace. Otherwise we use SPI to automatically
+ * handle triggers, concurrent updates, etc.
  */
 void
 ReportAutoFailoverNodeState(char *nodeName, int nodePort,
@@ -779,11 +1082,17 @@ ReportAutoFailoverNodeState(char *nodeName, int nodePort,
 		"walreporttime = CASE $4 WHEN '0/0'::pg_lsn THEN walreporttime ELSE now() END, "
 		"statechangetime = now() WHERE nodename = $5 AND nodeport = $6";
 
+	if (UpdateNodeStateInPlace(nodeName, nodePort, reportedState,
+							   pgIsRunning, pgSyncState, reportedLSN))
+	{
+		return;
+	}
+
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(updateQuery,
-									  argCount, argTypes, argValues,
-									  NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(updateQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
 
 	if (spiStatus != SPI_OK_UPDATE)
 	{
@@ -831,9 +1140,9 @@ ReportAutoFailoverNodeHealth(char *nodeName, int nodePort,
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(updateQuery,
-									  argCount, argTypes, argValues,
-									  NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(updateQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
 
 	if (spiStatus != SPI_OK_UPDATE)
 	{
@@ -879,9 +1188,47 @@ ReportAutoFailoverNodeReplicationSetting(int nodeid, char *nodeName, int nodePor
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(updateQuery,
-									  argCount, argTypes, argValues,
-									  NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(updateQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
+
+	if (spiStatus != SPI_OK_UPDATE)
+	{
+		elog(ERROR, "could not update " AUTO_FAILOVER_NODE_TABLE);
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * SetNodeQuorumExcluded sets whether the given node is temporarily left out
+ * of the synchronous_standby_names setting of its primary node.
+ */
+void
+SetNodeQuorumExcluded(int nodeId, bool quorumExcluded)
+{
+	Oid argTypes[] = {
+		BOOLOID,				 /* quorumexcluded */
+		INT4OID					 /* nodeid */
+	};
+
+	Datum argValues[] = {
+		BoolGetDatum(quorumExcluded),		  /* quorumexcluded */
+		Int32GetDatum(nodeId)				  /* nodeid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+	int spiStatus = 0;
+
+	const char *updateQuery =
+		"UPDATE " AUTO_FAILOVER_NODE_TABLE
+		" SET quorumexcluded = $1 WHERE nodeid = $2";
+
+	SPI_connect();
+
+	spiStatus = ExecuteCachedPlan(updateQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
 
 	if (spiStatus != SPI_OK_UPDATE)
 	{
@@ -891,6 +1238,7 @@ ReportAutoFailoverNodeReplicationSetting(int nodeid, char *nodeName, int nodePor
 	SPI_finish();
 }
 
+
 /*
  * RemoveAutoFailoverNode removes a node from a AutoFailover formation.
  *
@@ -917,9 +1265,9 @@ RemoveAutoFailoverNode(char *nodeName, int nodePort)
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(deleteQuery,
-									  argCount, argTypes, argValues,
-									  NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(deleteQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
 
 	if (spiStatus != SPI_OK_DELETE)
 	{
@@ -931,36 +1279,206 @@ RemoveAutoFailoverNode(char *nodeName, int nodePort)
 
 
 /*
- * SynStateFromString returns the enum value represented by given string.
+ * StartRollingRestart registers all the nodes of the given formation as
+ * pending a restart, unless a rolling restart is already in progress for
+ * that formation. It returns true when a new rolling restart has started.
  */
-SyncState
-SyncStateFromString(const char *pgsrSyncState)
+bool
+StartRollingRestart(char *formationId)
 {
-	SyncState syncStateArray[] = { SYNC_STATE_UNKNOWN,
-								   SYNC_STATE_UNKNOWN,
-								   SYNC_STATE_SYNC,
-								   SYNC_STATE_ASYNC,
-								   SYNC_STATE_QUORUM,
-								   SYNC_STATE_POTENTIAL };
-	char *syncStateList[] = {"", "unknown",
-							 "sync", "async", "quorum", "potential",
-							 NULL};
+	Oid argTypes[] = {
+		TEXTOID /* formationid */
+	};
 
-	for(int listIndex = 0; syncStateList[listIndex] != NULL; listIndex++)
-	{
-		char *candidate = syncStateList[listIndex];
+	Datum argValues[] = {
+		CStringGetTextDatum(formationId)  /* formationid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+	int spiStatus = 0;
+	bool started = false;
 
-		if (strcmp(pgsrSyncState, candidate) == 0)
-		{
-			return syncStateArray[listIndex];
-		}
-	}
+	const char *insertQuery =
+		"INSERT INTO " AUTO_FAILOVER_ROLLING_RESTART_TABLE
+		" (formationid, nodeid, groupid) "
+		"SELECT formationid, nodeid, groupid FROM " AUTO_FAILOVER_NODE_TABLE
+		" WHERE formationid = $1 "
+		"   AND NOT EXISTS (SELECT 1 FROM " AUTO_FAILOVER_ROLLING_RESTART_TABLE
+		"                    WHERE formationid = $1)";
 
-	ereport(ERROR, (ERRCODE_INVALID_PARAMETER_VALUE,
-					errmsg("unknown pg_stat_replication.sync_state \"%s\"",
-						   pgsrSyncState)));
+	SPI_connect();
 
-	/* never happens, make compiler happy */
+	spiStatus = ExecuteCachedPlan(insertQuery, argCount, argTypes,
+								  argValues, NULL, false, 0);
+	if (spiStatus != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not insert into " AUTO_FAILOVER_ROLLING_RESTART_TABLE);
+	}
+
+	started = SPI_processed > 0;
+
+	SPI_finish();
+
+	return started;
+}
+
+
+/*
+ * RollingRestartPendingNodeIds returns the list of the ids of the nodes of
+ * the given formation that the current rolling restart has yet to restart.
+ */
+List *
+RollingRestartPendingNodeIds(char *formationId)
+{
+	List *nodeIdList = NIL;
+	MemoryContext callerContext = CurrentMemoryContext;
+	MemoryContext spiContext = NULL;
+
+	Oid argTypes[] = {
+		TEXTOID /* formationid */
+	};
+
+	Datum argValues[] = {
+		CStringGetTextDatum(formationId)  /* formationid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+	int spiStatus = 0;
+	uint64 rowNumber = 0;
+
+	const char *selectQuery =
+		"SELECT nodeid FROM " AUTO_FAILOVER_ROLLING_RESTART_TABLE
+		" WHERE formationid = $1 AND restarttime IS NULL";
+
+	SPI_connect();
+
+	spiStatus = ExecuteCachedPlan(selectQuery, argCount, argTypes,
+								  argValues, NULL, false, 0);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from " AUTO_FAILOVER_ROLLING_RESTART_TABLE);
+	}
+
+	spiContext = MemoryContextSwitchTo(callerContext);
+
+	for (rowNumber = 0; rowNumber < SPI_processed; rowNumber++)
+	{
+		bool isNull = false;
+		Datum nodeIdDatum = SPI_getbinval(SPI_tuptable->vals[rowNumber],
+										  SPI_tuptable->tupdesc,
+										  1,
+										  &isNull);
+
+		nodeIdList = lappend_int(nodeIdList, (int) DatumGetInt64(nodeIdDatum));
+	}
+
+	MemoryContextSwitchTo(spiContext);
+
+	SPI_finish();
+
+	return nodeIdList;
+}
+
+
+/*
+ * SetNodeRestarted records that the current rolling restart has restarted
+ * the given node.
+ */
+void
+SetNodeRestarted(int nodeId)
+{
+	Oid argTypes[] = {
+		INT8OID /* nodeid */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum((int64) nodeId) /* nodeid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+	int spiStatus = 0;
+
+	const char *updateQuery =
+		"UPDATE " AUTO_FAILOVER_ROLLING_RESTART_TABLE
+		" SET restarttime = now() WHERE nodeid = $1";
+
+	SPI_connect();
+
+	spiStatus = ExecuteCachedPlan(updateQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
+	if (spiStatus != SPI_OK_UPDATE)
+	{
+		elog(ERROR, "could not update " AUTO_FAILOVER_ROLLING_RESTART_TABLE);
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * FinishRollingRestart removes the tracking of the rolling restart of the
+ * given formation.
+ */
+void
+FinishRollingRestart(char *formationId)
+{
+	Oid argTypes[] = {
+		TEXTOID /* formationid */
+	};
+
+	Datum argValues[] = {
+		CStringGetTextDatum(formationId)  /* formationid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+	int spiStatus = 0;
+
+	const char *deleteQuery =
+		"DELETE FROM " AUTO_FAILOVER_ROLLING_RESTART_TABLE
+		" WHERE formationid = $1";
+
+	SPI_connect();
+
+	spiStatus = ExecuteCachedPlan(deleteQuery,
+								  argCount, argTypes, argValues,
+								  NULL, false, 0);
+	if (spiStatus != SPI_OK_DELETE)
+	{
+		elog(ERROR, "could not delete from " AUTO_FAILOVER_ROLLING_RESTART_TABLE);
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * SynStateFromString returns the enum value represented by given string.
+ */
+SyncState
+SyncStateFromString(const char *pgsrSyncState)
+{
+	SyncState syncStateArray[] = { SYNC_STATE_UNKNOWN,
+								   SYNC_STATE_UNKNOWN,
+								   SYNC_STATE_SYNC,
+								   SYNC_STATE_ASYNC,
+								   SYNC_STATE_QUORUM,
+								   SYNC_STATE_POTENTIAL };
+	char *syncStateList[] = {"", "unknown",
+							 "sync", "async", "quorum", "potential",
+							 NULL};
+
+	for(int listIndex = 0; syncStateList[listIndex] != NULL; listIndex++)
+	{
+		char *candidate = syncStateList[listIndex];
+
+		if (strcmp(pgsrSyncState, candidate) == 0)
+		{
+			return syncStateArray[listIndex];
+		}
+	}
+
+	ereport(ERROR, (ERRCODE_INVALID_PARAMETER_VALUE,
+					errmsg("unknown pg_stat_replication.sync_state \"%s\"",
+						   pgsrSyncState)));
+
+	/* never happens, make compiler happy */
 	return SYNC_STATE_UNKNOWN;
 }
 
@@ -1068,3 +1586,461 @@ IsInPrimaryState(AutoFailoverNode *pgAutoFailoverNode)
 		&& pgAutoFailoverNode->goalState == pgAutoFailoverNode->reportedState
 		&& CanTakeWritesInState(pgAutoFailoverNode->goalState);
 }
+
+
+/*
+ * InitNodeRelationCache looks up the OID of the pgautofailover.node table,
+ * the OIDs of its indexes, and the attribute numbers of its columns, unless
+ * they are already cached.
+ */
+static void
+InitNodeRelationCache(void)
+{
+	Relation nodeRelation = NULL;
+	AttrNumber *attributeNumbers = nodeRelationCache.attributeNumbers;
+	int anum = 0;
+
+	if (nodeRelationCache.valid)
+	{
+		return;
+	}
+
+	if (!nodeRelationCallbackRegistered)
+	{
+		CacheRegisterRelcacheCallback(InvalidateNodeRelationCache, (Datum) 0);
+		nodeRelationCallbackRegistered = true;
+	}
+
+	nodeRelationCache.relationId =
+		pgAutoFailoverRelationId(AUTO_FAILOVER_NODE_TABLE_NAME);
+
+	for (anum = 1; anum <= Natts_pgautofailover_node; anum++)
+	{
+		attributeNumbers[anum] = get_attnum(nodeRelationCache.relationId,
+											NodeColumnNames[anum]);
+
+		if (attributeNumbers[anum] == InvalidAttrNumber)
+		{
+			ereport(ERROR, (errmsg("column %s of %s does not exist",
+								   NodeColumnNames[anum],
+								   AUTO_FAILOVER_NODE_TABLE)));
+		}
+	}
+
+	nodeRelation = heap_open(nodeRelationCache.relationId, AccessShareLock);
+
+	nodeRelationCache.nodeNameIndexId =
+		FindNodeIndex(nodeRelation,
+					  attributeNumbers[Anum_pgautofailover_node_nodename],
+					  attributeNumbers[Anum_pgautofailover_node_nodeport]);
+
+	nodeRelationCache.groupIndexId =
+		FindNodeIndex(nodeRelation,
+					  attributeNumbers[Anum_pgautofailover_node_formationid],
+					  attributeNumbers[Anum_pgautofailover_node_groupid]);
+
+	nodeRelationCache.canUpdateInPlace = CanUpdateNodeInPlace(nodeRelation);
+
+	heap_close(nodeRelation, AccessShareLock);
+
+	nodeRelationCache.valid = true;
+}
+
+
+/*
+ * FindNodeIndex returns the OID of a valid btree index of the node table
+ * whose first two keys are the given columns, or InvalidOid when there is
+ * none, in which case our scans fall back to a sequential scan.
+ */
+static Oid
+FindNodeIndex(Relation nodeRelation,
+			  AttrNumber firstAttributeNumber,
+			  AttrNumber secondAttributeNumber)
+{
+	List *indexList = RelationGetIndexList(nodeRelation);
+	ListCell *indexCell = NULL;
+	Oid indexId = InvalidOid;
+
+	foreach(indexCell, indexList)
+	{
+		Oid candidateIndexId = lfirst_oid(indexCell);
+		Relation indexRelation = index_open(candidateIndexId, AccessShareLock);
+		Form_pg_index indexForm = indexRelation->rd_index;
+
+		if (indexRelation->rd_rel->relam == BTREE_AM_OID &&
+			indexForm->indisvalid &&
+			indexForm->indnatts >= 2 &&
+			indexForm->indkey.values[0] == firstAttributeNumber &&
+			indexForm->indkey.values[1] == secondAttributeNumber &&
+			RelationGetIndexPredicate(indexRelation) == NIL)
+		{
+			indexId = candidateIndexId;
+		}
+
+		index_close(indexRelation, AccessShareLock);
+
+		if (OidIsValid(indexId))
+		{
+			break;
+		}
+	}
+
+	list_free(indexList);
+
+	return indexId;
+}
+
+
+/*
+ * InvalidateNodeRelationCache resets our cache when the node table changes,
+ * or when the whole relcache is reset.
+ */
+static void
+InvalidateNodeRelationCache(Datum argument, Oid relationId)
+{
+	if (relationId == InvalidOid ||
+		relationId == nodeRelationCache.relationId)
+	{
+		nodeRelationCache.valid = false;
+	}
+}
+
+
+/*
+ * InitNodeScanKey initializes an equality scan key on the given column of
+ * the node table. We use the collation of the column, which is the one its
+ * indexes are sorted with.
+ */
+static void
+InitNodeScanKey(ScanKey scanKey, Relation nodeRelation,
+				int anum, RegProcedure procedure, Datum argument)
+{
+	AttrNumber attributeNumber = nodeRelationCache.attributeNumbers[anum];
+	Form_pg_attribute attributeForm =
+		TupleDescAttr(RelationGetDescr(nodeRelation), attributeNumber - 1);
+
+	ScanKeyEntryInitialize(scanKey, 0, attributeNumber,
+						   BTEqualStrategyNumber, InvalidOid,
+						   attributeForm->attcollation,
+						   procedure, argument);
+}
+
+
+/*
+ * ScanAutoFailoverNodes returns the nodes that match the given scan keys, at
+ * most maxCount of them when maxCount is positive.
+ *
+ * As SPI does, we first make the changes of the current transaction visible,
+ * and then scan with a new snapshot.
+ */
+static List *
+ScanAutoFailoverNodes(Relation nodeRelation, Oid indexId,
+					  ScanKey scanKey, int scanKeyCount, int maxCount)
+{
+	List *nodeList = NIL;
+	SysScanDesc scanDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	Snapshot snapshot = NULL;
+	bool indexOK = OidIsValid(indexId);
+
+	CommandCounterIncrement();
+
+	snapshot = RegisterSnapshot(GetTransactionSnapshot());
+
+	scanDescriptor = systable_beginscan(nodeRelation, indexId, indexOK,
+										snapshot, scanKeyCount, scanKey);
+
+	while (HeapTupleIsValid(heapTuple = systable_getnext(scanDescriptor)))
+	{
+		AutoFailoverNode *pgAutoFailoverNode =
+			HeapTupleToAutoFailoverNode(RelationGetDescr(nodeRelation),
+										heapTuple,
+										nodeRelationCache.attributeNumbers);
+
+		nodeList = lappend(nodeList, pgAutoFailoverNode);
+
+		if (maxCount > 0 && list_length(nodeList) >= maxCount)
+		{
+			break;
+		}
+	}
+
+	systable_endscan(scanDescriptor);
+	UnregisterSnapshot(snapshot);
+
+	return nodeList;
+}
+
+
+/*
+ * pgautofailover_node_nodeid_compare
+ *	  qsort comparator for sorting node lists by node id
+ */
+static int
+pgautofailover_node_nodeid_compare(const void *a, const void *b)
+{
+	AutoFailoverNode *node1 = (AutoFailoverNode *) lfirst(*(ListCell **) a);
+	AutoFailoverNode *node2 = (AutoFailoverNode *) lfirst(*(ListCell **) b);
+
+	if (node1->nodeId < node2->nodeId)
+	{
+		return -1;
+	}
+
+	if (node1->nodeId > node2->nodeId)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * CanUpdateNodeInPlace returns whether the given relation only has the
+ * features that an in-place update with CatalogTupleUpdate supports. That
+ * function does not fire triggers, only maintains plain indexes, and is not
+ * subject to row level security, so we use SPI when the table has:
+ *
+ *  - any trigger other than the internal ones that implement foreign keys,
+ *    which only act when the key columns change, and we never change them,
+ *  - any expression index, partial index, exclusion constraint or deferred
+ *    unique constraint,
+ *  - any publication, so that logical replication gets the UPDATE statement
+ *    and its checks, such as requiring a replica identity,
+ *  - any CHECK constraint, which CatalogTupleUpdate does not evaluate,
+ *  - row level security enabled.
+ *
+ * This opens every index of the table, so the result is kept in our
+ * NodeRelationCache rather than computed for each node_active call.
+ */
+static bool
+CanUpdateNodeInPlace(Relation relation)
+{
+	TriggerDesc *triggerDesc = relation->trigdesc;
+	PublicationActions *publicationActions = NULL;
+	List *indexList = NIL;
+	ListCell *indexCell = NULL;
+	bool canUpdateInPlace = true;
+
+	if (relation->rd_rel->relrowsecurity)
+	{
+		return false;
+	}
+
+	if (relation->rd_att->constr != NULL &&
+		relation->rd_att->constr->num_check > 0)
+	{
+		return false;
+	}
+
+	if (triggerDesc != NULL)
+	{
+		int triggerIndex = 0;
+
+		for (triggerIndex = 0;
+			 triggerIndex < triggerDesc->numtriggers;
+			 triggerIndex++)
+		{
+			Trigger *trigger = &(triggerDesc->triggers[triggerIndex]);
+
+			if (!trigger->tgisinternal ||
+				RI_FKey_trigger_type(trigger->tgfoid) == RI_TRIGGER_NONE)
+			{
+				return false;
+			}
+		}
+	}
+
+	publicationActions = GetRelationPublicationActions(relation);
+
+	if (publicationActions->pubinsert ||
+		publicationActions->pubupdate ||
+		publicationActions->pubdelete)
+	{
+		return false;
+	}
+
+	indexList = RelationGetIndexList(relation);
+
+	foreach(indexCell, indexList)
+	{
+		Oid indexId = lfirst_oid(indexCell);
+		Relation indexRelation = index_open(indexId, AccessShareLock);
+		Form_pg_index indexForm = indexRelation->rd_index;
+
+		if (RelationGetIndexExpressions(indexRelation) != NIL ||
+			RelationGetIndexPredicate(indexRelation) != NIL ||
+			indexForm->indisexclusion ||
+			!indexForm->indimmediate)
+		{
+			canUpdateInPlace = false;
+		}
+
+		index_close(indexRelation, AccessShareLock);
+
+		if (!canUpdateInPlace)
+		{
+			break;
+		}
+	}
+
+	list_free(indexList);
+
+	return canUpdateInPlace;
+}
+
+
+/*
+ * UpdateNodeStateInPlace implements ReportAutoFailoverNodeState without
+ * SPI: we find the node row with the (nodename, nodeport) index, lock it, and
+ * update its reported columns with CatalogTupleUpdate, which also maintains
+ * the indexes when the update is not HOT.
+ *
+ * It returns false when the caller should use SPI instead: when someone
+ * changed the table in a way that CatalogTupleUpdate does not support, such
+ * as adding triggers, expression or partial indexes, CHECK constraints,
+ * publications, or row level security, see CanUpdateNodeInPlace. We also use
+ * SPI when the row has been concurrently updated, such as by the health check
+ * worker, in which case the UPDATE statement follows the new row version for
+ * us.
+ */
+static bool
+UpdateNodeStateInPlace(char *nodeName, int nodePort,
+					   ReplicationState reportedState,
+					   bool pgIsRunning, SyncState pgSyncState,
+					   XLogRecPtr reportedLSN)
+{
+	Relation nodeRelation = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	AttrNumber *attributeNumbers = NULL;
+	ScanKeyData scanKey[2];
+	SysScanDesc scanDescriptor = NULL;
+	Snapshot snapshot = NULL;
+	HeapTuple heapTuple = NULL;
+	HeapTuple newHeapTuple = NULL;
+	HeapTupleData lockedTuple;
+	Buffer buffer = InvalidBuffer;
+	TM_FailureData failureData;
+	TM_Result lockResult;
+	TimestampTz now = GetCurrentTransactionStartTimestamp();
+	Datum *values = NULL;
+	bool *isNulls = NULL;
+	bool *replace = NULL;
+
+	InitNodeRelationCache();
+
+	attributeNumbers = nodeRelationCache.attributeNumbers;
+
+	if (!OidIsValid(nodeRelationCache.nodeNameIndexId))
+	{
+		return false;
+	}
+
+	nodeRelation = heap_open(nodeRelationCache.relationId, RowExclusiveLock);
+
+	/* taking the lock processed pending invalidations, if any */
+	InitNodeRelationCache();
+
+	if (!nodeRelationCache.canUpdateInPlace ||
+		!OidIsValid(nodeRelationCache.nodeNameIndexId))
+	{
+		heap_close(nodeRelation, RowExclusiveLock);
+		return false;
+	}
+
+	InitNodeScanKey(&scanKey[0], nodeRelation,
+					Anum_pgautofailover_node_nodename, F_TEXTEQ,
+					CStringGetTextDatum(nodeName));
+	InitNodeScanKey(&scanKey[1], nodeRelation,
+					Anum_pgautofailover_node_nodeport, F_INT4EQ,
+					Int32GetDatum(nodePort));
+
+	CommandCounterIncrement();
+
+	snapshot = RegisterSnapshot(GetLatestSnapshot());
+
+	scanDescriptor = systable_beginscan(nodeRelation,
+										nodeRelationCache.nodeNameIndexId,
+										true, snapshot, 2, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+
+	if (HeapTupleIsValid(heapTuple))
+	{
+		heapTuple = heap_copytuple(heapTuple);
+	}
+
+	systable_endscan(scanDescriptor);
+	UnregisterSnapshot(snapshot);
+
+	if (!HeapTupleIsValid(heapTuple))
+	{
+		/* the UPDATE statement would not have found any row either */
+		heap_close(nodeRelation, RowExclusiveLock);
+		return true;
+	}
+
+	lockedTuple.t_self = heapTuple->t_self;
+
+	lockResult = heap_lock_tuple(nodeRelation, &lockedTuple,
+								 GetCurrentCommandId(true),
+								 LockTupleNoKeyExclusive, LockWaitBlock,
+								 false, &buffer, &failureData);
+
+	ReleaseBuffer(buffer);
+
+	if (lockResult != TM_Ok)
+	{
+		heap_close(nodeRelation, RowExclusiveLock);
+		return false;
+	}
+
+	tupleDescriptor = RelationGetDescr(nodeRelation);
+
+	values = (Datum *) palloc0(tupleDescriptor->natts * sizeof(Datum));
+	isNulls = (bool *) palloc0(tupleDescriptor->natts * sizeof(bool));
+	replace = (bool *) palloc0(tupleDescriptor->natts * sizeof(bool));
+
+#define SetNodeColumn(anum, datum) \
+	do { \
+		values[attributeNumbers[anum] - 1] = (datum); \
+		replace[attributeNumbers[anum] - 1] = true; \
+	} while (0)
+
+	SetNodeColumn(Anum_pgautofailover_node_reportedstate,
+				  ObjectIdGetDatum(ReplicationStateGetEnum(reportedState)));
+	SetNodeColumn(Anum_pgautofailover_node_reporttime,
+				  TimestampTzGetDatum(now));
+	SetNodeColumn(Anum_pgautofailover_node_reportedpgisrunning,
+				  BoolGetDatum(pgIsRunning));
+	SetNodeColumn(Anum_pgautofailover_node_reportedrepstate,
+				  CStringGetTextDatum(SyncStateToString(pgSyncState)));
+	SetNodeColumn(Anum_pgautofailover_node_statechangetime,
+				  TimestampTzGetDatum(now));
+
+	if (reportedLSN != InvalidXLogRecPtr)
+	{
+		SetNodeColumn(Anum_pgautofailover_node_reportedLSN,
+					  LSNGetDatum(reportedLSN));
+		SetNodeColumn(Anum_pgautofailover_node_walreporttime,
+					  TimestampTzGetDatum(now));
+	}
+
+#undef SetNodeColumn
+
+	newHeapTuple = heap_modify_tuple(heapTuple, tupleDescriptor,
+									 values, isNulls, replace);
+
+	CatalogTupleUpdate(nodeRelation, &heapTuple->t_self, newHeapTuple);
+
+	CommandCounterIncrement();
+
+	/* keep the lock until the end of the transaction, as UPDATE does */
+	heap_close(nodeRelation, NoLock);
+
+	heap_freetuple(newHeapTuple);
+	heap_freetuple(heapTuple);
+
+	return true;
+}
@@ -24,7 +24,7 @@
  * indices must match with the columns given
  * in the following definition.
  */
-#define Natts_pgautofailover_node 15
+#define Natts_pgautofailover_node 19
 #define Anum_pgautofailover_node_formationid 1
 #define Anum_pgautofailover_node_nodeid 2
 #define Anum_pgautofailover_node_groupid 3
@@ -42,6 +42,8 @@
 #define Anum_pgautofailover_node_reportedLSN 15
 #define Anum_pgautofailover_node_candidate_priority 16
 #define Anum_pgautofailover_node_replication_quorum 17
+#define Anum_pgautofailover_node_nodezone 18
+#define Anum_pgautofailover_node_quorumexcluded 19
 
 #define AUTO_FAILOVER_NODE_TABLE_ALL_COLUMNS \
     "formationid, "			\
@@ -60,7 +62,9 @@
 	"statechangetime, "		\
 	"reportedlsn, "			\
 	"candidatepriority, "	\
-    "replicationquorum"
+	"replicationquorum, "	\
+	"nodezone, "			\
+	"quorumexcluded"
 
 
 #define SELECT_ALL_FROM_AUTO_FAILOVER_NODE_TABLE \
@@ -100,6 +104,8 @@ typedef struct AutoFailoverNode
 	XLogRecPtr reportedLSN;
 	int candidatePriority;
 	bool replicationQuorum;
+	char *nodeZone;
+	bool quorumExcluded;
 } AutoFailoverNode;
 
 
@@ -113,6 +119,12 @@ extern AutoFailoverNode * GetPrimaryNodeInGroup(char *formationId, int32 groupId
 extern AutoFailoverNode * FindFailoverNewStandbyNode(List *groupNodeList);
 extern List *GroupListCandidates(List *groupNodeList);
 extern List *GroupListSyncStandbys(List *groupNodeList);
+extern List *GroupListCandidatesInZone(List *groupNodeList, const char *zone);
+extern List *NodesInOtherZonesFirst(List *nodesList, const char *zone);
+extern bool IsNodeInZone(AutoFailoverNode *node, const char *zone);
+extern bool NodeReplicationLag(AutoFailoverNode *node, List *nodesList,
+							   int64 *lagBytes);
+extern List *ListReadableNodes(List *nodesList, int64 maxLagBytes);
 extern bool AllNodesHaveSameCandidatePriority(List *groupNodeList);
 extern int CountStandbyCandidates(AutoFailoverNode *primaryNode,
 								  List *stateList);
@@ -127,7 +139,8 @@ extern int AddAutoFailoverNode(char *formationId, int groupId,
 							   ReplicationState goalState,
 							   ReplicationState reportedState,
 							   int candidatePriority,
-							   bool replicationQuorum);
+							   bool replicationQuorum,
+							   char *nodeZone);
 extern void SetNodeGoalState(char *nodeName, int nodePort,
 							 ReplicationState goalState);
 extern void ReportAutoFailoverNodeState(char *nodeName, int nodePort,
@@ -143,7 +156,12 @@ extern void ReportAutoFailoverNodeReplicationSetting(int nodeid,
 													 int nodePort,
 													 int candidatePriority,
 													 bool replicationQuorum);
+extern void SetNodeQuorumExcluded(int nodeId, bool quorumExcluded);
 extern void RemoveAutoFailoverNode(char *nodeName, int nodePort);
+extern bool StartRollingRestart(char *formationId);
+extern List * RollingRestartPendingNodeIds(char *formationId);
+extern void SetNodeRestarted(int nodeId);
+extern void FinishRollingRestart(char *formationId);
 
 extern SyncState SyncStateFromString(const char *pgsrSyncState);
 extern char *SyncStateToString(SyncState pgsrSyncState);
@@ -15,6 +15,7 @@
 
 #include "metadata.h"
 #include "notifications.h"
+#include "plan_cache.h"
 #include "replication_state.h"
 
 #include "catalog/pg_type.h"
@@ -173,8 +174,8 @@ InsertEvent(const char *formationId, int groupId, int64 nodeId,
 
 	SPI_connect();
 
-	spiStatus = SPI_execute_with_args(insertQuery, argCount, argTypes,
-									  argValues, NULL, false, 0);
+	spiStatus = ExecuteCachedPlan(insertQuery, argCount, argTypes,
+								  argValues, NULL, false, 0);
 
 	if (spiStatus == SPI_OK_INSERT_RETURNING && SPI_processed > 0)
 	{
@@ -137,6 +137,13 @@ StartMonitorNode(void)
 							NULL, &StartupGracePeriodMs, 10 * 1000, 1, INT_MAX,
 							PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
 
+	DefineCustomIntVariable("pgautofailover.sync_standby_max_lag",
+							"Temporarily remove synchronous standby nodes that lag"
+							" more than this many bytes behind the primary, 0"
+							" disables",
+							NULL, &SyncStandbyMaxLagBytes, 0, 0,
+							INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
 	PreviousProcessUtility_hook = ProcessUtility_hook;
 	ProcessUtility_hook = pgautofailover_ProcessUtility;
 
@@ -160,6 +167,9 @@ StartMonitorNode(void)
  * background workers attached to a database when a DROP DATABASE command is
  * executed. As long as the background worker is connected, the DROP DATABASE
  * command would otherwise fail to complete.
+ *
+ * It also makes backends check the extension version again when extensions
+ * are created, updated or dropped.
  */
 void
 pgautofailover_ProcessUtility(PlannedStmt *pstmt,
@@ -198,4 +208,12 @@ pgautofailover_ProcessUtility(PlannedStmt *pstmt,
 		standard_ProcessUtility(pstmt, queryString, context,
 								params, queryEnv, dest, completionTag);
 	}
+
+	if (IsA(parsetree, CreateExtensionStmt) ||
+		IsA(parsetree, AlterExtensionStmt) ||
+		(IsA(parsetree, DropStmt) &&
+		 ((DropStmt *) parsetree)->removeType == OBJECT_EXTENSION))
+	{
+		InvalidateExtensionVersionCache();
+	}
 }
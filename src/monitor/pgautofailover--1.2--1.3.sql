@@ -0,0 +1,163 @@
+--
+-- extension update file from 1.2 to 1.3
+--
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "ALTER EXTENSION pgautofailover UPDATE TO 1.3" to load this file. \quit
+
+CREATE FUNCTION pgautofailover.perform_switchover
+ (
+  formation_id text default 'default',
+  group_id     int  default 0
+ )
+RETURNS void LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$perform_switchover$$;
+
+comment on function pgautofailover.perform_switchover(text,int)
+        is 'manually switchover from the primary to the best standby node';
+
+grant execute on function pgautofailover.perform_switchover(text,int)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.readable_nodes
+ (
+    IN formation_id     text default 'default',
+    IN max_lag_bytes    bigint default -1,
+   OUT node_id          int,
+   OUT group_id         int,
+   OUT node_name        text,
+   OUT node_port        int,
+   OUT node_lsn         pg_lsn,
+   OUT lag_bytes        bigint
+ )
+RETURNS SETOF record LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$readable_nodes$$;
+
+comment on function pgautofailover.readable_nodes(text,bigint)
+        is 'get the healthy secondary nodes of a formation, freshest first';
+
+grant execute on function pgautofailover.readable_nodes(text,bigint)
+   to autoctl_node;
+
+CREATE TABLE pgautofailover.rolling_restart
+ (
+    formationid       text not null,
+    nodeid            bigint not null,
+    groupid           int not null,
+    starttime         timestamptz not null default now(),
+    restarttime       timestamptz,
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid) REFERENCES pgautofailover.node(nodeid)
+      ON DELETE CASCADE
+ );
+
+GRANT SELECT ON pgautofailover.rolling_restart TO autoctl_node;
+
+CREATE FUNCTION pgautofailover.perform_rolling_restart
+ (
+  formation_id text default 'default'
+ )
+RETURNS int LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$perform_rolling_restart$$;
+
+comment on function pgautofailover.perform_rolling_restart(text)
+        is 'restart every node of a formation, one node per group at a time';
+
+grant execute on function pgautofailover.perform_rolling_restart(text)
+   to autoctl_node;
+
+ALTER TABLE pgautofailover.node
+  ADD COLUMN nodezone text not null default '';
+
+DROP FUNCTION pgautofailover.register_node(text,text,int,name,int,
+                          pgautofailover.replication_state,text,int,bool);
+
+CREATE FUNCTION pgautofailover.register_node
+ (
+    IN formation_id         text,
+    IN node_name            text,
+    IN node_port            int,
+    IN dbname               name,
+    IN desired_group_id     int default -1,
+    IN initial_group_role   pgautofailover.replication_state default 'init',
+    IN node_kind            text default 'standalone',
+    IN candidate_priority 	int default 100,
+    IN replication_quorum	bool default true,
+    IN node_zone            text default '',
+   OUT assigned_node_id     int,
+   OUT assigned_group_id    int,
+   OUT assigned_group_state pgautofailover.replication_state,
+   OUT assigned_candidate_priority 	int,
+   OUT assigned_replication_quorum  bool
+ )
+RETURNS record LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$register_node$$;
+
+grant execute on function
+      pgautofailover.register_node(text,text,int,name,int,pgautofailover.replication_state,text, int, bool, text)
+   to autoctl_node;
+
+ALTER TABLE pgautofailover.node
+  ADD COLUMN quorumexcluded bool not null default false;
+
+-- node_active looks up the nodes of a group at each call
+CREATE INDEX node_formationid_groupid_idx
+    ON pgautofailover.node (formationid, groupid);
+
+CREATE TABLE pgautofailover.standby_telemetry
+ (
+    nodeid            bigint not null,
+    primarynodeid     bigint not null,
+    writelsn          pg_lsn,
+    flushlsn          pg_lsn,
+    replaylsn         pg_lsn,
+    writelag          interval,
+    flushlag          interval,
+    replaylag         interval,
+    reporttime        timestamptz not null default now(),
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid) REFERENCES pgautofailover.node(nodeid)
+      ON DELETE CASCADE
+ )
+ -- one row per standby node, updated at each node_active call of the primary
+ WITH (fillfactor = 25);
+
+GRANT SELECT ON pgautofailover.standby_telemetry TO autoctl_node;
+
+DROP FUNCTION pgautofailover.node_active(text,text,int,int,int,
+                          pgautofailover.replication_state,bool,pg_lsn,text);
+
+CREATE FUNCTION pgautofailover.node_active
+ (
+    IN formation_id           		text,
+    IN node_name              		text,
+    IN node_port              		int,
+    IN current_node_id        		int default -1,
+    IN current_group_id       		int default -1,
+    IN current_group_role     		pgautofailover.replication_state default 'init',
+    IN current_pg_is_running  		bool default true,
+    IN current_lsn			  		pg_lsn default '0/0',
+    IN current_rep_state      		text default '',
+    IN standby_node_ids             int[] default '{}',
+    IN standby_write_lsns           pg_lsn[] default '{}',
+    IN standby_flush_lsns           pg_lsn[] default '{}',
+    IN standby_replay_lsns          pg_lsn[] default '{}',
+    IN standby_write_lags           interval[] default '{}',
+    IN standby_flush_lags           interval[] default '{}',
+    IN standby_replay_lags          interval[] default '{}',
+   OUT assigned_node_id       		int,
+   OUT assigned_group_id      		int,
+   OUT assigned_group_state   		pgautofailover.replication_state,
+   OUT assigned_candidate_priority 	int,
+   OUT assigned_replication_quorum  bool
+ )
+RETURNS record LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$node_active$$;
+
+grant execute on function
+      pgautofailover.node_active(text,text,int,int,int,
+                          pgautofailover.replication_state,bool,pg_lsn,text,
+                          int[],pg_lsn[],pg_lsn[],pg_lsn[],
+                          interval[],interval[],interval[])
+   to autoctl_node;
@@ -109,6 +109,8 @@ CREATE TABLE pgautofailover.node
     statechangetime      timestamptz not null default now(),
     candidatepriority	 int not null default 100,
     replicationquorum	 bool not null default true,
+    nodezone             text not null default '',
+    quorumexcluded       bool not null default false,
 
     UNIQUE (nodename, nodeport),
     PRIMARY KEY (nodeid),
@@ -117,6 +119,10 @@ CREATE TABLE pgautofailover.node
  -- we expect few rows and lots of UPDATE, let's benefit from HOT
  WITH (fillfactor = 25);
 
+-- node_active looks up the nodes of a group at each call
+CREATE INDEX node_formationid_groupid_idx
+    ON pgautofailover.node (formationid, groupid);
+
 CREATE TABLE pgautofailover.event
  (
     eventid           bigserial not null,
@@ -137,6 +143,38 @@ CREATE TABLE pgautofailover.event
     PRIMARY KEY (eventid)
  );
 
+CREATE TABLE pgautofailover.rolling_restart
+ (
+    formationid       text not null,
+    nodeid            bigint not null,
+    groupid           int not null,
+    starttime         timestamptz not null default now(),
+    restarttime       timestamptz,
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid) REFERENCES pgautofailover.node(nodeid)
+      ON DELETE CASCADE
+ );
+
+CREATE TABLE pgautofailover.standby_telemetry
+ (
+    nodeid            bigint not null,
+    primarynodeid     bigint not null,
+    writelsn          pg_lsn,
+    flushlsn          pg_lsn,
+    replaylsn         pg_lsn,
+    writelag          interval,
+    flushlag          interval,
+    replaylag         interval,
+    reporttime        timestamptz not null default now(),
+
+    PRIMARY KEY (nodeid),
+    FOREIGN KEY (nodeid) REFERENCES pgautofailover.node(nodeid)
+      ON DELETE CASCADE
+ )
+ -- one row per standby node, updated at each node_active call of the primary
+ WITH (fillfactor = 25);
+
 GRANT SELECT ON ALL TABLES IN SCHEMA pgautofailover TO autoctl_node;
 
 CREATE FUNCTION pgautofailover.set_node_nodename
@@ -170,6 +208,7 @@ CREATE FUNCTION pgautofailover.register_node
     IN node_kind            text default 'standalone',
     IN candidate_priority 	int default 100,
     IN replication_quorum	bool default true,
+    IN node_zone            text default '',
    OUT assigned_node_id     int,
    OUT assigned_group_id    int,
    OUT assigned_group_state pgautofailover.replication_state,
@@ -180,7 +219,7 @@ RETURNS record LANGUAGE C STRICT SECURITY DEFINER
 AS 'MODULE_PATHNAME', $$register_node$$;
 
 grant execute on function
-      pgautofailover.register_node(text,text,int,name,int,pgautofailover.replication_state,text, int, bool)
+      pgautofailover.register_node(text,text,int,name,int,pgautofailover.replication_state,text, int, bool, text)
    to autoctl_node;
 
 
@@ -195,6 +234,13 @@ CREATE FUNCTION pgautofailover.node_active
     IN current_pg_is_running  		bool default true,
     IN current_lsn			  		pg_lsn default '0/0',
     IN current_rep_state      		text default '',
+    IN standby_node_ids             int[] default '{}',
+    IN standby_write_lsns           pg_lsn[] default '{}',
+    IN standby_flush_lsns           pg_lsn[] default '{}',
+    IN standby_replay_lsns          pg_lsn[] default '{}',
+    IN standby_write_lags           interval[] default '{}',
+    IN standby_flush_lags           interval[] default '{}',
+    IN standby_replay_lags          interval[] default '{}',
    OUT assigned_node_id       		int,
    OUT assigned_group_id      		int,
    OUT assigned_group_state   		pgautofailover.replication_state,
@@ -206,7 +252,9 @@ AS 'MODULE_PATHNAME', $$node_active$$;
 
 grant execute on function
       pgautofailover.node_active(text,text,int,int,int,
-                          pgautofailover.replication_state,bool,pg_lsn,text)
+                          pgautofailover.replication_state,bool,pg_lsn,text,
+                          int[],pg_lsn[],pg_lsn[],pg_lsn[],
+                          interval[],interval[],interval[])
    to autoctl_node;
 
 CREATE FUNCTION pgautofailover.get_nodes
@@ -228,6 +276,26 @@ comment on function pgautofailover.get_nodes(text,int)
 grant execute on function pgautofailover.get_nodes(text,int)
    to autoctl_node;
 
+CREATE FUNCTION pgautofailover.readable_nodes
+ (
+    IN formation_id     text default 'default',
+    IN max_lag_bytes    bigint default -1,
+   OUT node_id          int,
+   OUT group_id         int,
+   OUT node_name        text,
+   OUT node_port        int,
+   OUT node_lsn         pg_lsn,
+   OUT lag_bytes        bigint
+ )
+RETURNS SETOF record LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$readable_nodes$$;
+
+comment on function pgautofailover.readable_nodes(text,bigint)
+        is 'get the healthy secondary nodes of a formation, freshest first';
+
+grant execute on function pgautofailover.readable_nodes(text,bigint)
+   to autoctl_node;
+
 CREATE FUNCTION pgautofailover.get_primary
  (
     IN formation_id      text default 'default',
@@ -334,6 +402,33 @@ comment on function pgautofailover.perform_failover(text,int)
 grant execute on function pgautofailover.perform_failover(text,int)
    to autoctl_node;
 
+CREATE FUNCTION pgautofailover.perform_switchover
+ (
+  formation_id text default 'default',
+  group_id     int  default 0
+ )
+RETURNS void LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$perform_switchover$$;
+
+comment on function pgautofailover.perform_switchover(text,int)
+        is 'manually switchover from the primary to the best standby node';
+
+grant execute on function pgautofailover.perform_switchover(text,int)
+   to autoctl_node;
+
+CREATE FUNCTION pgautofailover.perform_rolling_restart
+ (
+  formation_id text default 'default'
+ )
+RETURNS int LANGUAGE C STRICT SECURITY DEFINER
+AS 'MODULE_PATHNAME', $$perform_rolling_restart$$;
+
+comment on function pgautofailover.perform_rolling_restart(text)
+        is 'restart every node of a formation, one node per group at a time';
+
+grant execute on function pgautofailover.perform_rolling_restart(text)
+   to autoctl_node;
+
 CREATE FUNCTION pgautofailover.start_maintenance
  (
    node_name text,
@@ -0,0 +1,196 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/plan_cache.c
+ *
+ * Implementation of a cache of prepared SPI plans for the monitor metadata
+ * queries.
+ *
+ * The metadata functions run the same few queries over and over again, for
+ * instance at each node_active call. Instead of parsing, analyzing and
+ * planning the query text at each call with SPI_execute_with_args, we
+ * prepare each query once per backend and keep the plan around. The plans
+ * are dropped when the extension is created, updated or dropped, see
+ * InvalidateExtensionVersionCache().
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "plan_cache.h"
+
+#include "catalog/pg_extension.h"
+#include "executor/spi.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+
+
+/*
+ * The hash table is keyed by the query text. Entries point to their own copy
+ * of the query, and lookups use the caller's query.
+ */
+typedef struct CachedPlanEntry
+{
+	const char *query;
+	SPIPlanPtr plan;
+} CachedPlanEntry;
+
+static HTAB *CachedPlans = NULL;
+static bool CachedPlansAreValid = false;
+static bool CachedPlansCallbackRegistered = false;
+
+static void InitCachedPlans(void);
+static void ResetCachedPlans(void);
+static void CachedPlansInvalidationCallback(Datum argument, Oid relationId);
+static uint32 CachedPlanHash(const void *key, Size keysize);
+static int CachedPlanMatch(const void *key1, const void *key2, Size keysize);
+
+
+/*
+ * ExecuteCachedPlan is a replacement for SPI_execute_with_args that prepares
+ * the given query only once per backend. The caller must have connected to
+ * SPI already.
+ */
+int
+ExecuteCachedPlan(const char *query, int argCount, Oid *argTypes,
+				  Datum *argValues, const char *nulls,
+				  bool readOnly, long count)
+{
+	CachedPlanEntry *entry = NULL;
+	bool found = false;
+
+	if (!CachedPlansAreValid)
+	{
+		ResetCachedPlans();
+	}
+
+	entry = (CachedPlanEntry *) hash_search(CachedPlans, &query,
+											HASH_FIND, &found);
+
+	if (!found)
+	{
+		SPIPlanPtr plan = SPI_prepare(query, argCount, argTypes);
+
+		if (plan == NULL)
+		{
+			elog(ERROR, "could not prepare query: %s",
+				 SPI_result_code_string(SPI_result));
+		}
+
+		if (SPI_keepplan(plan) != 0)
+		{
+			elog(ERROR, "could not keep the plan of query: %s", query);
+		}
+
+		entry = (CachedPlanEntry *) hash_search(CachedPlans, &query,
+												HASH_ENTER, &found);
+
+		entry->query = MemoryContextStrdup(CacheMemoryContext, query);
+		entry->plan = plan;
+	}
+
+	return SPI_execute_plan(entry->plan, argValues, nulls, readOnly, count);
+}
+
+
+/*
+ * InitCachedPlans creates the hash table of cached plans.
+ */
+static void
+InitCachedPlans(void)
+{
+	HASHCTL info;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(const char *);
+	info.entrysize = sizeof(CachedPlanEntry);
+	info.hash = CachedPlanHash;
+	info.match = CachedPlanMatch;
+	info.hcxt = CacheMemoryContext;
+
+	CachedPlans = hash_create("pg_auto_failover cached plans", 32, &info,
+							  HASH_ELEM | HASH_FUNCTION | HASH_COMPARE |
+							  HASH_CONTEXT);
+
+	if (!CachedPlansCallbackRegistered)
+	{
+		CacheRegisterRelcacheCallback(CachedPlansInvalidationCallback,
+									  (Datum) 0);
+		CachedPlansCallbackRegistered = true;
+	}
+}
+
+
+/*
+ * ResetCachedPlans frees all the plans we kept, and starts again with an
+ * empty cache. We only do that at the beginning of ExecuteCachedPlan, when
+ * none of the cached plans is being executed.
+ */
+static void
+ResetCachedPlans(void)
+{
+	if (CachedPlans != NULL)
+	{
+		HASH_SEQ_STATUS status;
+		CachedPlanEntry *entry = NULL;
+
+		hash_seq_init(&status, CachedPlans);
+
+		while ((entry = (CachedPlanEntry *) hash_seq_search(&status)) != NULL)
+		{
+			SPI_freeplan(entry->plan);
+			pfree((char *) entry->query);
+		}
+
+		hash_destroy(CachedPlans);
+		CachedPlans = NULL;
+	}
+
+	InitCachedPlans();
+
+	CachedPlansAreValid = true;
+}
+
+
+/*
+ * CachedPlansInvalidationCallback marks our cached plans as invalid when
+ * pg_extension is invalidated, or when the whole relcache is reset. Freeing
+ * the plans here would not be safe, this is done in ResetCachedPlans.
+ */
+static void
+CachedPlansInvalidationCallback(Datum argument, Oid relationId)
+{
+	if (relationId == InvalidOid || relationId == ExtensionRelationId)
+	{
+		CachedPlansAreValid = false;
+	}
+}
+
+
+/*
+ * CachedPlanHash hashes the query text that the given key points to.
+ */
+static uint32
+CachedPlanHash(const void *key, Size keysize)
+{
+	const char *query = *(const char *const *) key;
+
+	return string_hash(query, strlen(query) + 1);
+}
+
+
+/*
+ * CachedPlanMatch compares the query texts that the given keys point to.
+ */
+static int
+CachedPlanMatch(const void *key1, const void *key2, Size keysize)
+{
+	const char *query1 = *(const char *const *) key1;
+	const char *query2 = *(const char *const *) key2;
+
+	return strcmp(query1, query2);
+}
@@ -0,0 +1,21 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/plan_cache.h
+ *
+ * Declarations for the cache of prepared SPI plans used by the monitor
+ * metadata functions.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "postgres.h"
+
+
+extern int ExecuteCachedPlan(const char *query, int argCount, Oid *argTypes,
+							 Datum *argValues, const char *nulls,
+							 bool readOnly, long count);
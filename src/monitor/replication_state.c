@@ -25,11 +25,32 @@
 #include "nodes/parsenodes.h"
 #include "nodes/value.h"
 #include "parser/parse_type.h"
+#include "utils/inval.h"
 #include "utils/syscache.h"
 
 
+/*
+ * We cache the OID of the replication_state type and of each of its enum
+ * values in each backend, as they are needed several times per node_active
+ * call. The cache is reset when pg_type or pg_enum entries are invalidated,
+ * such as when the extension is updated.
+ */
+typedef struct ReplicationStateCache
+{
+	bool valid;
+	Oid typeOid;
+	Oid enumOids[REPLICATION_STATE_UNKNOWN];
+} ReplicationStateCache;
+
+static ReplicationStateCache replicationStateCache = { 0 };
+static bool replicationStateCallbackRegistered = false;
+
+
 /* private function forward declarations */
 static bool IsReplicationStateName(char *name, ReplicationState replicationState);
+static void InitReplicationStateCache(void);
+static void InvalidateReplicationStateCache(Datum argument, int cacheId,
+											uint32 hashValue);
 
 
 /*
@@ -39,13 +60,9 @@ static bool IsReplicationStateName(char *name, ReplicationState replicationState
 Oid
 ReplicationStateTypeOid(void)
 {
-	Value *schemaName = makeString(AUTO_FAILOVER_SCHEMA_NAME);
-	Value *typeName = makeString(REPLICATION_STATE_TYPE_NAME);
-	List *enumTypeNameList = list_make2(schemaName, typeName);
-	TypeName *enumTypeName = makeTypeNameFromNameList(enumTypeNameList);
-	Oid enumTypeOid = typenameTypeId(NULL, enumTypeName);
+	InitReplicationStateCache();
 
-	return enumTypeOid;
+	return replicationStateCache.typeOid;
 }
 
 
@@ -60,6 +77,19 @@ EnumGetReplicationState(Oid replicationStateOid)
 	char *enumName = NULL;
 	ReplicationState replicationState = REPLICATION_STATE_UNKNOWN;
 
+	InitReplicationStateCache();
+
+	for (replicationState = REPLICATION_STATE_INITIAL;
+		 replicationState < REPLICATION_STATE_UNKNOWN;
+		 replicationState++)
+	{
+		if (replicationStateCache.enumOids[replicationState] ==
+			replicationStateOid)
+		{
+			return replicationState;
+		}
+	}
+
 	enumTuple = SearchSysCache1(ENUMOID, ObjectIdGetDatum(replicationStateOid));
 	if (!HeapTupleIsValid(enumTuple))
 	{
@@ -85,24 +115,96 @@ Oid
 ReplicationStateGetEnum(ReplicationState replicationState)
 {
 	Oid replicationStateOid = InvalidOid;
-	const char *enumName = ReplicationStateGetName(replicationState);
-	HeapTuple enumTuple = NULL;
-	Oid enumTypeOid = ReplicationStateTypeOid();
 
-	enumTuple = SearchSysCache2(ENUMTYPOIDNAME,
-								ObjectIdGetDatum(enumTypeOid),
-								CStringGetDatum(enumName));
-	if (!HeapTupleIsValid(enumTuple))
+	InitReplicationStateCache();
+
+	if (replicationState >= REPLICATION_STATE_INITIAL &&
+		replicationState < REPLICATION_STATE_UNKNOWN)
+	{
+		replicationStateOid = replicationStateCache.enumOids[replicationState];
+	}
+
+	if (replicationStateOid == InvalidOid)
 	{
 		ereport(ERROR, (errmsg("invalid value for enum: %d",
 							   replicationState)));
 	}
 
-	replicationStateOid = HeapTupleGetOid(enumTuple);
+	return replicationStateOid;
+}
 
-	ReleaseSysCache(enumTuple);
 
-	return replicationStateOid;
+/*
+ * InitReplicationStateCache looks up the OIDs of the replication_state type
+ * and of its enum values, unless they are already cached. Enum values that
+ * the installed version of the extension doesn't have are cached as
+ * InvalidOid.
+ */
+static void
+InitReplicationStateCache(void)
+{
+	Value *schemaName = NULL;
+	Value *typeName = NULL;
+	List *enumTypeNameList = NIL;
+	TypeName *enumTypeName = NULL;
+	Oid enumTypeOid = InvalidOid;
+	ReplicationState replicationState = REPLICATION_STATE_INITIAL;
+
+	if (replicationStateCache.valid)
+	{
+		return;
+	}
+
+	if (!replicationStateCallbackRegistered)
+	{
+		CacheRegisterSyscacheCallback(TYPEOID,
+									  InvalidateReplicationStateCache,
+									  (Datum) 0);
+		CacheRegisterSyscacheCallback(ENUMOID,
+									  InvalidateReplicationStateCache,
+									  (Datum) 0);
+		replicationStateCallbackRegistered = true;
+	}
+
+	schemaName = makeString(AUTO_FAILOVER_SCHEMA_NAME);
+	typeName = makeString(REPLICATION_STATE_TYPE_NAME);
+	enumTypeNameList = list_make2(schemaName, typeName);
+	enumTypeName = makeTypeNameFromNameList(enumTypeNameList);
+	enumTypeOid = typenameTypeId(NULL, enumTypeName);
+
+	for (replicationState = REPLICATION_STATE_INITIAL;
+		 replicationState < REPLICATION_STATE_UNKNOWN;
+		 replicationState++)
+	{
+		const char *enumName = ReplicationStateGetName(replicationState);
+		HeapTuple enumTuple = SearchSysCache2(ENUMTYPOIDNAME,
+											  ObjectIdGetDatum(enumTypeOid),
+											  CStringGetDatum(enumName));
+
+		replicationStateCache.enumOids[replicationState] = InvalidOid;
+
+		if (HeapTupleIsValid(enumTuple))
+		{
+			replicationStateCache.enumOids[replicationState] =
+				HeapTupleGetOid(enumTuple);
+
+			ReleaseSysCache(enumTuple);
+		}
+	}
+
+	replicationStateCache.typeOid = enumTypeOid;
+	replicationStateCache.valid = true;
+}
+
+
+/*
+ * InvalidateReplicationStateCache resets our cache of OIDs, it is registered
+ * as a syscache callback for pg_type and pg_enum.
+ */
+static void
+InvalidateReplicationStateCache(Datum argument, int cacheId, uint32 hashValue)
+{
+	replicationStateCache.valid = false;
 }
 
 
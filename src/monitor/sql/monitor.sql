@@ -43,3 +43,21 @@ select * from pgautofailover.node_active('default', 'localhost', 9877);
 
 -- should fail as there's no primary at this point
 select pgautofailover.perform_failover();
+
+-- a primary node reports the replication telemetry of its standby nodes,
+-- entries about unknown nodes are skipped
+select *
+  from pgautofailover.node_active('default', 'localhost', 9877,
+                                  current_group_role => 'single',
+                                  current_lsn => '0/3000060',
+                                  standby_node_ids => '{2,42}',
+                                  standby_write_lsns => '{0/3000060,0/3000060}',
+                                  standby_flush_lsns => '{0/3000000,0/3000000}',
+                                  standby_replay_lsns => '{NULL,NULL}',
+                                  standby_write_lags => '{00:00:01,00:00:01}',
+                                  standby_flush_lags => '{00:00:02,00:00:02}',
+                                  standby_replay_lags => '{NULL,NULL}');
+
+select nodeid, primarynodeid, writelsn, flushlsn, replaylsn,
+       writelag, flushlag, replaylag
+  from pgautofailover.standby_telemetry;
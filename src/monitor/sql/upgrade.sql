@@ -7,4 +7,7 @@ CREATE EXTENSION pgautofailover VERSION '1.0';
 ALTER EXTENSION pgautofailover UPDATE TO '1.1';
 \dx pgautofailover
 
+ALTER EXTENSION pgautofailover UPDATE TO '1.3';
+\dx pgautofailover
+
 DROP EXTENSION pgautofailover;
@@ -0,0 +1,216 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/telemetry_metadata.c
+ *
+ * Implementation of functions related to the replication telemetry that
+ * primary nodes report about their standby nodes.
+ *
+ * Standby nodes report their own LSN when they call node_active, which is
+ * up to a keeper main loop iteration apart from when the primary node
+ * reported its LSN. The primary node also reports what pg_stat_replication
+ * knows about each of its standby nodes, and we keep the last report per
+ * standby node in pgautofailover.standby_telemetry.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "fmgr.h"
+
+#include "metadata.h"
+#include "plan_cache.h"
+#include "telemetry_metadata.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "utils/array.h"
+#include "utils/lsyscache.h"
+#include "utils/pg_lsn.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * ReportStandbyTelemetry stores the replication telemetry that the given
+ * primary node reported about its standby nodes. Entries for nodes that are
+ * not registered, such as left-over replication slots, are skipped.
+ */
+void
+ReportStandbyTelemetry(int primaryNodeId, StandbyTelemetryReport *report)
+{
+	ArrayType *nodeIdsArray = DatumGetArrayTypeP(report->nodeIds);
+	Oid lsnArrayTypeOid = get_array_type(LSNOID);
+	Oid intervalArrayTypeOid = get_array_type(INTERVALOID);
+
+	Oid argTypes[] = {
+		INT4OID,              /* primarynodeid */
+		INT4ARRAYOID,         /* nodeid */
+		lsnArrayTypeOid,      /* writelsn */
+		lsnArrayTypeOid,      /* flushlsn */
+		lsnArrayTypeOid,      /* replaylsn */
+		intervalArrayTypeOid, /* writelag */
+		intervalArrayTypeOid, /* flushlag */
+		intervalArrayTypeOid  /* replaylag */
+	};
+
+	Datum argValues[] = {
+		Int32GetDatum(primaryNodeId), /* primarynodeid */
+		report->nodeIds,              /* nodeid */
+		report->writeLSNs,            /* writelsn */
+		report->flushLSNs,            /* flushlsn */
+		report->replayLSNs,           /* replaylsn */
+		report->writeLags,            /* writelag */
+		report->flushLags,            /* flushlag */
+		report->replayLags            /* replaylag */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+	int spiStatus = 0;
+
+	const char *upsertQuery =
+		"INSERT INTO " AUTO_FAILOVER_STANDBY_TELEMETRY_TABLE
+		" (nodeid, primarynodeid, writelsn, flushlsn, replaylsn,"
+		" writelag, flushlag, replaylag, reporttime)"
+		" SELECT report.nodeid, $1, report.writelsn, report.flushlsn,"
+		" report.replaylsn, report.writelag, report.flushlag,"
+		" report.replaylag, now()"
+		" FROM unnest($2, $3, $4, $5, $6, $7, $8)"
+		" AS report(nodeid, writelsn, flushlsn, replaylsn,"
+		" writelag, flushlag, replaylag)"
+		" JOIN " AUTO_FAILOVER_NODE_TABLE " ON node.nodeid = report.nodeid"
+		" ON CONFLICT (nodeid) DO UPDATE"
+		" SET primarynodeid = excluded.primarynodeid,"
+		" writelsn = excluded.writelsn, flushlsn = excluded.flushlsn,"
+		" replaylsn = excluded.replaylsn, writelag = excluded.writelag,"
+		" flushlag = excluded.flushlag, replaylag = excluded.replaylag,"
+		" reporttime = excluded.reporttime";
+
+	if (ArrayGetNItems(ARR_NDIM(nodeIdsArray), ARR_DIMS(nodeIdsArray)) == 0)
+	{
+		/* not a primary node, or no standby node is connected */
+		return;
+	}
+
+	SPI_connect();
+
+	spiStatus = ExecuteCachedPlan(upsertQuery, argCount, argTypes,
+								  argValues, NULL, false, 0);
+
+	if (spiStatus != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not insert into "
+			 AUTO_FAILOVER_STANDBY_TELEMETRY_TABLE);
+	}
+
+	SPI_finish();
+}
+
+
+/*
+ * GetStandbyTelemetryList returns the last replication telemetry reported by
+ * the given primary node about each of its standby nodes, as a list of
+ * StandbyTelemetry entries, in a single scan of the table. The group state
+ * machine then looks up the standby nodes it needs with
+ * FindStandbyTelemetry.
+ */
+List *
+GetStandbyTelemetryList(int primaryNodeId)
+{
+	List *telemetryList = NIL;
+	MemoryContext callerContext = CurrentMemoryContext;
+
+	Oid argTypes[] = {
+		INT8OID /* primarynodeid */
+	};
+
+	Datum argValues[] = {
+		Int64GetDatum((int64) primaryNodeId) /* primarynodeid */
+	};
+	const int argCount = sizeof(argValues) / sizeof(argValues[0]);
+	int spiStatus = 0;
+	uint64 rowNumber = 0;
+
+	const char *selectQuery =
+		"SELECT nodeid, writelsn, flushlsn, replaylsn, reporttime"
+		" FROM " AUTO_FAILOVER_STANDBY_TELEMETRY_TABLE
+		" WHERE primarynodeid = $1";
+
+	SPI_connect();
+
+	spiStatus = ExecuteCachedPlan(selectQuery, argCount, argTypes, argValues,
+								  NULL, false, 0);
+	if (spiStatus != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not select from "
+			 AUTO_FAILOVER_STANDBY_TELEMETRY_TABLE);
+	}
+
+	for (rowNumber = 0; rowNumber < SPI_processed; rowNumber++)
+	{
+		HeapTuple heapTuple = SPI_tuptable->vals[rowNumber];
+		TupleDesc tupleDescriptor = SPI_tuptable->tupdesc;
+		MemoryContext spiContext = MemoryContextSwitchTo(callerContext);
+		StandbyTelemetry *telemetry =
+			(StandbyTelemetry *) palloc0(sizeof(StandbyTelemetry));
+		bool isNull = false;
+		Datum nodeId = 0;
+		Datum writeLSN = 0;
+		Datum flushLSN = 0;
+		Datum replayLSN = 0;
+		Datum reportTime = 0;
+
+		nodeId = SPI_getbinval(heapTuple, tupleDescriptor, 1, &isNull);
+		telemetry->nodeId = (int) DatumGetInt64(nodeId);
+		telemetry->primaryNodeId = primaryNodeId;
+
+		/* LSNs are NULL until the standby node replies to the primary */
+		writeLSN = SPI_getbinval(heapTuple, tupleDescriptor, 2, &isNull);
+		telemetry->writeLSN =
+			isNull ? InvalidXLogRecPtr : DatumGetLSN(writeLSN);
+
+		flushLSN = SPI_getbinval(heapTuple, tupleDescriptor, 3, &isNull);
+		telemetry->flushLSN =
+			isNull ? InvalidXLogRecPtr : DatumGetLSN(flushLSN);
+
+		replayLSN = SPI_getbinval(heapTuple, tupleDescriptor, 4, &isNull);
+		telemetry->replayLSN =
+			isNull ? InvalidXLogRecPtr : DatumGetLSN(replayLSN);
+
+		reportTime = SPI_getbinval(heapTuple, tupleDescriptor, 5, &isNull);
+		telemetry->reportTime = DatumGetTimestampTz(reportTime);
+
+		telemetryList = lappend(telemetryList, telemetry);
+
+		MemoryContextSwitchTo(spiContext);
+	}
+
+	SPI_finish();
+
+	return telemetryList;
+}
+
+
+/*
+ * FindStandbyTelemetry returns the entry of the given standby node in a list
+ * obtained with GetStandbyTelemetryList, or NULL when there is none.
+ */
+StandbyTelemetry *
+FindStandbyTelemetry(List *telemetryList, int nodeId)
+{
+	ListCell *telemetryCell = NULL;
+
+	foreach(telemetryCell, telemetryList)
+	{
+		StandbyTelemetry *telemetry =
+			(StandbyTelemetry *) lfirst(telemetryCell);
+
+		if (telemetry->nodeId == nodeId)
+		{
+			return telemetry;
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,61 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/monitor/telemetry_metadata.h
+ *
+ * Declarations for public functions and types related to the replication
+ * telemetry that primary nodes report about their standby nodes.
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the PostgreSQL License.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "postgres.h"
+
+#include "access/xlogdefs.h"
+#include "datatype/timestamp.h"
+#include "nodes/pg_list.h"
+
+
+/*
+ * StandbyTelemetryReport holds the arrays that a primary node sends to
+ * node_active, one entry per standby node connected to its replication
+ * slots: node ids, write/flush/replay LSNs and lags, as found in
+ * pg_stat_replication.
+ */
+typedef struct StandbyTelemetryReport
+{
+	Datum nodeIds;      /* int[] */
+	Datum writeLSNs;    /* pg_lsn[] */
+	Datum flushLSNs;    /* pg_lsn[] */
+	Datum replayLSNs;   /* pg_lsn[] */
+	Datum writeLags;    /* interval[] */
+	Datum flushLags;    /* interval[] */
+	Datum replayLags;   /* interval[] */
+} StandbyTelemetryReport;
+
+
+/*
+ * StandbyTelemetry is what the primary node last reported about one of its
+ * standby nodes.
+ */
+typedef struct StandbyTelemetry
+{
+	int nodeId;
+	int primaryNodeId;
+	XLogRecPtr writeLSN;
+	XLogRecPtr flushLSN;
+	XLogRecPtr replayLSN;
+	TimestampTz reportTime;
+} StandbyTelemetry;
+
+
+/* public function declarations */
+extern void ReportStandbyTelemetry(int primaryNodeId,
+								   StandbyTelemetryReport *report);
+extern List * GetStandbyTelemetryList(int primaryNodeId);
+extern StandbyTelemetry * FindStandbyTelemetry(List *telemetryList,
+											   int nodeId);
@@ -44,6 +44,10 @@ extern List *list_qsort(const List *list, list_qsort_comparator cmp);
 #define table_beginscan_catalog heap_beginscan_catalog
 #define TableScanDesc HeapScanDesc
 
+#define TM_Result HTSU_Result
+#define TM_FailureData HeapUpdateFailureData
+#define TM_Ok HeapTupleMayBeUpdated
+
 #endif
 
 #if (PG_VERSION_NUM >= 120000)
@@ -120,6 +120,24 @@ class VirtualNode:
             # Namespace doesn't exist. Return silently.
             pass
 
+    def ifdown(self):
+        """
+        Disconnects this virtual node from the virtual network, simulating a
+        network partition.
+        """
+        self._set_peer_state('down')
+
+    def ifup(self):
+        """
+        Connects this virtual node back to the virtual network.
+        """
+        self._set_peer_state('up')
+
+    def _set_peer_state(self, state):
+        with IPRoute() as ipr:
+            idx = ipr.link_lookup(ifname=self.vethPeer)[0]
+            ipr.link('set', index=idx, state=state)
+
     def run(self, command, user=os.getenv("USER")):
         """
         Executes a command under the given user from this virtual node. Returns
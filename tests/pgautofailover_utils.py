@@ -66,12 +66,16 @@ class Cluster:
                         listen_flag=False, role=Role.Postgres,
                         formation=None, authMethod=None,
                         sslMode=None, sslSelfSigned=False,
-                        sslCAFile=None, sslServerKey=None, sslServerCert=None):
+                        sslCAFile=None, sslServerKey=None, sslServerCert=None,
+                        zone=None, vnode=None):
         """
         Initializes a data node and returns an instance of DataNode. This will
-        do the "keeper init" and "pg_autoctl run" commands.
+        do the "keeper init" and "pg_autoctl run" commands. Several data nodes
+        can share the same virtual node when given a vnode, using different
+        ports.
         """
-        vnode = self.vlan.create_node()
+        if vnode is None:
+            vnode = self.vlan.create_node()
         nodeid = len(self.datanodes) + 1
 
         datanode = DataNode(datadir, vnode, port,
@@ -82,7 +86,8 @@ class Cluster:
                             sslSelfSigned=sslSelfSigned,
                             sslCAFile=sslCAFile,
                             sslServerKey=sslServerKey,
-                            sslServerCert=sslServerCert)
+                            sslServerCert=sslServerCert,
+                            zone=zone)
         self.datanodes.append(datanode)
         return datanode
 
@@ -205,6 +210,18 @@ class PGNode:
             except psycopg2.ProgrammingError:
                 return None
 
+    def run_sql_command(self, command):
+        """
+        Runs the given sql command outside of a transaction block in this
+        postgres node, as needed for ALTER SYSTEM.
+        """
+        conn = psycopg2.connect(self.connection_string())
+        try:
+            conn.autocommit = True
+            conn.cursor().execute(command)
+        finally:
+            conn.close()
+
     def set_user_password(self, username, password):
         """
         Sets user passwords on the PGNode
@@ -395,15 +412,17 @@ class PGNode:
                                    'config', 'get', setting)
         return out[:-1]
 
-    def show_uri(self, json=False):
+    def show_uri(self, json=False, readonly=False):
         """
         Runs pg_autoctl show uri
         """
         command = PGAutoCtl(self.vnode, self.datadir)
+        args = ['show', 'uri']
+        if readonly:
+            args.append('--readonly')
         if json:
-            out, err = command.execute("show uri", 'show', 'uri', '--json')
-        else:
-            out, err = command.execute("show uri", 'show', 'uri')
+            args.append('--json')
+        out, err = command.execute("show uri", *args)
         return out
 
 
@@ -412,7 +431,8 @@ class DataNode(PGNode):
                  username, authMethod, database, monitor,
                  nodeid, group, listen_flag, role, formation,
                  sslMode=None, sslSelfSigned=False,
-                 sslCAFile=None, sslServerKey=None, sslServerCert=None):
+                 sslCAFile=None, sslServerKey=None, sslServerCert=None,
+                 zone=None):
         super().__init__(datadir, vnode, port,
                          username, authMethod, database, role,
                          sslMode=sslMode,
@@ -425,6 +445,7 @@ class DataNode(PGNode):
         self.group = group
         self.listen_flag = listen_flag
         self.formation = formation
+        self.zone = zone
 
     def create(self, run=False, level='-v'):
         """
@@ -473,6 +494,9 @@ class DataNode(PGNode):
         if self.formation:
             create_args += ['--formation', self.formation]
 
+        if self.zone:
+            create_args += ['--zone', self.zone]
+
         if run:
             create_args += ['--run']
 
@@ -897,6 +921,31 @@ class MonitorNode(PGNode):
                          name="manual failover",
                          timeout=COMMAND_TIMEOUT)
 
+    def switchover(self, formation='default', group=0):
+        """
+        performs a planned switchover for given formation and group id
+        """
+        switchover_command_text = \
+            "select * from pgautofailover.perform_switchover('%s', %s)" % \
+            (formation, group)
+        switchover_command = [shutil.which('psql'),
+                              '-d', self.database,
+                              '-c', switchover_command_text]
+        switchover_proc = self.vnode.run(switchover_command)
+        wait_or_timeout_proc(switchover_proc,
+                             name="switchover",
+                             timeout=COMMAND_TIMEOUT)
+
+
+    def perform_rolling_restart(self, formation='default'):
+        """
+        advances the rolling restart of the given formation by one step, and
+        returns how many nodes are left to restart
+        """
+        result = self.run_sql_query(
+            "select pgautofailover.perform_rolling_restart(%s)", formation)
+
+        return result[0][0]
 
     def print_state(self, formation="default"):
         print("pg_autoctl show state --pgdata %s" % self.datadir)
@@ -1,4 +1,5 @@
 import pgautofailover_utils as pgautofailover
+import json
 from nose.tools import *
 
 cluster = None
@@ -46,6 +47,11 @@ def test_004_read_from_secondary():
     results = node2.run_sql_query("SELECT * FROM t1")
     assert results == [(1,), (2,)]
 
+def test_004_show_readonly_uri():
+    uri = json.loads(monitor.show_uri(json=True, readonly=True))
+    assert "%s:%d" % (node2.vnode.address, node2.port) in uri["default"]
+    assert "%s:%d" % (node1.vnode.address, node1.port) not in uri["default"]
+
 @raises(Exception)
 def test_005_writes_to_node2_fail():
     node2.run_sql_query("INSERT INTO t1 VALUES (3)")
@@ -0,0 +1,143 @@
+import os
+import time
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+#
+# This test only uses the monitor: the Citus worker nodes are registered and
+# report to the monitor from here, as their keepers would. The primary nodes
+# use ports where nothing listens, so they fail their health checks as soon
+# as they stop reporting, and the secondary nodes are the monitor's own
+# Postgres instance, reached with different host names.
+#
+
+cluster = None
+monitor = None
+
+# group: (primary, secondary)
+groups = {}
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+class FakeNode:
+    def __init__(self, host, port, group):
+        self.host = host
+        self.port = port
+        self.group = group
+        self.nodeid = None
+        self.state = 'init'
+
+    def register(self):
+        self.nodeid, self.state = monitor.run_sql_query(
+            """
+SELECT assigned_node_id, assigned_group_state
+  FROM pgautofailover.register_node('rack', %s, %s, 'postgres', %s,
+                                    node_kind => 'worker')
+""",
+            self.host, self.port, self.group)[0]
+
+    def report(self):
+        # report the assigned state as reached, as a keeper does
+        self.state = monitor.run_sql_query(
+            """
+SELECT assigned_group_state
+  FROM pgautofailover.node_active('rack', %s, %s, %s, %s, %s, true, '0/0')
+""",
+            self.host, self.port, self.nodeid, self.group, self.state)[0][0]
+
+    def goal_state(self):
+        return monitor.run_sql_query(
+            "SELECT goalstate FROM pgautofailover.node WHERE nodeid = %s",
+            self.nodeid)[0][0]
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/citus_group_failover/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+    # let the health checks reach the secondary nodes, whatever their name
+    hba = os.path.join(monitor.datadir, "pg_hba.conf")
+    with open(hba) as f:
+        rules = f.read()
+    with open(hba, "w") as f:
+        f.write("host postgres pgautofailover_monitor all trust\n" + rules)
+    monitor.run_sql_query("SELECT pg_reload_conf()")
+
+    monitor.run_sql_query(
+        "SELECT pgautofailover.create_formation('rack', 'citus', 'postgres', "
+        "true, 0)")
+
+def test_001_register_worker_groups():
+    secondaries = ["127.0.0.1", "localhost", str(monitor.vnode.address)]
+
+    for group in [1, 2, 3]:
+        primary = FakeNode("127.0.0.1", 6000 + group, group)
+        secondary = FakeNode(secondaries[group - 1], monitor.port, group)
+
+        primary.register()
+        secondary.register()
+
+        groups[group] = (primary, secondary)
+
+    for i in range(60):
+        for primary, secondary in groups.values():
+            primary.report()
+            secondary.report()
+
+        if all(p.state == 'primary' and s.state == 'secondary'
+               for p, s in groups.values()):
+            break
+
+        time.sleep(1)
+
+    for primary, secondary in groups.values():
+        eq_(primary.state, 'primary')
+        eq_(secondary.state, 'secondary')
+
+def test_002_rack_failure():
+    # all the primary nodes stop reporting now, and so does the keeper of
+    # the secondary node of group 3
+    stop = time.time()
+
+    # the secondary nodes of groups 1 and 2 report while the primary nodes
+    # are not considered unhealthy yet, then they stop reporting too: only
+    # the health check worker can start the failovers
+    while time.time() - stop < 12:
+        groups[1][1].report()
+        groups[2][1].report()
+        time.sleep(2)
+
+    for i in range(60):
+        if all(groups[g][1].goal_state() == 'prepare_promotion'
+               for g in [1, 2]):
+            break
+
+        time.sleep(1)
+
+    for group in [1, 2]:
+        primary, secondary = groups[group]
+
+        eq_(secondary.goal_state(), 'prepare_promotion')
+        eq_(primary.goal_state(), 'draining')
+
+    # both failovers were started in the same transaction
+    eventtimes = monitor.run_sql_query(
+        """
+SELECT DISTINCT eventtime
+  FROM pgautofailover.event
+ WHERE formationid = 'rack' AND goalstate = 'prepare_promotion'
+""")
+    eq_(len(eventtimes), 1)
+
+def test_003_no_failover_without_a_reporting_standby():
+    primary, secondary = groups[3]
+
+    eq_(primary.goal_state(), 'primary')
+    eq_(secondary.goal_state(), 'secondary')
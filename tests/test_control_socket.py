@@ -0,0 +1,82 @@
+import json
+import os
+import signal
+import stat
+import time
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def pidfile():
+    command = pgautofailover.PGAutoCtl(node1.vnode, node1.datadir)
+    out, err = command.execute("show file --pid", 'show', 'file', '--pid')
+    return out.strip()
+
+def control(cmd):
+    command = pgautofailover.PGAutoCtl(node1.vnode, node1.datadir)
+    out, err = command.execute("control %s" % cmd, 'control', cmd)
+    return json.loads(out)
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/control_socket/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/control_socket/node1")
+    node1.create(run = True)
+    assert node1.wait_until_state(target_state="single")
+
+def test_002_control_status():
+    status = control("status")
+    assert "error" not in status
+
+def test_003_socket_is_private():
+    socket = os.path.join(os.path.dirname(pidfile()), "pg_autoctl.sock")
+    mode = os.stat(socket).st_mode
+
+    assert stat.S_ISSOCK(mode)
+
+    # created so, not restricted after the fact
+    assert mode & (stat.S_IRWXG | stat.S_IRWXO) == 0
+
+def test_004_stuck_keeper():
+    with open(pidfile()) as f:
+        pid = int(f.readline())
+
+    # the keeper accepts connections in the kernel backlog, but never replies
+    os.kill(pid, signal.SIGSTOP)
+
+    start = time.time()
+    error = None
+
+    try:
+        control("status")
+    except Exception as e:
+        error = str(e)
+    finally:
+        os.kill(pid, signal.SIGCONT)
+
+    # pg_autoctl control gave up on its own, well before the test timeout
+    assert error is not None
+    assert "did not reply" in error
+    assert time.time() - start < pgautofailover.COMMAND_TIMEOUT
+
+def test_005_keeper_resumes():
+    assert node1.wait_until_state(target_state="single")
+
+    status = control("status")
+    assert "error" not in status
@@ -0,0 +1,66 @@
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/create_standby/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/create_standby/node1")
+    node1.create(run = True)
+    assert node1.wait_until_state(target_state="single")
+
+def test_002_init_secondary_while_primary_is_away():
+    global node2
+
+    # the primary keeper is not there to prepare replication for us
+    node1.stop_pg_autoctl()
+
+    node2 = cluster.create_datanode("/tmp/create_standby/node2")
+    node2.create(run = True)
+
+    # more than one polling interval, and the standby still waits
+    for i in range(10):
+        node2.pg_autoctl.consume_output(1)
+
+    assert node2.get_state() == "wait_standby"
+
+def test_003_primary_comes_back():
+    node1.run()
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_004_standby_woke_up_on_notification():
+    # the standby is assigned catchingup in its own node_active call, made as
+    # soon as the primary reported wait_primary rather than at its next
+    # polling tick, 5s later
+    delay = monitor.run_sql_query(
+        """
+SELECT extract(epoch from c.eventtime - w.eventtime)
+  FROM pgautofailover.event w, pgautofailover.event c
+ WHERE w.nodeid = %s AND w.description ~ 'reported new state wait_primary'
+   AND c.nodeid = %s AND c.goalstate = 'catchingup'
+ORDER BY w.eventid DESC, c.eventid
+ LIMIT 1
+""",
+        node1.nodeid, node2.nodeid)[0][0]
+
+    print()
+    print("standby assigned catchingup %ss after wait_primary" % delay)
+
+    assert delay < 3
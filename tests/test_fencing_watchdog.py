@@ -0,0 +1,91 @@
+import os
+import signal
+import time
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+# the default timeout.network_partition_timeout
+PARTITION_TIMEOUT = 20
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def keeper_pid(node):
+    command = pgautofailover.PGAutoCtl(node.vnode, node.datadir)
+    out, err = command.execute("show file --pid", 'show', 'file', '--pid')
+
+    with open(out.strip()) as f:
+        return int(f.readline())
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/fencing_watchdog/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_nodes():
+    global node1, node2
+
+    node1 = cluster.create_datanode("/tmp/fencing_watchdog/node1")
+    node1.create(run = True)
+    assert node1.wait_until_state(target_state="single")
+
+    node2 = cluster.create_datanode("/tmp/fencing_watchdog/node2")
+    node2.create(run = True)
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_002_standby_feedback_prevents_fencing():
+    # the primary does not hear from the monitor, but its standby still
+    # sends replication feedback: no partition, keep serving
+    monitor.vnode.ifdown()
+
+    time.sleep(PARTITION_TIMEOUT + 10)
+
+    assert node1.pg_is_running()
+
+    monitor.vnode.ifup()
+
+    assert node1.wait_until_state(target_state="primary")
+    assert node2.wait_until_state(target_state="secondary")
+
+def test_003_fenced_while_main_loop_is_blocked():
+    # the main loop can't check for the partition, the watchdog still does
+    pid = keeper_pid(node1)
+    os.kill(pid, signal.SIGSTOP)
+
+    start = time.time()
+    node1.vnode.ifdown()
+
+    stopped = False
+
+    try:
+        for i in range(3 * PARTITION_TIMEOUT):
+            time.sleep(1)
+
+            if not node1.pg_is_running():
+                stopped = True
+                break
+    finally:
+        os.kill(pid, signal.SIGCONT)
+
+    assert stopped
+    assert time.time() - start >= PARTITION_TIMEOUT - 5
+
+    assert node2.wait_until_state(target_state="wait_primary")
+
+def test_004_partition_heals():
+    node1.vnode.ifup()
+
+    assert node1.wait_until_state(target_state="secondary")
+    assert node2.wait_until_state(target_state="primary")
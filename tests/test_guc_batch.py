@@ -0,0 +1,64 @@
+import os
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/guc_batch/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_nodes():
+    global node1, node2
+
+    node1 = cluster.create_datanode("/tmp/guc_batch/node1")
+    node1.create()
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+    node2 = cluster.create_datanode("/tmp/guc_batch/node2")
+    node2.create()
+    node2.run()
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_002_alter_system_without_reload():
+    # the value in effect comes from postgresql.conf
+    with open(os.path.join(node2.datadir, "postgresql.conf"), "a") as conf:
+        conf.write("\ndefault_transaction_read_only = on\n")
+    node2.run_sql_query("SELECT pg_reload_conf()")
+
+    # postgresql.auto.conf already has the value the keeper is going to
+    # want after promotion, but the configuration has not been reloaded
+    node2.run_sql_command(
+        "ALTER SYSTEM SET default_transaction_read_only TO 'off'")
+
+    results = node2.run_sql_query("SHOW default_transaction_read_only")
+    assert results == [('on',)]
+
+def test_003_switchover_reloads():
+    monitor.switchover()
+
+    assert node2.wait_until_state(target_state="primary")
+    assert node1.wait_until_state(target_state="secondary")
+
+    results = node2.run_sql_query("SHOW default_transaction_read_only")
+    assert results == [('off',)]
+
+def test_004_writes_to_new_primary():
+    node2.run_sql_query("CREATE TABLE t1(a int)")
+    node2.run_sql_query("INSERT INTO t1 VALUES (1)")
+    results = node2.run_sql_query("SELECT * FROM t1")
+    assert results == [(1,)]
@@ -0,0 +1,83 @@
+import os
+import shutil
+import stat
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+node3 = None
+
+# node1's pg_hba.conf is a symbolic link to this file
+hbafile = "/tmp/hba_batch/conf/pg_hba.conf"
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+    shutil.rmtree("/tmp/hba_batch", ignore_errors=True)
+
+def rules_for(node):
+    address = str(node.vnode.address)
+
+    with open(hbafile) as f:
+        return [line for line in f
+                if address in line and not line.lstrip().startswith('#')]
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/hba_batch/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/hba_batch/node1")
+    node1.create(run = True)
+    assert node1.wait_until_state(target_state="single")
+
+def test_002_symlink_hba_file():
+    os.makedirs(os.path.dirname(hbafile), mode=0o700)
+
+    link = os.path.join(node1.datadir, "pg_hba.conf")
+    shutil.move(link, hbafile)
+    os.chmod(hbafile, 0o600)
+    os.symlink(hbafile, link)
+
+def test_003_init_secondary():
+    global node2
+    node2 = cluster.create_datanode("/tmp/hba_batch/node2")
+    node2.create(run = True)
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_004_hba_file_kept_its_link_and_mode():
+    link = os.path.join(node1.datadir, "pg_hba.conf")
+
+    assert os.path.islink(link)
+    assert os.readlink(link) == hbafile
+    assert stat.S_IMODE(os.stat(hbafile).st_mode) == 0o600
+
+    # the rules for the standby have been added to the target file
+    assert len(rules_for(node2)) > 0
+
+def test_005_rules_are_not_duplicated():
+    global node3
+    count = len(rules_for(node2))
+
+    # the primary grants access to all its standby nodes again
+    node3 = cluster.create_datanode("/tmp/hba_batch/node3")
+    node3.create(run = True)
+    assert node3.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+    assert len(rules_for(node2)) == count
+    assert len(rules_for(node3)) > 0
+
+    assert os.path.islink(os.path.join(node1.datadir, "pg_hba.conf"))
+    assert stat.S_IMODE(os.stat(hbafile).st_mode) == 0o600
@@ -0,0 +1,63 @@
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+# an address of the cluster's network where no node answers
+UNREACHABLE_HOST = "172.27.1.250"
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/monitor_hosts/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_nodes():
+    global node1, node2
+
+    node1 = cluster.create_datanode("/tmp/monitor_hosts/node1")
+    node1.create()
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+    node2 = cluster.create_datanode("/tmp/monitor_hosts/node2")
+    node2.create()
+    node2.run()
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_002_list_an_unreachable_monitor_host_first():
+    # the monitor is now reached only after the first host times out
+    uri = monitor.connection_string().replace(
+        "@", "@%s:%d," % (UNREACHABLE_HOST, monitor.port), 1)
+
+    for node in [node1, node2]:
+        node.stop_pg_autoctl()
+        node.config_set("pg_autoctl.monitor", uri)
+        node.run()
+
+def test_003_nodes_keep_reporting():
+    for i in range(3):
+        for node in [node1, node2]:
+            node.pg_autoctl.consume_output(5)
+
+        # each keeper reported within its last loop iterations
+        results = monitor.run_sql_query(
+            "SELECT count(*) FROM pgautofailover.node "
+            "WHERE reporttime > now() - interval '10s'")
+        assert results == [(2,)]
+
+def test_004_failover():
+    monitor.failover()
+    assert node2.wait_until_state(target_state="primary")
+    assert node1.wait_until_state(target_state="secondary")
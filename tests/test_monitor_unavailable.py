@@ -0,0 +1,59 @@
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/monitor_unavailable/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_nodes():
+    global node1, node2
+
+    node1 = cluster.create_datanode("/tmp/monitor_unavailable/node1")
+    node1.create()
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+    node2 = cluster.create_datanode("/tmp/monitor_unavailable/node2")
+    node2.create()
+    node2.run()
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_002_stop_monitor():
+    monitor.stop_pg_autoctl()
+    monitor.stop_postgres()
+    assert not monitor.pg_is_running()
+
+def test_003_secondary_restarted_without_monitor():
+    # the keeper keeps its current state without the monitor
+    node2.stop_postgres()
+    assert node2.wait_until_pg_is_running()
+
+def test_004_primary_accepts_writes_without_monitor():
+    node1.run_sql_query("CREATE TABLE t1(a int)")
+    node1.run_sql_query("INSERT INTO t1 VALUES (1)")
+
+def test_005_monitor_comes_back():
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+    assert node1.wait_until_state(target_state="primary")
+    assert node2.wait_until_state(target_state="secondary")
+
+def test_006_secondary_replays_writes():
+    results = node2.run_sql_query("SELECT * FROM t1")
+    assert results == [(1,)]
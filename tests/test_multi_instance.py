@@ -0,0 +1,94 @@
+import os
+import time
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def seconds_since_report(node):
+    return monitor.run_sql_query(
+        """
+SELECT extract(epoch from now() - reporttime)
+  FROM pgautofailover.node
+ WHERE nodeid = %s
+""",
+        node.nodeid)[0][0]
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/multi_instance/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/multi_instance/node1")
+    node1.create(run = True)
+    assert node1.wait_until_state(target_state="single")
+
+def test_002_init_secondary_on_the_same_host():
+    global node2
+    node2 = cluster.create_datanode("/tmp/multi_instance/node2",
+                                    port=5433, vnode=node1.vnode)
+    node2.create(run = True)
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_003_run_both_instances_in_one_process():
+    node1.stop_pg_autoctl()
+    node2.stop_pg_autoctl()
+
+    shared = pgautofailover.PGAutoCtl(
+        node1.vnode, node1.datadir,
+        ['run', '--pgdata', node1.datadir, '--pgdata', node2.datadir])
+    shared.run()
+
+    # stopping node1 stops the shared process
+    node1.pg_autoctl = shared
+    node2.pg_autoctl = None
+
+    node1.wait_until_pg_is_running()
+    node2.wait_until_pg_is_running()
+
+    assert node1.wait_until_state(target_state="primary")
+    assert node2.wait_until_state(target_state="secondary")
+
+    node1.pg_autoctl.consume_output(10)
+
+    # both instances report to the monitor
+    assert seconds_since_report(node1) < 10
+    assert seconds_since_report(node2) < 10
+
+def test_004_restart_postgres_of_one_instance():
+    node2.stop_postgres()
+    node2.wait_until_pg_is_running()
+
+    assert node1.pg_is_running()
+    assert node2.wait_until_state(target_state="secondary")
+
+def test_005_lost_pidfile_stops_only_that_instance():
+    command = pgautofailover.PGAutoCtl(node2.vnode, node2.datadir)
+    out, err = command.execute("show file --pid", 'show', 'file', '--pid')
+    pidfile = out.strip()
+
+    os.remove(pidfile)
+
+    node1.pg_autoctl.consume_output(15)
+
+    # the process keeps running the other instance
+    assert node1.pg_autoctl.run_proc.poll() is None
+    assert seconds_since_report(node1) < 10
+    assert seconds_since_report(node2) > 10
+
+    assert node1.get_state() == "primary"
@@ -1,11 +1,13 @@
 import pgautofailover_utils as pgautofailover
 from nose.tools import *
+import os
 import time
 
 cluster = None
 monitor = None
 node1 = None
 node2 = None
+node3 = None
 
 def setup_module():
     global cluster
@@ -58,7 +60,28 @@ def test_004_add_standby():
     assert node2.wait_until_state(target_state="secondary")
     assert node1.wait_until_state(target_state="primary")
 
-def test_005_number_sync_standbys():
+def test_005_standby_telemetry():
+    # the primary reports what pg_stat_replication knows about node2
+    query = """
+      SELECT flushlsn IS NOT NULL
+        FROM pgautofailover.standby_telemetry t
+             JOIN pgautofailover.node s ON s.nodeid = t.nodeid
+             JOIN pgautofailover.node p ON p.nodeid = t.primarynodeid
+       WHERE s.nodename = %s AND p.nodename = %s
+    """
+    results = []
+
+    for i in range(10):
+        results = monitor.run_sql_query(query,
+                                        str(node2.vnode.address),
+                                        str(node1.vnode.address))
+        if results == [(True,)]:
+            break
+        time.sleep(1)
+
+    assert results == [(True,)]
+
+def test_006_number_sync_standbys():
     print()
     assert node1.get_number_sync_standbys() == 1
     assert not node1.set_number_sync_standbys(-1)
@@ -78,3 +101,68 @@ def test_005_number_sync_standbys():
     assert node1.get_number_sync_standbys() == 1
     print("synchronous_standby_names = '%s'" %
           node1.get_synchronous_standby_names())
+
+def set_sync_standby_max_lag(value):
+    # ALTER SYSTEM can't run in the transaction that run_sql_query opens
+    auto_conf = os.path.join(monitor.datadir, "postgresql.auto.conf")
+
+    with open(auto_conf, "a") as f:
+        f.write("pgautofailover.sync_standby_max_lag = %d\n" % value)
+
+    monitor.run_sql_query("SELECT pg_reload_conf()")
+
+def wait_for_sync_standby(standby, included):
+    # nodes with the same candidate priority are listed in any order
+    name = "pgautofailover_standby_%d" % standby.nodeid
+    names = None
+
+    for i in range(60):
+        names = node1.get_synchronous_standby_names()
+        if (name in names) == included:
+            break
+        time.sleep(1)
+
+    print("synchronous_standby_names = '%s'" % names)
+    return names.startswith("ANY 1 (") and (name in names) == included
+
+def test_007_add_second_standby():
+    global node3
+
+    node3 = cluster.create_datanode("/tmp/multi_standby/node3")
+    node3.create()
+    node3.run()
+    assert node3.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+    assert wait_for_sync_standby(node2, True)
+    assert wait_for_sync_standby(node3, True)
+
+def test_008_sync_standby_max_lag_excludes():
+    print()
+    set_sync_standby_max_lag(1024 * 1024)
+
+    # node3 stops replicating while the primary writes more than 1MB of WAL
+    node3.stop_pg_autoctl()
+    node3.stop_postgres()
+
+    node1.run_sql_query("CREATE TABLE t1 AS "
+                        "SELECT x, repeat('x', 100) AS filler "
+                        "FROM generate_series(1, 100000) AS x")
+
+    assert wait_for_sync_standby(node3, False)
+    assert wait_for_sync_standby(node2, True)
+    assert node1.wait_until_state(target_state="primary")
+
+    events = node1.get_events_str()
+    print(events)
+    assert "after updating its synchronous standby names" in events
+
+def test_009_sync_standby_max_lag_includes_again():
+    print()
+    node3.run()
+    assert node3.wait_until_state(target_state="secondary")
+
+    assert wait_for_sync_standby(node3, True)
+    assert node1.wait_until_state(target_state="primary")
+
+    set_sync_standby_max_lag(0)
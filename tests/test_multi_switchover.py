@@ -0,0 +1,109 @@
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+node3 = None
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/multi_switchover/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/multi_switchover/node1")
+    node1.create()
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+def test_002_add_standbys():
+    global node2, node3
+
+    node2 = cluster.create_datanode("/tmp/multi_switchover/node2")
+    node2.create()
+    node2.run()
+    assert node2.wait_until_state(target_state="secondary")
+
+    node3 = cluster.create_datanode("/tmp/multi_switchover/node3")
+    node3.create()
+    node3.run()
+    assert node3.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_003_create_t1():
+    node1.run_sql_query("CREATE TABLE t1(a int)")
+    node1.run_sql_query("INSERT INTO t1 VALUES (1), (2)")
+
+def test_004_switchover():
+    # node3 only follows, node2 is the one to promote
+    assert node3.set_candidate_priority(0)
+
+    print()
+    print("Calling pgautofailover.perform_switchover() on the monitor")
+    monitor.switchover()
+
+    assert node2.wait_until_state(target_state="primary")
+    assert node1.wait_until_state(target_state="secondary")
+    assert node3.wait_until_state(target_state="secondary")
+
+def test_005_fast_path_was_used():
+    events = node2.get_events_str()
+    print()
+    print(events)
+
+    # the candidate received all the WAL, no failover transitions
+    assert "received all of its WAL" in events
+    assert "falling back to a failover" not in events
+
+def test_006_writes_to_new_primary():
+    node2.run_sql_query("INSERT INTO t1 VALUES (3)")
+    results = node2.run_sql_query("SELECT * FROM t1 ORDER BY a")
+    assert results == [(1,), (2,), (3,)]
+
+def test_007_standbys_follow_new_primary():
+    # pg_stat_wal_receiver.sender_host is not available in Postgres 10
+    for node in [node1, node3]:
+        results = node.run_sql_query(
+            "SELECT conninfo ~ ('host=' || %s || ' ') "
+            "FROM pg_stat_wal_receiver WHERE status = 'streaming'",
+            str(node2.vnode.address))
+        assert results == [(True,)]
+
+def test_008_switchover_candidate_disappears():
+    # node1 is now the only candidate, and its keeper stops reporting
+    node1.stop_pg_autoctl()
+
+    print()
+    print("Calling pgautofailover.perform_switchover() on the monitor")
+    monitor.switchover()
+
+    # the switchover times out after twice the drain timeout
+    assert node2.wait_until_state(target_state="primary", timeout=180)
+    assert node3.wait_until_state(target_state="secondary")
+
+    events = node2.get_events_str()
+    print()
+    print(events)
+
+    assert "failed to complete within" in events
+
+def test_009_writes_after_switchover_timeout():
+    node2.run_sql_query("INSERT INTO t1 VALUES (4)")
+    results = node2.run_sql_query("SELECT * FROM t1 ORDER BY a")
+    assert results == [(1,), (2,), (3,), (4,)]
+
+def test_010_candidate_rejoins():
+    node1.run()
+    assert node1.wait_until_state(target_state="secondary")
+    assert node2.wait_until_state(target_state="primary")
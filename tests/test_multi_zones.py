@@ -0,0 +1,86 @@
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+import time
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+node3 = None
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def wait_for_synchronous_standby_names(node, expected):
+    names = None
+
+    for i in range(10):
+        names = node.get_synchronous_standby_names()
+        if names == expected:
+            break
+        time.sleep(1)
+
+    print("synchronous_standby_names = '%s'" % names)
+    return names == expected
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/multi_zones/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/multi_zones/node1", zone="a")
+    node1.create()
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+def test_002_add_standbys():
+    global node2, node3
+
+    node2 = cluster.create_datanode("/tmp/multi_zones/node2", zone="a")
+    node2.create()
+    node2.run()
+    assert node2.wait_until_state(target_state="secondary")
+
+    node3 = cluster.create_datanode("/tmp/multi_zones/node3", zone="b")
+    node3.create()
+    node3.run()
+    assert node3.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_003_same_priority_keeps_any():
+    # the standby in the other zone is listed first, ANY is kept
+    print()
+    assert wait_for_synchronous_standby_names(
+        node1, "ANY 1 (pgautofailover_standby_3, pgautofailover_standby_2)")
+
+def test_004_priority_before_zone():
+    # node2 has a higher priority, the zone only orders equal priorities
+    print()
+    assert node3.set_candidate_priority(90)
+    assert node1.wait_until_state(target_state="primary")
+
+    assert wait_for_synchronous_standby_names(
+        node1, "FIRST 1 (pgautofailover_standby_2, pgautofailover_standby_3)")
+
+    assert node3.set_candidate_priority(100)
+    assert node1.wait_until_state(target_state="primary")
+
+    assert wait_for_synchronous_standby_names(
+        node1, "ANY 1 (pgautofailover_standby_3, pgautofailover_standby_2)")
+
+def test_005_failover_prefers_same_zone():
+    # node2 and node3 have the same priority, node2 is in the zone of node1
+    print()
+    print("Calling pgautofailover.failover() on the monitor")
+    monitor.failover()
+
+    assert node2.wait_until_state(target_state="primary")
+    assert node1.wait_until_state(target_state="secondary")
+    assert node3.wait_until_state(target_state="secondary")
@@ -0,0 +1,86 @@
+import time
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+# the default timeout.network_partition_timeout
+PARTITION_TIMEOUT = 20
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def wait_until_pg_is_stopped(node, timeout):
+    for i in range(timeout):
+        if node.pg_autoctl and node.pg_autoctl.run_proc:
+            node.pg_autoctl.consume_output(1)
+        else:
+            time.sleep(1)
+
+        if not node.pg_is_running():
+            return True
+    return False
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/network_partition/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_nodes():
+    global node1, node2
+
+    node1 = cluster.create_datanode("/tmp/network_partition/node1")
+    node1.create(run = True)
+    assert node1.wait_until_state(target_state="single")
+
+    node2 = cluster.create_datanode("/tmp/network_partition/node2")
+    node2.create(run = True)
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_002_partitioned_primary_demotes():
+    start = time.time()
+    node1.vnode.ifdown()
+
+    assert wait_until_pg_is_stopped(node1, 3 * PARTITION_TIMEOUT)
+
+    # not before the network partition timeout has expired
+    assert time.time() - start >= PARTITION_TIMEOUT - 5
+
+    assert node2.wait_until_state(target_state="wait_primary")
+
+def test_003_partition_heals():
+    node1.vnode.ifup()
+
+    assert node1.wait_until_state(target_state="secondary")
+    assert node2.wait_until_state(target_state="primary")
+
+def test_004_partition_detected_across_a_restart():
+    start = time.time()
+    node2.vnode.ifdown()
+
+    # restart the keeper after 15s: the last contacts are seeded from the
+    # state file, the timeout doesn't start over
+    node2.pg_autoctl.consume_output(15)
+    node2.stop_pg_autoctl()
+    node2.run()
+
+    assert wait_until_pg_is_stopped(node2, 3 * PARTITION_TIMEOUT)
+    assert time.time() - start < PARTITION_TIMEOUT + 13
+
+    assert node1.wait_until_state(target_state="wait_primary")
+
+def test_005_partition_heals_again():
+    node2.vnode.ifup()
+
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
@@ -0,0 +1,72 @@
+import psycopg2
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def node_active(lsn):
+    return monitor.run_sql_query(
+        """
+SELECT assigned_group_state
+  FROM pgautofailover.node_active('default', %s, %s, %s, 0, 'single',
+                                  true, %s)
+""",
+        str(node1.vnode.address), node1.port, node1.nodeid, lsn)
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/node_active_in_place/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/node_active_in_place/node1")
+    node1.create(run = True)
+    assert node1.wait_until_state(target_state="single")
+
+    # from now on we report the node state ourselves
+    node1.stop_pg_autoctl()
+
+@raises(psycopg2.IntegrityError)
+def test_002_check_constraint_is_enforced():
+    # the in-place update does not evaluate CHECK constraints, node_active
+    # must go through SPI as soon as the table has one
+    monitor.run_sql_command(
+        "ALTER TABLE pgautofailover.node "
+        "ADD CONSTRAINT reportedlsn_check CHECK (reportedlsn <> '0/42')")
+
+    node_active('0/42')
+
+def test_003_row_not_updated():
+    lsn = monitor.run_sql_query(
+        "SELECT reportedlsn::text FROM pgautofailover.node WHERE nodeid = %s",
+        node1.nodeid)[0][0]
+
+    assert lsn != "0/42"
+
+def test_004_drop_check_constraint():
+    monitor.run_sql_command(
+        "ALTER TABLE pgautofailover.node DROP CONSTRAINT reportedlsn_check")
+
+    node_active('0/42')
+
+    lsn = monitor.run_sql_query(
+        "SELECT reportedlsn::text FROM pgautofailover.node WHERE nodeid = %s",
+        node1.nodeid)[0][0]
+
+    assert lsn == "0/42"
+
+def test_005_keeper_reports_again():
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
@@ -0,0 +1,133 @@
+import os
+import signal
+import socket
+import struct
+import time
+
+import psycopg2
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+proxy = None
+
+PROXY_PORT = 6432
+PROXY_READONLY_PORT = 6433
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    if proxy:
+        proxy.stop()
+    cluster.destroy()
+
+def proxy_query(port, query):
+    with psycopg2.connect(host=str(node1.vnode.address), port=port,
+                          user=node1.username, dbname=node1.database,
+                          connect_timeout=5) as conn:
+        cur = conn.cursor()
+        cur.execute(query)
+        return cur.fetchone()[0]
+
+def proxy_cpu_ticks():
+    # the proxy runs under sudo, find the pg_autoctl process itself
+    for pid in os.listdir("/proc"):
+        if not pid.isdigit():
+            continue
+        try:
+            with open("/proc/%s/cmdline" % pid) as f:
+                argv = f.read().split("\0")
+            if argv[0].endswith("pg_autoctl") and "proxy" in argv:
+                with open("/proc/%s/stat" % pid) as f:
+                    fields = f.read().rsplit(")", 1)[1].split()
+                # utime and stime
+                return int(fields[11]) + int(fields[12])
+        except (FileNotFoundError, ProcessLookupError):
+            continue
+    return None
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/proxy/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_nodes():
+    global node1, node2
+    node1 = cluster.create_datanode("/tmp/proxy/node1")
+    node1.create(run = True)
+    assert node1.wait_until_state(target_state="single")
+
+    node2 = cluster.create_datanode("/tmp/proxy/node2")
+    node2.create(run = True)
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_002_start_proxy():
+    global proxy
+    proxy = pgautofailover.PGAutoCtl(
+        node1.vnode, node1.datadir,
+        ['proxy', '-vv',
+         '--monitor', monitor.connection_string(),
+         '--listen', str(node1.vnode.address),
+         '--port', str(PROXY_PORT),
+         '--readonly-port', str(PROXY_READONLY_PORT)])
+    proxy.run()
+
+    # give the proxy time to fetch its routes from the monitor
+    time.sleep(2)
+
+    assert not proxy_query(PROXY_PORT, "SELECT pg_is_in_recovery()")
+    assert proxy_query(PROXY_READONLY_PORT, "SELECT pg_is_in_recovery()")
+
+def test_003_clients_hanging_up_early():
+    # clients that reset their connection right away, while the proxy is
+    # still connecting to the server, must not keep the event loop busy
+    for i in range(50):
+        s = socket.create_connection((str(node1.vnode.address), PROXY_PORT))
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER,
+                     struct.pack('ii', 1, 0))
+        s.close()
+
+    time.sleep(1)
+
+    before = proxy_cpu_ticks()
+    time.sleep(3)
+    after = proxy_cpu_ticks()
+
+    assert before is not None and after is not None
+
+    # less than half a second of CPU time in 3s
+    assert after - before < os.sysconf('SC_CLK_TCK') / 2
+
+    assert not proxy_query(PROXY_PORT, "SELECT pg_is_in_recovery()")
+
+def test_004_reload_resolves_again():
+    os.killpg(os.getpgid(proxy.run_proc.pid), signal.SIGHUP)
+    time.sleep(1)
+
+    assert not proxy_query(PROXY_PORT, "SELECT pg_is_in_recovery()")
+
+def test_005_failover():
+    monitor.failover()
+    assert node2.wait_until_state(target_state="primary")
+    assert node1.wait_until_state(target_state="secondary")
+
+    # the routes are refreshed on notification, without a DNS round-trip
+    time.sleep(2)
+
+    assert not proxy_query(PROXY_PORT, "SELECT pg_is_in_recovery()")
+    assert proxy_query(PROXY_READONLY_PORT, "SELECT pg_is_in_recovery()")
+
+def test_006_stop_proxy():
+    global proxy
+    out, err = proxy.stop()
+    proxy = None
+
+    assert "resolving node host names again" in err
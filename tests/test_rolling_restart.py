@@ -0,0 +1,99 @@
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+node3 = None
+start_times = {}
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def postmaster_start_time(node):
+    return node.run_sql_query("SELECT pg_postmaster_start_time()")[0][0]
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/rolling_restart/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_nodes():
+    global node1, node2, node3
+
+    node1 = cluster.create_datanode("/tmp/rolling_restart/node1")
+    node1.create()
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+    node2 = cluster.create_datanode("/tmp/rolling_restart/node2")
+    node2.create()
+    node2.run()
+    assert node2.wait_until_state(target_state="secondary")
+
+    node3 = cluster.create_datanode("/tmp/rolling_restart/node3")
+    node3.create()
+    node3.run()
+    assert node3.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+def test_002_record_start_times():
+    for node in [node1, node2, node3]:
+        start_times[node.datadir] = postmaster_start_time(node)
+
+def test_003_rolling_restart():
+    print()
+    print("Calling pgautofailover.perform_rolling_restart() on the monitor")
+
+    for i in range(pgautofailover.STATE_CHANGE_TIMEOUT):
+        if monitor.perform_rolling_restart() == 0:
+            break
+
+        # keep reading from the pg_autoctl processes while they restart
+        for node in [node1, node2, node3]:
+            node.pg_autoctl.consume_output(1)
+    else:
+        assert False, "rolling restart did not complete"
+
+def test_004_nodes_are_back():
+    # the primary is restarted last, by means of a switchover
+    assert node1.wait_until_state(target_state="secondary")
+
+    primary = None
+
+    for node in [node2, node3]:
+        if node.get_state() in ["wait_primary", "primary"]:
+            primary = node
+
+    assert primary is not None
+    assert primary.wait_until_state(target_state="primary")
+
+    for node in [node2, node3]:
+        if node is not primary:
+            assert node.wait_until_state(target_state="secondary")
+
+def test_005_every_postmaster_restarted():
+    for node in [node1, node2, node3]:
+        assert postmaster_start_time(node) > start_times[node.datadir]
+
+def test_006_sync_rep_kept_for_standbys():
+    events = monitor.run_sql_query(
+        "SELECT description FROM pgautofailover.event "
+        "WHERE description ~ 'rolling restart' ORDER BY eventid")
+    print()
+    print(events)
+
+    # with two standby nodes, the primary kept synchronous replication
+    assert not any("to wait_primary and" in e[0] for e in events)
+
+    # and the restarted standby nodes went back to secondary on their own
+    events = monitor.run_sql_query(
+        "SELECT description FROM pgautofailover.event "
+        "WHERE description ~ 'to secondary after it caught up with'")
+    assert len(events) >= 2
@@ -0,0 +1,61 @@
+import os
+import shutil
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+# node1's PGDATA is a symbolic link to this directory
+realdir = "/tmp/speculative_initdb/real/node1"
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+    shutil.rmtree("/tmp/speculative_initdb", ignore_errors=True)
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/speculative_initdb/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_primary_in_symlinked_pgdata():
+    global node1
+
+    os.makedirs(realdir, mode=0o700)
+    os.symlink(realdir, "/tmp/speculative_initdb/node1")
+
+    node1 = cluster.create_datanode("/tmp/speculative_initdb/node1")
+    node1.create(level='-vv')
+
+    # the first node of the group runs initdb while registering
+    assert "while registering to the monitor" in node1.pg_autoctl.err
+
+    # and moving it in place did not replace the symbolic link
+    assert os.path.islink("/tmp/speculative_initdb/node1")
+    assert os.path.isfile(os.path.join(realdir, "PG_VERSION"))
+    assert not os.path.exists(realdir + ".pg_autoctl.initdb")
+
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+def test_002_init_secondary_skips_initdb():
+    global node2
+
+    node2 = cluster.create_datanode("/tmp/speculative_initdb/node2")
+    node2.create(level='-vv')
+
+    # the monitor already has a node in our group: no initdb for nothing
+    assert "while registering to the monitor" not in node2.pg_autoctl.err
+    assert not os.path.exists("/tmp/speculative_initdb/node2.pg_autoctl.initdb")
+
+    node2.run()
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
@@ -0,0 +1,95 @@
+import json
+import os
+import stat
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def show_file(node, option):
+    command = pgautofailover.PGAutoCtl(node.vnode, node.datadir)
+    out, err = command.execute("show file %s" % option, 'show', 'file', option)
+    return out.strip()
+
+def status_file(node):
+    return show_file(node, '--status')
+
+def status(node):
+    command = pgautofailover.PGAutoCtl(node.vnode, node.datadir)
+    out, err = command.execute("show file --status --contents",
+                               'show', 'file', '--status', '--contents',
+                               '--json')
+    return json.loads(out)
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/status_page/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/status_page/node1")
+    node1.create(run = True)
+    assert node1.wait_until_state(target_state="single")
+
+def test_002_status_page_contents():
+    page = status(node1)
+
+    eq_(page["current_role"], "single")
+    eq_(page["assigned_role"], "single")
+    assert page["pg_is_running"]
+    assert not page["transition_in_progress"]
+
+    with open(show_file(node1, '--pid')) as f:
+        eq_(page["pid"], int(f.readline()))
+
+def test_003_status_page_is_private():
+    mode = os.stat(status_file(node1)).st_mode
+
+    eq_(stat.S_IMODE(mode), 0o600)
+
+def test_004_status_page_is_updated():
+    first = status(node1)
+    node1.pg_autoctl.consume_output(12)
+    second = status(node1)
+
+    assert second["iterations"] > first["iterations"]
+    assert second["last_update"] > first["last_update"]
+
+def test_005_readers_always_get_a_consistent_copy():
+    # read while the keeper keeps updating the page
+    for i in range(50):
+        page = status(node1)
+        eq_(page["current_role"], "single")
+
+def test_006_status_page_removed_on_stop():
+    filename = status_file(node1)
+    node1.stop_pg_autoctl()
+
+    assert not os.path.exists(filename)
+
+    # readers report that the keeper is not running, rather than stale data
+    command = pgautofailover.PGAutoCtl(node1.vnode, node1.datadir)
+    try:
+        command.execute("show file --status --contents",
+                        'show', 'file', '--status', '--contents')
+        assert False, "reading the status of a stopped keeper succeeded"
+    except Exception as e:
+        assert "does not exist" in str(e)
+
+def test_007_status_page_back_on_restart():
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+
+    eq_(status(node1)["current_role"], "single")
@@ -0,0 +1,104 @@
+import os
+import signal
+import time
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def postmaster_pid(node):
+    with open(os.path.join(node.datadir, "postmaster.pid")) as f:
+        return int(f.readline())
+
+def parent_command(pid):
+    with open("/proc/%d/stat" % pid) as f:
+        ppid = int(f.read().rsplit(")", 1)[1].split()[1])
+
+    with open("/proc/%d/cmdline" % ppid) as f:
+        return f.read().split("\0")
+
+def wait_for_new_postmaster(node, previous, timeout=30):
+    for i in range(timeout):
+        node.pg_autoctl.consume_output(1)
+        try:
+            pid = postmaster_pid(node)
+            if pid != previous and node.pg_is_running():
+                return pid
+        except (FileNotFoundError, ValueError):
+            pass
+    return None
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/supervise/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_primary():
+    global node1
+    node1 = cluster.create_datanode("/tmp/supervise/node1")
+    node1.create()
+
+    # the keeper starts the postmaster itself from now on
+    node1.config_set("postgresql.supervise", "1")
+    node1.stop_postgres()
+
+    node1.run()
+    assert node1.wait_until_state(target_state="single")
+    node1.wait_until_pg_is_running()
+
+def test_002_postmaster_is_our_child():
+    argv = parent_command(postmaster_pid(node1))
+
+    assert argv[0].endswith("pg_autoctl")
+
+def test_003_postmaster_crash_is_restarted():
+    pid = postmaster_pid(node1)
+
+    start = time.time()
+    os.kill(pid, signal.SIGKILL)
+
+    newpid = wait_for_new_postmaster(node1, pid)
+
+    assert newpid is not None
+
+    # noticed with SIGCHLD, rather than at the next pg_ctl status
+    assert time.time() - start < 15
+
+    # and restarted as our child process again
+    assert parent_command(newpid)[0].endswith("pg_autoctl")
+
+    node1.run_sql_query("SELECT 1")
+
+def test_004_postmaster_fails_to_start():
+    conf = os.path.join(node1.datadir, "postgresql.conf")
+
+    with open(conf) as f:
+        saved = f.read()
+
+    with open(conf, "a") as f:
+        f.write("\nshared_buffers = 'not a size'\n")
+
+    pid = postmaster_pid(node1)
+    os.kill(pid, signal.SIGKILL)
+
+    # the child exits during startup, the keeper keeps running and trying
+    node1.pg_autoctl.consume_output(10)
+    assert node1.pg_autoctl.run_proc.poll() is None
+    assert not node1.pg_is_running()
+
+    with open(conf, "w") as f:
+        f.write(saved)
+
+    assert wait_for_new_postmaster(node1, pid) is not None
+    assert node1.wait_until_state(target_state="single")
@@ -0,0 +1,103 @@
+import os
+
+import psycopg2
+
+import pgautofailover_utils as pgautofailover
+from nose.tools import *
+
+cluster = None
+monitor = None
+node1 = None
+node2 = None
+
+def setup_module():
+    global cluster
+    cluster = pgautofailover.Cluster()
+
+def teardown_module():
+    cluster.destroy()
+
+def published_primary(node):
+    command = pgautofailover.PGAutoCtl(node.vnode, node.datadir)
+    out, err = command.execute("show file --pid", 'show', 'file', '--pid')
+    filename = os.path.join(os.path.dirname(out.strip()), "pg_autoctl.primary")
+
+    with open(filename) as f:
+        return f.read()
+
+def write_to(node, value):
+    node.run_sql_query("INSERT INTO t1 VALUES (%s)", value)
+
+def test_000_create_monitor():
+    global monitor
+    monitor = cluster.create_monitor("/tmp/switchover_drain/monitor")
+    monitor.run()
+    monitor.wait_until_pg_is_running()
+
+def test_001_init_nodes():
+    global node1, node2
+
+    node1 = cluster.create_datanode("/tmp/switchover_drain/node1")
+    node1.create(run = True)
+    assert node1.wait_until_state(target_state="single")
+
+    node1.run_sql_query("CREATE TABLE t1(a int)")
+
+    node2 = cluster.create_datanode("/tmp/switchover_drain/node2")
+    node2.create(run = True)
+    assert node2.wait_until_state(target_state="secondary")
+    assert node1.wait_until_state(target_state="primary")
+
+    # each node publishes the current primary of its group
+    expected = "host=%s port=%d\n" % (node1.vnode.address, node1.port)
+    assert published_primary(node1) == expected
+    assert published_primary(node2) == expected
+
+@raises(psycopg2.OperationalError)
+def test_002_switchover_drains_idle_sessions():
+    conn = psycopg2.connect(node1.connection_string())
+    conn.autocommit = True
+
+    monitor.switchover()
+
+    assert node2.wait_until_state(target_state="primary")
+    assert node1.wait_until_state(target_state="secondary")
+
+    # the idle session has been terminated while draining
+    conn.cursor().execute("SELECT 1")
+
+def test_003_new_primary_is_published():
+    expected = "host=%s port=%d\n" % (node2.vnode.address, node2.port)
+
+    assert published_primary(node1) == expected
+    assert published_primary(node2) == expected
+
+def test_004_writes_to_new_primary():
+    write_to(node2, 1)
+
+    results = node2.run_sql_query("SHOW default_transaction_read_only")
+    assert results == [('off',)]
+
+def test_005_switchover_back_resumes_writes():
+    # node1 was drained with default_transaction_read_only set to on
+    monitor.switchover()
+
+    assert node1.wait_until_state(target_state="primary")
+    assert node2.wait_until_state(target_state="secondary")
+
+    write_to(node1, 2)
+
+def test_006_failover_resumes_writes():
+    # node2 was drained before, and pg_rewind might have carried the
+    # setting over: a promotion must resume writes too
+    node1.fail()
+    assert node2.wait_until_state(target_state="wait_primary")
+
+    write_to(node2, 3)
+
+    node1.run()
+    assert node1.wait_until_state(target_state="secondary")
+    assert node2.wait_until_state(target_state="primary")
+
+    results = node2.run_sql_query("SELECT count(*) FROM t1")
+    assert results == [(3,)]